@@ -4,18 +4,31 @@
 	shared memory layout:
 		shared memory start
 		fixed size headers
-		entries_start
+		shard 1 start
+			shard header
+			entries_start
+			...
+			entries_end
+
+			buffers_start
+			...
+			buffers_end
+		shard 1 end
 		...
-		entries_end
-
-		buffers_start
+		shard N start
 		...
-		buffers_end
+		shard N end
 		shared memory end
 
-	the shared memory is composed of 3 sections:
-	1. fixed size headers - contains the ngx_slab_pool_t struct allocated by nginx,
-		the log context string and ngx_buffer_cache_sh_t
+	the shared memory is composed of a fixed size header followed by one or more shards.
+	the fixed size header contains the ngx_slab_pool_t struct allocated by nginx, the log 
+	context string and the array of shard pointers. the cache keys are distributed between 
+	the shards according to their hash, and each shard is an independent cache protected 
+	by its own mutex. this way, when multiple shards are configured, operations on different 
+	keys do not contend on the same lock. each shard is composed of 3 sections:
+	1. shard header - ngx_buffer_cache_sh_t, contains the mutex of the shard, followed by 
+		a fixed size open addressing hash index of the entries. the index is used for 
+		looking up entries without locking the mutex (see below)
 	2. entries - an array of ngx_buffer_cache_entry_t, each entry has a key and 
 		points to a buffer in the buffers section. the entries are connected with a 
 		red/black tree for fast lookup by key. the entries section grows as needed until 
@@ -23,11 +36,37 @@
 		linked lists - the free queue and the used queue. the entries move between these 
 		queues as they are allocated / deallocated
 	3. buffers - a cyclic queue of variable size buffers. the buffers section starts
-		at the end of the shared memory and grows towards its beginning until it bumps
+		at the end of the shard and grows towards its beginning until it bumps
 		into the entries section. the buffers section has 2 pointers:
 		a. when a buffer is allocated, it is allocated before the write head
 		b. when an entry is freed, the read head of the buffers section moves
 
+	lock free fetch:
+	cache hits are served without locking the mutex - the entry is located using the 
+	hash index, and validated using its version. the version of an entry is incremented
+	(and becomes odd) before the entry is evicted, and incremented again (becomes even)
+	once it is freed. a reader increments the ref count of the entry and then verifies 
+	the version did not change, while the evicting process increments the version and 
+	then checks the ref count, since both use atomic operations, at least one of them 
+	is guaranteed to see the change made by the other. when the lock free lookup fails 
+	for any reason, the fetch falls back to the locked rbtree lookup. 
+	all modifications to the index and to the entries are performed with the mutex locked.
+
+	stale entries:
+	when a stale time is configured, expired entries are kept for this additional period.
+	such entries can be fetched only using ngx_buffer_cache_fetch_stale, and they can be 
+	replaced by a subsequent store of the same key. a replaced entry is removed from the 
+	index and the rbtree, but it remains in the used queue until its buffer is reclaimed.
+	an entry may be replaced while it is referenced, in this case, it is also recorded in 
+	a small table of the shard, so that the release of the reference can find it, and its 
+	buffer is not reclaimed until all references are released (or their lock expires).
+
+	fill locks:
+	each shard has a small table of keys that are currently being fetched from their origin,
+	in order to let the processes that miss the cache wait for a single fetch. a lock is 
+	released when the key is stored, when the lock is released explicitly or when it expires.
+	when the table is full, locks are granted without being recorded.
+
 */
 
 // Note: code taken from ngx_str_rbtree_insert_value, updated the node comparison
@@ -110,6 +149,116 @@ ngx_buffer_cache_rbtree_lookup(ngx_rbtree_t *rbtree, const u_char* key, uint32_t
 	return NULL;
 }
 
+static ngx_inline ngx_uint_t
+ngx_buffer_cache_index_slot(ngx_buffer_cache_sh_t *cache, uint32_t hash)
+{
+	// Note: all the keys of a shard have the same hash % shard count, dividing spreads them over all the slots
+	return (hash / cache->index_divisor) & cache->index_mask;
+}
+
+/* Note: must be called with the mutex locked */
+static void
+ngx_buffer_cache_index_insert(ngx_buffer_cache_sh_t *cache, ngx_buffer_cache_entry_t* entry)
+{
+	ngx_atomic_uint_t value;
+	ngx_uint_t slot;
+	ngx_uint_t i;
+
+	slot = ngx_buffer_cache_index_slot(cache, entry->node.key);
+	for (i = 0; i < INDEX_MAX_PROBES; i++)
+	{
+		value = cache->index[slot];
+		if (value == INDEX_SLOT_EMPTY || value == INDEX_SLOT_DELETED)
+		{
+			cache->index[slot] = entry - cache->entries_start + 1;
+			return;
+		}
+
+		slot = (slot + 1) & cache->index_mask;
+	}
+
+	// Note: the index is full in this area, the entry will be accessible only with the mutex locked
+}
+
+/* Note: must be called with the mutex locked */
+static void
+ngx_buffer_cache_index_remove(ngx_buffer_cache_sh_t *cache, ngx_buffer_cache_entry_t* entry)
+{
+	ngx_atomic_uint_t value;
+	ngx_uint_t slot;
+	ngx_uint_t i;
+
+	value = entry - cache->entries_start + 1;
+
+	slot = ngx_buffer_cache_index_slot(cache, entry->node.key);
+	for (i = 0; i < INDEX_MAX_PROBES; i++)
+	{
+		if (cache->index[slot] == value)
+		{
+			// Note: if the next slot is empty, no probe sequence can continue past this slot
+			cache->index[slot] = cache->index[(slot + 1) & cache->index_mask] == INDEX_SLOT_EMPTY ?
+				INDEX_SLOT_EMPTY : INDEX_SLOT_DELETED;
+			return;
+		}
+
+		if (cache->index[slot] == INDEX_SLOT_EMPTY)
+		{
+			return;
+		}
+
+		slot = (slot + 1) & cache->index_mask;
+	}
+}
+
+/* Note: called without the mutex, the returned entry must be validated using its version */
+static ngx_buffer_cache_entry_t*
+ngx_buffer_cache_index_lookup(
+	ngx_buffer_cache_sh_t *cache, 
+	const u_char* key, 
+	uint32_t hash, 
+	ngx_atomic_uint_t* version)
+{
+	ngx_buffer_cache_entry_t* entries_start;
+	ngx_buffer_cache_entry_t* entry;
+	ngx_atomic_uint_t entry_count;
+	ngx_atomic_uint_t value;
+	ngx_uint_t slot;
+	ngx_uint_t i;
+
+	entries_start = cache->entries_start;
+	entry_count = cache->entries_end - entries_start;
+
+	slot = ngx_buffer_cache_index_slot(cache, hash);
+	for (i = 0; i < INDEX_MAX_PROBES; i++)
+	{
+		value = cache->index[slot];
+		if (value == INDEX_SLOT_EMPTY)
+		{
+			break;
+		}
+
+		if (value != INDEX_SLOT_DELETED && value <= entry_count)
+		{
+			entry = entries_start + value - 1;
+
+			*version = entry->version;
+			ngx_memory_barrier();
+
+			if ((*version & 1) == 0 &&
+				entry->node.key == hash &&
+				entry->state == CES_READY &&
+				ngx_memcmp(entry->key, key, BUFFER_CACHE_KEY_SIZE) == 0)
+			{
+				return entry;
+			}
+		}
+
+		slot = (slot + 1) & cache->index_mask;
+	}
+
+	return NULL;
+}
+
 static void
 ngx_buffer_cache_reset(ngx_buffer_cache_sh_t *cache)
 {
@@ -120,6 +269,8 @@ ngx_buffer_cache_reset(ngx_buffer_cache_sh_t *cache)
 	ngx_rbtree_init(&cache->rbtree, &cache->sentinel, ngx_buffer_cache_rbtree_insert_value);
 	ngx_queue_init(&cache->used_queue);
 	ngx_queue_init(&cache->free_queue);
+	ngx_memzero((void*)cache->index, sizeof(cache->index[0]) * (cache->index_mask + 1));
+	ngx_memzero(cache->replaced_entries, sizeof(cache->replaced_entries));
 
 	// update stats (everything is evicted)
 	cache->stats.evicted = cache->stats.store_ok;
@@ -132,13 +283,24 @@ ngx_buffer_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 	ngx_buffer_cache_sh_t *sh;
 	ngx_buffer_cache_t *ocache = data;
 	ngx_buffer_cache_t *cache;
+	ngx_uint_t index_slots;
+	ngx_uint_t i;
+	size_t shard_size;
 	u_char* p;
 
 	cache = shm_zone->data;
 
 	if (ocache)
 	{
-		cache->sh = ocache->sh;
+		if (ocache->shard_count != cache->shard_count)
+		{
+			ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+				"cache \"%V\" uses %ui shards, previously it used %ui shards",
+				&shm_zone->shm.name, cache->shard_count, ocache->shard_count);
+			return NGX_ERROR;
+		}
+
+		cache->shards = ocache->shards;
 		cache->shpool = ocache->shpool;
 		return NGX_OK;
 	}
@@ -147,7 +309,7 @@ ngx_buffer_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 
 	if (shm_zone->shm.exists) 
 	{
-		cache->sh = cache->shpool->data;
+		cache->shards = cache->shpool->data;
 		return NGX_OK;
 	}
 
@@ -158,34 +320,88 @@ ngx_buffer_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 	cache->shpool->log_ctx = p;
 	p = ngx_sprintf(cache->shpool->log_ctx, " in buffer cache \"%V\"%Z", &shm_zone->shm.name);
 
-	// allocate the shared cache state
+	// allocate the shards array
 	p = ngx_align_ptr(p, sizeof(void *));
-	sh = (ngx_buffer_cache_sh_t*)p;
-	p += sizeof(*sh);
-	cache->sh = sh;
+	cache->shards = (ngx_buffer_cache_sh_t**)p;
+	p += sizeof(cache->shards[0]) * cache->shard_count;
 
-	cache->shpool->data = sh;
+	cache->shpool->data = cache->shards;
 
-	// initialize fixed cache fields
-	p = ngx_align_ptr(p, sizeof(void *));
-	sh->entries_start = (ngx_buffer_cache_entry_t*)p;
-	sh->buffers_end = shm_zone->shm.addr + shm_zone->shm.size;
-	sh->access_time = 0;
+	// split the remaining space between the shards
+	p = ngx_align_ptr(p, BUFFER_ALIGNMENT);
+	shard_size = ((shm_zone->shm.addr + shm_zone->shm.size - p) / cache->shard_count) & ~(BUFFER_ALIGNMENT - 1);
 
-	// reset the stats
-	ngx_memzero(&sh->stats, sizeof(sh->stats));
+	// Note: the number of index slots must be a power of 2
+	for (index_slots = INDEX_MIN_SLOTS; index_slots * INDEX_BYTES_PER_SLOT < shard_size; index_slots <<= 1);
 
-	// reset the cache status
-	ngx_buffer_cache_reset(sh);
-	sh->reset = 0;
+	for (i = 0; i < cache->shard_count; i++)
+	{
+		// allocate the shard state
+		sh = (ngx_buffer_cache_sh_t*)p;
+		cache->shards[i] = sh;
+
+		if (ngx_shmtx_create(&sh->mutex, &sh->lock, shm_zone->shm.name.data) != NGX_OK)
+		{
+			return NGX_ERROR;
+		}
+
+		// initialize fixed shard fields
+		sh->index = (ngx_atomic_t*)ngx_align_ptr(p + sizeof(*sh), sizeof(void *));
+		sh->index_mask = index_slots - 1;
+		sh->index_divisor = cache->shard_count;
+		sh->entries_start = (ngx_buffer_cache_entry_t*)(sh->index + index_slots);
+		sh->buffers_end = p + shard_size;
+		sh->access_time = 0;
+		ngx_memzero(sh->fill_locks, sizeof(sh->fill_locks));
+
+		// reset the stats
+		ngx_memzero(&sh->stats, sizeof(sh->stats));
+
+		// reset the shard status
+		ngx_buffer_cache_reset(sh);
+		sh->reset = 0;
+
+		p += shard_size;
+	}
 
 	return NGX_OK;
 }
 
+static ngx_inline ngx_buffer_cache_sh_t*
+ngx_buffer_cache_get_shard(ngx_buffer_cache_t* cache, uint32_t hash)
+{
+	if (cache->shard_count <= 1)
+	{
+		return cache->shards[0];
+	}
+
+	return cache->shards[hash % cache->shard_count];
+}
+
+/* Note: must be called with the mutex locked */
+static ngx_buffer_cache_entry_t**
+ngx_buffer_cache_replaced_lookup(ngx_buffer_cache_sh_t *cache, ngx_buffer_cache_entry_t* entry)
+{
+	ngx_buffer_cache_entry_t** cur;
+	ngx_buffer_cache_entry_t** last;
+
+	last = cache->replaced_entries + REPLACED_ENTRY_SLOTS;
+	for (cur = cache->replaced_entries; cur < last; cur++)
+	{
+		if (*cur == entry)
+		{
+			return cur;
+		}
+	}
+
+	return NULL;
+}
+
 /* Note: must be called with the mutex locked */
 static ngx_buffer_cache_entry_t*
 ngx_buffer_cache_free_oldest_entry(ngx_buffer_cache_sh_t *cache, uint32_t expiration)
 {
+	ngx_buffer_cache_entry_t** slot;
 	ngx_buffer_cache_entry_t* entry;
 
 	// verify we have an entry to free
@@ -194,26 +410,45 @@ ngx_buffer_cache_free_oldest_entry(ngx_buffer_cache_sh_t *cache, uint32_t expira
 		return NULL;
 	}
 
-	// verify the entry is not locked
 	entry = container_of(ngx_queue_head(&cache->used_queue), ngx_buffer_cache_entry_t, queue_node);
+
+	// make sure the entry is expired, if that is the requirement
+	if (expiration && ngx_time() < (time_t)(entry->write_time + expiration))
+	{
+		return NULL;
+	}
+
+	// Note: the version must be incremented before checking the ref count, 
+	//		otherwise a lock free fetch may grab the entry while it is being freed
+	(void)ngx_atomic_fetch_add(&entry->version, 1);
+
+	// verify the entry is not locked
 	if (entry->ref_count > 0 &&
 		ngx_time() < entry->access_time + ENTRY_LOCK_EXPIRATION)
 	{
+		(void)ngx_atomic_fetch_add(&entry->version, 1);
 		return NULL;
 	}
 
-	// make sure the entry is expired, if that is the requirement
-	if (expiration && ngx_time() < (time_t)(entry->write_time + expiration))
+	// remove from the index and the rb tree (replaced entries were already removed)
+	if (entry->state != CES_REPLACED)
 	{
-		return NULL;
+		ngx_buffer_cache_index_remove(cache, entry);
+		ngx_rbtree_delete(&cache->rbtree, &entry->node);
 	}
-	
+	else
+	{
+		// the lock of the references expired, forget the entry
+		slot = ngx_buffer_cache_replaced_lookup(cache, entry);
+		if (slot != NULL)
+		{
+			*slot = NULL;
+		}
+	}
+
 	// update the state
 	entry->state = CES_FREE;
 
-	// remove from rb tree
-	ngx_rbtree_delete(&cache->rbtree, &entry->node);
-
 	// move from used_queue to free_queue
 	ngx_queue_remove(&entry->queue_node);
 	ngx_queue_insert_tail(&cache->free_queue, &entry->queue_node);
@@ -234,9 +469,78 @@ ngx_buffer_cache_free_oldest_entry(ngx_buffer_cache_sh_t *cache, uint32_t expira
 	cache->stats.evicted++;
 	cache->stats.evicted_bytes += entry->buffer_size;
 
+	(void)ngx_atomic_fetch_add(&entry->version, 1);
+
 	return entry;
 }
 
+/* Note: must be called with the mutex locked */
+static ngx_flag_t
+ngx_buffer_cache_replace_entry(ngx_buffer_cache_t* cache, ngx_buffer_cache_sh_t *sh, ngx_buffer_cache_entry_t* entry)
+{
+	ngx_buffer_cache_entry_t** slot;
+
+	// only expired entries can be replaced
+	if (entry->state != CES_READY || 
+		cache->expiration == 0 || 
+		ngx_time() < (time_t)(entry->write_time + cache->expiration))
+	{
+		return 0;
+	}
+
+	// Note: same as in ngx_buffer_cache_free_oldest_entry, the version must be incremented before checking 
+	//		the ref count. a referenced entry is recorded so that the release can find it, when the table 
+	//		is full, the buffer is kept until the lock of the references expires
+	(void)ngx_atomic_fetch_add(&entry->version, 1);
+
+	if (entry->ref_count > 0 &&
+		ngx_time() < entry->access_time + ENTRY_LOCK_EXPIRATION)
+	{
+		slot = ngx_buffer_cache_replaced_lookup(sh, NULL);
+		if (slot != NULL)
+		{
+			*slot = entry;
+		}
+	}
+
+	entry->state = CES_REPLACED;
+
+	ngx_buffer_cache_index_remove(sh, entry);
+	ngx_rbtree_delete(&sh->rbtree, &entry->node);
+
+	(void)ngx_atomic_fetch_add(&entry->version, 1);
+
+	return 1;
+}
+
+/* Note: must be called with the mutex locked */
+static ngx_buffer_cache_fill_lock_t*
+ngx_buffer_cache_fill_lock_lookup(ngx_buffer_cache_sh_t *sh, u_char* key, time_t now, ngx_buffer_cache_fill_lock_t** free_slot)
+{
+	ngx_buffer_cache_fill_lock_t* cur;
+	ngx_buffer_cache_fill_lock_t* last;
+
+	last = sh->fill_locks + FILL_LOCK_SLOTS;
+	for (cur = sh->fill_locks; cur < last; cur++)
+	{
+		if (cur->expire_time <= now)
+		{
+			if (free_slot != NULL && *free_slot == NULL)
+			{
+				*free_slot = cur;
+			}
+			continue;
+		}
+
+		if (ngx_memcmp(cur->key, key, BUFFER_CACHE_KEY_SIZE) == 0)
+		{
+			return cur;
+		}
+	}
+
+	return NULL;
+}
+
 /* Note: must be called with the mutex locked */
 static ngx_buffer_cache_entry_t*
 ngx_buffer_cache_get_free_entry(ngx_buffer_cache_sh_t *cache)
@@ -256,7 +560,12 @@ ngx_buffer_cache_get_free_entry(ngx_buffer_cache_sh_t *cache)
 		cache->entries_end++;
 
 		// initialize the state and add to free queue
+		// Note: the slot may have been used before the cache was reset, the version is
+		//		advanced to the next even value rather than zeroed, so that a lock free reader
+		//		that looked up the previous entry will not validate against this one
 		entry->state = CES_FREE;
+		entry->ref_count = 0;
+		entry->version = (entry->version + 2) & ~((ngx_atomic_uint_t)1);
 		ngx_queue_insert_tail(&cache->free_queue, &entry->queue_node);
 		return entry;
 	}
@@ -322,33 +631,142 @@ ngx_buffer_cache_get_free_buffer(
 	return NULL;
 }
 
-ngx_flag_t
-ngx_buffer_cache_fetch(
+static ngx_flag_t
+ngx_buffer_cache_fetch_lock_free(
 	ngx_buffer_cache_t* cache,
+	ngx_buffer_cache_sh_t *sh,
 	u_char* key,
+	uint32_t hash,
 	ngx_str_t* buffer,
-	uint32_t* token)
+	uint32_t* token,
+	ngx_flag_t* stale)
 {
 	ngx_buffer_cache_entry_t* entry;
-	ngx_buffer_cache_sh_t *sh = cache->sh;
+	ngx_atomic_uint_t version;
+	ngx_flag_t is_stale;
+	time_t write_time;
+	time_t now;
+	u_char* data;
+	size_t len;
+
+	if (sh->reset)
+	{
+		return 0;
+	}
+
+	entry = ngx_buffer_cache_index_lookup(sh, key, hash, &version);
+	if (entry == NULL)
+	{
+		return 0;
+	}
+
+	now = ngx_time();
+
+	write_time = entry->write_time;
+	is_stale = 0;
+	if (cache->expiration != 0 && now >= (time_t)(write_time + cache->expiration))
+	{
+		if (stale == NULL || now >= (time_t)(write_time + cache->expiration + cache->stale_time))
+		{
+			return 0;
+		}
+
+		is_stale = 1;
+	}
+
+	data = entry->start_offset;
+	len = entry->buffer_size;
+
+	// Note: the access time is set before the ref count is incremented, so that an evicting 
+	//		process that sees the ref count will also see the updated access time
+	entry->access_time = now;
+	(void)ngx_atomic_fetch_add(&entry->ref_count, 1);
+
+	if (entry->version != version)
+	{
+		// the entry is being evicted
+		(void)ngx_atomic_fetch_add(&entry->ref_count, -1);
+		return 0;
+	}
+
+	// Note: updating the cache access time only when it changes, to avoid writing to 
+	//		a shared cache line on every fetch
+	if (sh->access_time != now)
+	{
+		sh->access_time = now;
+	}
+
+	// update stats
+	(void)ngx_atomic_fetch_add(&sh->stats.fetch_hit, 1);
+	(void)ngx_atomic_fetch_add(&sh->stats.fetch_bytes, len);
+
+	if (stale != NULL)
+	{
+		*stale = is_stale;
+		if (is_stale)
+		{
+			(void)ngx_atomic_fetch_add(&sh->stats.fetch_stale, 1);
+		}
+	}
+
+	buffer->data = data;
+	buffer->len = len;
+	*token = write_time;
+
+	return 1;
+}
+
+static ngx_flag_t
+ngx_buffer_cache_fetch_internal(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	ngx_str_t* buffer,
+	uint32_t* token,
+	ngx_flag_t* stale)
+{
+	ngx_buffer_cache_entry_t* entry;
+	ngx_buffer_cache_sh_t *sh;
 	ngx_flag_t result = 0;
+	uint32_t expiration;
 	uint32_t hash;
 
 	hash = ngx_crc32_short(key, BUFFER_CACHE_KEY_SIZE);
+	sh = ngx_buffer_cache_get_shard(cache, hash);
+
+	if (ngx_buffer_cache_fetch_lock_free(cache, sh, key, hash, buffer, token, stale))
+	{
+		return 1;
+	}
+
+	expiration = cache->expiration;
+	if (stale != NULL && expiration != 0)
+	{
+		expiration += cache->stale_time;
+	}
 
-	ngx_shmtx_lock(&cache->shpool->mutex);
+	ngx_shmtx_lock(&sh->mutex);
 
 	if (!sh->reset)
 	{
 		entry = ngx_buffer_cache_rbtree_lookup(&sh->rbtree, key, hash);
 		if (entry != NULL && entry->state == CES_READY && 
-			(cache->expiration == 0 || ngx_time() < (time_t)(entry->write_time + cache->expiration)))
+			(expiration == 0 || ngx_time() < (time_t)(entry->write_time + expiration)))
 		{
 			result = 1;
 
+			if (stale != NULL)
+			{
+				*stale = cache->expiration != 0 && ngx_time() >= (time_t)(entry->write_time + cache->expiration);
+				if (*stale)
+				{
+					(void)ngx_atomic_fetch_add(&sh->stats.fetch_stale, 1);
+				}
+			}
+
 			// update stats
-			sh->stats.fetch_hit++;
-			sh->stats.fetch_bytes += entry->buffer_size;
+			// Note: using atomic increments since the lock free fetch updates them as well
+			(void)ngx_atomic_fetch_add(&sh->stats.fetch_hit, 1);
+			(void)ngx_atomic_fetch_add(&sh->stats.fetch_bytes, entry->buffer_size);
 
 			// copy buffer pointer and size
 			buffer->data = entry->start_offset;
@@ -367,11 +785,60 @@ ngx_buffer_cache_fetch(
 		}
 	}
 
-	ngx_shmtx_unlock(&cache->shpool->mutex);
+	ngx_shmtx_unlock(&sh->mutex);
 
 	return result;
 }
 
+ngx_flag_t
+ngx_buffer_cache_fetch(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	ngx_str_t* buffer,
+	uint32_t* token)
+{
+	return ngx_buffer_cache_fetch_internal(cache, key, buffer, token, NULL);
+}
+
+ngx_flag_t
+ngx_buffer_cache_fetch_stale(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	ngx_str_t* buffer,
+	uint32_t* token,
+	ngx_flag_t* stale)
+{
+	return ngx_buffer_cache_fetch_internal(cache, key, buffer, token, stale);
+}
+
+/* Note: must be called with the mutex locked */
+static void
+ngx_buffer_cache_release_replaced(ngx_buffer_cache_sh_t *sh, u_char* key, uint32_t token)
+{
+	ngx_buffer_cache_entry_t** cur;
+	ngx_buffer_cache_entry_t** last;
+	ngx_buffer_cache_entry_t* entry;
+
+	last = sh->replaced_entries + REPLACED_ENTRY_SLOTS;
+	for (cur = sh->replaced_entries; cur < last; cur++)
+	{
+		entry = *cur;
+		if (entry == NULL ||
+			(uint32_t)entry->write_time != token ||
+			ngx_memcmp(entry->key, key, BUFFER_CACHE_KEY_SIZE) != 0)
+		{
+			continue;
+		}
+
+		if (ngx_atomic_fetch_add(&entry->ref_count, -1) <= 1)
+		{
+			// the last reference was released, the buffer can be reclaimed
+			*cur = NULL;
+		}
+		return;
+	}
+}
+
 void
 ngx_buffer_cache_release(
 	ngx_buffer_cache_t* cache,
@@ -379,12 +846,33 @@ ngx_buffer_cache_release(
 	uint32_t token)
 {
 	ngx_buffer_cache_entry_t* entry;
-	ngx_buffer_cache_sh_t *sh = cache->sh;
+	ngx_buffer_cache_sh_t *sh;
+	ngx_atomic_uint_t version;
 	uint32_t hash;
 
 	hash = ngx_crc32_short(key, BUFFER_CACHE_KEY_SIZE);
+	sh = ngx_buffer_cache_get_shard(cache, hash);
+
+	// Note: the entry may have been evicted and reused once the lock of the caller expired,
+	//		the version is validated after the decrement, same as in the lock free fetch.
+	//		in case of a mismatch, the decrement is reverted and the locked path is used
+	if (!sh->reset)
+	{
+		entry = ngx_buffer_cache_index_lookup(sh, key, hash, &version);
+		if (entry != NULL && (uint32_t)entry->write_time == token)
+		{
+			(void)ngx_atomic_fetch_add(&entry->ref_count, -1);
+
+			if (entry->version == version)
+			{
+				return;
+			}
+
+			(void)ngx_atomic_fetch_add(&entry->ref_count, 1);
+		}
+	}
 
-	ngx_shmtx_lock(&cache->shpool->mutex);
+	ngx_shmtx_lock(&sh->mutex);
 
 	if (!sh->reset)
 	{
@@ -393,9 +881,13 @@ ngx_buffer_cache_release(
 		{
 			(void)ngx_atomic_fetch_add(&entry->ref_count, -1);
 		}
+		else
+		{
+			ngx_buffer_cache_release_replaced(sh, key, token);
+		}
 	}
 
-	ngx_shmtx_unlock(&cache->shpool->mutex);
+	ngx_shmtx_unlock(&sh->mutex);
 }
 
 ngx_flag_t
@@ -406,7 +898,8 @@ ngx_buffer_cache_store_gather(
 	size_t buffer_count)
 {
 	ngx_buffer_cache_entry_t* entry;
-	ngx_buffer_cache_sh_t *sh = cache->sh;
+	ngx_buffer_cache_fill_lock_t* fill_lock;
+	ngx_buffer_cache_sh_t *sh;
 	ngx_str_t* cur_buffer;
 	ngx_str_t* last_buffer;
 	size_t buffer_size;
@@ -415,8 +908,16 @@ ngx_buffer_cache_store_gather(
 	u_char* target_buffer;
 
 	hash = ngx_crc32_short(key, BUFFER_CACHE_KEY_SIZE);
+	sh = ngx_buffer_cache_get_shard(cache, hash);
+
+	ngx_shmtx_lock(&sh->mutex);
 
-	ngx_shmtx_lock(&cache->shpool->mutex);
+	// release the fill lock of the key, if any
+	fill_lock = ngx_buffer_cache_fill_lock_lookup(sh, key, ngx_time(), NULL);
+	if (fill_lock != NULL)
+	{
+		fill_lock->expire_time = 0;
+	}
 
 	if (sh->reset)
 	{
@@ -426,7 +927,7 @@ ngx_buffer_cache_store_gather(
 		// writing to the cache
 		if (ngx_time() < sh->access_time + CACHE_LOCK_EXPIRATION)
 		{
-			ngx_shmtx_unlock(&cache->shpool->mutex);
+			ngx_shmtx_unlock(&sh->mutex);
 			return 0;
 		}
 
@@ -443,19 +944,19 @@ ngx_buffer_cache_store_gather(
 		{
 			for (evictions = MAX_EVICTIONS_PER_STORE; evictions > 0; evictions--)
 			{
-				if (!ngx_buffer_cache_free_oldest_entry(sh, cache->expiration))
+				if (!ngx_buffer_cache_free_oldest_entry(sh, cache->expiration + cache->stale_time))
 				{
 					break;
 				}
 			}
 		}
 
-		// make sure the entry does not already exist
+		// make sure the entry does not already exist, expired entries are replaced
 		entry = ngx_buffer_cache_rbtree_lookup(&sh->rbtree, key, hash);
-		if (entry != NULL)
+		if (entry != NULL && !ngx_buffer_cache_replace_entry(cache, sh, entry))
 		{
 			sh->stats.store_exists++;
-			ngx_shmtx_unlock(&cache->shpool->mutex);
+			ngx_shmtx_unlock(&sh->mutex);
 			return 0;
 		}
 
@@ -500,8 +1001,9 @@ ngx_buffer_cache_store_gather(
 	ngx_queue_remove(&entry->queue_node);
 	ngx_queue_insert_tail(&sh->used_queue, &entry->queue_node);
 
-	// insert to rbtree
+	// insert to rbtree and index
 	ngx_rbtree_insert(&sh->rbtree, &entry->node);
+	ngx_buffer_cache_index_insert(sh, entry);
 
 	// update stats
 	sh->stats.store_ok++;
@@ -513,7 +1015,7 @@ ngx_buffer_cache_store_gather(
 	entry->write_time = ngx_time();
 
 	sh->reset = 0;
-	ngx_shmtx_unlock(&cache->shpool->mutex);
+	ngx_shmtx_unlock(&sh->mutex);
 
 	for (cur_buffer = buffers; cur_buffer < last_buffer; cur_buffer++)
 	{
@@ -530,7 +1032,7 @@ ngx_buffer_cache_store_gather(
 error:
 	sh->stats.store_err++;
 	sh->reset = 0;
-	ngx_shmtx_unlock(&cache->shpool->mutex);
+	ngx_shmtx_unlock(&sh->mutex);
 	return 0;
 }
 
@@ -549,35 +1051,146 @@ ngx_buffer_cache_store(
 	return ngx_buffer_cache_store_gather(cache, key, &buffer, 1);
 }
 
+ngx_flag_t
+ngx_buffer_cache_lock(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	time_t timeout)
+{
+	ngx_buffer_cache_fill_lock_t* free_slot = NULL;
+	ngx_buffer_cache_fill_lock_t* fill_lock;
+	ngx_buffer_cache_sh_t *sh;
+	uint32_t hash;
+	time_t now;
+
+	hash = ngx_crc32_short(key, BUFFER_CACHE_KEY_SIZE);
+	sh = ngx_buffer_cache_get_shard(cache, hash);
+
+	now = ngx_time();
+
+	ngx_shmtx_lock(&sh->mutex);
+
+	fill_lock = ngx_buffer_cache_fill_lock_lookup(sh, key, now, &free_slot);
+	if (fill_lock != NULL)
+	{
+		// another process is fetching this key
+		ngx_shmtx_unlock(&sh->mutex);
+		return 0;
+	}
+
+	// Note: if all slots are taken, the lock is granted without being recorded
+	if (free_slot != NULL)
+	{
+		ngx_memcpy(free_slot->key, key, BUFFER_CACHE_KEY_SIZE);
+		free_slot->expire_time = now + timeout;
+	}
+
+	ngx_shmtx_unlock(&sh->mutex);
+
+	return 1;
+}
+
+void
+ngx_buffer_cache_unlock(
+	ngx_buffer_cache_t* cache,
+	u_char* key)
+{
+	ngx_buffer_cache_fill_lock_t* fill_lock;
+	ngx_buffer_cache_sh_t *sh;
+	uint32_t hash;
+
+	hash = ngx_crc32_short(key, BUFFER_CACHE_KEY_SIZE);
+	sh = ngx_buffer_cache_get_shard(cache, hash);
+
+	ngx_shmtx_lock(&sh->mutex);
+
+	fill_lock = ngx_buffer_cache_fill_lock_lookup(sh, key, ngx_time(), NULL);
+	if (fill_lock != NULL)
+	{
+		fill_lock->expire_time = 0;
+	}
+
+	ngx_shmtx_unlock(&sh->mutex);
+}
+
+ngx_flag_t
+ngx_buffer_cache_is_locked(
+	ngx_buffer_cache_t* cache,
+	u_char* key)
+{
+	ngx_buffer_cache_fill_lock_t* fill_lock;
+	ngx_buffer_cache_sh_t *sh;
+	uint32_t hash;
+
+	hash = ngx_crc32_short(key, BUFFER_CACHE_KEY_SIZE);
+	sh = ngx_buffer_cache_get_shard(cache, hash);
+
+	ngx_shmtx_lock(&sh->mutex);
+
+	fill_lock = ngx_buffer_cache_fill_lock_lookup(sh, key, ngx_time(), NULL);
+
+	ngx_shmtx_unlock(&sh->mutex);
+
+	return fill_lock != NULL;
+}
+
 void
 ngx_buffer_cache_get_stats(
 	ngx_buffer_cache_t* cache,
 	ngx_buffer_cache_stats_t* stats)
 {
-	ngx_buffer_cache_sh_t *sh = cache->sh;
+	ngx_buffer_cache_sh_t *sh;
+	ngx_atomic_t* dest;
+	ngx_atomic_t* src;
+	ngx_uint_t count;
+	ngx_uint_t i;
+	ngx_uint_t j;
 
-	ngx_shmtx_lock(&cache->shpool->mutex);
+	ngx_memzero(stats, sizeof(*stats));
 
-	memcpy(stats, &sh->stats, sizeof(sh->stats));
+	count = sizeof(*stats) / sizeof(ngx_atomic_t);
 
-	stats->entries = sh->entries_end - sh->entries_start;
-	stats->data_size = sh->buffers_end - sh->buffers_start;
+	// Note: all the stats are summed across the shards
+	for (i = 0; i < cache->shard_count; i++)
+	{
+		sh = cache->shards[i];
 
-	ngx_shmtx_unlock(&cache->shpool->mutex);
+		ngx_shmtx_lock(&sh->mutex);
+
+		src = (ngx_atomic_t*)&sh->stats;
+		dest = (ngx_atomic_t*)stats;
+		for (j = 0; j < count; j++)
+		{
+			dest[j] += src[j];
+		}
+
+		stats->entries += sh->entries_end - sh->entries_start;
+		stats->data_size += sh->buffers_end - sh->buffers_start;
+
+		ngx_shmtx_unlock(&sh->mutex);
+	}
 }
 
 void
 ngx_buffer_cache_reset_stats(ngx_buffer_cache_t* cache)
 {
-	ngx_shmtx_lock(&cache->shpool->mutex);
+	ngx_buffer_cache_sh_t *sh;
+	ngx_uint_t i;
 
-	ngx_memzero(&cache->sh->stats, sizeof(cache->sh->stats));
+	for (i = 0; i < cache->shard_count; i++)
+	{
+		sh = cache->shards[i];
+
+		ngx_shmtx_lock(&sh->mutex);
 
-	ngx_shmtx_unlock(&cache->shpool->mutex);
+		ngx_memzero(&sh->stats, sizeof(sh->stats));
+
+		ngx_shmtx_unlock(&sh->mutex);
+	}
 }
 
 ngx_buffer_cache_t*
-ngx_buffer_cache_create(ngx_conf_t *cf, ngx_str_t *name, size_t size, time_t expiration, void *tag)
+ngx_buffer_cache_create(ngx_conf_t *cf, ngx_str_t *name, size_t size, time_t expiration, time_t stale_time, ngx_uint_t shard_count, void *tag)
 {
 	ngx_buffer_cache_t* cache;
 
@@ -588,6 +1201,8 @@ ngx_buffer_cache_create(ngx_conf_t *cf, ngx_str_t *name, size_t size, time_t exp
 	}
 
 	cache->expiration = expiration;
+	cache->stale_time = stale_time;
+	cache->shard_count = shard_count > 0 ? shard_count : 1;
 
 	cache->shm_zone = ngx_shared_memory_add(cf, name, size, tag);
 	if (cache->shm_zone == NULL)
@@ -6,6 +6,8 @@
 
 // constants
 #define BUFFER_CACHE_KEY_SIZE (16)
+#define BUFFER_CACHE_MAX_SHARDS (64)
+#define BUFFER_CACHE_MIN_SHARD_SIZE (1024 * 1024)
 
 // typedefs
 struct ngx_buffer_cache_s;
@@ -19,6 +21,7 @@ typedef struct {
 	ngx_atomic_t fetch_hit;
 	ngx_atomic_t fetch_bytes;
 	ngx_atomic_t fetch_miss;
+	ngx_atomic_t fetch_stale;
 	ngx_atomic_t evicted;
 	ngx_atomic_t evicted_bytes;
 	ngx_atomic_t reset;
@@ -35,6 +38,13 @@ ngx_flag_t ngx_buffer_cache_fetch(
 	ngx_str_t* buffer,
 	uint32_t* token);
 
+ngx_flag_t ngx_buffer_cache_fetch_stale(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	ngx_str_t* buffer,
+	uint32_t* token,
+	ngx_flag_t* stale);
+
 void ngx_buffer_cache_release(
 	ngx_buffer_cache_t* cache,
 	u_char* key,
@@ -52,6 +62,19 @@ ngx_flag_t ngx_buffer_cache_store_gather(
 	ngx_str_t* buffers,
 	size_t buffer_count);
 
+ngx_flag_t ngx_buffer_cache_lock(
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	time_t timeout);
+
+void ngx_buffer_cache_unlock(
+	ngx_buffer_cache_t* cache,
+	u_char* key);
+
+ngx_flag_t ngx_buffer_cache_is_locked(
+	ngx_buffer_cache_t* cache,
+	u_char* key);
+
 void ngx_buffer_cache_get_stats(
 	ngx_buffer_cache_t* cache,
 	ngx_buffer_cache_stats_t* stats);
@@ -63,6 +86,8 @@ ngx_buffer_cache_t* ngx_buffer_cache_create(
 	ngx_str_t *name, 
 	size_t size, 
 	time_t expiration, 
+	time_t stale_time,
+	ngx_uint_t shard_count,
 	void *tag);
 
 #endif // _NGX_BUFFER_CACHE_H_INCLUDED_
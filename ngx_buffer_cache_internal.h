@@ -13,12 +13,20 @@
 #define ENTRIES_ALLOC_MARGIN (1024)		// 1K entries ~= 100KB, we reserve this space to make sure allocating entries does not become the bottleneck
 #define BUFFER_ALIGNMENT (16)
 #define MAX_EVICTIONS_PER_STORE (128)
+#define INDEX_MIN_SLOTS (256)
+#define INDEX_BYTES_PER_SLOT (4096)	// the index is sized assuming the average buffer size is at least 4KB
+#define INDEX_MAX_PROBES (8)
+#define INDEX_SLOT_EMPTY (0)
+#define INDEX_SLOT_DELETED ((ngx_atomic_uint_t)-1)
+#define FILL_LOCK_SLOTS (32)
+#define REPLACED_ENTRY_SLOTS (16)
 
 // enums
 enum {
 	CES_FREE,
 	CES_ALLOCATED,
 	CES_READY,
+	CES_REPLACED,		// removed from the index and the rbtree, the buffer is freed when it reaches the queue head
 };
 
 // typedefs
@@ -29,32 +37,47 @@ typedef struct {
 	size_t buffer_size;
 	ngx_atomic_t state;
 	ngx_atomic_t ref_count;
+	ngx_atomic_t version;		// odd while the entry is being evicted
 	time_t access_time;
 	time_t write_time;
 	u_char key[BUFFER_CACHE_KEY_SIZE];
 } ngx_buffer_cache_entry_t;
 
 typedef struct {
+	u_char key[BUFFER_CACHE_KEY_SIZE];
+	time_t expire_time;			// the slot is free once this time passes
+} ngx_buffer_cache_fill_lock_t;
+
+typedef struct {
+	ngx_shmtx_sh_t lock;
+	ngx_shmtx_t mutex;
 	ngx_atomic_t reset;
 	time_t access_time;
 	ngx_rbtree_t rbtree;
 	ngx_rbtree_node_t sentinel;
 	ngx_queue_t used_queue;
 	ngx_queue_t free_queue;
+	ngx_atomic_t* index;		// open addressing hash, each slot holds an entry index + 1
+	ngx_uint_t index_mask;
+	ngx_uint_t index_divisor;	// the shard count, the slot is taken from the hash bits that did not select the shard
 	ngx_buffer_cache_entry_t* entries_start;
 	ngx_buffer_cache_entry_t* entries_end;
 	u_char* buffers_start;
 	u_char* buffers_end;
 	u_char* buffers_read;
 	u_char* buffers_write;
+	ngx_buffer_cache_fill_lock_t fill_locks[FILL_LOCK_SLOTS];
+	ngx_buffer_cache_entry_t* replaced_entries[REPLACED_ENTRY_SLOTS];	// replaced entries that are still referenced
 	ngx_buffer_cache_stats_t stats;
 } ngx_buffer_cache_sh_t;
 
 struct ngx_buffer_cache_s {
-	ngx_buffer_cache_sh_t *sh;
+	ngx_buffer_cache_sh_t **shards;
+	ngx_uint_t shard_count;
 	ngx_slab_pool_t *shpool;
 
 	uint32_t expiration;
+	uint32_t stale_time;
 
 	ngx_shm_zone_t *shm_zone;
 };
@@ -88,6 +88,65 @@ static ngx_child_request_hide_header_t hide_headers[] = {
 static ngx_http_output_header_filter_pt ngx_http_next_header_filter;
 static ngx_hash_t hide_headers_hash;
 
+static ngx_int_t
+ngx_child_request_get_result(
+	ngx_http_request_t *r,
+	ngx_child_request_context_t* ctx,
+	ngx_http_upstream_t *u,
+	ngx_buf_t* b,
+	ngx_int_t rc)
+{
+	if (rc == NGX_OK && is_in_memory(ctx) && u != NULL)
+	{
+		switch (u->headers_in.status_n)
+		{
+		case NGX_HTTP_OK:
+		case NGX_HTTP_PARTIAL_CONTENT:
+			if (u->headers_in.content_length_n > 0 && u->headers_in.content_length_n != b->last - b->pos)
+			{
+				ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+					"ngx_child_request_get_result: upstream connection was closed with %O bytes left to read", 
+					u->headers_in.content_length_n - (b->last - b->pos));
+				rc = NGX_HTTP_BAD_GATEWAY;
+			}
+			break;
+
+		case NGX_HTTP_RANGE_NOT_SATISFIABLE:
+			// ignore this error, treat it like a successful read with empty body
+			rc = NGX_OK;
+			b->last = b->pos;
+			break;
+
+		default:
+			if (u->headers_in.status_n != 0)
+			{
+				ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+					"ngx_child_request_get_result: upstream returned a bad status %ui", u->headers_in.status_n);
+			}
+			else
+			{
+				ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+					"ngx_child_request_get_result: failed to get upstream status");
+			}
+			rc = NGX_HTTP_BAD_GATEWAY;
+			break;
+		}
+	}
+	else if (rc == NGX_ERROR)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_child_request_get_result: got error -1, changing to 502");
+		rc = NGX_HTTP_BAD_GATEWAY;
+	}
+
+	if (ctx->send_header_result == NGX_ERROR || ctx->send_header_result > NGX_OK)
+	{
+		rc = ctx->send_header_result;
+	}
+
+	return rc;
+}
+
 static void
 ngx_child_request_wev_handler(ngx_http_request_t *r)
 {
@@ -166,54 +225,7 @@ ngx_child_request_wev_handler(ngx_http_request_t *r)
 	}
 
 	// get the final error code
-	rc = ctx->error_code;
-	if (rc == NGX_OK && is_in_memory(ctx) && u != NULL)
-	{
-		switch (u->headers_in.status_n)
-		{
-		case NGX_HTTP_OK:
-		case NGX_HTTP_PARTIAL_CONTENT:
-			if (u->headers_in.content_length_n > 0 && u->headers_in.content_length_n != b->last - b->pos)
-			{
-				ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-					"ngx_child_request_wev_handler: upstream connection was closed with %O bytes left to read", 
-					u->headers_in.content_length_n - (b->last - b->pos));
-				rc = NGX_HTTP_BAD_GATEWAY;
-			}
-			break;
-
-		case NGX_HTTP_RANGE_NOT_SATISFIABLE:
-			// ignore this error, treat it like a successful read with empty body
-			rc = NGX_OK;
-			b->last = b->pos;
-			break;
-
-		default:
-			if (u->headers_in.status_n != 0)
-			{
-				ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-					"ngx_child_request_wev_handler: upstream returned a bad status %ui", u->headers_in.status_n);
-			}
-			else
-			{
-				ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-					"ngx_child_request_wev_handler: failed to get upstream status");
-			}
-			rc = NGX_HTTP_BAD_GATEWAY;
-			break;
-		}
-	}
-	else if (rc == NGX_ERROR)
-	{
-		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-			"ngx_child_request_wev_handler: got error -1, changing to 502");
-		rc = NGX_HTTP_BAD_GATEWAY;
-	}
-
-	if (ctx->send_header_result == NGX_ERROR || ctx->send_header_result > NGX_OK)
-	{
-		rc = ctx->send_header_result;
-	}
+	rc = ngx_child_request_get_result(r, ctx, u, b, ctx->error_code);
 
 	// get the content length
 	if (is_in_memory(ctx))
@@ -250,6 +262,19 @@ ngx_child_request_wev_handler(ngx_http_request_t *r)
 	}
 }
 
+static ngx_int_t
+ngx_child_request_completed_handler(
+	ngx_http_request_t *r,
+	void *data,
+	ngx_int_t rc)
+{
+	return rc;
+}
+
+static ngx_http_post_subrequest_t ngx_child_request_completed = {
+	ngx_child_request_completed_handler, NULL
+};
+
 static ngx_int_t
 ngx_child_request_finished_handler(
 	ngx_http_request_t *r, 
@@ -263,7 +288,8 @@ ngx_child_request_finished_handler(
 		"ngx_child_request_finished_handler: error code %i", rc);
 
 	// make sure we are not called twice for the same request
-	r->post_subrequest = NULL;
+	//	Note: not reset to null, the post subrequest identifies child requests in the header filter
+	r->post_subrequest = &ngx_child_request_completed;
 
 	// save the completed upstream and error code in the context for the write event handler
 	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
@@ -311,6 +337,81 @@ ngx_child_request_finished_handler(
 	return NGX_OK;
 }
 
+#if defined(NGX_HTTP_SUBREQUEST_BACKGROUND)
+static ngx_int_t
+ngx_child_request_background_finished_handler(
+	ngx_http_request_t *r,
+	void *data,
+	ngx_int_t rc)
+{
+	ngx_child_request_context_t* ctx = data;
+	ngx_http_upstream_t *u;
+	ngx_buf_t* b;
+
+	ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+		"ngx_child_request_background_finished_handler: error code %i", rc);
+
+	// make sure we are not called twice for the same request
+	//	Note: not reset to null, the post subrequest identifies child requests in the header filter
+	r->post_subrequest = &ngx_child_request_completed;
+
+	u = r->upstream;
+
+#if defined(nginx_version) && nginx_version >= 1013010
+	if (r->out == NULL || r->out->buf == NULL)
+	{
+		ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+			"ngx_child_request_background_finished_handler: unexpected, output buffer is null");
+		return NGX_OK;
+	}
+
+	b = r->out->buf;
+#else
+	if (u == NULL)
+	{
+		ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+			"ngx_child_request_background_finished_handler: unexpected, upstream is null");
+		return NGX_OK;
+	}
+
+	b = &u->buffer;
+#endif
+
+	rc = ngx_child_request_get_result(r, ctx, u, b, rc);
+
+	// Note: unlike regular child requests, the parent is not resumed, it may have already completed
+	ctx->callback(ctx->callback_context, rc, b, b->last - b->pos);
+
+	return NGX_OK;
+}
+#endif // NGX_HTTP_SUBREQUEST_BACKGROUND
+
+static ngx_child_request_context_t*
+ngx_child_request_get_context(ngx_http_request_t *r)
+{
+	ngx_http_post_subrequest_t* psr = r->post_subrequest;
+
+	// Note: other requests may have a different context in the module slot (e.g. the requests started
+	//		by the warmup handler), the requests started by ngx_child_request_start are identified by their
+	//		post subrequest handler
+	if (psr == NULL)
+	{
+		return NULL;
+	}
+
+	if (psr != &ngx_child_request_completed &&
+		psr->handler != ngx_child_request_finished_handler
+#if defined(NGX_HTTP_SUBREQUEST_BACKGROUND)
+		&& psr->handler != ngx_child_request_background_finished_handler
+#endif // NGX_HTTP_SUBREQUEST_BACKGROUND
+		)
+	{
+		return NULL;
+	}
+
+	return ngx_http_get_module_ctx(r, ngx_http_vod_module);
+}
+
 static void
 ngx_child_request_initial_wev_handler(ngx_http_request_t *r)
 {
@@ -348,7 +449,7 @@ ngx_child_request_initial_wev_handler(ngx_http_request_t *r)
 	}
 
 	// initialize the upstream buffer
-	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
+	ctx = ngx_child_request_get_context(r);
 	if (ctx == NULL)
 	{
 		ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
@@ -632,6 +733,27 @@ ngx_child_request_start(
 		flags = NGX_HTTP_SUBREQUEST_WAITED;
 	}
 
+	if (params->background)
+	{
+#if defined(NGX_HTTP_SUBREQUEST_BACKGROUND)
+		if (callback == NULL || !is_in_memory(child_ctx))
+		{
+			ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+				"ngx_child_request_start: background requests must have a callback and a response buffer");
+			return NGX_ERROR;
+		}
+
+		psr->handler = ngx_child_request_background_finished_handler;
+		psr->data = child_ctx;
+
+		flags |= NGX_HTTP_SUBREQUEST_BACKGROUND;
+#else
+		ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+			"ngx_child_request_start: background requests are not supported by this nginx version");
+		return NGX_ERROR;
+#endif // NGX_HTTP_SUBREQUEST_BACKGROUND
+	}
+
 	rc = ngx_http_subrequest(r, &uri, &params->extra_args, &sr, psr, flags);
 	if (rc == NGX_ERROR)
 	{
@@ -676,14 +798,14 @@ ngx_child_request_header_filter(ngx_http_request_t *r)
 	ngx_child_request_context_t* ctx;
 	ngx_http_request_t* pr = r->parent;
 
-	// if the request is not a child of a vod request, ignore
-	if (pr == NULL || pr->header_sent || ngx_http_get_module_ctx(pr, ngx_http_vod_module) == NULL)
+	// if the request is not a child request, ignore
+	//	Note: the parent having a vod context is not enough, e.g. the warmup handler starts vod requests
+	if (pr == NULL)
 	{
 		return ngx_http_next_header_filter(r);
 	}
 
-	// if the request is not a vod request or it's in memory, ignore
-	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
+	ctx = ngx_child_request_get_context(r);
 	if (ctx == NULL)
 	{
 		return ngx_http_next_header_filter(r);
@@ -704,6 +826,11 @@ ngx_child_request_header_filter(ngx_http_request_t *r)
 		return ngx_http_next_header_filter(r);
 	}
 
+	if (pr->header_sent)
+	{
+		return ngx_http_next_header_filter(r);
+	}
+
 	if (r->headers_out.status != 0)
 	{
 		// send the parent request headers
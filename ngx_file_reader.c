@@ -91,6 +91,7 @@ ngx_file_reader_update_state_file_info(ngx_file_reader_state_t* state, ngx_open_
 
 	state->file.fd = of->fd;
 	state->file_size = of->size;
+	state->file_mtime = of->mtime;
 
 	return NGX_OK;
 }
@@ -112,7 +113,7 @@ ngx_file_reader_init(
 	state->file.name = *path;
 	state->file.log = r->connection->log;
 	state->directio = clcf->directio;
-	state->log_not_found = clcf->log_not_found;
+	state->log_not_found = (flags & OPEN_FILE_NO_LOG_NOT_FOUND) != 0 ? 0 : clcf->log_not_found;
 	state->log = r->connection->log;
 #if (NGX_HAVE_FILE_AIO)
 	state->use_aio = clcf->aio;
@@ -183,7 +184,7 @@ ngx_file_reader_init_async(
 	state->file.name = *path;
 	state->file.log = r->connection->log;
 	state->directio = clcf->directio;
-	state->log_not_found = clcf->log_not_found;
+	state->log_not_found = (flags & OPEN_FILE_NO_LOG_NOT_FOUND) != 0 ? 0 : clcf->log_not_found;
 	state->log = r->connection->log;
 #if (NGX_HAVE_FILE_AIO)
 	state->use_aio = clcf->aio;
@@ -240,32 +241,49 @@ ngx_file_reader_init_async(
 
 #endif // NGX_THREADS
 
-ngx_int_t
-ngx_file_reader_dump_file_part(void* context, off_t start, off_t end)
+ngx_buf_t*
+ngx_file_reader_create_file_buf(ngx_file_reader_state_t* state, off_t start, off_t end)
 {
-	ngx_file_reader_state_t* state = context;
 	ngx_http_request_t* r = state->r;
-	ngx_buf_t                 *b;
-	ngx_int_t                  rc;
-	ngx_chain_t                out;
+	ngx_buf_t* b;
 
 	b = ngx_calloc_buf(r->pool);
 	if (b == NULL)
 	{
 		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, state->log, 0,
-			"ngx_file_reader_dump_file_part: ngx_pcalloc failed (1)");
-		return NGX_HTTP_INTERNAL_SERVER_ERROR;
+			"ngx_file_reader_create_file_buf: ngx_pcalloc failed (1)");
+		return NULL;
 	}
 
 	b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
 	if (b->file == NULL)
 	{
 		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, state->log, 0,
-			"ngx_file_reader_dump_file_part: ngx_pcalloc failed (2)");
-		return NGX_HTTP_INTERNAL_SERVER_ERROR;
+			"ngx_file_reader_create_file_buf: ngx_pcalloc failed (2)");
+		return NULL;
 	}
 
 	b->file_pos = start;
+	b->file_last = end;
+	b->in_file = end > start ? 1 : 0;
+
+	b->file->fd = state->file.fd;
+	b->file->name = state->file.name;
+	b->file->log = state->log;
+	b->file->directio = state->file.directio;
+
+	return b;
+}
+
+ngx_int_t
+ngx_file_reader_dump_file_part(void* context, off_t start, off_t end)
+{
+	ngx_file_reader_state_t* state = context;
+	ngx_http_request_t* r = state->r;
+	ngx_buf_t                 *b;
+	ngx_int_t                  rc;
+	ngx_chain_t                out;
+
 	if (end != 0)
 	{
 		if (end > state->file_size)
@@ -274,22 +292,21 @@ ngx_file_reader_dump_file_part(void* context, off_t start, off_t end)
 				"ngx_file_reader_dump_file_part: end offset %O exceeds file size %O, probably a truncated file", end, state->file_size);
 			return NGX_HTTP_NOT_FOUND;
 		}
-		b->file_last = end;
 	}
 	else
 	{
-		b->file_last = state->file_size;
+		end = state->file_size;
+	}
+
+	b = ngx_file_reader_create_file_buf(state, start, end);
+	if (b == NULL)
+	{
+		return NGX_HTTP_INTERNAL_SERVER_ERROR;
 	}
 
-	b->in_file = b->file_last ? 1 : 0;
 	b->last_buf = (r == r->main) ? 1 : 0;
 	b->last_in_chain = 1;
 
-	b->file->fd = state->file.fd;
-	b->file->name = state->file.name;
-	b->file->log = state->log;
-	b->file->directio = state->file.directio;
-
 	out.buf = b;
 	out.next = NULL;
 
@@ -330,6 +347,14 @@ ngx_file_reader_get_size(void* context)
 	return state->file_size;
 }
 
+time_t
+ngx_file_reader_get_mtime(void* context)
+{
+	ngx_file_reader_state_t* state = context;
+
+	return state->file_mtime;
+}
+
 void
 ngx_file_reader_get_path(void* context, ngx_str_t* path)
 {
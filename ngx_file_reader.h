@@ -13,6 +13,7 @@
 
 // constants
 #define OPEN_FILE_NO_CACHE (0x1)
+#define OPEN_FILE_NO_LOG_NOT_FOUND (0x2)
 
 // typedefs
 typedef void (*ngx_async_read_callback_t)(void* context, ngx_int_t rc, ngx_buf_t* buf, ssize_t bytes_read);
@@ -24,6 +25,7 @@ typedef struct {
 	ngx_flag_t log_not_found;
 	ngx_log_t* log;
 	off_t file_size;
+	time_t file_mtime;
 #if (NGX_HAVE_FILE_AIO)
 	ngx_flag_t use_aio;
 	ngx_async_read_callback_t read_callback;
@@ -56,10 +58,14 @@ ngx_int_t ngx_file_reader_init_async(
 	uint32_t flags);
 #endif // NGX_THREADS
 
+ngx_buf_t* ngx_file_reader_create_file_buf(ngx_file_reader_state_t* state, off_t start, off_t end);
+
 ngx_int_t ngx_file_reader_dump_file_part(void* context, off_t start, off_t end);
 
 size_t ngx_file_reader_get_size(void* context);
 
+time_t ngx_file_reader_get_mtime(void* context);
+
 void ngx_file_reader_get_path(void* context, ngx_str_t* path);
 
 ngx_int_t ngx_async_file_read(ngx_file_reader_state_t* state, ngx_buf_t *buf, size_t size, off_t offset);
@@ -4,6 +4,7 @@
 #include "ngx_http_vod_submodule.h"
 #include "ngx_http_vod_module.h"
 #include "ngx_http_vod_status.h"
+#include "ngx_http_vod_warmup.h"
 #include "ngx_perf_counters.h"
 #include "ngx_buffer_cache.h"
 #include "vod/media_set_parser.h"
@@ -79,6 +80,7 @@ ngx_http_vod_create_loc_conf(ngx_conf_t *cf)
 	conf->segmenter.manifest_duration_policy = NGX_CONF_UNSET_UINT;
 	conf->segmenter.gop_look_ahead = NGX_CONF_UNSET_UINT;
 	conf->segmenter.gop_look_behind = NGX_CONF_UNSET_UINT;
+	conf->segmenter.part_duration = NGX_CONF_UNSET_UINT;
 	conf->force_playlist_type_vod = NGX_CONF_UNSET;
 	conf->force_continuous_timestamps = NGX_CONF_UNSET;
 	conf->force_sequence_index = NGX_CONF_UNSET;
@@ -86,6 +88,9 @@ ngx_http_vod_create_loc_conf(ngx_conf_t *cf)
 	conf->max_metadata_size = NGX_CONF_UNSET_SIZE;
 	conf->max_frames_size = NGX_CONF_UNSET_SIZE;
 	conf->cache_buffer_size = NGX_CONF_UNSET_SIZE;
+	conf->max_coalesced_read_size = NGX_CONF_UNSET_SIZE;
+	conf->zero_copy_segments = NGX_CONF_UNSET;
+	conf->manifest_streaming = NGX_CONF_UNSET;
 	conf->max_upstream_headers_size = NGX_CONF_UNSET_SIZE;
 	conf->ignore_edit_list = NGX_CONF_UNSET;
 	conf->parse_hdlr_name = NGX_CONF_UNSET;
@@ -93,6 +98,9 @@ ngx_http_vod_create_loc_conf(ngx_conf_t *cf)
 
 	conf->metadata_cache = NGX_CONF_UNSET_PTR;
 	conf->dynamic_mapping_cache = NGX_CONF_UNSET_PTR;
+	conf->audio_filter_cache = NGX_CONF_UNSET_PTR;
+	conf->manifest_fragment_cache = NGX_CONF_UNSET_PTR;
+	conf->response_cache_max_segment_size = NGX_CONF_UNSET_SIZE;
 	for (type = 0; type < CACHE_TYPE_COUNT; type++)
 	{
 		conf->response_cache[type] = NGX_CONF_UNSET_PTR;
@@ -110,10 +118,17 @@ ngx_http_vod_create_loc_conf(ngx_conf_t *cf)
 	conf->drm_clear_lead_segment_count = NGX_CONF_UNSET_UINT;
 	conf->drm_max_info_length = NGX_CONF_UNSET_SIZE;
 	conf->drm_info_cache = NGX_CONF_UNSET_PTR;
+	conf->mapping_cache_compiled = NGX_CONF_UNSET;
+	conf->cache_lock = NGX_CONF_UNSET;
+	conf->cache_lock_timeout = NGX_CONF_UNSET_MSEC;
 	conf->min_single_nalu_per_frame_segment = NGX_CONF_UNSET_UINT;
+	conf->warmup_concurrency = NGX_CONF_UNSET_UINT;
+	conf->warmup_worker_concurrency = NGX_CONF_UNSET_UINT;
 
 #if (NGX_THREADS)
 	conf->open_file_thread_pool = NGX_CONF_UNSET_PTR;
+	conf->audio_filter_thread_pool = NGX_CONF_UNSET_PTR;
+	conf->audio_filter_max_jobs = NGX_CONF_UNSET_UINT;
 #endif // NGX_THREADS
 
 	// submodules
@@ -162,6 +177,7 @@ ngx_http_vod_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 	ngx_conf_merge_uint_value(conf->segmenter.manifest_duration_policy, prev->segmenter.manifest_duration_policy, MDP_MAX);
 	ngx_conf_merge_uint_value(conf->segmenter.gop_look_ahead, prev->segmenter.gop_look_ahead, 1000);
 	ngx_conf_merge_uint_value(conf->segmenter.gop_look_behind, prev->segmenter.gop_look_behind, 10000);
+	ngx_conf_merge_uint_value(conf->segmenter.part_duration, prev->segmenter.part_duration, 0);
 	ngx_conf_merge_value(conf->force_playlist_type_vod, prev->force_playlist_type_vod, 0);
 	ngx_conf_merge_value(conf->force_continuous_timestamps, prev->force_continuous_timestamps, 0);
 	ngx_conf_merge_value(conf->force_sequence_index, prev->force_sequence_index, 0);
@@ -187,13 +203,17 @@ ngx_http_vod_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 	}
 
 	ngx_conf_merge_ptr_value(conf->metadata_cache, prev->metadata_cache, NULL);
+	ngx_conf_merge_str_value(conf->metadata_index_path, prev->metadata_index_path, "");
 	ngx_conf_merge_ptr_value(conf->dynamic_mapping_cache, prev->dynamic_mapping_cache, NULL);
+	ngx_conf_merge_ptr_value(conf->audio_filter_cache, prev->audio_filter_cache, NULL);
+	ngx_conf_merge_ptr_value(conf->manifest_fragment_cache, prev->manifest_fragment_cache, NULL);
 
 	for (type = 0; type < CACHE_TYPE_COUNT; type++)
 	{
 		ngx_conf_merge_ptr_value(conf->response_cache[type], prev->response_cache[type], NULL);
 		ngx_conf_merge_ptr_value(conf->mapping_cache[type], prev->mapping_cache[type], NULL);
 	}
+	ngx_conf_merge_size_value(conf->response_cache_max_segment_size, prev->response_cache_max_segment_size, 0);
 
 	for (type = 0; type < EXPIRES_TYPE_COUNT; type++)
 	{
@@ -204,6 +224,7 @@ ngx_http_vod_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 	ngx_conf_merge_size_value(conf->max_metadata_size, prev->max_metadata_size, 128 * 1024 * 1024);
 	ngx_conf_merge_size_value(conf->max_frames_size, prev->max_frames_size, 16 * 1024 * 1024);
 	ngx_conf_merge_size_value(conf->cache_buffer_size, prev->cache_buffer_size, 256 * 1024);
+	ngx_conf_merge_size_value(conf->max_coalesced_read_size, prev->max_coalesced_read_size, 0);
 	ngx_conf_merge_size_value(conf->max_upstream_headers_size, prev->max_upstream_headers_size, 4 * 1024);
 	
 	if (conf->output_buffer_pool == NULL)
@@ -211,6 +232,9 @@ ngx_http_vod_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 		conf->output_buffer_pool = prev->output_buffer_pool;
 	}
 
+	ngx_conf_merge_value(conf->zero_copy_segments, prev->zero_copy_segments, 0);
+	ngx_conf_merge_value(conf->manifest_streaming, prev->manifest_streaming, 0);
+
 	ngx_conf_merge_value(conf->ignore_edit_list, prev->ignore_edit_list, 0);
 	ngx_conf_merge_value(conf->parse_hdlr_name, prev->parse_hdlr_name, 0);
 
@@ -283,11 +307,16 @@ ngx_http_vod_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 	ngx_conf_merge_str_value(conf->drm_upstream_location, prev->drm_upstream_location, "");
 	ngx_conf_merge_size_value(conf->drm_max_info_length, prev->drm_max_info_length, 4096);
 	ngx_conf_merge_ptr_value(conf->drm_info_cache, prev->drm_info_cache, NULL);
+	ngx_conf_merge_value(conf->mapping_cache_compiled, prev->mapping_cache_compiled, 0);
+	ngx_conf_merge_value(conf->cache_lock, prev->cache_lock, 0);
+	ngx_conf_merge_msec_value(conf->cache_lock_timeout, prev->cache_lock_timeout, 5000);
 	if (conf->drm_request_uri == NULL)
 	{
 		conf->drm_request_uri = prev->drm_request_uri;
 	}
 	ngx_conf_merge_uint_value(conf->min_single_nalu_per_frame_segment, prev->min_single_nalu_per_frame_segment, 0);
+	ngx_conf_merge_uint_value(conf->warmup_concurrency, prev->warmup_concurrency, 4);
+	ngx_conf_merge_uint_value(conf->warmup_worker_concurrency, prev->warmup_worker_concurrency, 16);
 	
 	ngx_conf_merge_str_value(conf->clip_to_param_name, prev->clip_to_param_name, "clipTo");
 	ngx_conf_merge_str_value(conf->clip_from_param_name, prev->clip_from_param_name, "clipFrom");
@@ -303,8 +332,22 @@ ngx_http_vod_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 
 #if (NGX_THREADS)
 	ngx_conf_merge_ptr_value(conf->open_file_thread_pool, prev->open_file_thread_pool, NULL);
+	ngx_conf_merge_ptr_value(conf->audio_filter_thread_pool, prev->audio_filter_thread_pool, NULL);
+	ngx_conf_merge_uint_value(conf->audio_filter_max_jobs, prev->audio_filter_max_jobs, 0);
 #endif // NGX_THREADS
 
+	// Note: the index files are written only by the open file thread pool
+	if (conf->metadata_index_path.len != 0 && 
+		conf->metadata_index_path.data != prev->metadata_index_path.data
+#if (NGX_THREADS)
+		&& conf->open_file_thread_pool == NULL
+#endif // NGX_THREADS
+		)
+	{
+		ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+			"\"vod_metadata_index_path\" is used without \"vod_open_file_thread_pool\", index files will not be saved");
+	}
+
 	// validate vod_upstream / vod_upstream_host_header used when needed
 	if (conf->request_handler == ngx_http_vod_remote_request_handler)
 	{
@@ -323,6 +366,44 @@ ngx_http_vod_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 		return NGX_CONF_ERROR;
 	}
 
+	if (conf->segmenter.part_duration != 0)
+	{
+		if (conf->segmenter.part_duration >= conf->segmenter.segment_duration)
+		{
+			ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+				"\"vod_partial_segment_duration\" must be less than \"vod_segment_duration\"");
+			return NGX_CONF_ERROR;
+		}
+
+		if (conf->segmenter.align_to_key_frames)
+		{
+			ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+				"\"vod_partial_segment_duration\" cannot be used with \"vod_align_segments_to_key_frames\"");
+			return NGX_CONF_ERROR;
+		}
+	}
+
+	if (conf->warmup_concurrency <= 0)
+	{
+		ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+			"\"vod_warmup_concurrency\" must be positive");
+		return NGX_CONF_ERROR;
+	}
+
+	if (conf->warmup_worker_concurrency <= 0)
+	{
+		ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+			"\"vod_warmup_worker_concurrency\" must be positive");
+		return NGX_CONF_ERROR;
+	}
+
+	if (conf->max_coalesced_read_size > NGX_MAX_UINT32_VALUE)
+	{
+		ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+			"\"vod_max_coalesced_read_size\" must be less than 4G");
+		return NGX_CONF_ERROR;
+	}
+
 #if (NGX_HAVE_LIB_AV_CODEC)
 	if (conf->submodule.name == thumb.name)
 	{
@@ -628,8 +709,12 @@ ngx_http_vod_cache_command(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
 	ngx_buffer_cache_t **cache = (ngx_buffer_cache_t **)((u_char*)conf + cmd->offset);
 	ngx_str_t  *value;
+	ngx_str_t  str;
+	ngx_uint_t i;
+	ngx_int_t shard_count;
 	ssize_t size;
 	time_t expiration;
+	time_t stale_time;
 
 	value = cf->args->elts;
 
@@ -659,22 +744,75 @@ ngx_http_vod_cache_command(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 		return NGX_CONF_ERROR;
 	}
 
-	if (cf->args->nelts > 3)
+	expiration = 0;
+	stale_time = 0;
+	shard_count = 1;
+
+	for (i = 3; i < cf->args->nelts; i++)
 	{
-		expiration = ngx_parse_time(&value[3], 1);
+		if (ngx_strncmp(value[i].data, "shards=", sizeof("shards=") - 1) == 0)
+		{
+			str.data = value[i].data + sizeof("shards=") - 1;
+			str.len = value[i].len - (sizeof("shards=") - 1);
+
+			shard_count = ngx_atoi(str.data, str.len);
+			if (shard_count == NGX_ERROR || shard_count < 1 || shard_count > BUFFER_CACHE_MAX_SHARDS)
+			{
+				ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+					"invalid shard count %V, must be between 1 and %d", &str, BUFFER_CACHE_MAX_SHARDS);
+				return NGX_CONF_ERROR;
+			}
+
+			if ((size_t)size / shard_count < BUFFER_CACHE_MIN_SHARD_SIZE)
+			{
+				ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+					"cache size %V is too small for %i shards", &value[2], shard_count);
+				return NGX_CONF_ERROR;
+			}
+
+			continue;
+		}
+
+		if (ngx_strncmp(value[i].data, "stale=", sizeof("stale=") - 1) == 0)
+		{
+			str.data = value[i].data + sizeof("stale=") - 1;
+			str.len = value[i].len - (sizeof("stale=") - 1);
+
+			stale_time = ngx_parse_time(&str, 1);
+			if (stale_time == (time_t)NGX_ERROR)
+			{
+				ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+					"invalid stale time %V", &str);
+				return NGX_CONF_ERROR;
+			}
+
+			continue;
+		}
+
+		if (i != 3)
+		{
+			ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+				"invalid parameter \"%V\"", &value[i]);
+			return NGX_CONF_ERROR;
+		}
+
+		expiration = ngx_parse_time(&value[i], 1);
 		if (expiration == (time_t)NGX_ERROR) 
 		{
 			ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-				"invalid expiration %V", &value[3]);
+				"invalid expiration %V", &value[i]);
 			return NGX_CONF_ERROR;
 		}
 	}
-	else
+
+	if (stale_time != 0 && expiration == 0)
 	{
-		expiration = 0;
+		ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+			"stale time requires an expiration");
+		return NGX_CONF_ERROR;
 	}
 
-	*cache = ngx_buffer_cache_create(cf, &value[1], size, expiration, &ngx_http_vod_module);
+	*cache = ngx_buffer_cache_create(cf, &value[1], size, expiration, stale_time, shard_count, &ngx_http_vod_module);
 	if (*cache == NULL)
 	{
 		ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
@@ -830,6 +968,17 @@ ngx_http_vod_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 	return NGX_CONF_OK;
 }
 
+static char *
+ngx_http_vod_warmup(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+	ngx_http_core_loc_conf_t *clcf;
+
+	clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+	clcf->handler = ngx_http_vod_warmup_handler;
+
+	return NGX_CONF_OK;
+}
+
 static ngx_conf_enum_t manifest_duration_policies[] = {
 	{ ngx_string("max"), MDP_MAX },
 	{ ngx_string("min"), MDP_MIN },
@@ -860,6 +1009,27 @@ ngx_command_t ngx_http_vod_commands[] = {
 	0,
 	NULL },
 
+	{ ngx_string("vod_warmup"),
+	NGX_HTTP_LOC_CONF | NGX_CONF_NOARGS,
+	ngx_http_vod_warmup,
+	0,
+	0,
+	NULL },
+
+	{ ngx_string("vod_warmup_concurrency"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_num_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, warmup_concurrency),
+	NULL },
+
+	{ ngx_string("vod_warmup_worker_concurrency"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_num_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, warmup_worker_concurrency),
+	NULL },
+
 	// output generation parameters
 	{ ngx_string("vod_multi_uri_suffix"),
 	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
@@ -875,6 +1045,13 @@ ngx_command_t ngx_http_vod_commands[] = {
 	offsetof(ngx_http_vod_loc_conf_t, segmenter.segment_duration),
 	NULL },
 
+	{ ngx_string("vod_partial_segment_duration"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_num_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, segmenter.part_duration),
+	NULL },
+
 	{ ngx_string("vod_live_window_duration"),
 	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
 	ngx_http_vod_set_signed_slot,
@@ -982,26 +1159,40 @@ ngx_command_t ngx_http_vod_commands[] = {
 	
 	// mp4 reading parameters
 	{ ngx_string("vod_metadata_cache"),
-	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE123,
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_1MORE,
 	ngx_http_vod_cache_command,
 	NGX_HTTP_LOC_CONF_OFFSET,
 	offsetof(ngx_http_vod_loc_conf_t, metadata_cache),
 	NULL },
 
+	{ ngx_string("vod_metadata_index_path"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_str_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, metadata_index_path),
+	NULL },
+
 	{ ngx_string("vod_response_cache"),
-	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE123,
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_1MORE,
 	ngx_http_vod_cache_command,
 	NGX_HTTP_LOC_CONF_OFFSET,
 	offsetof(ngx_http_vod_loc_conf_t, response_cache[CACHE_TYPE_VOD]),
 	NULL },
 
 	{ ngx_string("vod_live_response_cache"),
-	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE123,
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_1MORE,
 	ngx_http_vod_cache_command,
 	NGX_HTTP_LOC_CONF_OFFSET,
 	offsetof(ngx_http_vod_loc_conf_t, response_cache[CACHE_TYPE_LIVE]),
 	NULL },
 
+	{ ngx_string("vod_response_cache_max_segment_size"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_size_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, response_cache_max_segment_size),
+	NULL },
+
 	{ ngx_string("vod_initial_read_size"),
 	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
 	ngx_conf_set_size_slot,
@@ -1030,6 +1221,13 @@ ngx_command_t ngx_http_vod_commands[] = {
 	offsetof(ngx_http_vod_loc_conf_t, cache_buffer_size),
 	NULL },
 
+	{ ngx_string("vod_max_coalesced_read_size"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_size_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, max_coalesced_read_size),
+	NULL },
+
 	{ ngx_string("vod_ignore_edit_list"),
 	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
 	ngx_conf_set_flag_slot,
@@ -1075,26 +1273,61 @@ ngx_command_t ngx_http_vod_commands[] = {
 
 	// path request parameters - mapped mode only
 	{ ngx_string("vod_mapping_cache"),
-	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE123,
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_1MORE,
 	ngx_http_vod_cache_command,
 	NGX_HTTP_LOC_CONF_OFFSET,
 	offsetof(ngx_http_vod_loc_conf_t, mapping_cache[CACHE_TYPE_VOD]),
 	NULL },
 
 	{ ngx_string("vod_live_mapping_cache"),
-	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE123,
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_1MORE,
 	ngx_http_vod_cache_command,
 	NGX_HTTP_LOC_CONF_OFFSET,
 	offsetof(ngx_http_vod_loc_conf_t, mapping_cache[CACHE_TYPE_LIVE]),
 	NULL },
 
+	{ ngx_string("vod_mapping_cache_compiled"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_FLAG,
+	ngx_conf_set_flag_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, mapping_cache_compiled),
+	NULL },
+
 	{ ngx_string("vod_dynamic_mapping_cache"),
-	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE123,
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_1MORE,
 	ngx_http_vod_cache_command,
 	NGX_HTTP_LOC_CONF_OFFSET,
 	offsetof(ngx_http_vod_loc_conf_t, dynamic_mapping_cache),
 	NULL },
 
+	{ ngx_string("vod_audio_filter_cache"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_1MORE,
+	ngx_http_vod_cache_command,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, audio_filter_cache),
+	NULL },
+
+	{ ngx_string("vod_manifest_fragment_cache"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_1MORE,
+	ngx_http_vod_cache_command,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, manifest_fragment_cache),
+	NULL },
+
+	{ ngx_string("vod_cache_lock"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_FLAG,
+	ngx_conf_set_flag_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, cache_lock),
+	NULL },
+
+	{ ngx_string("vod_cache_lock_timeout"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_msec_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, cache_lock_timeout),
+	NULL },
+
 	{ ngx_string("vod_path_response_prefix"),
 	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
 	ngx_conf_set_str_slot,
@@ -1262,7 +1495,7 @@ ngx_command_t ngx_http_vod_commands[] = {
 	NULL },
 
 	{ ngx_string("vod_drm_info_cache"),
-	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE123,
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_1MORE,
 	ngx_http_vod_cache_command,
 	NGX_HTTP_LOC_CONF_OFFSET,
 	offsetof(ngx_http_vod_loc_conf_t, drm_info_cache),
@@ -1340,6 +1573,20 @@ ngx_command_t ngx_http_vod_commands[] = {
 	offsetof(ngx_http_vod_loc_conf_t, output_buffer_pool),
 	NULL },
 
+	{ ngx_string("vod_zero_copy_segments"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_FLAG,
+	ngx_conf_set_flag_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, zero_copy_segments),
+	NULL },
+
+	{ ngx_string("vod_manifest_streaming"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_FLAG,
+	ngx_conf_set_flag_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, manifest_streaming),
+	NULL },
+
 #if (NGX_THREADS)
 	{ ngx_string("vod_open_file_thread_pool"),
 	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_NOARGS | NGX_CONF_TAKE1,
@@ -1347,6 +1594,20 @@ ngx_command_t ngx_http_vod_commands[] = {
 	NGX_HTTP_LOC_CONF_OFFSET,
 	offsetof(ngx_http_vod_loc_conf_t, open_file_thread_pool),
 	NULL },
+
+	{ ngx_string("vod_audio_filter_thread_pool"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_NOARGS | NGX_CONF_TAKE1,
+	ngx_http_vod_thread_pool_command,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, audio_filter_thread_pool),
+	NULL },
+
+	{ ngx_string("vod_audio_filter_max_jobs"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_num_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	offsetof(ngx_http_vod_loc_conf_t, audio_filter_max_jobs),
+	NULL },
 #endif // NGX_THREADS
 
 #include "ngx_http_vod_dash_commands.h"
@@ -47,19 +47,27 @@ struct ngx_http_vod_loc_conf_s {
 	ngx_http_complex_value_t *base_url;
 	ngx_http_complex_value_t *segments_base_url;
 	ngx_buffer_cache_t* metadata_cache;
+	ngx_str_t metadata_index_path;
 	ngx_buffer_cache_t* response_cache[CACHE_TYPE_COUNT];
+	size_t response_cache_max_segment_size;
 	size_t initial_read_size;
 	size_t max_metadata_size;
 	size_t max_frames_size;
 	size_t cache_buffer_size;
+	size_t max_coalesced_read_size;
 	buffer_pool_t* output_buffer_pool;
+	ngx_flag_t zero_copy_segments;
+	ngx_flag_t manifest_streaming;
 	size_t max_upstream_headers_size;
 	ngx_flag_t ignore_edit_list;
 	ngx_flag_t parse_hdlr_name;
 	int parse_flags;
 	ngx_http_complex_value_t *upstream_extra_args;
 	ngx_buffer_cache_t* mapping_cache[CACHE_TYPE_COUNT];
+	ngx_flag_t mapping_cache_compiled;
 	ngx_buffer_cache_t* dynamic_mapping_cache;
+	ngx_buffer_cache_t* audio_filter_cache;
+	ngx_buffer_cache_t* manifest_fragment_cache;
 	ngx_str_t path_response_prefix;
 	ngx_str_t path_response_postfix;
 	size_t max_mapping_response_size;
@@ -87,6 +95,8 @@ struct ngx_http_vod_loc_conf_s {
 	ngx_str_t drm_upstream_location;
 	size_t drm_max_info_length;
 	ngx_buffer_cache_t* drm_info_cache;
+	ngx_flag_t cache_lock;
+	ngx_msec_t cache_lock_timeout;
 	ngx_http_complex_value_t *drm_request_uri;
 	ngx_uint_t min_single_nalu_per_frame_segment;
 
@@ -98,9 +108,13 @@ struct ngx_http_vod_loc_conf_s {
 	ngx_str_t lang_param_name;
 
 	ngx_shm_zone_t* perf_counters_zone;
+	ngx_uint_t warmup_concurrency;
+	ngx_uint_t warmup_worker_concurrency;
 
 #if (NGX_THREADS)
 	ngx_thread_pool_t *open_file_thread_pool;
+	ngx_thread_pool_t *audio_filter_thread_pool;
+	ngx_uint_t audio_filter_max_jobs;
 #endif // NGX_THREADS
 
 	// derived fields
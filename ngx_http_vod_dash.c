@@ -38,6 +38,69 @@ static const u_char fragment_file_ext[] = ".m4s";
 static const u_char webm_file_ext[] = ".webm";
 static const u_char vtt_file_ext[] = ".vtt";
 
+static void
+ngx_http_vod_dash_period_cache_get_key(vod_str_t* key, u_char* result)
+{
+	ngx_md5_t md5;
+
+	ngx_md5_init(&md5);
+	ngx_md5_update(&md5, key->data, key->len);
+	ngx_md5_final(result, &md5);
+}
+
+static vod_status_t
+ngx_http_vod_dash_period_cache_fetch(void* context, vod_str_t* key, vod_str_t* result)
+{
+	ngx_http_vod_submodule_context_t* submodule_context = context;
+	ngx_buffer_cache_t* cache = submodule_context->conf->manifest_fragment_cache;
+	u_char cache_key[BUFFER_CACHE_KEY_SIZE];
+	ngx_str_t buffer;
+	uint32_t token;
+
+	ngx_http_vod_dash_period_cache_get_key(key, cache_key);
+
+	if (!ngx_buffer_cache_fetch(cache, cache_key, &buffer, &token))
+	{
+		return VOD_NOT_FOUND;
+	}
+
+	result->data = ngx_pnalloc(submodule_context->request_context.pool, buffer.len);
+	if (result->data == NULL)
+	{
+		ngx_buffer_cache_release(cache, cache_key, token);
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+			"ngx_http_vod_dash_period_cache_fetch: ngx_pnalloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	ngx_memcpy(result->data, buffer.data, buffer.len);
+	result->len = buffer.len;
+
+	ngx_buffer_cache_release(cache, cache_key, token);
+
+	return VOD_OK;
+}
+
+static void
+ngx_http_vod_dash_period_cache_store(void* context, vod_str_t* key, vod_str_t* period)
+{
+	ngx_http_vod_submodule_context_t* submodule_context = context;
+	u_char cache_key[BUFFER_CACHE_KEY_SIZE];
+
+	ngx_http_vod_dash_period_cache_get_key(key, cache_key);
+
+	if (ngx_buffer_cache_store(submodule_context->conf->manifest_fragment_cache, cache_key, period->data, period->len))
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+			"ngx_http_vod_dash_period_cache_store: stored in manifest fragment cache");
+	}
+	else
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+			"ngx_http_vod_dash_period_cache_store: failed to store in manifest fragment cache");
+	}
+}
+
 static ngx_int_t 
 ngx_http_vod_dash_handle_manifest(
 	ngx_http_vod_submodule_context_t* submodule_context,
@@ -46,6 +109,8 @@ ngx_http_vod_dash_handle_manifest(
 {
 	dash_manifest_extensions_t extensions;
 	ngx_http_vod_loc_conf_t* conf = submodule_context->conf;
+	dash_period_cache_t period_cache;
+	dash_period_cache_t* period_cache_ptr;
 	ngx_str_t base_url = ngx_null_string;
 	vod_status_t rc;
 	ngx_str_t file_uri;
@@ -85,12 +150,25 @@ ngx_http_vod_dash_handle_manifest(
 	{
 		vod_memzero(&extensions, sizeof(extensions));
 
+		if (conf->manifest_fragment_cache != NULL)
+		{
+			period_cache.fetch = ngx_http_vod_dash_period_cache_fetch;
+			period_cache.store = ngx_http_vod_dash_period_cache_store;
+			period_cache.context = submodule_context;
+			period_cache_ptr = &period_cache;
+		}
+		else
+		{
+			period_cache_ptr = NULL;
+		}
+
 		rc = dash_packager_build_mpd(
 			&submodule_context->request_context,
 			&conf->dash.mpd_config,
 			&base_url,
 			&submodule_context->media_set,
 			&extensions,
+			period_cache_ptr,
 			response);
 	}
 
@@ -247,6 +325,7 @@ ngx_http_vod_dash_mp4_init_frame_processor(
 			&submodule_context->request_context,
 			submodule_context->media_set.sequences,
 			segment_writer->write_tail,
+			segment_writer->write_file_range,
 			segment_writer->context,
 			reuse_buffers,
 			&state);
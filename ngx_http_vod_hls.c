@@ -244,6 +244,7 @@ ngx_http_vod_hls_init_segment_encryption(
 	}
 
 	segment_writer->write_tail = (write_callback_t)aes_cbc_encrypt_write;
+	segment_writer->write_file_range = NULL;
 	segment_writer->context = encrypted_write_context;
 	return NGX_OK;
 }
@@ -288,6 +289,94 @@ ngx_http_vod_hls_handle_master_playlist(
 	return NGX_OK;
 }
 
+// returns NGX_AGAIN when the playlist requested by _HLS_msn / _HLS_part is not available yet
+static ngx_int_t
+ngx_http_vod_hls_check_blocking_reload(
+	ngx_http_vod_submodule_context_t* submodule_context,
+	ngx_uint_t container_format)
+{
+	ngx_http_request_t* r = submodule_context->r;
+	m3u8_live_edge_t live_edge;
+	ngx_str_t value;
+	ngx_int_t part = NGX_ERROR;
+	ngx_int_t msn;
+	vod_status_t rc;
+
+	if (!m3u8_builder_low_latency_enabled(&submodule_context->media_set, container_format))
+	{
+		return NGX_OK;
+	}
+
+	if (ngx_http_arg(r, (u_char *) "_HLS_part", sizeof("_HLS_part") - 1, &value) == NGX_OK)
+	{
+		part = ngx_atoi(value.data, value.len);
+		if (part == NGX_ERROR)
+		{
+			ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+				"ngx_http_vod_hls_check_blocking_reload: invalid _HLS_part \"%V\"", &value);
+			return ngx_http_vod_status_to_ngx_error(r, VOD_BAD_REQUEST);
+		}
+	}
+
+	if (ngx_http_arg(r, (u_char *) "_HLS_msn", sizeof("_HLS_msn") - 1, &value) != NGX_OK)
+	{
+		if (part != NGX_ERROR)
+		{
+			ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+				"ngx_http_vod_hls_check_blocking_reload: _HLS_part specified without _HLS_msn");
+			return ngx_http_vod_status_to_ngx_error(r, VOD_BAD_REQUEST);
+		}
+
+		return NGX_OK;
+	}
+
+	msn = ngx_atoi(value.data, value.len);
+	if (msn == NGX_ERROR)
+	{
+		ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+			"ngx_http_vod_hls_check_blocking_reload: invalid _HLS_msn \"%V\"", &value);
+		return ngx_http_vod_status_to_ngx_error(r, VOD_BAD_REQUEST);
+	}
+
+	rc = m3u8_builder_get_live_edge(
+		&submodule_context->request_context,
+		&submodule_context->media_set,
+		&live_edge);
+	if (rc != VOD_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_hls_check_blocking_reload: m3u8_builder_get_live_edge failed %i", rc);
+		return ngx_http_vod_status_to_ngx_error(r, rc);
+	}
+
+	// Note: media sequence numbers are 1-based, live_edge.segment_index is the msn of the last complete segment
+	if ((ngx_uint_t)msn <= live_edge.segment_index)
+	{
+		return NGX_OK;
+	}
+
+	if ((ngx_uint_t)msn == live_edge.segment_index + 1 &&
+		part != NGX_ERROR &&
+		(ngx_uint_t)part < live_edge.part_count)
+	{
+		return NGX_OK;
+	}
+
+	if ((ngx_uint_t)msn > live_edge.segment_index + 2)
+	{
+		ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+			"ngx_http_vod_hls_check_blocking_reload: _HLS_msn %i is too far ahead of the live edge %uD",
+			msn, live_edge.segment_index);
+		return ngx_http_vod_status_to_ngx_error(r, VOD_BAD_REQUEST);
+	}
+
+	ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+		"ngx_http_vod_hls_check_blocking_reload: waiting for msn %i part %i, live edge %uD",
+		msn, part, live_edge.segment_index);
+
+	return NGX_AGAIN;
+}
+
 static ngx_int_t 
 ngx_http_vod_hls_handle_index_playlist(
 	ngx_http_vod_submodule_context_t* submodule_context,
@@ -296,6 +385,7 @@ ngx_http_vod_hls_handle_index_playlist(
 {
 	ngx_http_vod_loc_conf_t* conf = submodule_context->conf;
 	hls_encryption_params_t encryption_params;
+	m3u8_index_stream_t* stream = NULL;
 	ngx_uint_t container_format;
 	ngx_str_t segments_base_url = ngx_null_string;
 	ngx_str_t base_url = ngx_null_string;
@@ -361,6 +451,12 @@ ngx_http_vod_hls_handle_index_playlist(
 	encryption_params.type = HLS_ENC_NONE;
 #endif // NGX_HAVE_OPENSSL_EVP
 
+	rc = ngx_http_vod_hls_check_blocking_reload(submodule_context, container_format);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
 	rc = m3u8_builder_build_index_playlist(
 		&submodule_context->request_context,
 		&conf->hls.m3u8_config,
@@ -369,6 +465,7 @@ ngx_http_vod_hls_handle_index_playlist(
 		&encryption_params,
 		container_format,
 		&submodule_context->media_set,
+		submodule_context->manifest_streaming ? &stream : NULL,
 		response);
 	if (rc != VOD_OK)
 	{
@@ -377,6 +474,12 @@ ngx_http_vod_hls_handle_index_playlist(
 		return ngx_http_vod_status_to_ngx_error(submodule_context->r, rc);
 	}
 
+	if (stream != NULL)
+	{
+		submodule_context->manifest_stream.next_chunk = m3u8_builder_index_stream_next;
+		submodule_context->manifest_stream.context = stream;
+	}
+
 	content_type->data = m3u8_content_type;
 	content_type->len = sizeof(m3u8_content_type) - 1;
 	
@@ -425,12 +528,28 @@ ngx_http_vod_hls_handle_iframe_playlist(
 		return ngx_http_vod_status_to_ngx_error(submodule_context->r, VOD_BAD_REQUEST);
 	}
 
+	// Note: when the index was found in the cache, only the basic metadata was parsed
+	if (submodule_context->frames_index.len == 0)
+	{
+		rc = m3u8_builder_build_iframe_index(
+			&submodule_context->request_context,
+			&conf->hls.mpegts_muxer_config,
+			&submodule_context->media_set,
+			&submodule_context->frames_index);
+		if (rc != VOD_OK)
+		{
+			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+				"ngx_http_vod_hls_handle_iframe_playlist: m3u8_builder_build_iframe_index failed %i", rc);
+			return ngx_http_vod_status_to_ngx_error(submodule_context->r, rc);
+		}
+	}
+
 	rc = m3u8_builder_build_iframe_playlist(
 		&submodule_context->request_context,
 		&conf->hls.m3u8_config,
-		&conf->hls.mpegts_muxer_config,
 		&base_url,
 		&submodule_context->media_set,
+		&submodule_context->frames_index,
 		response);
 	if (rc != VOD_OK)
 	{
@@ -816,6 +935,7 @@ ngx_http_vod_hls_init_fmp4_frame_processor(
 				&submodule_context->request_context,
 				submodule_context->media_set.sequences,
 				segment_writers[0].write_tail,
+				segment_writers[0].write_file_range,
 				segment_writers[0].context,
 				reuse_input_buffers,
 				&state);
@@ -892,7 +1012,7 @@ static const ngx_http_vod_request_t hls_index_request = {
 };
 
 static const ngx_http_vod_request_t hls_iframes_request = {
-	REQUEST_FLAG_SINGLE_TRACK_PER_MEDIA_TYPE | REQUEST_FLAG_PARSE_ALL_CLIPS,
+	REQUEST_FLAG_SINGLE_TRACK_PER_MEDIA_TYPE | REQUEST_FLAG_PARSE_ALL_CLIPS | REQUEST_FLAG_FRAMES_INDEX,
 	PARSE_FLAG_FRAMES_ALL_EXCEPT_OFFSETS | PARSE_FLAG_PARSED_EXTRA_DATA_SIZE,
 	REQUEST_CLASS_OTHER,
 	SUPPORTED_CODECS,
@@ -1004,6 +1124,7 @@ ngx_http_vod_hls_merge_loc_conf(
 	ngx_conf_merge_str_value(conf->m3u8_config.index_file_name_prefix, prev->m3u8_config.index_file_name_prefix, "index");
 	ngx_conf_merge_str_value(conf->m3u8_config.iframes_file_name_prefix, prev->m3u8_config.iframes_file_name_prefix, "iframes");
 	ngx_conf_merge_str_value(conf->m3u8_config.segment_file_name_prefix, prev->m3u8_config.segment_file_name_prefix, "seg");
+	ngx_conf_merge_str_value(conf->m3u8_config.part_file_name_prefix, prev->m3u8_config.part_file_name_prefix, "part");
 	ngx_conf_merge_str_value(conf->m3u8_config.init_file_name_prefix, prev->m3u8_config.init_file_name_prefix, "init");
 
 	ngx_conf_merge_str_value(conf->m3u8_config.encryption_key_file_name, prev->m3u8_config.encryption_key_file_name, "encryption");
@@ -1061,6 +1182,22 @@ ngx_http_vod_hls_get_file_path_components(ngx_str_t* uri)
 	return 1;
 }
 
+static const ngx_http_vod_request_t*
+ngx_http_vod_hls_get_mp4_segment_request(ngx_http_vod_loc_conf_t *conf)
+{
+	switch (conf->hls.encryption_method)
+	{
+	case HLS_ENC_SAMPLE_AES:
+		return &hls_mp4_segment_request_cbcs;
+
+	case HLS_ENC_SAMPLE_AES_CENC:
+		return &hls_mp4_segment_request_cenc;
+
+	default:
+		return &hls_mp4_segment_request;
+	}
+}
+
 static ngx_int_t
 ngx_http_vod_hls_parse_uri_file_name(
 	ngx_http_request_t *r,
@@ -1086,24 +1223,18 @@ ngx_http_vod_hls_parse_uri_file_name(
 	{
 		start_pos += conf->hls.m3u8_config.segment_file_name_prefix.len;
 		end_pos -= (sizeof(m4s_file_ext) - 1);
-
-		switch (conf->hls.encryption_method)
-		{
-		case HLS_ENC_SAMPLE_AES:
-			*request = &hls_mp4_segment_request_cbcs;
-			break;
-
-		case HLS_ENC_SAMPLE_AES_CENC:
-			*request = &hls_mp4_segment_request_cenc;
-			break;
-
-		default:
-			*request = &hls_mp4_segment_request;
-			break;
-		}
-
+		*request = ngx_http_vod_hls_get_mp4_segment_request(conf);
 		flags = PARSE_FILE_NAME_EXPECT_SEGMENT_INDEX;
 	}
+	// fmp4 partial segment
+	else if (conf->segmenter.part_duration != 0 &&
+		ngx_http_vod_match_prefix_postfix(start_pos, end_pos, &conf->hls.m3u8_config.part_file_name_prefix, m4s_file_ext))
+	{
+		start_pos += conf->hls.m3u8_config.part_file_name_prefix.len;
+		end_pos -= (sizeof(m4s_file_ext) - 1);
+		*request = ngx_http_vod_hls_get_mp4_segment_request(conf);
+		flags = PARSE_FILE_NAME_EXPECT_SEGMENT_INDEX | PARSE_FILE_NAME_EXPECT_PART_INDEX;
+	}
 	// vtt segment
 	else if (ngx_http_vod_match_prefix_postfix(start_pos, end_pos, &conf->hls.m3u8_config.segment_file_name_prefix, vtt_file_ext))
 	{
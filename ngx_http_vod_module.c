@@ -47,6 +47,12 @@
 // constants
 #define OPEN_FILE_FALLBACK_ENABLED (0x80000000)
 #define MAX_STALE_RETRIES (2)
+#define CACHE_LOCK_POLL_INTERVAL (50)
+#define BLOCKING_RELOAD_HOLD_SEGMENTS (3)
+
+#define METADATA_INDEX_MAGIC (0x78646d76)		// vmdx
+#define METADATA_INDEX_VERSION (1)
+#define METADATA_READS_WARN_THRESHOLD (16)
 
 #define SEGMENT_REQUEST_MAX_FRAME_COUNT (64 * 1024)
 #define NON_SEGMENT_REQUEST_MAX_FRAME_COUNT (1024 * 1024)
@@ -60,15 +66,20 @@ enum {
 	// main state machine
 	STATE_READ_DRM_INFO,
 	STATE_READ_METADATA_INITIAL,
+	STATE_READ_METADATA_INDEX_INITIAL,
+	STATE_READ_METADATA_INDEX_OPEN,
+	STATE_READ_METADATA_INDEX_READ,
 	STATE_READ_METADATA_OPEN_FILE,
 	STATE_READ_METADATA_READ,
 	STATE_READ_FRAMES_OPEN_FILE,
 	STATE_READ_FRAMES_READ,
+	STATE_LOCK_SEGMENT,
 	STATE_OPEN_FILE,
 	STATE_FILTER_FRAMES,
 	STATE_PROCESS_FRAMES,
 	STATE_DUMP_OPEN_FILE,
 	STATE_DUMP_FILE_PART,
+	STATE_HANDLE_METADATA_REQUEST,
 };
 
 enum {
@@ -86,6 +97,7 @@ typedef ngx_int_t(*ngx_http_vod_open_file_t)(ngx_http_request_t* r, ngx_str_t* p
 typedef ngx_int_t(*ngx_http_vod_async_read_func_t)(void* context, ngx_buf_t *buf, size_t size, off_t offset);
 typedef ngx_int_t(*ngx_http_vod_dump_part_t)(void* context, off_t start, off_t end);
 typedef size_t(*ngx_http_vod_get_size_t)(void* context);
+typedef time_t(*ngx_http_vod_get_mtime_t)(void* context);
 typedef void(*ngx_http_vod_get_path_t)(void* context, ngx_str_t* path);
 typedef ngx_int_t(*ngx_http_vod_enable_directio_t)(void* context);
 
@@ -98,6 +110,16 @@ typedef struct {
 	uint32_t part_count;
 } multipart_cache_header_t;
 
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t word_size;			// the multipart part sizes are saved as size_t
+	uint32_t header_size;
+	u_char file_key[MEDIA_CLIP_KEY_SIZE];
+	uint64_t file_size;
+	int64_t file_mtime;
+} metadata_index_header_t;
+
 typedef struct {
 	size_t content_type_len;
 	uint32_t media_set_type;
@@ -108,6 +130,9 @@ typedef struct {
 	ngx_chain_t* chain_head;
 	ngx_chain_t* chain_end;
 	size_t total_size;
+	u_char* cache_start;		// copy of the streamed response for the response cache, NULL when not saved
+	u_char* cache_pos;
+	u_char* cache_end;
 } ngx_http_vod_write_segment_context_t;
 
 typedef struct {
@@ -131,6 +156,8 @@ typedef struct {
 	size_t max_response_size;
 	ngx_http_vod_mapping_get_uri_t get_uri;
 	ngx_http_vod_mapping_apply_t apply;
+	ngx_flag_t cache_hit;		// the mapping passed to apply was fetched from cache
+	ngx_str_t compiled;
 } ngx_http_vod_mapping_context_t;
 
 typedef struct {
@@ -138,6 +165,7 @@ typedef struct {
 	ngx_http_vod_dump_part_t dump_part;
 	ngx_http_vod_dump_request_t dump_request;
 	ngx_http_vod_get_size_t get_size;
+	ngx_http_vod_get_mtime_t get_mtime;
 	ngx_http_vod_get_path_t get_path;
 	ngx_http_vod_enable_directio_t enable_directio;
 } ngx_http_vod_reader_t;
@@ -175,8 +203,32 @@ struct ngx_http_vod_ctx_s {
 	off_t requested_offset;
 	off_t read_offset;
 	void* metadata_reader_context;
+	ngx_uint_t metadata_read_count;
 	ngx_str_t* metadata_parts;
 	size_t metadata_part_count;
+	void* metadata_index_reader_context;
+
+	// cache lock state
+	ngx_pool_cleanup_t* cache_lock_cleanup;		// allocated, not armed yet
+	ngx_pool_cleanup_t* cache_lock_owned;		// armed, releases the last lock that was taken
+	ngx_event_t* cache_lock_event;
+	ngx_msec_t cache_lock_start;
+	ngx_flag_t cache_lock_waiting;
+
+	// frames index
+	u_char frames_index_key[BUFFER_CACHE_KEY_SIZE];
+	ngx_flag_t frames_index_enabled;
+	ngx_flag_t frames_index_found;
+
+	// manifest streaming
+	ngx_buf_t* manifest_buf;
+
+	// blocking playlist reload
+	ngx_flag_t blocking_reload;
+	ngx_event_t* blocking_reload_event;
+
+	// segment caching
+	ngx_buffer_cache_t* segment_cache;
 
 	// read frames state
 	media_base_metadata_t* base_metadata;
@@ -219,8 +271,48 @@ typedef struct {
 	uintptr_t data;
 } ngx_http_vod_variable_t;
 
+typedef struct {
+	ngx_buffer_cache_t* cache;
+	u_char key[BUFFER_CACHE_KEY_SIZE];
+} ngx_http_vod_cache_lock_t;
+
+// Note: the validate function may replace the response with the value that should be stored in the cache
+typedef ngx_int_t(*ngx_http_vod_cache_refresh_validate_t)(ngx_http_vod_ctx_t *ctx, ngx_str_t* response);
+
+typedef struct {
+	ngx_http_vod_ctx_t* ctx;
+	ngx_buffer_cache_t* cache;
+	u_char key[BUFFER_CACHE_KEY_SIZE];
+	size_t max_size;
+	ngx_http_vod_cache_refresh_validate_t validate;
+	ngx_buf_t response;
+} ngx_http_vod_cache_refresh_t;
+
+#if (NGX_THREADS)
+typedef struct {
+	ngx_http_request_t* r;
+	ngx_str_t path;
+	u_char* temp_path;
+	ngx_str_t data;
+	ngx_err_t err;
+	char* failed;		// the name of the failed operation, NULL on success
+} ngx_http_vod_metadata_index_save_t;
+
+typedef struct {
+	ngx_http_request_t* r;
+	ngx_thread_pool_t* thread_pool;
+	ngx_uint_t max_jobs;
+	ngx_thread_task_t* task;
+	ngx_queue_t queue;
+	void* filter_state;
+	vod_status_t rc;
+	ngx_flag_t processed;
+} ngx_http_vod_filter_thread_state_t;
+#endif // NGX_THREADS
+
 // forward declarations
 static ngx_int_t ngx_http_vod_run_state_machine(ngx_http_vod_ctx_t *ctx);
+static ngx_int_t ngx_http_vod_reload_media_set(ngx_http_vod_ctx_t *ctx);
 static ngx_int_t ngx_http_vod_send_notification(ngx_http_vod_ctx_t *ctx);
 static ngx_int_t ngx_http_vod_init_process(ngx_cycle_t *cycle);
 static void ngx_http_vod_exit_process();
@@ -228,12 +320,15 @@ static void ngx_http_vod_exit_process();
 static ngx_int_t ngx_http_vod_init_file_reader_with_fallback(ngx_http_request_t *r, ngx_str_t* path, uint32_t flags, void** context);
 static ngx_int_t ngx_http_vod_init_file_reader(ngx_http_request_t *r, ngx_str_t* path, uint32_t flags, void** context);
 static ngx_int_t ngx_http_vod_dump_file(void* context);
+static void ngx_http_vod_handle_read_completed(void* context, ngx_int_t rc, ngx_buf_t* buf, ssize_t bytes_read);
 
 static ngx_int_t ngx_http_vod_http_reader_open_file(ngx_http_request_t* r, ngx_str_t* path, uint32_t flags, void** context);
 static ngx_int_t ngx_http_vod_dump_http_part(void* context, off_t start, off_t end);
 static ngx_int_t ngx_http_vod_dump_http_request(void* context);
 static void	ngx_http_vod_http_reader_get_path(void* context, ngx_str_t* path);
 
+static ngx_int_t ngx_http_vod_map_media_set_apply(ngx_http_vod_ctx_t *ctx, ngx_str_t* mapping, int* cache_index);
+
 // globals
 ngx_module_t  ngx_http_vod_module = {
     NGX_MODULE_V1,
@@ -250,6 +345,12 @@ ngx_module_t  ngx_http_vod_module = {
     NGX_MODULE_V1_PADDING
 };
 
+#if (NGX_THREADS)
+// Note: per worker process, limits the number of audio filter jobs that run concurrently on the thread pools
+static ngx_queue_t ngx_http_vod_filter_pending_jobs;
+static ngx_uint_t ngx_http_vod_filter_active_jobs;
+#endif // NGX_THREADS
+
 static ngx_str_t options_content_type = ngx_string("text/plain");
 static ngx_str_t empty_file_string = ngx_string("empty");
 static ngx_str_t empty_string = ngx_null_string;
@@ -270,6 +371,7 @@ static ngx_http_vod_reader_t reader_file_with_fallback = {
 	ngx_file_reader_dump_file_part,
 	ngx_http_vod_dump_file,
 	ngx_file_reader_get_size,
+	ngx_file_reader_get_mtime,
 	ngx_file_reader_get_path,
 	(ngx_http_vod_enable_directio_t)ngx_file_reader_enable_directio,
 };
@@ -279,6 +381,7 @@ static ngx_http_vod_reader_t reader_file = {
 	ngx_file_reader_dump_file_part,
 	ngx_http_vod_dump_file,
 	ngx_file_reader_get_size,
+	ngx_file_reader_get_mtime,
 	ngx_file_reader_get_path,
 	(ngx_http_vod_enable_directio_t)ngx_file_reader_enable_directio,
 };
@@ -288,6 +391,7 @@ static ngx_http_vod_reader_t reader_http = {
 	ngx_http_vod_dump_http_part,
 	ngx_http_vod_dump_http_request,
 	NULL,
+	NULL,
 	ngx_http_vod_http_reader_get_path,
 	NULL,
 };
@@ -742,14 +846,22 @@ ngx_buffer_cache_fetch_perf(
 	ngx_buffer_cache_t* cache,
 	u_char* key,
 	ngx_str_t* buffer,
-	uint32_t* token)
+	uint32_t* token,
+	ngx_flag_t* stale)
 {
 	ngx_perf_counter_context(pcctx);
 	ngx_flag_t result;
 	
 	ngx_perf_counter_start(pcctx);
 
-	result = ngx_buffer_cache_fetch(cache, key, buffer, token);
+	if (stale != NULL)
+	{
+		result = ngx_buffer_cache_fetch_stale(cache, key, buffer, token, stale);
+	}
+	else
+	{
+		result = ngx_buffer_cache_fetch(cache, key, buffer, token);
+	}
 
 	ngx_perf_counter_end(perf_counters, pcctx, PC_FETCH_CACHE);
 
@@ -763,7 +875,8 @@ ngx_buffer_cache_fetch_multi_perf(
 	uint32_t cache_count,
 	u_char* key,
 	ngx_str_t* buffer,
-	uint32_t* token)
+	uint32_t* token,
+	ngx_flag_t* stale)
 {
 	ngx_perf_counter_context(pcctx);
 	ngx_buffer_cache_t* cache;
@@ -780,7 +893,15 @@ ngx_buffer_cache_fetch_multi_perf(
 			continue;
 		}
 
-		result = ngx_buffer_cache_fetch(cache, key, buffer, token);
+		if (stale != NULL)
+		{
+			result = ngx_buffer_cache_fetch_stale(cache, key, buffer, token, stale);
+		}
+		else
+		{
+			result = ngx_buffer_cache_fetch(cache, key, buffer, token);
+		}
+
 		if (!result)
 		{
 			continue;
@@ -816,7 +937,8 @@ ngx_buffer_cache_fetch_copy_perf(
 		cache_count,
 		key,
 		&original_buffer,
-		&token);
+		&token,
+		NULL);
 	if (result < 0)
 	{
 		return result;
@@ -883,11 +1005,9 @@ ngx_buffer_cache_store_gather_perf(
 
 ////// Multipart cache functions
 
-static ngx_flag_t 
-ngx_buffer_cache_store_multipart_perf(
+static ngx_str_t*
+ngx_http_vod_multipart_get_buffers(
 	ngx_http_vod_ctx_t *ctx,
-	ngx_buffer_cache_t* cache,
-	u_char* key,
 	multipart_cache_header_t* header,
 	ngx_str_t* parts)
 {
@@ -904,8 +1024,8 @@ ngx_buffer_cache_store_multipart_perf(
 	if (p == NULL)
 	{
 		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-			"ngx_buffer_cache_store_multipart_perf: ngx_palloc failed");
-		return 0;
+			"ngx_http_vod_multipart_get_buffers: ngx_palloc failed");
+		return NULL;
 	}
 
 	buffers = (void*)p;
@@ -924,51 +1044,33 @@ ngx_buffer_cache_store_multipart_perf(
 		*cur_size++ = cur_part->len;
 	}
 
-	return ngx_buffer_cache_store_gather_perf(
-		ctx->perf_counters,
-		cache,
-		key,
-		buffers,
-		part_count + 1);
+	return buffers;
 }
 
 static ngx_flag_t
-ngx_buffer_cache_fetch_multipart_perf(
+ngx_http_vod_multipart_parse(
 	ngx_http_vod_ctx_t *ctx,
-	ngx_buffer_cache_t* cache,
-	u_char* key,
+	ngx_str_t* buffer,
 	multipart_cache_header_t* header,
-	ngx_str_t** out_parts,
-	uint32_t* token)
+	ngx_str_t** out_parts)
 {
 	vod_str_t* cur_part;
 	vod_str_t* parts;
-	ngx_str_t cache_buffer;
 	uint32_t part_count;
 	size_t* part_sizes;
 	size_t cur_size;
 	u_char* end;
 	u_char* p;
 
-	if (!ngx_buffer_cache_fetch_perf(
-		ctx->perf_counters,
-		cache,
-		key,
-		&cache_buffer,
-		token))
-	{
-		return 0;
-	}
-
-	if (cache_buffer.len < sizeof(*header))
+	if (buffer->len < sizeof(*header))
 	{
 		ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
-			"ngx_buffer_cache_fetch_multipart_perf: size %uz smaller than header size", cache_buffer.len);
+			"ngx_http_vod_multipart_parse: size %uz smaller than header size", buffer->len);
 		return 0;
 	}
 
-	p = cache_buffer.data;
-	end = p + cache_buffer.len;
+	p = buffer->data;
+	end = p + buffer->len;
 
 	*header = *(multipart_cache_header_t*)p;
 	p += sizeof(*header);
@@ -977,8 +1079,8 @@ ngx_buffer_cache_fetch_multipart_perf(
 	if ((size_t)(end - p) < part_count * sizeof(part_sizes[0]))
 	{
 		ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
-			"ngx_buffer_cache_fetch_multipart_perf: size %uz too small to hold %uD parts", 
-			cache_buffer.len, part_count);
+			"ngx_http_vod_multipart_parse: size %uz too small to hold %uD parts", 
+			buffer->len, part_count);
 		return 0;
 	}
 	part_sizes = (void*)p;
@@ -988,7 +1090,7 @@ ngx_buffer_cache_fetch_multipart_perf(
 	if (parts == NULL)
 	{
 		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-			"ngx_buffer_cache_fetch_multipart_perf: ngx_palloc failed");
+			"ngx_http_vod_multipart_parse: ngx_palloc failed");
 		return 0;
 	}
 
@@ -1000,7 +1102,7 @@ ngx_buffer_cache_fetch_multipart_perf(
 		if ((size_t)(end - p) < cur_size)
 		{
 			ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
-				"ngx_buffer_cache_fetch_multipart_perf: size left %uz smaller than part size %uz", 
+				"ngx_http_vod_multipart_parse: size left %uz smaller than part size %uz", 
 				(size_t)(end - p), cur_size);
 			return 0;
 		}
@@ -1016,6 +1118,55 @@ ngx_buffer_cache_fetch_multipart_perf(
 	return 1;
 }
 
+static ngx_flag_t 
+ngx_buffer_cache_store_multipart_perf(
+	ngx_http_vod_ctx_t *ctx,
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	multipart_cache_header_t* header,
+	ngx_str_t* parts)
+{
+	ngx_str_t* buffers;
+
+	buffers = ngx_http_vod_multipart_get_buffers(ctx, header, parts);
+	if (buffers == NULL)
+	{
+		return 0;
+	}
+
+	return ngx_buffer_cache_store_gather_perf(
+		ctx->perf_counters,
+		cache,
+		key,
+		buffers,
+		header->part_count + 1);
+}
+
+static ngx_flag_t
+ngx_buffer_cache_fetch_multipart_perf(
+	ngx_http_vod_ctx_t *ctx,
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	multipart_cache_header_t* header,
+	ngx_str_t** out_parts,
+	uint32_t* token)
+{
+	ngx_str_t cache_buffer;
+
+	if (!ngx_buffer_cache_fetch_perf(
+		ctx->perf_counters,
+		cache,
+		key,
+		&cache_buffer,
+		token,
+		NULL))
+	{
+		return 0;
+	}
+
+	return ngx_http_vod_multipart_parse(ctx, &cache_buffer, header, out_parts);
+}
+
 ////// Utility functions
 
 static ngx_int_t
@@ -1153,950 +1304,1878 @@ ngx_http_vod_alloc_read_buffer(ngx_http_vod_ctx_t *ctx, size_t size, int alloc_p
 	return NGX_OK;
 }
 
-////// DRM
+////// Cache locks
 
-static void
-ngx_http_vod_copy_drm_info(ngx_http_vod_ctx_t *ctx)
+static ngx_flag_t
+ngx_http_vod_cache_allow_stale(ngx_http_request_t* r)
 {
-	media_sequence_t* ref_sequence = ctx->cur_sequence;
-	media_sequence_t* cur_sequence;
-
-	for (cur_sequence = ref_sequence + 1;
-		cur_sequence < ctx->submodule_context.media_set.sequences_end;
-		cur_sequence++)
-	{
-		cur_sequence->drm_info = ref_sequence->drm_info;
-	}
+#if defined(NGX_HTTP_SUBREQUEST_BACKGROUND)
+	return 1;
+#else
+	// Note: stale entries are not used when a background refresh cannot be started
+	return 0;
+#endif // NGX_HTTP_SUBREQUEST_BACKGROUND
 }
 
 static void
-ngx_http_vod_drm_info_request_finished(void* context, ngx_int_t rc, ngx_buf_t* response, ssize_t content_length)
+ngx_http_vod_cache_lock_cleanup(void* data)
 {
-	ngx_http_vod_loc_conf_t *conf;
-	ngx_http_vod_ctx_t *ctx;
-	ngx_http_request_t *r = context;
-	ngx_str_t drm_info;
+	ngx_http_vod_cache_lock_t* lock = data;
 
-	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
-	conf = ctx->submodule_context.conf;
+	ngx_buffer_cache_unlock(lock->cache, lock->key);
+}
 
-	if (rc != NGX_OK)
+static ngx_int_t
+ngx_http_vod_cache_lock_acquire(ngx_http_vod_ctx_t *ctx, ngx_buffer_cache_t* cache, u_char* key)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_http_vod_cache_lock_t* lock;
+	ngx_pool_cleanup_t* cln;
+
+	// Note: allocating the cleanup before taking the lock, so that the lock is always released.
+	//		the cleanup is armed only when the lock is taken, otherwise it is kept for the next attempt
+	cln = ctx->cache_lock_cleanup;
+	if (cln == NULL)
 	{
-		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-			"ngx_http_vod_drm_info_request_finished: upstream request failed %i", rc);
-		goto finalize_request;
+		cln = ngx_pool_cleanup_add(r->pool, sizeof(*lock));
+		if (cln == NULL)
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_cache_lock_acquire: ngx_pool_cleanup_add failed");
+			return NGX_ERROR;
+		}
+
+		ctx->cache_lock_cleanup = cln;
 	}
 
-	if (response->last >= response->end)
+	if (!ngx_buffer_cache_lock(cache, key, (conf->cache_lock_timeout + 999) / 1000))
 	{
-		ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
-			"ngx_http_vod_drm_info_request_finished: not enough room in buffer for null terminator");
-		rc = NGX_HTTP_BAD_GATEWAY;
-		goto finalize_request;
+		return NGX_DECLINED;
 	}
 
-	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_GET_DRM_INFO);
+	lock = cln->data;
+	lock->cache = cache;
+	ngx_memcpy(lock->key, key, sizeof(lock->key));
 
-	drm_info.data = response->pos;
-	drm_info.len = content_length;
-	*response->last = '\0';
+	cln->handler = ngx_http_vod_cache_lock_cleanup;
+	ctx->cache_lock_cleanup = NULL;
+	ctx->cache_lock_owned = cln;
 
-	ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, 
-		"ngx_http_vod_drm_info_request_finished: result %V", &drm_info);
+	return NGX_OK;
+}
 
-	// parse the drm info
-	rc = conf->submodule.parse_drm_info(&ctx->submodule_context, &drm_info, &ctx->cur_sequence->drm_info);
-	if (rc != NGX_OK)
-	{
-		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-			"ngx_http_vod_drm_info_request_finished: invalid drm info response %V", &drm_info);
-		rc = NGX_HTTP_SERVICE_UNAVAILABLE;
-		goto finalize_request;
-	}
+static void
+ngx_http_vod_cache_lock_wait_handler(ngx_event_t* ev)
+{
+	ngx_http_vod_ctx_t *ctx = ev->data;
+	ngx_connection_t* c = ctx->submodule_context.r->connection;
+	ngx_int_t rc;
 
-	// save to cache
-	if (conf->drm_info_cache != NULL)
+	rc = ctx->state_machine(ctx);
+	if (rc != NGX_AGAIN)
 	{
-		if (ngx_buffer_cache_store_perf(
-			ctx->perf_counters,
-			conf->drm_info_cache,
-			ctx->child_request_key,
-			drm_info.data,
-			drm_info.len))
-		{
-			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-				"ngx_http_vod_drm_info_request_finished: stored in drm info cache");
-		}
-		else
+		if (rc != NGX_OK)
 		{
-			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-				"ngx_http_vod_drm_info_request_finished: failed to store drm info in cache");
+			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+				"ngx_http_vod_cache_lock_wait_handler: state machine failed %i", rc);
 		}
-	}
 
-	if (conf->drm_single_key)
-	{
-		ngx_http_vod_copy_drm_info(ctx);
-		ctx->cur_sequence = ctx->submodule_context.media_set.sequences_end;
-	}
-	else
-	{
-		ctx->cur_sequence++;
+		ngx_http_vod_finalize_request(ctx, rc);
 	}
 
-	rc = ngx_http_vod_run_state_machine(ctx);
-	if (rc == NGX_AGAIN)
-	{
-		return;
-	}
+	ngx_http_run_posted_requests(c);
+}
 
-	if (rc != NGX_OK)
+static void
+ngx_http_vod_cache_lock_wait_cleanup(void* data)
+{
+	ngx_event_t* ev = data;
+
+	if (ev->timer_set)
 	{
-		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-			"ngx_http_vod_drm_info_request_finished: ngx_http_vod_run_state_machine failed %i", rc);
+		ngx_del_timer(ev);
 	}
-
-finalize_request:
-
-	ngx_http_vod_finalize_request(ctx, rc);
 }
 
+// returns NGX_OK when the caller should fetch the key, and NGX_AGAIN when the state machine will run again later
 static ngx_int_t
-ngx_http_vod_state_machine_get_drm_info(ngx_http_vod_ctx_t *ctx)
+ngx_http_vod_cache_lock(ngx_http_vod_ctx_t *ctx, ngx_buffer_cache_t* cache, u_char* key)
 {
-	ngx_child_request_params_t child_params;
 	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
 	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_pool_cleanup_t* cln;
+	ngx_event_t* ev;
 	ngx_int_t rc;
-	ngx_str_t drm_info;
-	ngx_str_t base_uri;
-	ngx_md5_t md5;
-	uint32_t cache_token;
 
-	for (;
-		ctx->cur_sequence < ctx->submodule_context.media_set.sequences_end;
-		ctx->cur_sequence++)
+	if (!conf->cache_lock || cache == NULL)
 	{
-		// get the request uri
-		if (conf->drm_request_uri != NULL)
+		return NGX_OK;
+	}
+
+	ev = ctx->cache_lock_event;
+	if (ctx->cache_lock_waiting)
+	{
+		if (ngx_current_msec - ctx->cache_lock_start >= conf->cache_lock_timeout)
 		{
-			if (ngx_http_complex_value(
-				r,
-				conf->drm_request_uri,
-				&base_uri) != NGX_OK)
-			{
-				ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-					"ngx_http_vod_state_machine_get_drm_info: ngx_http_complex_value failed");
-				return NGX_ERROR;
-			}
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_cache_lock: lock wait timed out");
+			ctx->cache_lock_waiting = 0;
+			return NGX_OK;
 		}
-		else
+
+		// Note: the caller checks the cache before getting here, so a released lock means the owner did not
+		//		store the key (e.g. the response was too big or failed). the waiting requests continue
+		//		in parallel, instead of taking the lock one at a time
+		if (!ngx_buffer_cache_is_locked(cache, key))
 		{
-			base_uri = ctx->cur_sequence->stripped_uri;
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_cache_lock: lock released without storing the key");
+			ctx->cache_lock_waiting = 0;
+			return NGX_OK;
 		}
 
-		if (conf->drm_info_cache != NULL)
-		{
-			// generate a request key
-			ngx_md5_init(&md5);
-			ngx_md5_update(&md5, conf->drm_upstream_location.data, conf->drm_upstream_location.len);
-			ngx_md5_update(&md5, base_uri.data, base_uri.len);
-			ngx_md5_final(ctx->child_request_key, &md5);
-
-			// try to read the drm info from cache
-			if (ngx_buffer_cache_fetch_perf(
-				ctx->perf_counters, 
-				conf->drm_info_cache, 
-				ctx->child_request_key,
-				&drm_info, 
-				&cache_token))
-			{
-				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-					"ngx_http_vod_state_machine_get_drm_info: drm info cache hit, size is %uz", drm_info.len);
-
-				rc = conf->submodule.parse_drm_info(&ctx->submodule_context, &drm_info, &ctx->cur_sequence->drm_info);
-				if (rc != NGX_OK)
-				{
-					ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-						"ngx_http_vod_state_machine_get_drm_info: invalid drm info in cache %V", &drm_info);
-					return rc;
-				}
-
-				ngx_buffer_cache_release(
-					conf->drm_info_cache,
-					ctx->child_request_key, 
-					cache_token);
-
-				if (conf->drm_single_key)
-				{
-					ngx_http_vod_copy_drm_info(ctx);
-					ctx->cur_sequence = ctx->submodule_context.media_set.sequences_end - 1;
-				}
+		ngx_add_timer(ev, CACHE_LOCK_POLL_INTERVAL);
 
-				continue;
-			}
-			else
-			{
-				ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-					"ngx_http_vod_state_machine_get_drm_info: drm info cache miss");
-			}
-		}
+		return NGX_AGAIN;
+	}
 
-		r->connection->log->action = "getting drm info";
+	rc = ngx_http_vod_cache_lock_acquire(ctx, cache, key);
+	if (rc != NGX_DECLINED)
+	{
+		return rc;
+	}
 
-		rc = ngx_http_vod_alloc_read_buffer(ctx, conf->drm_max_info_length, READER_HTTP);
-		if (rc != NGX_OK)
+	// another request is fetching the key, poll the cache until it is stored
+	if (ev == NULL)
+	{
+		ev = ngx_pcalloc(r->pool, sizeof(*ev));
+		if (ev == NULL)
 		{
-			return rc;
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_cache_lock: ngx_pcalloc failed");
+			return NGX_ERROR;
 		}
 
-		// start the drm request
-		ngx_memzero(&child_params, sizeof(child_params));
-		child_params.method = NGX_HTTP_GET;
-		child_params.base_uri = base_uri;
-
-		ngx_perf_counter_start(ctx->perf_counter_context);
-
-		rc = ngx_child_request_start(
-			r,
-			ngx_http_vod_drm_info_request_finished,
-			r,
-			&conf->drm_upstream_location,
-			&child_params,
-			&ctx->read_buffer);
-		if (rc != NGX_AGAIN)
+		cln = ngx_pool_cleanup_add(r->pool, 0);
+		if (cln == NULL)
 		{
-			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-				"ngx_http_vod_state_machine_get_drm_info: ngx_child_request_start failed %i", rc);
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_cache_lock: ngx_pool_cleanup_add failed");
+			return NGX_ERROR;
 		}
-		return rc;
-	}
 
-	return NGX_OK;
-}
+		ev->handler = ngx_http_vod_cache_lock_wait_handler;
+		ev->data = ctx;
+		ev->log = r->connection->log;
 
-////// Common media processing
+		cln->handler = ngx_http_vod_cache_lock_wait_cleanup;
+		cln->data = ev;
 
-static void
-ngx_http_vod_update_source_tracks(
-	request_context_t* request_context,
-	media_clip_source_t* cur_source)
-{
-	media_track_t* cur_track;
-	file_info_t file_info;
-	uint32_t time_shift;
-	int64_t original_clip_time;
+		ctx->cache_lock_event = ev;
+	}
 
-	file_info.source = cur_source;
-	file_info.uri = cur_source->uri;
-	file_info.drm_info = cur_source->sequence->drm_info;
+	ctx->cache_lock_waiting = 1;
+	ctx->cache_lock_start = ngx_current_msec;
 
-	original_clip_time = cur_source->range != NULL ?
-		cur_source->range->original_clip_time : cur_source->clip_time;
+	ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+		"ngx_http_vod_cache_lock: waiting for another request to fetch the key");
 
-	for (cur_track = cur_source->track_array.first_track;
-		cur_track < cur_source->track_array.last_track;
-		cur_track++)
-	{
-		time_shift = cur_source->time_shift[cur_track->media_info.media_type];
-		cur_track->first_frame_time_offset += rescale_time(time_shift, 1000, cur_track->media_info.timescale);
-		cur_track->clip_start_time = cur_source->clip_time;
-		cur_track->original_clip_time = original_clip_time;
-		cur_track->file_info = file_info;
+	ngx_add_timer(ev, CACHE_LOCK_POLL_INTERVAL);
 
-		vod_log_debug1(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-			"ngx_http_vod_update_source_tracks: first frame dts is %uL",
-			rescale_time(cur_track->first_frame_time_offset, cur_track->media_info.timescale, 1000) +
-			cur_track->clip_start_time);
-	}
+	return NGX_AGAIN;
 }
 
+// releases the last lock taken by the request before the request completes, lets the waiting requests continue
 static void
-ngx_http_vod_get_sequence_tracks_mask(
-	request_params_t* request_params,
-	media_sequence_t* sequence,
-	uint32_t** result)
+ngx_http_vod_cache_unlock(ngx_http_vod_ctx_t *ctx)
 {
-	sequence_tracks_mask_t* sequence_tracks_mask;
-	ngx_str_t* cur_sequence_id;
-	int32_t index;
+	ngx_pool_cleanup_t* cln = ctx->cache_lock_owned;
 
-	for (sequence_tracks_mask = request_params->sequence_tracks_mask; 
-		sequence_tracks_mask < request_params->sequence_tracks_mask_end;
-		sequence_tracks_mask++)
+	if (cln == NULL || cln->handler == NULL)
 	{
-		index = sequence_tracks_mask->index;
-		if (index >= 0)
-		{
-			if (sequence->index != (uint32_t)index)
-			{
-				continue;
-			}
-		}
-		else
-		{
-			cur_sequence_id = request_params->sequence_ids + (-index - 1);
-			if (sequence->id.len != cur_sequence_id->len ||
-				vod_memcmp(sequence->id.data, cur_sequence_id->data, cur_sequence_id->len) != 0)
-			{
-				continue;
-			}
-		}
-
-		*result = sequence_tracks_mask->tracks_mask;
-		break;
+		return;
 	}
+
+	cln->handler(cln->data);
+	cln->handler = NULL;
+	ctx->cache_lock_owned = NULL;
 }
 
 static void
-ngx_http_vod_init_parse_params_metadata(
-	ngx_http_vod_ctx_t *ctx,
-	uint32_t* tracks_mask,
-	media_parse_params_t* parse_params)
+ngx_http_vod_blocking_reload_handler(ngx_event_t* ev)
 {
-	const ngx_http_vod_request_t* request = ctx->request;
-	media_clip_source_t* cur_source = ctx->cur_source;
-	segmenter_conf_t* segmenter = ctx->submodule_context.media_set.segmenter_conf;
-	uint32_t* request_tracks_mask;
-	uint32_t media_type;
+	ngx_http_request_t* r = ev->data;
+	ngx_connection_t* c = r->connection;
+	ngx_http_vod_ctx_t *ctx;
+	ngx_int_t rc;
 
-	if (request != NULL)
-	{
-		parse_params->parse_type = request->parse_type;
-		if (request->request_class == REQUEST_CLASS_MANIFEST &&
-			ctx->submodule_context.media_set.timing.durations == NULL)
-		{
-			parse_params->parse_type |= segmenter->parse_type;
-		}
-		parse_params->parse_type |= ctx->submodule_context.conf->parse_flags;
-		parse_params->codecs_mask = request->codecs_mask;
-	}
+	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
 
-	request_tracks_mask = ctx->submodule_context.request_params.tracks_mask;
-	if (ctx->submodule_context.request_params.sequence_tracks_mask != NULL)
+	rc = ngx_http_vod_reload_media_set(ctx);
+	if (rc != NGX_AGAIN)
 	{
-		ngx_http_vod_get_sequence_tracks_mask(
-			&ctx->submodule_context.request_params,
-			cur_source->sequence,
-			&request_tracks_mask);
+		// Note: the reload may have replaced the module context
+		ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
+		ngx_http_vod_finalize_request(ctx, rc);
 	}
 
-	for (media_type = 0; media_type < MEDIA_TYPE_COUNT; media_type++)
-	{
-		tracks_mask[media_type] = cur_source->tracks_mask[media_type] & request_tracks_mask[media_type];
-	}
-	parse_params->required_tracks_mask = tracks_mask;
-	parse_params->langs_mask = ctx->submodule_context.request_params.langs_mask;
-	parse_params->source = cur_source;
+	ngx_http_run_posted_requests(c);
 }
 
+// returns NGX_AGAIN when the media set is scheduled to be reloaded, used by playlists that block until the live edge advances
 static ngx_int_t
-ngx_http_vod_init_parse_params_frames(
-	ngx_http_vod_ctx_t *ctx,
-	media_range_t* range,
-	media_parse_params_t* parse_params)
+ngx_http_vod_blocking_reload(ngx_http_vod_ctx_t *ctx)
 {
-	const ngx_http_vod_request_t* request = ctx->request;
-	get_clip_ranges_params_t get_ranges_params;
-	get_clip_ranges_result_t clip_ranges;
-	media_clip_source_t* cur_source = ctx->cur_source;
-	request_context_t* request_context = &ctx->submodule_context.request_context;
-	segmenter_conf_t* segmenter = ctx->submodule_context.media_set.segmenter_conf;
-	vod_fraction_t rate;
-	vod_status_t rc;
-	uint64_t last_segment_end;
-	uint32_t duration_millis;
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_pool_cleanup_t* cln;
+	ngx_event_t* ev;
+	ngx_time_t* tp;
+	ngx_msec_t interval;
+	ngx_msec_t elapsed;
+	ngx_msec_t hold;
 
-	parse_params->max_frames_size = ctx->submodule_context.conf->max_frames_size;
+	tp = ngx_timeofday();
+	elapsed = (ngx_msec_t)((tp->sec - r->start_sec) * 1000 + (tp->msec - r->start_msec));
+	hold = BLOCKING_RELOAD_HOLD_SEGMENTS * conf->segmenter.segment_duration;
 
-	if ((request->request_class & (REQUEST_CLASS_MANIFEST | REQUEST_CLASS_OTHER)) != 0)
+	if (elapsed >= hold)
 	{
-		request_context->simulation_only = TRUE;
+		ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+			"ngx_http_vod_blocking_reload: the requested segment was not available after %M ms", elapsed);
+		return NGX_HTTP_SERVICE_UNAVAILABLE;
+	}
 
-		parse_params->max_frame_count = NON_SEGMENT_REQUEST_MAX_FRAME_COUNT;
-		range->timescale = 1000;
-		range->original_clip_time = 0;
-		range->start = 0;
-		if (cur_source->clip_to == ULLONG_MAX)
+	ev = ctx->blocking_reload_event;
+	if (ev == NULL)
+	{
+		ev = ngx_pcalloc(r->pool, sizeof(*ev));
+		if (ev == NULL)
 		{
-			range->end = ULLONG_MAX;
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_blocking_reload: ngx_pcalloc failed");
+			return NGX_ERROR;
 		}
-		else
+
+		cln = ngx_pool_cleanup_add(r->pool, 0);
+		if (cln == NULL)
 		{
-			range->end = cur_source->clip_to - cur_source->clip_from;
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_blocking_reload: ngx_pool_cleanup_add failed");
+			return NGX_ERROR;
 		}
-		parse_params->range = range;
-		return NGX_OK;
+
+		ev->handler = ngx_http_vod_blocking_reload_handler;
+		ev->data = r;
+		ev->log = r->connection->log;
+
+		cln->handler = ngx_http_vod_cache_lock_wait_cleanup;
+		cln->data = ev;
+
+		ctx->blocking_reload_event = ev;
 	}
 
-	request_context->simulation_only = FALSE;
+	// Note: a new part is published every part duration, poll twice per part
+	interval = conf->segmenter.part_duration / 2;
+	if (interval > hold - elapsed)
+	{
+		interval = hold - elapsed;
+	}
 
-	parse_params->max_frame_count = SEGMENT_REQUEST_MAX_FRAME_COUNT;
+	ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+		"ngx_http_vod_blocking_reload: reloading in %M ms", interval);
 
-	if (cur_source->range != NULL)
+	ngx_add_timer(ev, interval);
+
+	return NGX_AGAIN;
+}
+
+#if defined(NGX_HTTP_SUBREQUEST_BACKGROUND)
+static void
+ngx_http_vod_cache_refresh_finished(void* context, ngx_int_t rc, ngx_buf_t* response, ssize_t content_length)
+{
+	ngx_http_vod_cache_refresh_t* refresh = context;
+	ngx_http_vod_ctx_t* ctx = refresh->ctx;
+	ngx_log_t* log = ctx->submodule_context.request_context.log;
+	ngx_str_t value;
+
+	if (rc != NGX_OK)
 	{
-		// the range was already determined while parsing the media set
-		parse_params->range = cur_source->range;
-		return NGX_OK;
+		ngx_log_error(NGX_LOG_WARN, log, 0,
+			"ngx_http_vod_cache_refresh_finished: upstream request failed %i", rc);
+		return;
 	}
 
-	// get the rate
-	if (cur_source->base.parent != NULL && cur_source->base.parent->type == MEDIA_CLIP_RATE_FILTER)
+	value.data = response->pos;
+	value.len = response->last - response->pos;
+
+	if (value.len <= 0 || value.len > refresh->max_size || response->last >= response->end)
 	{
-		rate = ((media_clip_rate_filter_t*)cur_source->base.parent)->rate;
+		ngx_log_error(NGX_LOG_WARN, log, 0,
+			"ngx_http_vod_cache_refresh_finished: invalid response size %uz", value.len);
+		return;
 	}
-	else
+
+	*response->last = '\0';
+
+	// Note: the stale entry remains in the cache when the response is invalid
+	rc = refresh->validate(ctx, &value);
+	if (rc != NGX_OK)
 	{
-		rate.num = 1;
-		rate.denom = 1;
+		ngx_log_error(NGX_LOG_WARN, log, 0,
+			"ngx_http_vod_cache_refresh_finished: invalid response %V", &value);
+		return;
 	}
 
-	// get the last segment end
-	if (cur_source->clip_to == ULLONG_MAX)
+	if (ngx_buffer_cache_store_perf(
+		ctx->perf_counters,
+		refresh->cache,
+		refresh->key,
+		value.data,
+		value.len))
 	{
-		last_segment_end = ULLONG_MAX;
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, log, 0,
+			"ngx_http_vod_cache_refresh_finished: stored in cache");
 	}
 	else
 	{
-		last_segment_end = ((cur_source->clip_to - cur_source->clip_from) * rate.denom) / rate.num;
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, log, 0,
+			"ngx_http_vod_cache_refresh_finished: failed to store in cache");
 	}
+}
+#endif // NGX_HTTP_SUBREQUEST_BACKGROUND
 
-	// get the start/end offsets
-	duration_millis = rescale_time(ctx->base_metadata->duration * rate.denom, ctx->base_metadata->timescale * rate.num, 1000);
-
-	get_ranges_params.request_context = request_context;
-	get_ranges_params.conf = segmenter;
-	get_ranges_params.last_segment_end = last_segment_end;
+// starts a background fetch of a stale cache entry from the upstream, the response is stored in the cache
+static ngx_int_t
+ngx_http_vod_cache_refresh(
+	ngx_http_vod_ctx_t *ctx,
+	ngx_buffer_cache_t* cache,
+	u_char* key,
+	ngx_str_t* upstream_location,
+	ngx_child_request_params_t* child_params,
+	size_t max_size,
+	ngx_http_vod_cache_refresh_validate_t validate)
+{
+#if defined(NGX_HTTP_SUBREQUEST_BACKGROUND)
+	ngx_http_vod_cache_refresh_t* refresh;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_int_t rc;
+	size_t size;
+	u_char* start;
+
+	// Note: the lock is held until the request completes, the background request keeps it alive
+	rc = ngx_http_vod_cache_lock_acquire(ctx, cache, key);
+	if (rc != NGX_OK)
+	{
+		// NGX_DECLINED - another request is already refreshing the key
+		return rc == NGX_DECLINED ? NGX_OK : rc;
+	}
+
+	refresh = ngx_palloc(r->pool, sizeof(*refresh));
+	if (refresh == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_cache_refresh: ngx_palloc failed (1)");
+		return NGX_ERROR;
+	}
+
+	size = max_size + ctx->alloc_params[READER_HTTP].extra_size + VOD_BUFFER_PADDING_SIZE;
+
+	start = ngx_palloc(r->pool, size);
+	if (start == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_cache_refresh: ngx_palloc failed (2)");
+		return NGX_ERROR;
+	}
+
+	ngx_memzero(&refresh->response, sizeof(refresh->response));
+	refresh->response.start = start;
+	refresh->response.pos = start;
+	refresh->response.last = start;
+	refresh->response.end = start + size;
+	refresh->response.temporary = 1;
+
+	refresh->ctx = ctx;
+	refresh->cache = cache;
+	ngx_memcpy(refresh->key, key, sizeof(refresh->key));
+	refresh->max_size = max_size;
+	refresh->validate = validate;
+
+	child_params->background = 1;
+
+	rc = ngx_child_request_start(
+		r,
+		ngx_http_vod_cache_refresh_finished,
+		refresh,
+		upstream_location,
+		child_params,
+		&refresh->response);
+	if (rc != NGX_AGAIN)
+	{
+		// Note: the stale entry is still usable
+		ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+			"ngx_http_vod_cache_refresh: ngx_child_request_start failed %i", rc);
+		return NGX_OK;
+	}
+
+	ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+		"ngx_http_vod_cache_refresh: started background refresh");
+#endif // NGX_HTTP_SUBREQUEST_BACKGROUND
+
+	return NGX_OK;
+}
+
+////// DRM
+
+static void
+ngx_http_vod_copy_drm_info(ngx_http_vod_ctx_t *ctx)
+{
+	media_sequence_t* ref_sequence = ctx->cur_sequence;
+	media_sequence_t* cur_sequence;
+
+	for (cur_sequence = ref_sequence + 1;
+		cur_sequence < ctx->submodule_context.media_set.sequences_end;
+		cur_sequence++)
+	{
+		cur_sequence->drm_info = ref_sequence->drm_info;
+	}
+}
+
+static void
+ngx_http_vod_drm_info_request_finished(void* context, ngx_int_t rc, ngx_buf_t* response, ssize_t content_length)
+{
+	ngx_http_vod_loc_conf_t *conf;
+	ngx_http_vod_ctx_t *ctx;
+	ngx_http_request_t *r = context;
+	ngx_str_t drm_info;
+
+	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
+	conf = ctx->submodule_context.conf;
+
+	if (rc != NGX_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_drm_info_request_finished: upstream request failed %i", rc);
+		goto finalize_request;
+	}
+
+	if (response->last >= response->end)
+	{
+		ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+			"ngx_http_vod_drm_info_request_finished: not enough room in buffer for null terminator");
+		rc = NGX_HTTP_BAD_GATEWAY;
+		goto finalize_request;
+	}
+
+	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_GET_DRM_INFO);
+
+	drm_info.data = response->pos;
+	drm_info.len = content_length;
+	*response->last = '\0';
+
+	ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0, 
+		"ngx_http_vod_drm_info_request_finished: result %V", &drm_info);
+
+	// parse the drm info
+	rc = conf->submodule.parse_drm_info(&ctx->submodule_context, &drm_info, &ctx->cur_sequence->drm_info);
+	if (rc != NGX_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_drm_info_request_finished: invalid drm info response %V", &drm_info);
+		rc = NGX_HTTP_SERVICE_UNAVAILABLE;
+		goto finalize_request;
+	}
+
+	// save to cache
+	if (conf->drm_info_cache != NULL)
+	{
+		if (ngx_buffer_cache_store_perf(
+			ctx->perf_counters,
+			conf->drm_info_cache,
+			ctx->child_request_key,
+			drm_info.data,
+			drm_info.len))
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_drm_info_request_finished: stored in drm info cache");
+		}
+		else
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_drm_info_request_finished: failed to store drm info in cache");
+		}
+	}
+
+	if (conf->drm_single_key)
+	{
+		ngx_http_vod_copy_drm_info(ctx);
+		ctx->cur_sequence = ctx->submodule_context.media_set.sequences_end;
+	}
+	else
+	{
+		ctx->cur_sequence++;
+	}
+
+	rc = ngx_http_vod_run_state_machine(ctx);
+	if (rc == NGX_AGAIN)
+	{
+		return;
+	}
+
+	if (rc != NGX_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_drm_info_request_finished: ngx_http_vod_run_state_machine failed %i", rc);
+	}
+
+finalize_request:
+
+	ngx_http_vod_finalize_request(ctx, rc);
+}
+
+static ngx_int_t
+ngx_http_vod_drm_info_validate(ngx_http_vod_ctx_t *ctx, ngx_str_t* drm_info)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	void* output;
+
+	return conf->submodule.parse_drm_info(&ctx->submodule_context, drm_info, &output);
+}
+
+static ngx_int_t
+ngx_http_vod_state_machine_get_drm_info(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_child_request_params_t child_params;
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_int_t rc;
+	ngx_str_t drm_info;
+	ngx_str_t base_uri;
+	ngx_md5_t md5;
+	ngx_flag_t stale;
+	uint32_t cache_token;
+
+	for (;
+		ctx->cur_sequence < ctx->submodule_context.media_set.sequences_end;
+		ctx->cur_sequence++)
+	{
+		// get the request uri
+		if (conf->drm_request_uri != NULL)
+		{
+			if (ngx_http_complex_value(
+				r,
+				conf->drm_request_uri,
+				&base_uri) != NGX_OK)
+			{
+				ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+					"ngx_http_vod_state_machine_get_drm_info: ngx_http_complex_value failed");
+				return NGX_ERROR;
+			}
+		}
+		else
+		{
+			base_uri = ctx->cur_sequence->stripped_uri;
+		}
+
+		if (conf->drm_info_cache != NULL)
+		{
+			// generate a request key
+			ngx_md5_init(&md5);
+			ngx_md5_update(&md5, conf->drm_upstream_location.data, conf->drm_upstream_location.len);
+			ngx_md5_update(&md5, base_uri.data, base_uri.len);
+			ngx_md5_final(ctx->child_request_key, &md5);
+
+			// try to read the drm info from cache
+			stale = 0;
+			if (ngx_buffer_cache_fetch_perf(
+				ctx->perf_counters, 
+				conf->drm_info_cache, 
+				ctx->child_request_key,
+				&drm_info, 
+				&cache_token,
+				ngx_http_vod_cache_allow_stale(r) ? &stale : NULL))
+			{
+				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+					"ngx_http_vod_state_machine_get_drm_info: drm info cache hit, size is %uz", drm_info.len);
+
+				rc = conf->submodule.parse_drm_info(&ctx->submodule_context, &drm_info, &ctx->cur_sequence->drm_info);
+				if (rc != NGX_OK)
+				{
+					ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+						"ngx_http_vod_state_machine_get_drm_info: invalid drm info in cache %V", &drm_info);
+					return rc;
+				}
+
+				ngx_buffer_cache_release(
+					conf->drm_info_cache,
+					ctx->child_request_key, 
+					cache_token);
+
+				if (stale)
+				{
+					ngx_memzero(&child_params, sizeof(child_params));
+					child_params.method = NGX_HTTP_GET;
+					child_params.base_uri = base_uri;
+
+					rc = ngx_http_vod_cache_refresh(
+						ctx,
+						conf->drm_info_cache,
+						ctx->child_request_key,
+						&conf->drm_upstream_location,
+						&child_params,
+						conf->drm_max_info_length,
+						ngx_http_vod_drm_info_validate);
+					if (rc != NGX_OK)
+					{
+						return rc;
+					}
+				}
+
+				if (conf->drm_single_key)
+				{
+					ngx_http_vod_copy_drm_info(ctx);
+					ctx->cur_sequence = ctx->submodule_context.media_set.sequences_end - 1;
+				}
+
+				continue;
+			}
+			else
+			{
+				ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+					"ngx_http_vod_state_machine_get_drm_info: drm info cache miss");
+			}
+
+			rc = ngx_http_vod_cache_lock(ctx, conf->drm_info_cache, ctx->child_request_key);
+			if (rc != NGX_OK)
+			{
+				return rc;
+			}
+		}
+
+		r->connection->log->action = "getting drm info";
+
+		rc = ngx_http_vod_alloc_read_buffer(ctx, conf->drm_max_info_length, READER_HTTP);
+		if (rc != NGX_OK)
+		{
+			return rc;
+		}
+
+		// start the drm request
+		ngx_memzero(&child_params, sizeof(child_params));
+		child_params.method = NGX_HTTP_GET;
+		child_params.base_uri = base_uri;
+
+		ngx_perf_counter_start(ctx->perf_counter_context);
+
+		rc = ngx_child_request_start(
+			r,
+			ngx_http_vod_drm_info_request_finished,
+			r,
+			&conf->drm_upstream_location,
+			&child_params,
+			&ctx->read_buffer);
+		if (rc != NGX_AGAIN)
+		{
+			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_state_machine_get_drm_info: ngx_child_request_start failed %i", rc);
+		}
+		return rc;
+	}
+
+	return NGX_OK;
+}
+
+////// Common media processing
+
+static void
+ngx_http_vod_update_source_tracks(
+	request_context_t* request_context,
+	media_clip_source_t* cur_source)
+{
+	media_track_t* cur_track;
+	file_info_t file_info;
+	uint32_t time_shift;
+	int64_t original_clip_time;
+
+	file_info.source = cur_source;
+	file_info.uri = cur_source->uri;
+	file_info.drm_info = cur_source->sequence->drm_info;
+
+	original_clip_time = cur_source->range != NULL ?
+		cur_source->range->original_clip_time : cur_source->clip_time;
+
+	for (cur_track = cur_source->track_array.first_track;
+		cur_track < cur_source->track_array.last_track;
+		cur_track++)
+	{
+		time_shift = cur_source->time_shift[cur_track->media_info.media_type];
+		cur_track->first_frame_time_offset += rescale_time(time_shift, 1000, cur_track->media_info.timescale);
+		cur_track->clip_start_time = cur_source->clip_time;
+		cur_track->original_clip_time = original_clip_time;
+		cur_track->file_info = file_info;
+
+		vod_log_debug1(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"ngx_http_vod_update_source_tracks: first frame dts is %uL",
+			rescale_time(cur_track->first_frame_time_offset, cur_track->media_info.timescale, 1000) +
+			cur_track->clip_start_time);
+	}
+}
+
+static void
+ngx_http_vod_get_sequence_tracks_mask(
+	request_params_t* request_params,
+	media_sequence_t* sequence,
+	uint32_t** result)
+{
+	sequence_tracks_mask_t* sequence_tracks_mask;
+	ngx_str_t* cur_sequence_id;
+	int32_t index;
+
+	for (sequence_tracks_mask = request_params->sequence_tracks_mask; 
+		sequence_tracks_mask < request_params->sequence_tracks_mask_end;
+		sequence_tracks_mask++)
+	{
+		index = sequence_tracks_mask->index;
+		if (index >= 0)
+		{
+			if (sequence->index != (uint32_t)index)
+			{
+				continue;
+			}
+		}
+		else
+		{
+			cur_sequence_id = request_params->sequence_ids + (-index - 1);
+			if (sequence->id.len != cur_sequence_id->len ||
+				vod_memcmp(sequence->id.data, cur_sequence_id->data, cur_sequence_id->len) != 0)
+			{
+				continue;
+			}
+		}
+
+		*result = sequence_tracks_mask->tracks_mask;
+		break;
+	}
+}
+
+static void
+ngx_http_vod_init_parse_params_metadata(
+	ngx_http_vod_ctx_t *ctx,
+	uint32_t* tracks_mask,
+	media_parse_params_t* parse_params)
+{
+	const ngx_http_vod_request_t* request = ctx->request;
+	media_clip_source_t* cur_source = ctx->cur_source;
+	segmenter_conf_t* segmenter = ctx->submodule_context.media_set.segmenter_conf;
+	uint32_t* request_tracks_mask;
+	uint32_t media_type;
+
+	if (request != NULL)
+	{
+		// Note: when the frames index was found in the cache, the frames are not needed
+		parse_params->parse_type = ctx->frames_index_found ? PARSE_BASIC_METADATA_ONLY : request->parse_type;
+		if (request->request_class == REQUEST_CLASS_MANIFEST &&
+			ctx->submodule_context.media_set.timing.durations == NULL)
+		{
+			parse_params->parse_type |= segmenter->parse_type;
+		}
+		parse_params->parse_type |= ctx->submodule_context.conf->parse_flags;
+		parse_params->codecs_mask = request->codecs_mask;
+	}
+
+	request_tracks_mask = ctx->submodule_context.request_params.tracks_mask;
+	if (ctx->submodule_context.request_params.sequence_tracks_mask != NULL)
+	{
+		ngx_http_vod_get_sequence_tracks_mask(
+			&ctx->submodule_context.request_params,
+			cur_source->sequence,
+			&request_tracks_mask);
+	}
+
+	for (media_type = 0; media_type < MEDIA_TYPE_COUNT; media_type++)
+	{
+		tracks_mask[media_type] = cur_source->tracks_mask[media_type] & request_tracks_mask[media_type];
+	}
+	parse_params->required_tracks_mask = tracks_mask;
+	parse_params->langs_mask = ctx->submodule_context.request_params.langs_mask;
+	parse_params->source = cur_source;
+}
+
+static ngx_int_t
+ngx_http_vod_init_parse_params_frames(
+	ngx_http_vod_ctx_t *ctx,
+	media_range_t* range,
+	media_parse_params_t* parse_params)
+{
+	const ngx_http_vod_request_t* request = ctx->request;
+	get_clip_ranges_params_t get_ranges_params;
+	get_clip_ranges_result_t clip_ranges;
+	media_clip_source_t* cur_source = ctx->cur_source;
+	request_context_t* request_context = &ctx->submodule_context.request_context;
+	segmenter_conf_t* segmenter = ctx->submodule_context.media_set.segmenter_conf;
+	vod_fraction_t rate;
+	vod_status_t rc;
+	uint64_t last_segment_end;
+	uint32_t duration_millis;
+
+	parse_params->max_frames_size = ctx->submodule_context.conf->max_frames_size;
+
+	if ((request->request_class & (REQUEST_CLASS_MANIFEST | REQUEST_CLASS_OTHER)) != 0)
+	{
+		request_context->simulation_only = TRUE;
+
+		parse_params->max_frame_count = NON_SEGMENT_REQUEST_MAX_FRAME_COUNT;
+		range->timescale = 1000;
+		range->original_clip_time = 0;
+		range->start = 0;
+		if (cur_source->clip_to == ULLONG_MAX)
+		{
+			range->end = ULLONG_MAX;
+		}
+		else
+		{
+			range->end = cur_source->clip_to - cur_source->clip_from;
+		}
+		parse_params->range = range;
+		return NGX_OK;
+	}
+
+	request_context->simulation_only = FALSE;
+
+	parse_params->max_frame_count = SEGMENT_REQUEST_MAX_FRAME_COUNT;
+
+	if (cur_source->range != NULL)
+	{
+		// the range was already determined while parsing the media set
+		parse_params->range = cur_source->range;
+		return NGX_OK;
+	}
+
+	// get the rate
+	if (cur_source->base.parent != NULL && cur_source->base.parent->type == MEDIA_CLIP_RATE_FILTER)
+	{
+		rate = ((media_clip_rate_filter_t*)cur_source->base.parent)->rate;
+	}
+	else
+	{
+		rate.num = 1;
+		rate.denom = 1;
+	}
+
+	// get the last segment end
+	if (cur_source->clip_to == ULLONG_MAX)
+	{
+		last_segment_end = ULLONG_MAX;
+	}
+	else
+	{
+		last_segment_end = ((cur_source->clip_to - cur_source->clip_from) * rate.denom) / rate.num;
+	}
+
+	// get the start/end offsets
+	duration_millis = rescale_time(ctx->base_metadata->duration * rate.denom, ctx->base_metadata->timescale * rate.num, 1000);
+
+	get_ranges_params.request_context = request_context;
+	get_ranges_params.conf = segmenter;
+	get_ranges_params.last_segment_end = last_segment_end;
 	get_ranges_params.key_frame_durations = NULL;
 	get_ranges_params.allow_last_segment = TRUE;
+	get_ranges_params.part_index = ctx->submodule_context.request_params.part_index;
+
+	ngx_memzero(&get_ranges_params.timing, sizeof(get_ranges_params.timing));
+	get_ranges_params.timing.durations = &duration_millis;
+	get_ranges_params.timing.total_count = 1;
+	get_ranges_params.timing.total_duration = duration_millis;
+	get_ranges_params.timing.times = &get_ranges_params.timing.first_time;
+	get_ranges_params.timing.original_times = &get_ranges_params.timing.first_time;
+
+	if (ctx->submodule_context.request_params.segment_index != INVALID_SEGMENT_INDEX)
+	{
+		// segment request
+		get_ranges_params.segment_index = ctx->submodule_context.request_params.segment_index;
+
+		rc = segmenter_get_start_end_ranges_no_discontinuity(
+			&get_ranges_params,
+			&clip_ranges);
+
+		ctx->submodule_context.media_set.initial_segment_clip_relative_index = clip_ranges.clip_relative_segment_index;
+	}
+	else
+	{
+		// thumbnail request
+		get_ranges_params.time = ctx->submodule_context.request_params.segment_time;
+		get_ranges_params.time_span = request_params_get_tile_span(&ctx->submodule_context.request_params);
+
+		rc = segmenter_get_start_end_ranges_gop(
+			&get_ranges_params,
+			&clip_ranges);
+	}
+
+	if (rc != VOD_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, request_context->log, 0,
+			"ngx_http_vod_init_parse_params_frames: segmenter_get_start_end_ranges_no_discontinuity failed %i", rc);
+		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
+	}
+
+	if (clip_ranges.clip_count == 0)
+	{
+		return NGX_DONE;
+	}
+
+	if (clip_ranges.clip_ranges->end == ULLONG_MAX)
+	{
+		ctx->submodule_context.media_set.segment_duration =
+			duration_millis - clip_ranges.clip_ranges->start;
+	}
+	else
+	{
+		ctx->submodule_context.media_set.segment_duration =
+			clip_ranges.clip_ranges->end - clip_ranges.clip_ranges->start;
+	}
+
+	parse_params->range = clip_ranges.clip_ranges;
+	parse_params->range->start = (parse_params->range->start * rate.num) / rate.denom;
+	if (parse_params->range->end != ULLONG_MAX)
+	{
+		parse_params->range->end = (parse_params->range->end * rate.num) / rate.denom;
+	}
+
+	return NGX_OK;
+}
+
+static ngx_int_t 
+ngx_http_vod_parse_metadata(
+	ngx_http_vod_ctx_t *ctx, 
+	ngx_flag_t fetched_from_cache)
+{
+	media_parse_params_t parse_params;
+	const ngx_http_vod_request_t* request = ctx->request;
+	media_clip_source_t* cur_source = ctx->cur_source;
+	request_context_t* request_context = &ctx->submodule_context.request_context;
+	media_range_t range;
+	vod_status_t rc;
+	uint32_t tracks_mask[MEDIA_TYPE_COUNT];
+
+	// initialize clipping params
+	if (cur_source->clip_to == ULLONG_MAX)
+	{
+		if (cur_source->clip_from >= UINT_MAX)
+		{
+			ngx_log_error(NGX_LOG_ERR, request_context->log, 0,
+				"ngx_http_vod_parse_metadata: clip from value %uL too large", cur_source->clip_from);
+			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_REQUEST);
+		}
 
-	ngx_memzero(&get_ranges_params.timing, sizeof(get_ranges_params.timing));
-	get_ranges_params.timing.durations = &duration_millis;
-	get_ranges_params.timing.total_count = 1;
-	get_ranges_params.timing.total_duration = duration_millis;
-	get_ranges_params.timing.times = &get_ranges_params.timing.first_time;
-	get_ranges_params.timing.original_times = &get_ranges_params.timing.first_time;
+		parse_params.clip_to = UINT_MAX;
+	}
+	else
+	{
+		if (cur_source->clip_to >= UINT_MAX)
+		{
+			ngx_log_error(NGX_LOG_ERR, request_context->log, 0,
+				"ngx_http_vod_parse_metadata: clip to value %uL too large", cur_source->clip_to);
+			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_REQUEST);
+		}
 
-	if (ctx->submodule_context.request_params.segment_index != INVALID_SEGMENT_INDEX)
+		parse_params.clip_to = cur_source->clip_to;
+	}
+	parse_params.clip_from = cur_source->clip_from;
+
+	ngx_http_vod_init_parse_params_metadata(
+		ctx,
+		tracks_mask,
+		&parse_params);
+
+	if (request == NULL)
 	{
-		// segment request
-		get_ranges_params.segment_index = ctx->submodule_context.request_params.segment_index;
+		// Note: the other fields in parse_params are not required here
 
-		rc = segmenter_get_start_end_ranges_no_discontinuity(
-			&get_ranges_params,
-			&clip_ranges);
+		if (ctx->format->clipper_parse == NULL)
+		{
+			ngx_log_error(NGX_LOG_ERR, request_context->log, 0,
+				"ngx_http_vod_parse_metadata: clipping not supported for %V", &ctx->format->name);
+			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_REQUEST);
+		}
 
-		ctx->submodule_context.media_set.initial_segment_clip_relative_index = clip_ranges.clip_relative_segment_index;
+		rc = ctx->format->clipper_parse(
+			request_context,
+			&parse_params,
+			ctx->metadata_parts,
+			ctx->metadata_part_count,
+			fetched_from_cache,
+			&ctx->clipper_parse_result);
+		if (rc != VOD_OK)
+		{
+			ngx_log_debug2(NGX_LOG_DEBUG_HTTP, request_context->log, 0,
+				"ngx_http_vod_parse_metadata: clipper_parse(%V) failed %i", &ctx->format->name, rc);
+			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
+		}
+
+		return NGX_OK;
+	}
+
+	ngx_perf_counter_start(ctx->perf_counter_context);
+
+	// parse the basic metadata
+	rc = ctx->format->parse_metadata(
+		request_context,
+		&parse_params,
+		ctx->metadata_parts,
+		ctx->metadata_part_count,
+		&ctx->base_metadata);
+	if (rc != VOD_OK)
+	{
+		ngx_log_debug2(NGX_LOG_DEBUG_HTTP, request_context->log, 0,
+			"ngx_http_vod_parse_metadata: parse_metadata(%V) failed %i", &ctx->format->name, rc);
+
+		if (rc == VOD_NOT_FOUND && fetched_from_cache)
+		{
+			// the cached metadata was saved in an older format, the caller reads it from the file
+			return NGX_DECLINED;
+		}
+
+		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
+	}
+
+	if (ctx->base_metadata->tracks.nelts == 0)
+	{
+		ngx_memzero(&cur_source->track_array, sizeof(cur_source->track_array));
+		return VOD_OK;
+	}
+
+	rc = ngx_http_vod_init_parse_params_frames(
+		ctx,
+		&range,
+		&parse_params);
+	switch (rc)
+	{
+	case NGX_OK:
+		break;		// handled outside the switch
+
+	case NGX_DONE:
+		ngx_memzero(&cur_source->track_array, sizeof(cur_source->track_array));
+		return NGX_OK;
+
+	default:
+		return rc;
+	}
+
+	// parse the frames
+	rc = ctx->format->read_frames(
+		request_context,
+		ctx->base_metadata,
+		&parse_params,
+		ctx->submodule_context.media_set.segmenter_conf,
+		&ctx->read_cache_state,
+		NULL,
+		&ctx->frames_read_req,
+		&cur_source->track_array);
+	switch (rc)
+	{
+	case VOD_OK:
+		break;	// handled outside the switch
+
+	case VOD_AGAIN:
+		return NGX_AGAIN;
+
+	default:
+		ngx_log_debug2(NGX_LOG_DEBUG_HTTP, request_context->log, 0,
+			"ngx_http_vod_parse_metadata: read_frames(%V) failed %i", &ctx->format->name, rc);
+		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
+	}
+
+	ngx_http_vod_update_source_tracks(request_context, cur_source);
+
+	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_MEDIA_PARSE);
+
+	return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_vod_identify_format(ngx_http_vod_ctx_t* ctx)
+{
+	media_format_t** cur_format_ptr;
+	media_format_t* cur_format;
+	vod_status_t rc;
+	ngx_str_t path;
+	vod_str_t buffer;
+
+	buffer.data = ctx->read_buffer.pos;
+	buffer.len = ctx->read_buffer.last - ctx->read_buffer.pos;
+	buffer.data[buffer.len] = '\0';
+
+	for (cur_format_ptr = media_formats; ; cur_format_ptr++)
+	{
+		cur_format = *cur_format_ptr;
+		if (cur_format == NULL)
+		{
+			if (buffer.len > sizeof(wvm_file_magic) &&
+				ngx_memcmp(buffer.data, wvm_file_magic, sizeof(wvm_file_magic)) == 0)
+			{
+				ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+					"ngx_http_vod_identify_format: wvm format is not supported");
+			}
+			else
+			{
+				ctx->reader->get_path(ctx->cur_source->reader_context, &path);
+				ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+					"ngx_http_vod_identify_format: failed to identify the file format %V", &path);
+			}
+			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_DATA);
+		}
+
+		rc = cur_format->init_metadata_reader(
+			&ctx->submodule_context.request_context,
+			&buffer,
+			ctx->submodule_context.conf->initial_read_size,
+			ctx->submodule_context.conf->max_metadata_size,
+			&ctx->metadata_reader_context);
+		if (rc == VOD_NOT_FOUND)
+		{
+			continue;
+		}
+
+		if (rc != VOD_OK)
+		{
+			ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_identify_format: init_metadata_reader(%V) failed %i", &cur_format->name, rc);
+			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
+		}
+
+		ctx->format = cur_format;
+		break;
+	}
+
+	return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_vod_init_format(ngx_http_vod_ctx_t* ctx, uint32_t format_id)
+{
+	media_format_t** cur_format_ptr;
+	media_format_t* cur_format;
+
+	for (cur_format_ptr = media_formats; ; cur_format_ptr++)
+	{
+		cur_format = *cur_format_ptr;
+		if (cur_format == NULL)
+		{
+			ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_init_format: format id %uD not found", format_id);
+			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_UNEXPECTED);
+		}
+
+		if (cur_format->id != format_id)
+		{
+			continue;
+		}
+
+		ctx->format = cur_format;
+		break;
+	}
+
+	return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_vod_async_read(ngx_http_vod_ctx_t* ctx, media_format_read_request_t* read_req)
+{
+	size_t prefix_size;
+	size_t buffer_size;
+	size_t read_size;
+	off_t read_offset;
+	ngx_int_t rc;
+
+	// align the read size and offset
+	read_offset = read_req->read_offset & (~(ctx->alignment - 1));
+	if (read_req->read_size == 0)
+	{
+		read_size = ctx->submodule_context.conf->initial_read_size;
 	}
 	else
 	{
-		// thumbnail request
-		get_ranges_params.time = ctx->submodule_context.request_params.segment_time;
+		read_size = read_req->read_size + read_req->read_offset - read_offset;
+	}
+
+	read_size = (read_size + ctx->alignment - 1) & (~(ctx->alignment - 1));
+
+	// optimization for the case in which the current range is a prefix of the new range
+	buffer_size = ctx->read_buffer.last - ctx->read_buffer.pos;
+	prefix_size = 0;
+
+	if (read_offset >= ctx->read_offset && 
+		read_offset < (off_t)(ctx->read_offset + buffer_size) &&
+		ctx->read_buffer.start != NULL)
+	{
+		prefix_size = ctx->read_offset + buffer_size - read_offset;
+		ctx->prefix_buffer = ctx->read_buffer;
+		ctx->prefix_buffer.pos = ctx->prefix_buffer.last - prefix_size;
+		ctx->read_buffer.start = NULL;
+	}
+	else if ((read_req->flags & MEDIA_READ_FLAG_REALLOC_BUFFER) != 0)
+	{
+		ctx->read_buffer.start = NULL;
+	}
 
-		rc = segmenter_get_start_end_ranges_gop(
-			&get_ranges_params,
-			&clip_ranges);
+	// allocate the read buffer
+	rc = ngx_http_vod_alloc_read_buffer(ctx, read_size, ctx->alloc_params_index);
+	if (rc != NGX_OK)
+	{
+		return rc;
 	}
 
-	if (rc != VOD_OK)
+	if (ctx->prefix_buffer.start != NULL)
 	{
-		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, request_context->log, 0,
-			"ngx_http_vod_init_parse_params_frames: segmenter_get_start_end_ranges_no_discontinuity failed %i", rc);
-		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
+		ctx->read_buffer.start += prefix_size;
+		ctx->read_buffer.pos = ctx->read_buffer.start;
+		ctx->read_buffer.last = ctx->read_buffer.start;
 	}
 
-	if (clip_ranges.clip_count == 0)
+	// perform the read
+	ctx->read_offset = read_offset;
+	ctx->requested_offset = read_req->read_offset;
+	ctx->read_flags = read_req->flags;
+
+	ngx_perf_counter_start(ctx->perf_counter_context);
+
+	rc = ctx->read(
+		ctx->cur_source->reader_context,
+		&ctx->read_buffer,
+		read_size - prefix_size,
+		read_offset + prefix_size);
+	if (rc != NGX_OK)
 	{
-		return NGX_DONE;
+		if (rc != NGX_AGAIN)
+		{
+			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_async_read: async_read failed %i", rc);
+		}
+
+		return rc;
 	}
 
-	if (clip_ranges.clip_ranges->end == ULLONG_MAX)
+	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_READ_FILE);
+
+	return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_vod_get_async_read_result(ngx_http_vod_ctx_t* ctx, vod_str_t* read_buffer)
+{
+	size_t prefix_size;
+	size_t buffer_size;
+	off_t buffer_offset;
+
+	if (ctx->prefix_buffer.start != NULL)
 	{
-		ctx->submodule_context.media_set.segment_duration =
-			duration_millis - clip_ranges.clip_ranges->start;
+		// prepend the prefix buffer
+		prefix_size = ctx->prefix_buffer.last - ctx->prefix_buffer.pos;
+		ctx->read_buffer.start -= prefix_size;
+
+		ctx->read_buffer.pos -= prefix_size;
+		ngx_memcpy(ctx->read_buffer.pos, ctx->prefix_buffer.pos, prefix_size);
+
+		if ((ctx->read_flags & MEDIA_READ_FLAG_REALLOC_BUFFER) == 0)	// should not free the buffer if there are references to it
+		{
+			ngx_pfree(ctx->submodule_context.r->pool, ctx->prefix_buffer.start);
+		}
+		ctx->prefix_buffer.start = NULL;
 	}
-	else
+
+	// adjust the buffer pointer following the alignment
+	buffer_offset = ctx->requested_offset - ctx->read_offset;
+	buffer_size = ctx->read_buffer.last - ctx->read_buffer.pos;
+
+	if (buffer_size < (size_t)buffer_offset)
 	{
-		ctx->submodule_context.media_set.segment_duration =
-			clip_ranges.clip_ranges->end - clip_ranges.clip_ranges->start;
+		ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_get_async_read_result: buffer size %uz is smaller than buffer offset %O", 
+			buffer_size, buffer_offset);
+		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_DATA);
 	}
 
-	parse_params->range = clip_ranges.clip_ranges;
-	parse_params->range->start = (parse_params->range->start * rate.num) / rate.denom;
-	if (parse_params->range->end != ULLONG_MAX)
+	// null terminate the buffer
+	if (ctx->read_buffer.last >= ctx->read_buffer.end)
 	{
-		parse_params->range->end = (parse_params->range->end * rate.num) / rate.denom;
+		ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_get_async_read_result: not enough room for null terminator");
+		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_UNEXPECTED);
 	}
 
+	*ctx->read_buffer.last = '\0';
+
+	read_buffer->data = ctx->read_buffer.pos + buffer_offset;
+	read_buffer->len = buffer_size - buffer_offset;
+
 	return NGX_OK;
 }
 
-static ngx_int_t 
-ngx_http_vod_parse_metadata(
-	ngx_http_vod_ctx_t *ctx, 
-	ngx_flag_t fetched_from_cache)
+static ngx_int_t
+ngx_http_vod_read_metadata(ngx_http_vod_ctx_t* ctx)
 {
-	media_parse_params_t parse_params;
-	const ngx_http_vod_request_t* request = ctx->request;
-	media_clip_source_t* cur_source = ctx->cur_source;
-	request_context_t* request_context = &ctx->submodule_context.request_context;
-	media_range_t range;
-	vod_status_t rc;
-	uint32_t tracks_mask[MEDIA_TYPE_COUNT];
+	media_format_read_metadata_result_t result;
+	vod_str_t read_buffer;
+	ngx_int_t rc;
 
-	// initialize clipping params
-	if (cur_source->clip_to == ULLONG_MAX)
+	if (ctx->metadata_reader_context == NULL)
 	{
-		if (cur_source->clip_from >= UINT_MAX)
+		// identify the format
+		rc = ngx_http_vod_identify_format(ctx);
+		if (rc != NGX_OK)
 		{
-			ngx_log_error(NGX_LOG_ERR, request_context->log, 0,
-				"ngx_http_vod_parse_metadata: clip from value %uL too large", cur_source->clip_from);
-			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_REQUEST);
+			return rc;
 		}
-
-		parse_params.clip_to = UINT_MAX;
 	}
-	else
+
+	for (;;)
 	{
-		if (cur_source->clip_to >= UINT_MAX)
+		rc = ngx_http_vod_get_async_read_result(ctx, &read_buffer);
+		if (rc != NGX_OK)
 		{
-			ngx_log_error(NGX_LOG_ERR, request_context->log, 0,
-				"ngx_http_vod_parse_metadata: clip to value %uL too large", cur_source->clip_to);
-			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_REQUEST);
+			return rc;
 		}
 
-		parse_params.clip_to = cur_source->clip_to;
+		// run the read state machine
+		rc = ctx->format->read_metadata(
+			ctx->metadata_reader_context,
+			ctx->requested_offset,
+			&read_buffer,
+			&result);
+		if (rc == VOD_OK)
+		{
+			ctx->metadata_parts = result.parts;
+			ctx->metadata_part_count = result.part_count;
+			break;
+		}
+
+		if (rc != VOD_AGAIN)
+		{
+			ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+				"ngx_http_vod_read_metadata: read_metadata(%V) failed %i", &ctx->format->name, rc);
+			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
+		}
+
+		// issue another read request
+		ctx->metadata_read_count++;
+		rc = ngx_http_vod_async_read(ctx, &result.read_req);
+		if (rc != NGX_OK)
+		{
+			return rc;
+		}
 	}
-	parse_params.clip_from = cur_source->clip_from;
 
-	ngx_http_vod_init_parse_params_metadata(
-		ctx,
-		tracks_mask,
-		&parse_params);
+	return NGX_OK;
+}
 
-	if (request == NULL)
-	{
-		// Note: the other fields in parse_params are not required here
+static ngx_int_t
+ngx_http_vod_read_frames(ngx_http_vod_ctx_t *ctx)
+{
+	media_format_read_request_t read_req;
+	request_context_t* request_context = &ctx->submodule_context.request_context;
+	vod_str_t read_buffer;
+	ngx_int_t rc;
 
-		if (ctx->format->clipper_parse == NULL)
+	for (;;)
+	{
+		rc = ngx_http_vod_get_async_read_result(ctx, &read_buffer);
+		if (rc != NGX_OK)
 		{
-			ngx_log_error(NGX_LOG_ERR, request_context->log, 0,
-				"ngx_http_vod_parse_metadata: clipping not supported for %V", &ctx->format->name);
-			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_REQUEST);
+			return rc;
 		}
 
-		rc = ctx->format->clipper_parse(
+		// run the read state machine
+		rc = ctx->format->read_frames(
 			request_context,
-			&parse_params,
-			ctx->metadata_parts,
-			ctx->metadata_part_count,
-			fetched_from_cache,
-			&ctx->clipper_parse_result);
-		if (rc != VOD_OK)
+			ctx->base_metadata,
+			NULL,
+			ctx->submodule_context.media_set.segmenter_conf,
+			&ctx->read_cache_state,
+			&read_buffer,
+			&read_req,
+			&ctx->cur_source->track_array);
+		if (rc == VOD_OK)
+		{
+			break;
+		}
+
+		if (rc != VOD_AGAIN)
 		{
 			ngx_log_debug2(NGX_LOG_DEBUG_HTTP, request_context->log, 0,
-				"ngx_http_vod_parse_metadata: clipper_parse(%V) failed %i", &ctx->format->name, rc);
+				"ngx_http_vod_read_frames: read_frames(%V) failed %i", &ctx->format->name, rc);
 			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
 		}
 
-		return NGX_OK;
-	}
-
-	ngx_perf_counter_start(ctx->perf_counter_context);
-
-	// parse the basic metadata
-	rc = ctx->format->parse_metadata(
-		request_context,
-		&parse_params,
-		ctx->metadata_parts,
-		ctx->metadata_part_count,
-		&ctx->base_metadata);
-	if (rc != VOD_OK)
-	{
-		ngx_log_debug2(NGX_LOG_DEBUG_HTTP, request_context->log, 0,
-			"ngx_http_vod_parse_metadata: parse_metadata(%V) failed %i", &ctx->format->name, rc);
-		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
+		// issue another read request
+		rc = ngx_http_vod_async_read(ctx, &read_req);
+		if (rc != NGX_OK)
+		{
+			return rc;
+		}
 	}
 
-	if (ctx->base_metadata->tracks.nelts == 0)
-	{
-		ngx_memzero(&cur_source->track_array, sizeof(cur_source->track_array));
-		return VOD_OK;
-	}
+	ngx_http_vod_update_source_tracks(request_context, ctx->cur_source);
 
-	rc = ngx_http_vod_init_parse_params_frames(
-		ctx,
-		&range,
-		&parse_params);
-	switch (rc)
-	{
-	case NGX_OK:
-		break;		// handled outside the switch
+	return NGX_OK;
+}
 
-	case NGX_DONE:
-		ngx_memzero(&cur_source->track_array, sizeof(cur_source->track_array));
-		return NGX_OK;
+static void
+ngx_http_vod_add_metadata_index(ngx_http_vod_ctx_t *ctx)
+{
+	request_context_t* request_context = &ctx->submodule_context.request_context;
+	ngx_str_t* parts;
+	vod_str_t index;
+	vod_status_t rc;
 
-	default:
-		return rc;
+	if (ctx->format->build_metadata_index == NULL)
+	{
+		return;
 	}
 
-	// parse the frames
-	rc = ctx->format->read_frames(
+	rc = ctx->format->build_metadata_index(
 		request_context,
-		ctx->base_metadata,
-		&parse_params,
-		ctx->submodule_context.media_set.segmenter_conf,
-		&ctx->read_cache_state,
-		NULL,
-		&ctx->frames_read_req,
-		&cur_source->track_array);
-	switch (rc)
+		ctx->metadata_parts,
+		ctx->metadata_part_count,
+		&index);
+	if (rc != VOD_OK)
 	{
-	case VOD_OK:
-		break;	// handled outside the switch
+		// Note: the index is an optimization, the metadata is saved without it
+		ngx_log_debug2(NGX_LOG_DEBUG_HTTP, request_context->log, 0,
+			"ngx_http_vod_add_metadata_index: build_metadata_index(%V) failed %i", &ctx->format->name, rc);
+		return;
+	}
 
-	case VOD_AGAIN:
-		return NGX_AGAIN;
+	if (index.len == 0)
+	{
+		return;
+	}
 
-	default:
-		ngx_log_debug2(NGX_LOG_DEBUG_HTTP, request_context->log, 0,
-			"ngx_http_vod_parse_metadata: read_frames(%V) failed %i", &ctx->format->name, rc);
-		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
+	parts = ngx_palloc(request_context->pool, sizeof(parts[0]) * (ctx->metadata_part_count + 1));
+	if (parts == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, request_context->log, 0,
+			"ngx_http_vod_add_metadata_index: ngx_palloc failed");
+		return;
 	}
 
-	ngx_http_vod_update_source_tracks(request_context, cur_source);
+	ngx_memcpy(parts, ctx->metadata_parts, sizeof(parts[0]) * ctx->metadata_part_count);
+	parts[ctx->metadata_part_count] = index;
 
-	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_MEDIA_PARSE);
+	ctx->metadata_parts = parts;
+	ctx->metadata_part_count++;
+}
 
-	return NGX_OK;
+static ngx_flag_t
+ngx_http_vod_metadata_index_enabled(ngx_http_vod_ctx_t *ctx)
+{
+	// Note: the index file is validated against the mtime of the media file, so it can only be used with file readers
+	return ctx->submodule_context.conf->metadata_index_path.len != 0 &&
+		ctx->reader->get_mtime != NULL;
 }
 
 static ngx_int_t
-ngx_http_vod_identify_format(ngx_http_vod_ctx_t* ctx)
+ngx_http_vod_metadata_index_get_path(ngx_http_vod_ctx_t *ctx, ngx_str_t* result)
 {
-	media_format_t** cur_format_ptr;
-	media_format_t* cur_format;
-	vod_status_t rc;
-	ngx_str_t path;
-	vod_str_t buffer;
-
-	buffer.data = ctx->read_buffer.pos;
-	buffer.len = ctx->read_buffer.last - ctx->read_buffer.pos;
-	buffer.data[buffer.len] = '\0';
+	ngx_str_t* base_path = &ctx->submodule_context.conf->metadata_index_path;
+	u_char* file_key = ctx->cur_source->file_key;
+	u_char* p;
 
-	for (cur_format_ptr = media_formats; ; cur_format_ptr++)
+	// <base path>/<first byte of key in hex>/<key in hex>
+	p = ngx_pnalloc(ctx->submodule_context.request_context.pool,
+		base_path->len + sizeof("/xx/") - 1 + MEDIA_CLIP_KEY_SIZE * 2 + 1);
+	if (p == NULL)
 	{
-		cur_format = *cur_format_ptr;
-		if (cur_format == NULL)
-		{
-			if (buffer.len > sizeof(wvm_file_magic) &&
-				ngx_memcmp(buffer.data, wvm_file_magic, sizeof(wvm_file_magic)) == 0)
-			{
-				ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
-					"ngx_http_vod_identify_format: wvm format is not supported");
-			}
-			else
-			{
-				ctx->reader->get_path(ctx->cur_source->reader_context, &path);
-				ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
-					"ngx_http_vod_identify_format: failed to identify the file format %V", &path);
-			}
-			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_DATA);
-		}
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_metadata_index_get_path: ngx_pnalloc failed");
+		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_ALLOC_FAILED);
+	}
 
-		rc = cur_format->init_metadata_reader(
-			&ctx->submodule_context.request_context,
-			&buffer,
-			ctx->submodule_context.conf->initial_read_size,
-			ctx->submodule_context.conf->max_metadata_size,
-			&ctx->metadata_reader_context);
-		if (rc == VOD_NOT_FOUND)
-		{
-			continue;
-		}
+	result->data = p;
 
-		if (rc != VOD_OK)
-		{
-			ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-				"ngx_http_vod_identify_format: init_metadata_reader(%V) failed %i", &cur_format->name, rc);
-			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
-		}
+	p = ngx_copy(p, base_path->data, base_path->len);
+	*p++ = '/';
+	p = ngx_hex_dump(p, file_key, 1);
+	*p++ = '/';
+	p = ngx_hex_dump(p, file_key, MEDIA_CLIP_KEY_SIZE);
 
-		ctx->format = cur_format;
-		break;
-	}
+	result->len = p - result->data;
+	*p = '\0';
 
 	return NGX_OK;
 }
 
-static ngx_int_t
-ngx_http_vod_init_format(ngx_http_vod_ctx_t* ctx, uint32_t format_id)
+#if (NGX_THREADS)
+static void
+ngx_http_vod_metadata_index_open_completed(void* context, ngx_int_t rc)
 {
-	media_format_t** cur_format_ptr;
-	media_format_t* cur_format;
+	ngx_http_vod_ctx_t *ctx = (ngx_http_vod_ctx_t *)context;
 
-	for (cur_format_ptr = media_formats; ; cur_format_ptr++)
+	if (rc == NGX_OK)
 	{
-		cur_format = *cur_format_ptr;
-		if (cur_format == NULL)
-		{
-			ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
-				"ngx_http_vod_init_format: format id %uD not found", format_id);
-			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_UNEXPECTED);
-		}
-
-		if (cur_format->id != format_id)
-		{
-			continue;
-		}
+		ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_ASYNC_OPEN_FILE);
+	}
+	else
+	{
+		// the index is optional, read the media file
+		ctx->state = STATE_READ_METADATA_OPEN_FILE;
+	}
 
-		ctx->format = cur_format;
-		break;
+	// run the state machine
+	rc = ctx->state_machine(ctx);
+	if (rc == NGX_AGAIN)
+	{
+		return;
 	}
 
-	return NGX_OK;
+	ngx_http_vod_finalize_request(ctx, rc);
 }
+#endif // NGX_THREADS
 
 static ngx_int_t
-ngx_http_vod_async_read(ngx_http_vod_ctx_t* ctx, media_format_read_request_t* read_req)
+ngx_http_vod_metadata_index_open(ngx_http_vod_ctx_t *ctx)
 {
-	size_t prefix_size;
-	size_t buffer_size;
-	size_t read_size;
-	off_t read_offset;
+	ngx_file_reader_state_t* state;
+	ngx_http_core_loc_conf_t *clcf;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_str_t path;
 	ngx_int_t rc;
 
-	// align the read size and offset
-	read_offset = read_req->read_offset & (~(ctx->alignment - 1));
-	if (read_req->read_size == 0)
+	rc = ngx_http_vod_metadata_index_get_path(ctx, &path);
+	if (rc != NGX_OK)
 	{
-		read_size = ctx->submodule_context.conf->initial_read_size;
+		return rc;
 	}
-	else
+
+	clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+	state = ngx_pcalloc(r->pool, sizeof(*state));
+	if (state == NULL)
 	{
-		read_size = read_req->read_size + read_req->read_offset - read_offset;
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_metadata_index_open: ngx_pcalloc failed");
+		return ngx_http_vod_status_to_ngx_error(r, VOD_ALLOC_FAILED);
 	}
 
-	read_size = (read_size + ctx->alignment - 1) & (~(ctx->alignment - 1));
+	ctx->metadata_index_reader_context = state;
 
-	// optimization for the case in which the current range is a prefix of the new range
-	buffer_size = ctx->read_buffer.last - ctx->read_buffer.pos;
-	prefix_size = 0;
+	ngx_perf_counter_start(ctx->perf_counter_context);
 
-	if (read_offset >= ctx->read_offset && 
-		read_offset < (off_t)(ctx->read_offset + buffer_size) &&
-		ctx->read_buffer.start != NULL)
+	// Note: the index file is replaced by rename when it is saved, so it must not be served from the open file cache
+#if (NGX_THREADS)
+	if (ctx->submodule_context.conf->open_file_thread_pool != NULL)
 	{
-		prefix_size = ctx->read_offset + buffer_size - read_offset;
-		ctx->prefix_buffer = ctx->read_buffer;
-		ctx->prefix_buffer.pos = ctx->prefix_buffer.last - prefix_size;
-		ctx->read_buffer.start = NULL;
+		rc = ngx_file_reader_init_async(
+			state,
+			&ctx->async_open_context,
+			ctx->submodule_context.conf->open_file_thread_pool,
+			ngx_http_vod_metadata_index_open_completed,
+			ngx_http_vod_handle_read_completed,
+			ctx,
+			r,
+			clcf,
+			&path,
+			OPEN_FILE_NO_CACHE | OPEN_FILE_NO_LOG_NOT_FOUND);
 	}
-	else if ((read_req->flags & MEDIA_READ_FLAG_REALLOC_BUFFER) != 0)
+	else
+#endif // NGX_THREADS
 	{
-		ctx->read_buffer.start = NULL;
+		rc = ngx_file_reader_init(
+			state,
+			ngx_http_vod_handle_read_completed,
+			ctx,
+			r,
+			clcf,
+			&path,
+			OPEN_FILE_NO_CACHE | OPEN_FILE_NO_LOG_NOT_FOUND);
 	}
 
-	// allocate the read buffer
-	rc = ngx_http_vod_alloc_read_buffer(ctx, read_size, ctx->alloc_params_index);
 	if (rc != NGX_OK)
 	{
 		return rc;
 	}
 
-	if (ctx->prefix_buffer.start != NULL)
+	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_OPEN_FILE);
+
+	return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_vod_metadata_index_read(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_file_reader_state_t* state = ctx->metadata_index_reader_context;
+	ngx_int_t rc;
+
+	if (state->file_size < (off_t)sizeof(metadata_index_header_t) ||
+		state->file_size > (off_t)ctx->submodule_context.conf->max_metadata_size)
 	{
-		ctx->read_buffer.start += prefix_size;
-		ctx->read_buffer.pos = ctx->read_buffer.start;
-		ctx->read_buffer.last = ctx->read_buffer.start;
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_metadata_index_read: ignoring index file of size %O", state->file_size);
+		return NGX_DECLINED;
 	}
 
-	// perform the read
-	ctx->read_offset = read_offset;
-	ctx->requested_offset = read_req->read_offset;
-	ctx->read_flags = read_req->flags;
+	rc = ngx_http_vod_alloc_read_buffer(ctx, state->file_size, ctx->alloc_params_index);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	ctx->state = STATE_READ_METADATA_INDEX_READ;
 
 	ngx_perf_counter_start(ctx->perf_counter_context);
 
-	rc = ctx->read(
-		ctx->cur_source->reader_context,
-		&ctx->read_buffer,
-		read_size - prefix_size,
-		read_offset + prefix_size);
+	rc = ngx_async_file_read(state, &ctx->read_buffer, state->file_size, 0);
 	if (rc != NGX_OK)
 	{
 		if (rc != NGX_AGAIN)
 		{
 			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-				"ngx_http_vod_async_read: async_read failed %i", rc);
+				"ngx_http_vod_metadata_index_read: ngx_async_file_read failed %i", rc);
+			return NGX_DECLINED;
 		}
-
 		return rc;
 	}
 
+	// read completed synchronously
 	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_READ_FILE);
 
 	return NGX_OK;
 }
 
-static ngx_int_t
-ngx_http_vod_get_async_read_result(ngx_http_vod_ctx_t* ctx, vod_str_t* read_buffer)
+static ngx_flag_t
+ngx_http_vod_metadata_index_parse(
+	ngx_http_vod_ctx_t *ctx, 
+	multipart_cache_header_t* multipart_header)
 {
-	size_t prefix_size;
-	size_t buffer_size;
-	off_t buffer_offset;
+	metadata_index_header_t* header;
+	media_clip_source_t* cur_source = ctx->cur_source;
+	ngx_str_t buffer;
 
-	if (ctx->prefix_buffer.start != NULL)
+	buffer.data = ctx->read_buffer.pos;
+	buffer.len = ctx->read_buffer.last - ctx->read_buffer.pos;
+
+	if (buffer.len < sizeof(*header))
 	{
-		// prepend the prefix buffer
-		prefix_size = ctx->prefix_buffer.last - ctx->prefix_buffer.pos;
-		ctx->read_buffer.start -= prefix_size;
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_metadata_index_parse: size %uz smaller than header size", buffer.len);
+		return 0;
+	}
 
-		ctx->read_buffer.pos -= prefix_size;
-		ngx_memcpy(ctx->read_buffer.pos, ctx->prefix_buffer.pos, prefix_size);
+	header = (void*)buffer.data;
+
+	if (header->magic != METADATA_INDEX_MAGIC ||
+		header->version != METADATA_INDEX_VERSION ||
+		header->word_size != sizeof(size_t) ||
+		header->header_size != sizeof(*header))
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_metadata_index_parse: unsupported index file");
+		return 0;
+	}
+
+	if (ngx_memcmp(header->file_key, cur_source->file_key, sizeof(header->file_key)) != 0)
+	{
+		ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_metadata_index_parse: file key mismatch");
+		return 0;
+	}
+
+	if (header->file_size != (uint64_t)ctx->reader->get_size(cur_source->reader_context) ||
+		header->file_mtime != (int64_t)ctx->reader->get_mtime(cur_source->reader_context))
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_metadata_index_parse: media file changed, ignoring index file");
+		return 0;
+	}
+
+	buffer.data += sizeof(*header);
+	buffer.len -= sizeof(*header);
+
+	return ngx_http_vod_multipart_parse(ctx, &buffer, multipart_header, &ctx->metadata_parts);
+}
+
+#if (NGX_THREADS)
+static void
+ngx_http_vod_metadata_index_save_thread(void* data, ngx_log_t* log)
+{
+	ngx_http_vod_metadata_index_save_t* save = data;
+	ngx_fd_t fd;
+	ssize_t n;
 
-		if ((ctx->read_flags & MEDIA_READ_FLAG_REALLOC_BUFFER) == 0)	// should not free the buffer if there are references to it
+	fd = ngx_open_file(save->temp_path, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE, NGX_FILE_DEFAULT_ACCESS);
+	if (fd == NGX_INVALID_FILE && ngx_errno == NGX_ENOPATH)
+	{
+		// create the parent directories and retry
+		save->err = ngx_create_full_path(save->temp_path, 0700);
+		if (save->err != 0)
 		{
-			ngx_pfree(ctx->submodule_context.r->pool, ctx->prefix_buffer.start);
+			save->failed = "ngx_create_full_path()";
+			return;
 		}
-		ctx->prefix_buffer.start = NULL;
+
+		fd = ngx_open_file(save->temp_path, NGX_FILE_WRONLY, NGX_FILE_TRUNCATE, NGX_FILE_DEFAULT_ACCESS);
 	}
 
-	// adjust the buffer pointer following the alignment
-	buffer_offset = ctx->requested_offset - ctx->read_offset;
-	buffer_size = ctx->read_buffer.last - ctx->read_buffer.pos;
+	if (fd == NGX_INVALID_FILE)
+	{
+		save->err = ngx_errno;
+		save->failed = ngx_open_file_n;
+		return;
+	}
 
-	if (buffer_size < (size_t)buffer_offset)
+	n = ngx_write_fd(fd, save->data.data, save->data.len);
+	if (n != (ssize_t)save->data.len)
 	{
-		ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
-			"ngx_http_vod_get_async_read_result: buffer size %uz is smaller than buffer offset %O", 
-			buffer_size, buffer_offset);
-		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_DATA);
+		save->err = n < 0 ? ngx_errno : 0;
+		save->failed = ngx_write_fd_n;
+		ngx_close_file(fd);
+		goto delete_file;
 	}
 
-	// null terminate the buffer
-	if (ctx->read_buffer.last >= ctx->read_buffer.end)
+	if (ngx_close_file(fd) == NGX_FILE_ERROR)
 	{
-		ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
-			"ngx_http_vod_get_async_read_result: not enough room for null terminator");
-		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_UNEXPECTED);
+		save->err = ngx_errno;
+		save->failed = ngx_close_file_n;
+		goto delete_file;
 	}
 
-	*ctx->read_buffer.last = '\0';
+	if (ngx_rename_file(save->temp_path, save->path.data) == NGX_FILE_ERROR)
+	{
+		save->err = ngx_errno;
+		save->failed = ngx_rename_file_n;
+		goto delete_file;
+	}
 
-	read_buffer->data = ctx->read_buffer.pos + buffer_offset;
-	read_buffer->len = buffer_size - buffer_offset;
+	return;
 
-	return NGX_OK;
+delete_file:
+
+	ngx_delete_file(save->temp_path);
 }
 
-static ngx_int_t
-ngx_http_vod_read_metadata(ngx_http_vod_ctx_t* ctx)
+static void
+ngx_http_vod_metadata_index_save_completed(ngx_event_t* ev)
 {
-	media_format_read_metadata_result_t result;
-	vod_str_t read_buffer;
-	ngx_int_t rc;
+	ngx_http_vod_metadata_index_save_t* save = ev->data;
+	ngx_http_request_t* r = save->r;
 
-	if (ctx->metadata_reader_context == NULL)
+	if (save->failed != NULL)
 	{
-		// identify the format
-		rc = ngx_http_vod_identify_format(ctx);
-		if (rc != NGX_OK)
-		{
-			return rc;
-		}
+		ngx_log_error(NGX_LOG_ERR, r->connection->log, save->err,
+			"ngx_http_vod_metadata_index_save_completed: %s \"%s\" failed", save->failed, save->temp_path);
+	}
+	else
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_metadata_index_save_completed: saved index file \"%V\"", &save->path);
 	}
 
-	for (;;)
+	// release the request reference that was taken when the task was posted
+	ngx_http_finalize_request(r, NGX_DONE);
+}
+
+// Note: the index is written by the open file thread pool, the request is kept alive until the write completes
+static void
+ngx_http_vod_metadata_index_save(
+	ngx_http_vod_ctx_t *ctx, 
+	multipart_cache_header_t* multipart_header)
+{
+	ngx_http_vod_metadata_index_save_t* save;
+	metadata_index_header_t* header;
+	media_clip_source_t* cur_source = ctx->cur_source;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_thread_task_t* task;
+	ngx_str_t* buffers;
+	ngx_str_t* cur_buffer;
+	ngx_str_t* buffers_end;
+	size_t size;
+	u_char* p;
+
+	buffers = ngx_http_vod_multipart_get_buffers(ctx, multipart_header, ctx->metadata_parts);
+	if (buffers == NULL)
 	{
-		rc = ngx_http_vod_get_async_read_result(ctx, &read_buffer);
-		if (rc != NGX_OK)
-		{
-			return rc;
-		}
+		return;
+	}
 
-		// run the read state machine
-		rc = ctx->format->read_metadata(
-			ctx->metadata_reader_context,
-			ctx->requested_offset,
-			&read_buffer,
-			&result);
-		if (rc == VOD_OK)
-		{
-			ctx->metadata_parts = result.parts;
-			ctx->metadata_part_count = result.part_count;
-			break;
-		}
+	task = ngx_thread_task_alloc(r->pool, sizeof(*save));
+	if (task == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_metadata_index_save: ngx_thread_task_alloc failed");
+		return;
+	}
 
-		if (rc != VOD_AGAIN)
-		{
-			ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
-				"ngx_http_vod_read_metadata: read_metadata(%V) failed %i", &ctx->format->name, rc);
-			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
-		}
+	save = task->ctx;
+	save->r = r;
+	save->failed = NULL;
+	save->err = 0;
 
-		// issue another read request
-		rc = ngx_http_vod_async_read(ctx, &result.read_req);
-		if (rc != NGX_OK)
-		{
-			return rc;
-		}
+	if (ngx_http_vod_metadata_index_get_path(ctx, &save->path) != NGX_OK)
+	{
+		return;
 	}
 
-	return NGX_OK;
-}
+	// Note: the index is written to a temp file and renamed, so that readers never see a partial file
+	save->temp_path = ngx_pnalloc(r->pool, save->path.len + sizeof(".tmp") + NGX_INT64_LEN + 1);
+	if (save->temp_path == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_metadata_index_save: ngx_pnalloc failed (1)");
+		return;
+	}
 
-static ngx_int_t
-ngx_http_vod_read_frames(ngx_http_vod_ctx_t *ctx)
-{
-	media_format_read_request_t read_req;
-	request_context_t* request_context = &ctx->submodule_context.request_context;
-	vod_str_t read_buffer;
-	ngx_int_t rc;
+	ngx_sprintf(save->temp_path, "%V.%P.tmp%Z", &save->path, ngx_pid);
 
-	for (;;)
+	// Note: the parts may point to the read buffer, which is freed before the write completes
+	buffers_end = buffers + multipart_header->part_count + 1;
+	size = sizeof(*header);
+	for (cur_buffer = buffers; cur_buffer < buffers_end; cur_buffer++)
 	{
-		rc = ngx_http_vod_get_async_read_result(ctx, &read_buffer);
-		if (rc != NGX_OK)
-		{
-			return rc;
-		}
+		size += cur_buffer->len;
+	}
 
-		// run the read state machine
-		rc = ctx->format->read_frames(
-			request_context,
-			ctx->base_metadata,
-			NULL,
-			ctx->submodule_context.media_set.segmenter_conf,
-			&ctx->read_cache_state,
-			&read_buffer,
-			&read_req,
-			&ctx->cur_source->track_array);
-		if (rc == VOD_OK)
-		{
-			break;
-		}
+	p = ngx_palloc(r->pool, size);
+	if (p == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_metadata_index_save: ngx_palloc failed (2)");
+		return;
+	}
 
-		if (rc != VOD_AGAIN)
-		{
-			ngx_log_debug2(NGX_LOG_DEBUG_HTTP, request_context->log, 0,
-				"ngx_http_vod_read_frames: read_frames(%V) failed %i", &ctx->format->name, rc);
-			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
-		}
+	save->data.data = p;
+	save->data.len = size;
 
-		// issue another read request
-		rc = ngx_http_vod_async_read(ctx, &read_req);
-		if (rc != NGX_OK)
-		{
-			return rc;
-		}
+	header = (void*)p;
+	ngx_memzero(header, sizeof(*header));
+	header->magic = METADATA_INDEX_MAGIC;
+	header->version = METADATA_INDEX_VERSION;
+	header->word_size = sizeof(size_t);
+	header->header_size = sizeof(*header);
+	ngx_memcpy(header->file_key, cur_source->file_key, sizeof(header->file_key));
+	header->file_size = ctx->reader->get_size(cur_source->reader_context);
+	header->file_mtime = ctx->reader->get_mtime(cur_source->reader_context);
+	p += sizeof(*header);
+
+	for (cur_buffer = buffers; cur_buffer < buffers_end; cur_buffer++)
+	{
+		p = ngx_copy(p, cur_buffer->data, cur_buffer->len);
 	}
 
-	ngx_http_vod_update_source_tracks(request_context, ctx->cur_source);
+	task->handler = ngx_http_vod_metadata_index_save_thread;
+	task->event.data = save;
+	task->event.handler = ngx_http_vod_metadata_index_save_completed;
 
-	return NGX_OK;
+	if (ngx_thread_task_post(ctx->submodule_context.conf->open_file_thread_pool, task) != NGX_OK)
+	{
+		ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+			"ngx_http_vod_metadata_index_save: ngx_thread_task_post failed");
+		return;
+	}
+
+	r->main->count++;
 }
+#endif // NGX_THREADS
 
 static ngx_int_t
 ngx_http_vod_state_machine_parse_metadata(ngx_http_vod_ctx_t *ctx)
@@ -2140,6 +3219,7 @@ ngx_http_vod_state_machine_parse_metadata(ngx_http_vod_ctx_t *ctx)
 				ctx->metadata_parts[0].data = (void*)(ctx->metadata_parts + 1);
 				ctx->metadata_parts[0].data[0] = '\0';
 				multipart_header.type = FORMAT_ID_WEBVTT;
+				multipart_header.part_count = 1;
 				metadata_loaded = TRUE;
 			}
 			else if (conf->metadata_cache != NULL)
@@ -2166,6 +3246,8 @@ ngx_http_vod_state_machine_parse_metadata(ngx_http_vod_ctx_t *ctx)
 
 			if (metadata_loaded)
 			{
+				ctx->metadata_part_count = multipart_header.part_count;
+
 				// parse the metadata
 				rc = ngx_http_vod_init_format(ctx, multipart_header.type);
 				if (rc != NGX_OK)
@@ -2176,7 +3258,8 @@ ngx_http_vod_state_machine_parse_metadata(ngx_http_vod_ctx_t *ctx)
 				rc = ngx_http_vod_parse_metadata(ctx, 1);
 
 				if (cache_token && 
-					ctx->request != NULL)		// in case of progressive, the metadata parts are used in clipper_build_header
+					(ctx->request != NULL ||		// in case of progressive, the metadata parts are used in clipper_build_header
+					rc == NGX_DECLINED))
 				{
 					ngx_buffer_cache_release(
 						conf->metadata_cache,
@@ -2193,32 +3276,167 @@ ngx_http_vod_state_machine_parse_metadata(ngx_http_vod_ctx_t *ctx)
 					}
 					break;
 				}
-
-				if (rc != NGX_AGAIN)
+
+				if (rc == NGX_DECLINED)
+				{
+					ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+						"ngx_http_vod_state_machine_parse_metadata: outdated metadata cache entry, handling as a miss");
+					metadata_loaded = FALSE;
+				}
+				else if (rc != NGX_AGAIN)
+				{
+					ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+						"ngx_http_vod_state_machine_parse_metadata: ngx_http_vod_parse_metadata failed %i", rc);
+					return rc;
+				}
+				else
+				{
+					ctx->state = STATE_READ_FRAMES_OPEN_FILE;
+				}
+			}
+
+			if (!metadata_loaded)
+			{
+				if (ngx_http_vod_metadata_index_enabled(ctx))
+				{
+					// Note: the index is opened after the media file, since it is validated against its size & mtime
+					ctx->state = STATE_READ_METADATA_INDEX_INITIAL;
+				}
+				else
+				{
+					ctx->state = STATE_READ_METADATA_OPEN_FILE;
+				}
+			}
+
+			// open the file
+			rc = ctx->reader->open(r, &cur_source->mapped_uri, 0, &cur_source->reader_context);
+			if (rc != NGX_OK)
+			{
+				if (rc != NGX_AGAIN)
+				{
+					ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+						"ngx_http_vod_state_machine_parse_metadata: open_file failed %i", rc);
+				}
+				return rc;
+			}
+			break;
+
+		case STATE_READ_METADATA_INDEX_INITIAL:
+			// open the index file
+			ctx->state = STATE_READ_METADATA_INDEX_OPEN;
+
+			rc = ngx_http_vod_metadata_index_open(ctx);
+			if (rc != NGX_OK)
+			{
+				if (rc == NGX_AGAIN)
+				{
+					return rc;
+				}
+
+				// the index is optional, read the media file
+				ctx->state = STATE_READ_METADATA_OPEN_FILE;
+				break;
+			}
+			// fall through
+
+		case STATE_READ_METADATA_INDEX_OPEN:
+			// read the index file
+			rc = ngx_http_vod_metadata_index_read(ctx);
+			if (rc != NGX_OK)
+			{
+				if (rc == NGX_AGAIN)
+				{
+					return rc;
+				}
+
+				if (rc != NGX_DECLINED)
+				{
+					return rc;
+				}
+
+				ctx->state = STATE_READ_METADATA_OPEN_FILE;
+				break;
+			}
+			// fall through
+
+		case STATE_READ_METADATA_INDEX_READ:
+			if (!ngx_http_vod_metadata_index_parse(ctx, &multipart_header))
+			{
+				ctx->state = STATE_READ_METADATA_OPEN_FILE;
+				break;
+			}
+
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_state_machine_parse_metadata: loaded metadata from index file");
+
+			ctx->metadata_part_count = multipart_header.part_count;
+
+			// parse the metadata
+			rc = ngx_http_vod_init_format(ctx, multipart_header.type);
+			if (rc != NGX_OK)
+			{
+				return rc;
+			}
+
+			rc = ngx_http_vod_parse_metadata(ctx, 1);
+			if (rc == NGX_DECLINED)
+			{
+				// index saved in an older format, read the media file
+				ctx->state = STATE_READ_METADATA_OPEN_FILE;
+				break;
+			}
+
+			if (rc != NGX_OK && rc != NGX_AGAIN)
+			{
+				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+					"ngx_http_vod_state_machine_parse_metadata: ngx_http_vod_parse_metadata failed %i", rc);
+				return rc;
+			}
+
+			// save the metadata to cache
+			cur_source = ctx->cur_source;
+
+			if (conf->metadata_cache != NULL)
+			{
+				if (ngx_buffer_cache_store_multipart_perf(
+					ctx,
+					conf->metadata_cache,
+					cur_source->file_key,
+					&multipart_header,
+					ctx->metadata_parts))
+				{
+					ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+						"ngx_http_vod_state_machine_parse_metadata: stored metadata in cache");
+				}
+				else
 				{
-					ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-						"ngx_http_vod_state_machine_parse_metadata: ngx_http_vod_parse_metadata failed %i", rc);
-					return rc;
+					ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+						"ngx_http_vod_state_machine_parse_metadata: failed to store metadata in cache");
 				}
-
-				ctx->state = STATE_READ_FRAMES_OPEN_FILE;
 			}
-			else
+
+			if (ctx->request != NULL)
 			{
-				ctx->state = STATE_READ_METADATA_OPEN_FILE;
+				// no longer need the index buffer
+				ngx_pfree(r->pool, ctx->read_buffer.start);
+				ctx->read_buffer.start = NULL;
 			}
 
-			// open the file
-			rc = ctx->reader->open(r, &cur_source->mapped_uri, 0, &cur_source->reader_context);
-			if (rc != NGX_OK)
+			if (rc == NGX_OK)
 			{
-				if (rc != NGX_AGAIN)
+				// move to the next source
+				ctx->state = STATE_READ_METADATA_INITIAL;
+
+				ctx->cur_source = cur_source->next;
+				if (ctx->cur_source == NULL)
 				{
-					ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-						"ngx_http_vod_state_machine_parse_metadata: open_file failed %i", rc);
+					return NGX_OK;
 				}
-				return rc;
+				break;
 			}
+
+			// the media file is already open
+			ctx->state = STATE_READ_FRAMES_OPEN_FILE;
 			break;
 
 		case STATE_READ_METADATA_OPEN_FILE:
@@ -2233,6 +3451,7 @@ ngx_http_vod_state_machine_parse_metadata(ngx_http_vod_ctx_t *ctx)
 			r->connection->log->action = "reading media header";
 			ctx->state = STATE_READ_METADATA_READ;
 			ctx->metadata_reader_context = NULL;
+			ctx->metadata_read_count = 0;
 
 			ctx->read_offset = 0;
 			ctx->requested_offset = 0;
@@ -2282,11 +3501,25 @@ ngx_http_vod_state_machine_parse_metadata(ngx_http_vod_ctx_t *ctx)
 			// save the metadata to cache
 			cur_source = ctx->cur_source;
 
-			if (conf->metadata_cache != NULL)
+			if (conf->metadata_cache != NULL || ngx_http_vod_metadata_index_enabled(ctx))
 			{
+				// save the format index along with the metadata, for the requests that hit the cache
+				ngx_http_vod_add_metadata_index(ctx);
+
 				multipart_header.type = ctx->format->id;
 				multipart_header.part_count = ctx->metadata_part_count;
+			}
+			else if (ctx->metadata_read_count > METADATA_READS_WARN_THRESHOLD)
+			{
+				// Note: fragmented mp4 files and mkv files without cues are walked fragment by fragment / 
+				//		cluster by cluster, without a cache the walk is repeated on every request
+				ngx_log_error(NGX_LOG_WARN, ctx->submodule_context.request_context.log, 0,
+					"ngx_http_vod_state_machine_parse_metadata: reading the metadata of \"%V\" required %ui reads, "
+					"vod_metadata_cache should be enabled", &cur_source->mapped_uri, ctx->metadata_read_count);
+			}
 
+			if (conf->metadata_cache != NULL)
+			{
 				if (ngx_buffer_cache_store_multipart_perf(
 					ctx,
 					conf->metadata_cache,
@@ -2304,6 +3537,13 @@ ngx_http_vod_state_machine_parse_metadata(ngx_http_vod_ctx_t *ctx)
 				}
 			}
 
+#if (NGX_THREADS)
+			if (ngx_http_vod_metadata_index_enabled(ctx) && conf->open_file_thread_pool != NULL)
+			{
+				ngx_http_vod_metadata_index_save(ctx, &multipart_header);
+			}
+#endif // NGX_THREADS
+
 			if (ctx->request != NULL)
 			{
 				// no longer need the metadata buffer
@@ -2505,113 +3745,456 @@ ngx_http_vod_update_track_timescale(
 
 				track->total_frames_duration += scaled_dts - clip_start_dts;
 
-				dts = 0;
-				scaled_dts = 0;
-				clip_start_dts = 0;
-			}
+				dts = 0;
+				scaled_dts = 0;
+				clip_start_dts = 0;
+			}
+
+			if (part->next == NULL)
+			{
+				break;
+			}
+
+			// initialize the next part
+			part = part->next;
+			cur_frame = part->first_frame;
+			last_frame = part->last_frame;
+			if (part->clip_to != UINT_MAX && cur_frame < last_frame)
+			{
+				clip_end_dts = rescale_time(part->clip_to, 1000, new_timescale);
+				if (track->media_info.media_type == MEDIA_TYPE_VIDEO)
+				{
+					clip_end_pts = clip_end_dts + rescale_time(track->media_info.u.video.initial_pts_delay,
+						cur_timescale, new_timescale);
+				}
+			}
+			else
+			{
+				clip_end_dts = ULLONG_MAX;
+				clip_end_pts = ULLONG_MAX;
+			}
+		}
+
+		// get the pts delay
+		pts = dts + cur_frame->pts_delay;
+		scaled_pts = rescale_time(pts, cur_timescale, new_timescale);
+		if (scaled_pts > clip_end_pts)
+		{
+			scaled_pts = ngx_max(clip_end_pts, scaled_dts);
+		}
+		cur_frame->pts_delay = scaled_pts - scaled_dts + pts_delay;
+
+		// get the duration
+		dts += cur_frame->duration;
+		next_scaled_dts = rescale_time(dts, cur_timescale, new_timescale);
+		cur_frame->duration = next_scaled_dts - scaled_dts;
+		scaled_dts = next_scaled_dts;
+	}
+
+	track->total_frames_duration += scaled_dts - clip_start_dts;
+	track->clip_from_frame_offset = rescale_time(track->clip_from_frame_offset, cur_timescale, new_timescale);
+
+	// media info
+	track->media_info.duration = rescale_time(track->media_info.duration, cur_timescale, new_timescale);
+	track->media_info.full_duration = rescale_time(track->media_info.full_duration, cur_timescale, new_timescale);
+	if (track->media_info.full_duration == 0)
+	{
+		ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_update_track_timescale: full duration is zero following rescale");
+		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_DATA);
+	}
+
+	if (track->media_info.media_type == MEDIA_TYPE_VIDEO)
+	{
+		if (track->media_info.min_frame_duration != 0)
+		{
+			track->media_info.min_frame_duration =
+				rescale_time(track->media_info.min_frame_duration, cur_timescale, new_timescale);
+			if (track->media_info.min_frame_duration == 0)
+			{
+				ngx_log_error(NGX_LOG_WARN, ctx->submodule_context.request_context.log, 0,
+					"ngx_http_vod_update_track_timescale: min frame duration is zero following rescale");
+				track->media_info.min_frame_duration = 1;
+			}
+		}
+
+		track->media_info.u.video.initial_pts_delay =
+			rescale_time(track->media_info.u.video.initial_pts_delay, cur_timescale, new_timescale);
+	}
+
+	track->media_info.timescale = new_timescale;
+	track->media_info.frames_timescale = new_timescale;
+
+	return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_vod_update_timescale(ngx_http_vod_ctx_t *ctx)
+{
+	media_set_t* media_set = &ctx->submodule_context.media_set;
+	media_track_t* track;
+	ngx_int_t rc;
+
+	for (track = media_set->filtered_tracks; track < media_set->filtered_tracks_end; track++)
+	{
+		rc = ngx_http_vod_update_track_timescale(
+			ctx, 
+			track, 
+			ctx->request->timescale, 
+			ctx->submodule_context.request_params.pts_delay);
+		if (rc != NGX_OK)
+		{
+			return rc;
+		}
+	}
+
+	return NGX_OK;
+}
+
+////// Metadata request handling
+
+static void
+ngx_http_vod_init_frames_index_key(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	media_clip_source_t* cur_source;
+	media_clip_timing_t* timing;
+	segmenter_conf_t* segmenter;
+	ngx_md5_t md5;
+
+	// Note: the uri determines the selected sequences / tracks, the files are identified by their keys,
+	//	the host / base url are not included, since the index contains only relative positions
+	ngx_md5_init(&md5);
+	ngx_md5_update(&md5, "frames-index", sizeof("frames-index") - 1);
+	ngx_md5_update(&md5, ctx->submodule_context.r->uri.data, ctx->submodule_context.r->uri.len);
+
+	for (cur_source = ctx->submodule_context.media_set.sources_head;
+		cur_source != NULL;
+		cur_source = cur_source->next)
+	{
+		ngx_md5_update(&md5, cur_source->file_key, sizeof(cur_source->file_key));
+		ngx_md5_update(&md5, &cur_source->clip_from, sizeof(cur_source->clip_from));
+		ngx_md5_update(&md5, &cur_source->clip_to, sizeof(cur_source->clip_to));
+		ngx_md5_update(&md5, cur_source->tracks_mask, sizeof(cur_source->tracks_mask));
+		ngx_md5_update(&md5, cur_source->time_shift, sizeof(cur_source->time_shift));
+	}
+
+	timing = &ctx->submodule_context.media_set.timing;
+	if (timing->durations != NULL)
+	{
+		ngx_md5_update(&md5, timing->durations, sizeof(timing->durations[0]) * timing->total_count);
+	}
+
+	// the segmentation and muxing params
+	segmenter = ctx->submodule_context.media_set.segmenter_conf;
+	ngx_md5_update(&md5, &segmenter->segment_duration, sizeof(segmenter->segment_duration));
+	ngx_md5_update(&md5, &segmenter->align_to_key_frames, sizeof(segmenter->align_to_key_frames));
+	ngx_md5_update(&md5, &segmenter->get_segment_count, sizeof(segmenter->get_segment_count));
+	if (segmenter->bootstrap_segments_count > 0)
+	{
+		ngx_md5_update(&md5, segmenter->bootstrap_segments_durations, 
+			sizeof(segmenter->bootstrap_segments_durations[0]) * segmenter->bootstrap_segments_count);
+	}
+
+	ngx_md5_update(&md5, &conf->hls.mpegts_muxer_config, sizeof(conf->hls.mpegts_muxer_config));
+
+	ngx_md5_final(ctx->frames_index_key, &md5);
+}
+
+static void
+ngx_http_vod_fetch_frames_index(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	ngx_str_t* frames_index = &ctx->submodule_context.frames_index;
+
+	if ((ctx->request->flags & REQUEST_FLAG_FRAMES_INDEX) == 0 ||
+		conf->metadata_cache == NULL ||
+		ctx->submodule_context.media_set.type != MEDIA_SET_VOD)
+	{
+		return;
+	}
+
+	ngx_http_vod_init_frames_index_key(ctx);
+	ctx->frames_index_enabled = 1;
+
+	if (ngx_buffer_cache_fetch_copy_perf(
+		ctx->submodule_context.r,
+		ctx->perf_counters,
+		&conf->metadata_cache,
+		1,
+		ctx->frames_index_key,
+		frames_index) < 0)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_fetch_frames_index: frames index cache miss");
+		frames_index->len = 0;
+		return;
+	}
+
+	ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+		"ngx_http_vod_fetch_frames_index: frames index cache hit, size is %uz", frames_index->len);
+
+	ctx->frames_index_found = 1;
+}
+
+static void
+ngx_http_vod_store_frames_index(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	ngx_str_t* frames_index = &ctx->submodule_context.frames_index;
+
+	if (!ctx->frames_index_enabled || ctx->frames_index_found || frames_index->len == 0)
+	{
+		return;
+	}
+
+	if (ngx_buffer_cache_store_perf(
+		ctx->perf_counters,
+		conf->metadata_cache,
+		ctx->frames_index_key,
+		frames_index->data,
+		frames_index->len))
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_store_frames_index: stored frames index in cache");
+	}
+	else
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_store_frames_index: failed to store frames index in cache");
+	}
+}
+
+static ngx_int_t
+ngx_http_vod_send_cached_response(
+	ngx_http_request_t *r,
+	ngx_perf_counters_t* perf_counters,
+	const ngx_http_vod_request_t* request,
+	u_char* request_key)
+{
+	ngx_http_vod_loc_conf_t *conf;
+	response_cache_header_t cache_header;
+	ngx_str_t cache_buffer;
+	ngx_str_t content_type;
+	ngx_str_t response;
+	ngx_int_t rc;
+	int cache_type;
+
+	conf = ngx_http_get_module_loc_conf(r, ngx_http_vod_module);
+
+	cache_type = ngx_buffer_cache_fetch_copy_perf(
+		r,
+		perf_counters,
+		conf->response_cache,
+		CACHE_TYPE_COUNT,
+		request_key,
+		&cache_buffer);
+	if (cache_type < 0 ||
+		cache_buffer.len <= sizeof(cache_header))
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_send_cached_response: response cache miss");
+		return NGX_DECLINED;
+	}
+
+	ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+		"ngx_http_vod_send_cached_response: response cache hit, size is %uz", cache_buffer.len);
+
+	// extract the content type
+	ngx_memcpy(&cache_header, cache_buffer.data, sizeof(cache_header));
+	cache_buffer.data += sizeof(cache_header);
+	cache_buffer.len -= sizeof(cache_header);
+
+	content_type.data = cache_buffer.data;
+	content_type.len = cache_header.content_type_len;
+
+	if (cache_buffer.len < content_type.len)
+	{
+		return NGX_DECLINED;
+	}
+
+	// extract the response buffer
+	response.data = cache_buffer.data + content_type.len;
+	response.len = cache_buffer.len - content_type.len;
+
+	// update request flags
+	r->root_tested = !r->error_page;
+	r->allow_ranges = 1;
+
+	// return the response
+	rc = ngx_http_vod_send_header(r, response.len, &content_type, cache_header.media_set_type, request);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	return ngx_http_vod_send_response(r, &response, NULL);
+}
+
+static void ngx_http_vod_manifest_write_handler(ngx_http_request_t *r);
+
+// Note: the next chunk is built only after the previous one was sent, so that the memory used by the request
+//		does not grow with the size of the manifest. the builder reuses the buffer of the previous chunk
+static ngx_int_t
+ngx_http_vod_stream_manifest(ngx_http_vod_ctx_t *ctx, ngx_chain_t* in)
+{
+	ngx_http_vod_manifest_stream_t* stream = &ctx->submodule_context.manifest_stream;
+	ngx_http_core_loc_conf_t* clcf;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_event_t* wev = r->connection->write;
+	ngx_chain_t out;
+	ngx_buf_t* b = ctx->manifest_buf;
+	ngx_str_t chunk;
+	ngx_int_t rc;
+
+	for ( ;; )
+	{
+		rc = ngx_http_output_filter(r, in);
+		if (rc == NGX_ERROR)
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_stream_manifest: ngx_http_output_filter failed");
+			return NGX_ERROR;
+		}
 
-			if (part->next == NULL)
-			{
-				break;
-			}
+		if (b->last_buf)
+		{
+			// Note: any pending output is sent by nginx after the request is finalized
+			return NGX_OK;
+		}
 
-			// initialize the next part
-			part = part->next;
-			cur_frame = part->first_frame;
-			last_frame = part->last_frame;
-			if (part->clip_to != UINT_MAX && cur_frame < last_frame)
-			{
-				clip_end_dts = rescale_time(part->clip_to, 1000, new_timescale);
-				if (track->media_info.media_type == MEDIA_TYPE_VIDEO)
-				{
-					clip_end_pts = clip_end_dts + rescale_time(track->media_info.u.video.initial_pts_delay,
-						cur_timescale, new_timescale);
-				}
-			}
-			else
-			{
-				clip_end_dts = ULLONG_MAX;
-				clip_end_pts = ULLONG_MAX;
-			}
+		if (b->pos < b->last || r->connection->buffered)
+		{
+			break;
 		}
 
-		// get the pts delay
-		pts = dts + cur_frame->pts_delay;
-		scaled_pts = rescale_time(pts, cur_timescale, new_timescale);
-		if (scaled_pts > clip_end_pts)
+		rc = stream->next_chunk(stream->context, &chunk);
+		if (rc != VOD_OK && rc != VOD_AGAIN)
 		{
-			scaled_pts = ngx_max(clip_end_pts, scaled_dts);
+			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_stream_manifest: next_chunk failed %i", rc);
+			return ngx_http_vod_status_to_ngx_error(r, rc);
 		}
-		cur_frame->pts_delay = scaled_pts - scaled_dts + pts_delay;
 
-		// get the duration
-		dts += cur_frame->duration;
-		next_scaled_dts = rescale_time(dts, cur_timescale, new_timescale);
-		cur_frame->duration = next_scaled_dts - scaled_dts;
-		scaled_dts = next_scaled_dts;
+		b->pos = chunk.data;
+		b->last = chunk.data + chunk.len;
+		b->last_buf = (rc == VOD_OK);
+
+		out.buf = b;
+		out.next = NULL;
+		in = &out;
 	}
 
-	track->total_frames_duration += scaled_dts - clip_start_dts;
-	track->clip_from_frame_offset = rescale_time(track->clip_from_frame_offset, cur_timescale, new_timescale);
+	// wait until the client reads the pending output
+	r->write_event_handler = ngx_http_vod_manifest_write_handler;
 
-	// media info
-	track->media_info.duration = rescale_time(track->media_info.duration, cur_timescale, new_timescale);
-	track->media_info.full_duration = rescale_time(track->media_info.full_duration, cur_timescale, new_timescale);
-	if (track->media_info.full_duration == 0)
+	clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+	if (!wev->delayed)
 	{
-		ngx_log_error(NGX_LOG_ERR, ctx->submodule_context.request_context.log, 0,
-			"ngx_http_vod_update_track_timescale: full duration is zero following rescale");
-		return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_BAD_DATA);
+		ngx_add_timer(wev, clcf->send_timeout);
 	}
 
-	if (track->media_info.media_type == MEDIA_TYPE_VIDEO)
+	if (ngx_handle_write_event(wev, clcf->send_lowat) != NGX_OK)
 	{
-		if (track->media_info.min_frame_duration != 0)
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_stream_manifest: ngx_handle_write_event failed");
+		return NGX_ERROR;
+	}
+
+	return NGX_AGAIN;
+}
+
+static void
+ngx_http_vod_manifest_write_handler(ngx_http_request_t *r)
+{
+	ngx_http_vod_ctx_t *ctx;
+	ngx_event_t* wev = r->connection->write;
+	ngx_int_t rc;
+
+	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
+
+	if (wev->timedout)
+	{
+		if (!wev->delayed)
 		{
-			track->media_info.min_frame_duration =
-				rescale_time(track->media_info.min_frame_duration, cur_timescale, new_timescale);
-			if (track->media_info.min_frame_duration == 0)
-			{
-				ngx_log_error(NGX_LOG_WARN, ctx->submodule_context.request_context.log, 0,
-					"ngx_http_vod_update_track_timescale: min frame duration is zero following rescale");
-				track->media_info.min_frame_duration = 1;
-			}
+			ngx_log_error(NGX_LOG_INFO, r->connection->log, NGX_ETIMEDOUT,
+				"ngx_http_vod_manifest_write_handler: client timed out");
+			r->connection->timedout = 1;
+			ngx_http_vod_finalize_request(ctx, NGX_HTTP_REQUEST_TIME_OUT);
+			return;
 		}
 
-		track->media_info.u.video.initial_pts_delay =
-			rescale_time(track->media_info.u.video.initial_pts_delay, cur_timescale, new_timescale);
+		// the send rate limit delay expired
+		wev->timedout = 0;
+		wev->delayed = 0;
+	}
+	else if (wev->delayed)
+	{
+		return;
 	}
 
-	track->media_info.timescale = new_timescale;
-	track->media_info.frames_timescale = new_timescale;
+	if (wev->timer_set)
+	{
+		ngx_del_timer(wev);
+	}
 
-	return NGX_OK;
+	rc = ngx_http_vod_stream_manifest(ctx, NULL);
+	if (rc == NGX_AGAIN)
+	{
+		return;
+	}
+
+	r->write_event_handler = ngx_http_request_empty_handler;
+
+	ngx_http_vod_finalize_request(ctx, rc);
 }
 
 static ngx_int_t
-ngx_http_vod_update_timescale(ngx_http_vod_ctx_t *ctx)
+ngx_http_vod_start_manifest_stream(ngx_http_vod_ctx_t *ctx, ngx_str_t* response, ngx_str_t* content_type)
 {
-	media_set_t* media_set = &ctx->submodule_context.media_set;
-	media_track_t* track;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_chain_t out;
+	ngx_buf_t* b;
 	ngx_int_t rc;
 
-	for (track = media_set->filtered_tracks; track < media_set->filtered_tracks_end; track++)
+	// Note: the length of a streamed manifest is not known in advance, nginx uses chunked encoding
+	rc = ngx_http_vod_send_header(
+		r,
+		-1,
+		content_type,
+		ctx->submodule_context.media_set.type,
+		ctx->request);
+	if (rc != NGX_OK)
 	{
-		rc = ngx_http_vod_update_track_timescale(
-			ctx, 
-			track, 
-			ctx->request->timescale, 
-			ctx->submodule_context.request_params.pts_delay);
-		if (rc != NGX_OK)
-		{
-			return rc;
-		}
+		return rc;
 	}
 
-	return NGX_OK;
-}
+	if (r->header_only)
+	{
+		return NGX_OK;
+	}
 
-////// Metadata request handling
+	b = ngx_calloc_buf(r->pool);
+	if (b == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_start_manifest_stream: ngx_calloc_buf failed");
+		return NGX_ERROR;
+	}
+
+	b->pos = response->data;
+	b->last = response->data + response->len;
+	b->temporary = 1;
+	b->flush = 1;
+
+	ctx->manifest_buf = b;
+
+	out.buf = b;
+	out.next = NULL;
+
+	return ngx_http_vod_stream_manifest(ctx, &out);
+}
 
 static ngx_int_t
 ngx_http_vod_handle_metadata_request(ngx_http_vod_ctx_t *ctx)
@@ -2625,6 +4208,44 @@ ngx_http_vod_handle_metadata_request(ngx_http_vod_ctx_t *ctx)
 	ngx_int_t rc;
 	int cache_type;
 
+	if (ctx->submodule_context.media_set.original_type != MEDIA_SET_LIVE ||
+		(ctx->request->flags & REQUEST_FLAG_TIME_DEPENDENT_ON_LIVE) == 0)
+	{
+		cache_type = CACHE_TYPE_VOD;
+	}
+	else
+	{
+		cache_type = CACHE_TYPE_LIVE;
+	}
+
+	// Note: blocking playlist reloads depend on the query args, which are not part of the cache key
+	cache = ctx->blocking_reload ? NULL : conf->response_cache[cache_type];
+	if (cache != NULL && conf->cache_lock)
+	{
+		if (ctx->state == STATE_HANDLE_METADATA_REQUEST)
+		{
+			// woke up after waiting for the lock, check whether the response was stored by the lock owner
+			rc = ngx_http_vod_send_cached_response(
+				ctx->submodule_context.r, 
+				ctx->perf_counters, 
+				ctx->request, 
+				ctx->request_key);
+			if (rc != NGX_DECLINED)
+			{
+				return rc;
+			}
+		}
+
+		// make sure only one request builds the response, the others wait for it to be stored in the cache
+		ctx->state = STATE_HANDLE_METADATA_REQUEST;
+
+		rc = ngx_http_vod_cache_lock(ctx, cache, ctx->request_key);
+		if (rc != NGX_OK)
+		{
+			return rc;
+		}
+	}
+
 	rc = ngx_http_vod_update_timescale(ctx);
 	if (rc != NGX_OK)
 	{
@@ -2637,11 +4258,25 @@ ngx_http_vod_handle_metadata_request(ngx_http_vod_ctx_t *ctx)
 	{
 		ctx->submodule_context.media_set.has_multi_sequences = TRUE;
 	}
+
+	// Note: cached responses must be built in a single buffer
+	if (conf->manifest_streaming && 
+		cache == NULL && 
+		!ctx->submodule_context.r->header_only && 
+		ctx->submodule_context.r->method != NGX_HTTP_HEAD)
+	{
+		ctx->submodule_context.manifest_streaming = 1;
+	}
 	
 	rc = ctx->request->handle_metadata_request(
 		&ctx->submodule_context,
 		&response,
 		&content_type);
+	if (rc == NGX_AGAIN)
+	{
+		return ngx_http_vod_blocking_reload(ctx);
+	}
+
 	if (rc != NGX_OK)
 	{
 		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
@@ -2651,17 +4286,14 @@ ngx_http_vod_handle_metadata_request(ngx_http_vod_ctx_t *ctx)
 
 	ngx_perf_counter_end(ctx->perf_counters, ctx->perf_counter_context, PC_BUILD_MANIFEST);
 
-	if (ctx->submodule_context.media_set.original_type != MEDIA_SET_LIVE ||
-		(ctx->request->flags & REQUEST_FLAG_TIME_DEPENDENT_ON_LIVE) == 0)
-	{
-		cache_type = CACHE_TYPE_VOD;
-	}
-	else
+	ngx_http_vod_store_frames_index(ctx);
+
+	if (ctx->submodule_context.manifest_stream.next_chunk != NULL)
 	{
-		cache_type = CACHE_TYPE_LIVE;
+		// only the first chunk was built
+		return ngx_http_vod_start_manifest_stream(ctx, &response, &content_type);
 	}
 
-	cache = conf->response_cache[cache_type];
 	if (cache != NULL && response.data != NULL)
 	{
 		cache_header.content_type_len = content_type.len;
@@ -2691,14 +4323,142 @@ ngx_http_vod_handle_metadata_request(ngx_http_vod_ctx_t *ctx)
 		ctx->request);
 	if (rc != NGX_OK)
 	{
-		return rc;
+		return rc;
+	}
+	
+	return ngx_http_vod_send_response(ctx->submodule_context.r, &response, NULL);
+}
+
+////// Segment request handling
+
+// Note: only segments that are built in memory are saved in the response cache, range / HEAD requests
+//		and zero copy segments are not saved
+static ngx_int_t
+ngx_http_vod_lock_segment(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_buffer_cache_t* cache;
+	ngx_int_t rc;
+
+	if (conf->response_cache_max_segment_size <= 0 ||
+		r->headers_in.range != NULL ||
+		r->header_only ||
+		r->method == NGX_HTTP_HEAD ||
+		(conf->zero_copy_segments &&
+		(ctx->reader == &reader_file || ctx->reader == &reader_file_with_fallback)))
+	{
+		return NGX_OK;
+	}
+
+	cache = conf->response_cache[ctx->submodule_context.media_set.original_type == MEDIA_SET_LIVE ?
+		CACHE_TYPE_LIVE : CACHE_TYPE_VOD];
+	if (cache == NULL)
+	{
+		return NGX_OK;
+	}
+
+	if (ctx->cache_lock_waiting)
+	{
+		// woke up after waiting for the lock, check whether the segment was stored by the lock owner
+		rc = ngx_http_vod_send_cached_response(r, ctx->perf_counters, ctx->request, ctx->request_key);
+		if (rc != NGX_DECLINED)
+		{
+			return rc == NGX_OK ? NGX_DONE : rc;
+		}
+	}
+
+	// make sure only one request builds the segment, the others wait for it to be stored in the cache
+	ctx->cache_lock_owned = NULL;
+
+	rc = ngx_http_vod_cache_lock(ctx, cache, ctx->request_key);
+	if (rc != NGX_OK)
+	{
+		return rc;
+	}
+
+	ctx->segment_cache = cache;
+
+	return NGX_OK;
+}
+
+static void
+ngx_http_vod_store_segment(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_vod_write_segment_context_t* context = &ctx->write_segment_buffer_context;
+	response_cache_header_t cache_header;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_str_t* cache_buffers;
+	ngx_str_t* cur_buffer;
+	ngx_chain_t* cl;
+	size_t count;
+
+	if (context->total_size > ctx->submodule_context.conf->response_cache_max_segment_size)
+	{
+		return;
+	}
+
+	if (r->header_sent)
+	{
+		// the response was streamed, save the copy that was made while sending it
+		if (context->cache_start == NULL || context->cache_pos != context->cache_end)
+		{
+			return;
+		}
+
+		count = 1;
+	}
+	else
+	{
+		// the whole response is in the chain
+		count = 0;
+		for (cl = &ctx->out; cl != NULL; cl = cl->next)
+		{
+			count++;
+		}
+	}
+
+	cache_buffers = ngx_palloc(r->pool, sizeof(cache_buffers[0]) * (count + 2));
+	if (cache_buffers == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_store_segment: ngx_palloc failed");
+		return;
+	}
+
+	cache_header.content_type_len = r->headers_out.content_type.len;
+	cache_header.media_set_type = MEDIA_SET_VOD;
+	cache_buffers[0].data = (u_char*)&cache_header;
+	cache_buffers[0].len = sizeof(cache_header);
+	cache_buffers[1] = r->headers_out.content_type;
+
+	cur_buffer = cache_buffers + 2;
+	if (r->header_sent)
+	{
+		cur_buffer->data = context->cache_start;
+		cur_buffer->len = context->cache_end - context->cache_start;
+	}
+	else
+	{
+		for (cl = &ctx->out; cl != NULL; cl = cl->next, cur_buffer++)
+		{
+			cur_buffer->data = cl->buf->pos;
+			cur_buffer->len = cl->buf->last - cl->buf->pos;
+		}
+	}
+
+	if (ngx_buffer_cache_store_gather_perf(ctx->perf_counters, ctx->segment_cache, ctx->request_key, cache_buffers, count + 2))
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_store_segment: stored in response cache");
+	}
+	else
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_store_segment: failed to store response in cache");
 	}
-	
-	return ngx_http_vod_send_response(ctx->submodule_context.r, &response, NULL);
 }
 
-////// Segment request handling
-
 static ngx_int_t
 ngx_http_vod_state_machine_open_files(ngx_http_vod_ctx_t *ctx)
 {
@@ -2802,37 +4562,28 @@ ngx_http_vod_write_segment_header_buffer(void* ctx, u_char* buffer, uint32_t siz
 	return VOD_OK;
 }
 
-static vod_status_t 
-ngx_http_vod_write_segment_buffer(void* ctx, u_char* buffer, uint32_t size)
+static vod_status_t
+ngx_http_vod_write_segment_buf(ngx_http_vod_write_segment_context_t* context, ngx_buf_t* b, uint32_t size)
 {
-	ngx_http_vod_write_segment_context_t* context;
-	ngx_buf_t *b;
 	ngx_chain_t *chain;
 	ngx_chain_t out;
 	ngx_int_t rc;
 
-	if (size <= 0)
-	{
-		return VOD_OK;
-	}
-
-	context = (ngx_http_vod_write_segment_context_t*)ctx;
-	
-	// create a wrapping ngx_buf_t
-	b = ngx_calloc_buf(context->r->pool);
-	if (b == NULL) 
-	{
-		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, context->r->connection->log, 0,
-			"ngx_http_vod_write_segment_buffer: ngx_calloc_buf failed");
-		return VOD_ALLOC_FAILED;
-	}
-
-	b->pos = buffer;
-	b->last = buffer + size;
-	b->temporary = 1;
-
 	if (context->r->header_sent)
 	{
+		// save a copy for the response cache
+		if (context->cache_start != NULL)
+		{
+			if (size > (size_t)(context->cache_end - context->cache_pos))
+			{
+				context->cache_start = NULL;
+			}
+			else
+			{
+				context->cache_pos = ngx_copy(context->cache_pos, b->pos, size);
+			}
+		}
+
 		// headers already sent, output the chunk
 		out.buf = b;
 		out.next = NULL;
@@ -2843,7 +4594,7 @@ ngx_http_vod_write_segment_buffer(void* ctx, u_char* buffer, uint32_t size)
 			// either the connection dropped, or some allocation failed
 			// in case the connection dropped, the error code doesn't matter anyway
 			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, context->r->connection->log, 0,
-				"ngx_http_vod_write_segment_buffer: ngx_http_output_filter failed %i", rc);
+				"ngx_http_vod_write_segment_buf: ngx_http_output_filter failed %i", rc);
 			return VOD_ALLOC_FAILED;
 		}
 	}
@@ -2856,7 +4607,7 @@ ngx_http_vod_write_segment_buffer(void* ctx, u_char* buffer, uint32_t size)
 			if (chain == NULL) 
 			{
 				ngx_log_debug0(NGX_LOG_DEBUG_HTTP, context->r->connection->log, 0,
-					"ngx_http_vod_write_segment_buffer: ngx_alloc_chain_link failed");
+					"ngx_http_vod_write_segment_buf: ngx_alloc_chain_link failed");
 				return VOD_ALLOC_FAILED;
 			}
 
@@ -2871,6 +4622,70 @@ ngx_http_vod_write_segment_buffer(void* ctx, u_char* buffer, uint32_t size)
 	return VOD_OK;
 }
 
+static vod_status_t 
+ngx_http_vod_write_segment_buffer(void* ctx, u_char* buffer, uint32_t size)
+{
+	ngx_http_vod_write_segment_context_t* context;
+	ngx_buf_t *b;
+
+	if (size <= 0)
+	{
+		return VOD_OK;
+	}
+
+	context = (ngx_http_vod_write_segment_context_t*)ctx;
+	
+	// create a wrapping ngx_buf_t
+	b = ngx_calloc_buf(context->r->pool);
+	if (b == NULL) 
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, context->r->connection->log, 0,
+			"ngx_http_vod_write_segment_buffer: ngx_calloc_buf failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	b->pos = buffer;
+	b->last = buffer + size;
+	b->temporary = 1;
+
+	return ngx_http_vod_write_segment_buf(context, b, size);
+}
+
+static vod_status_t
+ngx_http_vod_write_segment_file_range(void* ctx, void* source, uint64_t offset, uint32_t size)
+{
+	ngx_http_vod_write_segment_context_t* context;
+	ngx_file_reader_state_t* reader_context;
+	ngx_buf_t *b;
+
+	if (size <= 0)
+	{
+		return VOD_OK;
+	}
+
+	context = (ngx_http_vod_write_segment_context_t*)ctx;
+	reader_context = ((media_clip_source_t*)source)->reader_context;
+
+	if (offset + size > (uint64_t)reader_context->file_size)
+	{
+		ngx_log_error(NGX_LOG_ERR, context->r->connection->log, 0,
+			"ngx_http_vod_write_segment_file_range: end offset %uL exceeds file size %O, probably a truncated file", 
+			offset + size, reader_context->file_size);
+		return VOD_BAD_DATA;
+	}
+
+	// create a file buffer, the data is sent without being read by the module (e.g. using sendfile)
+	b = ngx_file_reader_create_file_buf(reader_context, offset, offset + size);
+	if (b == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, context->r->connection->log, 0,
+			"ngx_http_vod_write_segment_file_range: ngx_file_reader_create_file_buf failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	return ngx_http_vod_write_segment_buf(context, b, size);
+}
+
 static ngx_int_t 
 ngx_http_vod_init_frame_processing(ngx_http_vod_ctx_t *ctx)
 {
@@ -2896,6 +4711,13 @@ ngx_http_vod_init_frame_processing(ngx_http_vod_ctx_t *ctx)
 	ctx->segment_writer.write_head = ngx_http_vod_write_segment_header_buffer;
 	ctx->segment_writer.context = &ctx->write_segment_buffer_context;
 
+	// Note: file buffers can be used only when the frames are read from local files
+	if (ctx->submodule_context.conf->zero_copy_segments &&
+		(ctx->reader == &reader_file || ctx->reader == &reader_file_with_fallback))
+	{
+		ctx->segment_writer.write_file_range = ngx_http_vod_write_segment_file_range;
+	}
+
 	// initialize the protocol specific frame processor
 	ngx_perf_counter_start(ctx->perf_counter_context);
 
@@ -2935,6 +4757,30 @@ ngx_http_vod_init_frame_processing(ngx_http_vod_ctx_t *ctx)
 			return NGX_DONE;
 		}
 
+		// allocate a buffer for saving the streamed response in the response cache
+		if (ctx->segment_cache != NULL)
+		{
+			if (ctx->content_length > ctx->submodule_context.conf->response_cache_max_segment_size)
+			{
+				// the segment will not be saved, let the waiting requests build it in parallel
+				ctx->segment_cache = NULL;
+				ngx_http_vod_cache_unlock(ctx);
+			}
+			else
+			{
+				ctx->write_segment_buffer_context.cache_start = ngx_palloc(r->pool, ctx->content_length);
+				if (ctx->write_segment_buffer_context.cache_start == NULL)
+				{
+					ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+						"ngx_http_vod_init_frame_processing: ngx_palloc failed");
+					return ngx_http_vod_status_to_ngx_error(r, VOD_ALLOC_FAILED);
+				}
+
+				ctx->write_segment_buffer_context.cache_pos = ctx->write_segment_buffer_context.cache_start;
+				ctx->write_segment_buffer_context.cache_end = ctx->write_segment_buffer_context.cache_start + ctx->content_length;
+			}
+		}
+
 		// in case of range request, get the end offset
 		if (ctx->submodule_context.r->headers_in.range != NULL &&
 			ngx_http_vod_range_parse(
@@ -3004,6 +4850,10 @@ ngx_http_vod_process_media_frames(ngx_http_vod_ctx_t *ctx)
 			// handled outside the switch
 			break;
 
+		case VOD_DONE:
+			// the frame processor resumes the state machine when its async operation completes
+			return NGX_AGAIN;
+
 		default:
 			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
 				"ngx_http_vod_process_media_frames: frame_processor failed %i", rc);
@@ -3022,13 +4872,11 @@ ngx_http_vod_process_media_frames(ngx_http_vod_ctx_t *ctx)
 			&ctx->read_cache_state,
 			&read_buf);
 
-		cache_buffer_size = ctx->submodule_context.conf->cache_buffer_size;
+		// Note: allocating at least the cache buffer size, so that the buffer can be reused by subsequent reads
+		cache_buffer_size = ngx_max(read_buf.size, ctx->submodule_context.conf->cache_buffer_size);
 
 		ctx->read_buffer.start = read_buf.buffer;
-		if (read_buf.buffer != NULL)
-		{
-			ctx->read_buffer.end = read_buf.buffer + cache_buffer_size;
-		}
+		ctx->read_buffer.end = read_buf.buffer_end;
 
 		rc = ngx_http_vod_alloc_read_buffer(ctx, cache_buffer_size, ctx->alloc_params_index);
 		if (rc != NGX_OK)
@@ -3086,6 +4934,11 @@ ngx_http_vod_finalize_segment_response(ngx_http_vod_ctx_t *ctx)
 				ctx->write_segment_buffer_context.total_size, ctx->content_length);
 		}
 
+		if (ctx->segment_cache != NULL)
+		{
+			ngx_http_vod_store_segment(ctx);
+		}
+
 		rc = ngx_http_send_special(r, NGX_HTTP_LAST);
 		if (rc != NGX_OK && rc != NGX_AGAIN)
 		{
@@ -3107,6 +4960,11 @@ ngx_http_vod_finalize_segment_response(ngx_http_vod_ctx_t *ctx)
 	ctx->write_segment_buffer_context.chain_end->next = NULL;
 	ctx->write_segment_buffer_context.chain_end->buf->last_buf = 1;
 
+	if (ctx->segment_cache != NULL)
+	{
+		ngx_http_vod_store_segment(ctx);
+	}
+
 	// send the response header
 	rc = ngx_http_vod_send_header(r, ctx->write_segment_buffer_context.total_size, NULL, MEDIA_SET_VOD, NULL);
 	if (rc != NGX_OK)
@@ -3139,6 +4997,10 @@ ngx_http_vod_init_process(ngx_cycle_t *cycle)
 
 	audio_filter_process_init(cycle->log);
 
+#if (NGX_THREADS)
+	ngx_queue_init(&ngx_http_vod_filter_pending_jobs);
+#endif // NGX_THREADS
+
 #if (NGX_HAVE_LIB_AV_CODEC)
 	audio_decoder_process_init(cycle->log);
 	audio_encoder_process_init(cycle->log);
@@ -3367,23 +5229,272 @@ ngx_http_vod_run_generators(ngx_http_vod_ctx_t *ctx)
 			return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
 		}
 
-		ngx_http_vod_update_source_tracks(&ctx->submodule_context.request_context, ctx->cur_source);
+		ngx_http_vod_update_source_tracks(&ctx->submodule_context.request_context, ctx->cur_source);
+	}
+
+	ctx->cur_source = NULL;
+
+	return NGX_OK;
+}
+
+////// Audio filter cache
+
+static void
+ngx_http_vod_audio_filter_cache_get_key(vod_str_t* key, u_char* result)
+{
+	ngx_md5_t md5;
+
+	ngx_md5_init(&md5);
+	ngx_md5_update(&md5, key->data, key->len);
+	ngx_md5_final(result, &md5);
+}
+
+static vod_status_t
+ngx_http_vod_audio_filter_cache_fetch(void* context, vod_str_t* key, vod_str_t* result)
+{
+	ngx_http_vod_ctx_t *ctx = context;
+	ngx_buffer_cache_t* cache = ctx->submodule_context.conf->audio_filter_cache;
+	u_char cache_key[BUFFER_CACHE_KEY_SIZE];
+	ngx_str_t buffer;
+	uint32_t token;
+
+	ngx_http_vod_audio_filter_cache_get_key(key, cache_key);
+
+	if (!ngx_buffer_cache_fetch(cache, cache_key, &buffer, &token))
+	{
+		return VOD_NOT_FOUND;
+	}
+
+	result->data = ngx_palloc(ctx->submodule_context.r->pool, buffer.len);
+	if (result->data == NULL)
+	{
+		ngx_buffer_cache_release(cache, cache_key, token);
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_audio_filter_cache_fetch: ngx_palloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	ngx_memcpy(result->data, buffer.data, buffer.len);
+	result->len = buffer.len;
+
+	ngx_buffer_cache_release(cache, cache_key, token);
+
+	return VOD_OK;
+}
+
+static void
+ngx_http_vod_audio_filter_cache_store(void* context, vod_str_t* key, vod_str_t* buffers, size_t buffer_count)
+{
+	ngx_http_vod_ctx_t *ctx = context;
+	u_char cache_key[BUFFER_CACHE_KEY_SIZE];
+
+	ngx_http_vod_audio_filter_cache_get_key(key, cache_key);
+
+	if (ngx_buffer_cache_store_gather(ctx->submodule_context.conf->audio_filter_cache, cache_key, buffers, buffer_count))
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_audio_filter_cache_store: stored in audio filter cache");
+	}
+	else
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_audio_filter_cache_store: failed to store in audio filter cache");
+	}
+}
+
+////// Audio filter thread pool
+
+#if (NGX_THREADS)
+static void
+ngx_http_vod_filter_thread_handler(void* data, ngx_log_t* log)
+{
+	ngx_http_vod_filter_thread_state_t* state = data;
+
+	state->rc = filter_process_deferred(state->filter_state);
+}
+
+static void
+ngx_http_vod_filter_start_pending_jobs(void)
+{
+	ngx_http_vod_filter_thread_state_t* state;
+	ngx_queue_t* q;
+
+	while (!ngx_queue_empty(&ngx_http_vod_filter_pending_jobs))
+	{
+		q = ngx_queue_head(&ngx_http_vod_filter_pending_jobs);
+		state = ngx_queue_data(q, ngx_http_vod_filter_thread_state_t, queue);
+		if (state->max_jobs != 0 && ngx_http_vod_filter_active_jobs >= state->max_jobs)
+		{
+			break;
+		}
+
+		ngx_queue_remove(q);
+
+		ngx_http_vod_filter_active_jobs++;
+
+		if (ngx_thread_task_post(state->thread_pool, state->task) != NGX_OK)
+		{
+			ngx_log_error(NGX_LOG_ERR, state->r->connection->log, 0,
+				"ngx_http_vod_filter_start_pending_jobs: ngx_thread_task_post failed");
+
+			// complete the job with an error, the request is resumed by the event handler
+			state->rc = VOD_UNEXPECTED;
+			ngx_post_event(&state->task->event, &ngx_posted_events);
+		}
+	}
+}
+
+static void
+ngx_http_vod_filter_thread_event_handler(ngx_event_t* ev)
+{
+	ngx_http_vod_filter_thread_state_t* state = ev->data;
+	ngx_http_request_t* r = state->r;
+	ngx_connection_t* c = r->connection;
+
+	r->main->blocked--;
+	r->aio = 0;
+
+	state->processed = 1;
+
+	ngx_http_vod_filter_active_jobs--;
+
+	ngx_http_vod_filter_start_pending_jobs();
+
+	ngx_http_vod_frame_processor_completed(r);
+
+	ngx_http_run_posted_requests(c);
+}
+
+static vod_status_t
+ngx_http_vod_filter_thread_process(void* context)
+{
+	ngx_http_vod_filter_thread_state_t* state = context;
+	ngx_http_request_t* r = state->r;
+	vod_status_t rc;
+
+	if (state->processed)
+	{
+		state->processed = 0;
+
+		if (state->rc != VOD_OK)
+		{
+			return state->rc;
+		}
+	}
+
+	rc = filter_run_state_machine(state->filter_state);
+	if (rc != VOD_DONE)
+	{
+		return rc;
+	}
+
+	// the frames of the current track were read, decode / filter / encode on the thread pool
+	if (state->max_jobs != 0 && ngx_http_vod_filter_active_jobs >= state->max_jobs)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_filter_thread_process: %ui jobs are active, queueing", ngx_http_vod_filter_active_jobs);
+
+		// Note: the job is posted when one of the active jobs completes
+		ngx_queue_insert_tail(&ngx_http_vod_filter_pending_jobs, &state->queue);
+	}
+	else
+	{
+		if (ngx_thread_task_post(state->thread_pool, state->task) != NGX_OK)
+		{
+			ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+				"ngx_http_vod_filter_thread_process: ngx_thread_task_post failed");
+			return VOD_UNEXPECTED;
+		}
+
+		ngx_http_vod_filter_active_jobs++;
+	}
+
+	r->main->blocked++;
+	r->aio = 1;
+
+	// Note: VOD_DONE signals the module that the processing continues asynchronously
+	return VOD_DONE;
+}
+
+static ngx_int_t
+ngx_http_vod_filter_thread_init(ngx_http_vod_ctx_t *ctx, ngx_pool_t** output_pool)
+{
+	ngx_http_vod_filter_thread_state_t* state;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	ngx_pool_cleanup_t* cln;
+	ngx_pool_t* pool;
+
+	state = ngx_pcalloc(r->pool, sizeof(*state));
+	if (state == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_filter_thread_init: ngx_pcalloc failed");
+		return NGX_HTTP_INTERNAL_SERVER_ERROR;
+	}
+
+	state->task = ngx_thread_task_alloc(r->pool, 0);
+	if (state->task == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_filter_thread_init: ngx_thread_task_alloc failed");
+		return NGX_HTTP_INTERNAL_SERVER_ERROR;
+	}
+
+	state->task->ctx = state;
+	state->task->handler = ngx_http_vod_filter_thread_handler;
+	state->task->event.data = state;
+	state->task->event.handler = ngx_http_vod_filter_thread_event_handler;
+
+	// Note: the encoded frames are allocated from a dedicated pool, since the request pool may be used
+	//		by other requests on the event loop thread (e.g. subrequests) while the job is running
+	pool = ngx_create_pool(ngx_pagesize, r->connection->log);
+	if (pool == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_filter_thread_init: ngx_create_pool failed");
+		return NGX_HTTP_INTERNAL_SERVER_ERROR;
 	}
 
-	ctx->cur_source = NULL;
+	cln = ngx_pool_cleanup_add(r->pool, 0);
+	if (cln == NULL)
+	{
+		ngx_destroy_pool(pool);
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_filter_thread_init: ngx_pool_cleanup_add failed");
+		return NGX_HTTP_INTERNAL_SERVER_ERROR;
+	}
+
+	cln->handler = (ngx_pool_cleanup_pt)ngx_destroy_pool;
+	cln->data = pool;
+
+	state->r = r;
+	state->thread_pool = ctx->submodule_context.conf->audio_filter_thread_pool;
+	state->max_jobs = ctx->submodule_context.conf->audio_filter_max_jobs;
+
+	ctx->frame_processor = ngx_http_vod_filter_thread_process;
+	ctx->frame_processor_state = state;
+
+	*output_pool = pool;
 
 	return NGX_OK;
 }
+#endif // NGX_THREADS
 
 static ngx_int_t
 ngx_http_vod_run_state_machine(ngx_http_vod_ctx_t *ctx)
 {
+	audio_filter_cache_t* filter_cache;
+	ngx_pool_t* output_pool;
 	ngx_int_t rc;
 	uint32_t max_frame_count;
 	uint32_t output_codec_id;
+	void** filter_state;
 
 	switch (ctx->state)
 	{
+	case STATE_HANDLE_METADATA_REQUEST:
+		return ngx_http_vod_handle_metadata_request(ctx);
+
 	case STATE_READ_DRM_INFO:
 		rc = ngx_http_vod_state_machine_get_drm_info(ctx);
 		if (rc != NGX_OK)
@@ -3435,7 +5546,7 @@ ngx_http_vod_run_state_machine(ngx_http_vod_ctx_t *ctx)
 			rc = filter_init_filtered_clips(
 				&ctx->submodule_context.request_context,
 				&ctx->submodule_context.media_set, 
-				(ctx->request->parse_type & PARSE_FLAG_FRAMES_DURATION) != 0);
+				(ctx->request->parse_type & PARSE_FLAG_FRAMES_DURATION) != 0 && !ctx->frames_index_found);
 			if (rc != VOD_OK)
 			{
 				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
@@ -3454,12 +5565,30 @@ ngx_http_vod_run_state_machine(ngx_http_vod_ctx_t *ctx)
 			{
 				return ngx_http_vod_handle_metadata_request(ctx);
 			}
+		}
+
+		ctx->state = STATE_LOCK_SEGMENT;
+		// fall through
+
+	case STATE_LOCK_SEGMENT:
+		if (ctx->request != NULL)
+		{
+			rc = ngx_http_vod_lock_segment(ctx);
+			if (rc != NGX_OK)
+			{
+				if (rc == NGX_DONE)
+				{
+					rc = NGX_OK;		// served from the response cache
+				}
+				return rc;
+			}
 
 			// initialize the read cache
 			read_cache_init(
 				&ctx->read_cache_state,
 				&ctx->submodule_context.request_context,
 				ctx->submodule_context.conf->cache_buffer_size,
+				ctx->submodule_context.conf->max_coalesced_read_size,
 				ctx->alignment);
 		}
 
@@ -3536,21 +5665,54 @@ ngx_http_vod_run_state_machine(ngx_http_vod_ctx_t *ctx)
 				output_codec_id = VOD_CODEC_ID_AAC;
 			}
 
+			filter_cache = NULL;
+			if (ctx->submodule_context.conf->audio_filter_cache != NULL)
+			{
+				filter_cache = ngx_palloc(ctx->submodule_context.r->pool, sizeof(*filter_cache));
+				if (filter_cache == NULL)
+				{
+					ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
+						"ngx_http_vod_run_state_machine: ngx_palloc failed");
+					return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_ALLOC_FAILED);
+				}
+
+				filter_cache->fetch = ngx_http_vod_audio_filter_cache_fetch;
+				filter_cache->store = ngx_http_vod_audio_filter_cache_store;
+				filter_cache->context = ctx;
+			}
+
+			output_pool = NULL;
+			filter_state = &ctx->frame_processor_state;
+			ctx->frame_processor = filter_run_state_machine;
+
+#if (NGX_THREADS)
+			if (ctx->submodule_context.conf->audio_filter_thread_pool != NULL)
+			{
+				rc = ngx_http_vod_filter_thread_init(ctx, &output_pool);
+				if (rc != NGX_OK)
+				{
+					return rc;
+				}
+
+				filter_state = &((ngx_http_vod_filter_thread_state_t*)ctx->frame_processor_state)->filter_state;
+			}
+#endif // NGX_THREADS
+
 			rc = filter_init_state(
 				&ctx->submodule_context.request_context,
 				&ctx->read_cache_state,
 				&ctx->submodule_context.media_set,
 				max_frame_count,
 				output_codec_id,
-				&ctx->frame_processor_state);
+				output_pool,
+				filter_cache,
+				filter_state);
 			if (rc != VOD_OK)
 			{
 				ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
 					"ngx_http_vod_run_state_machine: filter_init_state failed %i", rc);
 				return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, rc);
 			}
-
-			ctx->frame_processor = filter_run_state_machine;
 		}
 
 		// fall through
@@ -3625,6 +5787,29 @@ ngx_http_vod_run_state_machine(ngx_http_vod_ctx_t *ctx)
 	return ngx_http_vod_status_to_ngx_error(ctx->submodule_context.r, VOD_UNEXPECTED);
 }
 
+void
+ngx_http_vod_frame_processor_completed(ngx_http_request_t *r)
+{
+	ngx_http_vod_ctx_t *ctx;
+	ngx_int_t rc;
+
+	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
+
+	rc = ctx->state_machine(ctx);
+	if (rc == NGX_AGAIN)
+	{
+		return;
+	}
+
+	if (rc != NGX_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_frame_processor_completed: state machine failed %i", rc);
+	}
+
+	ngx_http_vod_finalize_request(ctx, rc);
+}
+
 static void
 ngx_http_vod_handle_read_completed(void* context, ngx_int_t rc, ngx_buf_t* buf, ssize_t bytes_read)
 {
@@ -3655,6 +5840,20 @@ ngx_http_vod_handle_read_completed(void* context, ngx_int_t rc, ngx_buf_t* buf,
 			goto finalize_request;
 		}
 
+		if (ctx->state == STATE_READ_METADATA_INDEX_READ)
+		{
+			// the index is optional, read the media file
+			ctx->state = STATE_READ_METADATA_OPEN_FILE;
+
+			rc = ctx->state_machine(ctx);
+			if (rc == NGX_AGAIN)
+			{
+				return;
+			}
+
+			goto finalize_request;
+		}
+
 		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
 			"ngx_http_vod_handle_read_completed: read failed %i", rc);
 		goto finalize_request;
@@ -3677,6 +5876,7 @@ ngx_http_vod_handle_read_completed(void* context, ngx_int_t rc, ngx_buf_t* buf,
 		switch (ctx->state)
 		{
 		case STATE_MAP_READ:		// the mapping state machine handles the case of empty mapping
+		case STATE_READ_METADATA_INDEX_READ:		// validated by the state machine
 			break;
 
 		case STATE_READ_METADATA_READ:
@@ -3844,6 +6044,12 @@ ngx_http_vod_start_processing_media_file(ngx_http_vod_ctx_t *ctx)
 		}
 	}
 
+	// skip the parsing of the frames if the frames index was already built
+	if (ctx->request != NULL)
+	{
+		ngx_http_vod_fetch_frames_index(ctx);
+	}
+
 	// restart the file index/uri params
 	ctx->cur_source = ctx->submodule_context.media_set.sources_head;
 
@@ -4309,6 +6515,90 @@ ngx_http_vod_local_request_handler(ngx_http_request_t *r)
 
 ////// Mapped mode only
 
+static ngx_flag_t
+ngx_http_vod_map_is_path_response(ngx_http_vod_loc_conf_t* conf, ngx_str_t* mapping)
+{
+	return mapping->len >= conf->path_response_prefix.len + conf->path_response_postfix.len &&
+		ngx_memcmp(mapping->data, conf->path_response_prefix.data, conf->path_response_prefix.len) == 0 &&
+		ngx_memcmp(mapping->data + mapping->len - conf->path_response_postfix.len,
+			conf->path_response_postfix.data, conf->path_response_postfix.len) == 0 &&
+		memchr(mapping->data + conf->path_response_prefix.len, '"',
+			mapping->len - conf->path_response_prefix.len - conf->path_response_postfix.len) == NULL;
+}
+
+static ngx_int_t
+ngx_http_vod_map_validate(ngx_http_vod_ctx_t *ctx, ngx_str_t* mapping)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	vod_json_value_t json;
+	vod_json_status_t rc;
+	ngx_str_t compiled;
+	u_char error[128];
+
+	rc = vod_json_parse(ctx->submodule_context.request_context.pool, mapping->data, &json, error, sizeof(error));
+	if (rc != VOD_JSON_OK)
+	{
+		ngx_log_error(NGX_LOG_WARN, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_map_validate: failed to parse json %i: %s", rc, error);
+		return NGX_ERROR;
+	}
+
+	// store the same form that is stored on a cache miss (only media set mappings are compiled)
+	if (!conf->mapping_cache_compiled ||
+		ctx->mapping.apply != ngx_http_vod_map_media_set_apply ||
+		ngx_http_vod_map_is_path_response(conf, mapping))
+	{
+		return NGX_OK;
+	}
+
+	rc = vod_json_compile(ctx->submodule_context.request_context.pool, &json, &compiled);
+	if (rc != VOD_JSON_OK)
+	{
+		ngx_log_error(NGX_LOG_WARN, ctx->submodule_context.request_context.log, 0,
+			"ngx_http_vod_map_validate: vod_json_compile failed %i", rc);
+		return NGX_ERROR;
+	}
+
+	*mapping = compiled;
+
+	return NGX_OK;
+}
+
+// Note: only http mappings are refreshed, stale entries are not used with other readers
+static ngx_int_t
+ngx_http_vod_map_refresh(ngx_http_vod_ctx_t *ctx, ngx_buffer_cache_t* cache, ngx_str_t* uri)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	ngx_child_request_params_t child_params;
+
+	if (ctx->upstream_extra_args.len == 0 && conf->upstream_extra_args != NULL)
+	{
+		if (ngx_http_complex_value(
+			ctx->submodule_context.r,
+			conf->upstream_extra_args,
+			&ctx->upstream_extra_args) != NGX_OK)
+		{
+			return NGX_ERROR;
+		}
+	}
+
+	ngx_memzero(&child_params, sizeof(child_params));
+	child_params.method = NGX_HTTP_GET;
+	child_params.base_uri = *uri;
+	child_params.extra_args = ctx->upstream_extra_args;
+	child_params.range_start = 0;
+	child_params.range_end = ctx->mapping.max_response_size;
+
+	return ngx_http_vod_cache_refresh(
+		ctx,
+		cache,
+		ctx->mapping.cache_key,
+		&conf->upstream_location,
+		&child_params,
+		ctx->mapping.max_response_size,
+		ngx_http_vod_map_validate);
+}
+
 static ngx_int_t
 ngx_http_vod_map_run_step(ngx_http_vod_ctx_t *ctx)
 {
@@ -4319,7 +6609,9 @@ ngx_http_vod_map_run_step(ngx_http_vod_ctx_t *ctx)
 	ngx_str_t uri;
 	ngx_md5_t md5;
 	ngx_int_t rc;
+	ngx_flag_t stale;
 	size_t read_size;
+	uint32_t cache_index;
 	int store_cache_index;
 	int fetch_cache_index;
 	uint32_t cache_token;
@@ -4345,18 +6637,21 @@ ngx_http_vod_map_run_step(ngx_http_vod_ctx_t *ctx)
 		ngx_md5_final(ctx->mapping.cache_key, &md5);
 
 		// try getting the mapping from cache
+		stale = 0;
 		fetch_cache_index = ngx_buffer_cache_fetch_multi_perf(
 			ctx->perf_counters,
 			ctx->mapping.caches,
 			ctx->mapping.cache_count,
 			ctx->mapping.cache_key,
 			&mapping,
-			&cache_token);
+			&cache_token,
+			ngx_http_vod_cache_allow_stale(ctx->submodule_context.r) && ctx->reader == &reader_http ? &stale : NULL);
 		if (fetch_cache_index >= 0)
 		{
 			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
 				"ngx_http_vod_map_run_step: mapping cache hit %V", &mapping);
 
+			ctx->mapping.cache_hit = 1;
 			rc = ctx->mapping.apply(ctx, &mapping, &store_cache_index);
 
 			ngx_buffer_cache_release(
@@ -4369,6 +6664,15 @@ ngx_http_vod_map_run_step(ngx_http_vod_ctx_t *ctx)
 				return rc;
 			}
 
+			if (stale)
+			{
+				rc = ngx_http_vod_map_refresh(ctx, ctx->mapping.caches[fetch_cache_index], &uri);
+				if (rc != NGX_OK)
+				{
+					return rc;
+				}
+			}
+
 			break;
 		}
 		else
@@ -4377,6 +6681,21 @@ ngx_http_vod_map_run_step(ngx_http_vod_ctx_t *ctx)
 				"ngx_http_vod_map_run_step: mapping cache miss");
 		}
 
+		// make sure only one request fetches the mapping (the lock is taken on the first cache)
+		for (cache_index = 0; cache_index < ctx->mapping.cache_count; cache_index++)
+		{
+			if (ctx->mapping.caches[cache_index] != NULL)
+			{
+				rc = ngx_http_vod_cache_lock(ctx, ctx->mapping.caches[cache_index], ctx->mapping.cache_key);
+				if (rc != NGX_OK)
+				{
+					return rc;
+				}
+
+				break;
+			}
+		}
+
 		// open the mapping file
 		ctx->submodule_context.request_context.log->action = "getting mapping";
 
@@ -4470,13 +6789,20 @@ ngx_http_vod_map_run_step(ngx_http_vod_ctx_t *ctx)
 
 		mapping.data = response->pos;
 		mapping.len = response->last - response->pos;
+		ctx->mapping.compiled.len = 0;
+		ctx->mapping.cache_hit = 0;
 		rc = ctx->mapping.apply(ctx, &mapping, &store_cache_index);
 		if (rc != NGX_OK)
 		{
 			return rc;
 		}
 
-		// save to cache
+		// save to cache (the compiled form of the mapping, if the apply function generated it)
+		if (ctx->mapping.compiled.len > 0)
+		{
+			mapping = ctx->mapping.compiled;
+		}
+
 		cache = ctx->mapping.caches[store_cache_index];
 		if (cache != NULL)
 		{
@@ -4484,8 +6810,8 @@ ngx_http_vod_map_run_step(ngx_http_vod_ctx_t *ctx)
 				ctx->perf_counters,
 				cache,
 				ctx->mapping.cache_key,
-				response->pos,
-				response->last - response->pos))
+				mapping.data,
+				mapping.len))
 			{
 				ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
 					"ngx_http_vod_map_run_step: stored in mapping cache");
@@ -4560,7 +6886,11 @@ ngx_http_vod_map_source_clip_apply(ngx_http_vod_ctx_t *ctx, ngx_str_t* mapping,
 	media_clip_source_t* cur_clip = vod_container_of(ctx->cur_clip, media_clip_source_t, base);
 	vod_status_t rc;
 
-	rc = media_set_map_source(&ctx->submodule_context.request_context, mapping->data, cur_clip);
+	rc = media_set_map_source(
+		&ctx->submodule_context.request_context, 
+		mapping, 
+		ctx->mapping.cache_hit && vod_json_is_compiled(mapping),
+		cur_clip);
 	if (rc != VOD_OK)
 	{
 		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->submodule_context.request_context.log, 0,
@@ -4924,9 +7254,11 @@ ngx_http_vod_map_media_set_apply(ngx_http_vod_ctx_t *ctx, ngx_str_t* mapping, in
 	ngx_str_t override;
 	ngx_str_t src_path;
 	ngx_str_t path;
+	ngx_str_t* compiled;
 	ngx_int_t rc;
 	uint32_t request_flags;
 	u_char* override_str = NULL;
+	bool_t is_compiled;
 
 	if (conf->media_set_override_json != NULL)
 	{
@@ -4956,13 +7288,12 @@ ngx_http_vod_map_media_set_apply(ngx_http_vod_ctx_t *ctx, ngx_str_t* mapping, in
 		}
 	}
 
+	// Note: only mappings fetched from the cache can be compiled, an upstream response is always parsed as json
+	is_compiled = ctx->mapping.cache_hit && vod_json_is_compiled(mapping);
+
 	// optimization for the case of simple mapping response
-	if (mapping->len >= conf->path_response_prefix.len + conf->path_response_postfix.len &&
-		ngx_memcmp(mapping->data, conf->path_response_prefix.data, conf->path_response_prefix.len) == 0 &&
-		ngx_memcmp(mapping->data + mapping->len - conf->path_response_postfix.len,
-			conf->path_response_postfix.data, conf->path_response_postfix.len) == 0 &&
-		memchr(mapping->data + conf->path_response_prefix.len, '"',
-			mapping->len - conf->path_response_prefix.len - conf->path_response_postfix.len) == NULL &&
+	if (!is_compiled &&
+		ngx_http_vod_map_is_path_response(conf, mapping) &&
 		override_str == NULL)
 	{
 		src_path.len = mapping->len - conf->path_response_prefix.len - conf->path_response_postfix.len;
@@ -5030,14 +7361,19 @@ ngx_http_vod_map_media_set_apply(ngx_http_vod_ctx_t *ctx, ngx_str_t* mapping, in
 		request_flags |= REQUEST_FLAG_FORCE_PLAYLIST_TYPE_VOD;
 	}
 
+	// on cache miss, compile the json in order to save the parsing on subsequent cache hits
+	compiled = conf->mapping_cache_compiled && !is_compiled ? &ctx->mapping.compiled : NULL;
+
 	rc = media_set_parse_json(
 		&ctx->submodule_context.request_context,
-		mapping->data,
+		mapping,
+		is_compiled,
 		override_str,
 		&ctx->submodule_context.request_params,
 		ctx->submodule_context.media_set.segmenter_conf,
 		cur_source,
 		request_flags,
+		compiled,
 		&mapped_media_set);
 
 	switch (rc)
@@ -5285,6 +7621,7 @@ ngx_http_vod_parse_uri(
 	}
 
 	request_params->segment_index = INVALID_SEGMENT_INDEX;
+	request_params->part_index = INVALID_PART_INDEX;
 	request_params->segment_time = INVALID_SEGMENT_TIME;
 
 	rc = conf->submodule.parse_uri_file_name(r, conf, uri_file_name.data, uri_file_name.data + uri_file_name.len, request_params, request);
@@ -5330,26 +7667,101 @@ ngx_http_vod_parse_uri(
 	return NGX_OK;
 }
 
+static void
+ngx_http_vod_init_ctx(
+	ngx_http_vod_ctx_t *ctx,
+	ngx_http_request_t *r,
+	ngx_http_vod_loc_conf_t *conf,
+	const ngx_http_vod_request_t* request,
+	request_params_t* request_params,
+	media_set_t* media_set)
+{
+	ngx_http_core_loc_conf_t *clcf;
+
+	ctx->submodule_context.r = r;
+	ctx->submodule_context.conf = conf;
+	ctx->submodule_context.request_params = *request_params;
+	ctx->submodule_context.media_set = *media_set;
+	ctx->submodule_context.media_set.segmenter_conf = &conf->segmenter;
+	ctx->submodule_context.media_set.version = request_params->version;
+	ctx->request = request;
+	ctx->cur_source = media_set->sources_head;
+	ctx->submodule_context.request_context.pool = r->pool;
+	ctx->submodule_context.request_context.log = r->connection->log;
+	ctx->submodule_context.request_context.output_buffer_pool = conf->output_buffer_pool;
+
+	clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+	ctx->alloc_params[READER_FILE].alignment = clcf->directio_alignment;
+	ctx->alloc_params[READER_HTTP].alignment = 1;	// don't care about alignment in case of remote
+	ctx->alloc_params[READER_HTTP].extra_size = conf->max_upstream_headers_size + 1;	// the + 1 is discussed here: http://trac.nginx.org/nginx/ticket/680
+
+	ngx_http_set_ctx(r, ctx, ngx_http_vod_module);
+}
+
+// restarts the processing of a blocking playlist request from the loading of the media set.
+// Note: a new context is allocated, since the previous one may still be referenced by background requests
+static ngx_int_t
+ngx_http_vod_reload_media_set(ngx_http_vod_ctx_t *ctx)
+{
+	ngx_http_vod_loc_conf_t* conf = ctx->submodule_context.conf;
+	ngx_http_request_t* r = ctx->submodule_context.r;
+	const ngx_http_vod_request_t* request;
+	request_params_t request_params;
+	media_set_t media_set;
+	ngx_http_vod_ctx_t *new_ctx;
+	ngx_int_t rc;
+
+	ngx_memzero(&request_params, sizeof(request_params));
+	ngx_memzero(&media_set, sizeof(media_set));
+
+	rc = ngx_http_vod_parse_uri(r, conf, &request_params, &media_set, &request);
+	if (rc != NGX_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_reload_media_set: ngx_http_vod_parse_uri failed %i", rc);
+		return rc;
+	}
+
+	new_ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_vod_ctx_t));
+	if (new_ctx == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_reload_media_set: ngx_pcalloc failed");
+		return NGX_ERROR;
+	}
+
+	ngx_http_vod_init_ctx(new_ctx, r, conf, request, &request_params, &media_set);
+
+	ngx_memcpy(new_ctx->request_key, ctx->request_key, sizeof(new_ctx->request_key));
+	new_ctx->blocking_reload = 1;
+	new_ctx->blocking_reload_event = ctx->blocking_reload_event;
+	new_ctx->perf_counters = ctx->perf_counters;
+	ngx_perf_counter_copy(new_ctx->total_perf_counter_context, ctx->total_perf_counter_context);
+	new_ctx->submodule_context.request_context.time = ctx->submodule_context.request_context.time;
+
+	ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+		"ngx_http_vod_reload_media_set: reloading the media set");
+
+	return conf->request_handler(r);
+}
+
 ngx_int_t
 ngx_http_vod_handler(ngx_http_request_t *r)
 {
 	ngx_perf_counter_context(pcctx);
-	response_cache_header_t cache_header;
 	ngx_perf_counters_t* perf_counters;
 	ngx_http_vod_ctx_t *ctx;
 	request_params_t request_params;
 	media_set_t media_set;
 	const ngx_http_vod_request_t* request;
-	ngx_http_core_loc_conf_t *clcf;
 	ngx_http_vod_loc_conf_t *conf;
 	u_char request_key[BUFFER_CACHE_KEY_SIZE];
 	ngx_md5_t md5;
-	ngx_str_t cache_buffer;
-	ngx_str_t content_type;
+	ngx_str_t blocking_reload_arg;
 	ngx_str_t response;
 	ngx_str_t base_url;
+	ngx_flag_t blocking_reload = 0;
 	ngx_int_t rc;
-	int cache_type;
 #if (NGX_DEBUG)
 	ngx_str_t time_str;
 #endif // NGX_DEBUG
@@ -5437,7 +7849,7 @@ ngx_http_vod_handler(ngx_http_request_t *r)
 	}
 
 	if (request != NULL &&
-		request->handle_metadata_request != NULL)
+		(request->handle_metadata_request != NULL || conf->response_cache_max_segment_size > 0))
 	{
 		// calc request key from host + uri
 		ngx_md5_init(&md5);
@@ -5465,53 +7877,19 @@ ngx_http_vod_handler(ngx_http_request_t *r)
 
 		ngx_md5_final(request_key, &md5);
 
-		// try to fetch from cache
-		cache_type = ngx_buffer_cache_fetch_copy_perf(
-			r,
-			perf_counters,
-			conf->response_cache,
-			CACHE_TYPE_COUNT,
-			request_key,
-			&cache_buffer);
-		if (cache_type >= 0 &&
-			cache_buffer.len > sizeof(cache_header))
+		// try to fetch from cache (blocking playlist reloads of LL-HLS must not get a cached playlist)
+		if (conf->segmenter.part_duration != 0 &&
+			ngx_http_arg(r, (u_char *) "_HLS_msn", sizeof("_HLS_msn") - 1, &blocking_reload_arg) == NGX_OK)
 		{
-			ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-				"ngx_http_vod_handler: response cache hit, size is %uz", cache_buffer.len);
-
-			// extract the content type
-			ngx_memcpy(&cache_header, cache_buffer.data, sizeof(cache_header));
-			cache_buffer.data += sizeof(cache_header);
-			cache_buffer.len -= sizeof(cache_header);
-
-			content_type.data = cache_buffer.data;
-			content_type.len = cache_header.content_type_len;
-
-			if (cache_buffer.len >= content_type.len)
-			{
-				// extract the response buffer
-				response.data = cache_buffer.data + content_type.len;
-				response.len = cache_buffer.len - content_type.len;
-
-				// update request flags
-				r->root_tested = !r->error_page;
-				r->allow_ranges = 1;
-
-				// return the response
-				rc = ngx_http_vod_send_header(r, response.len, &content_type, cache_header.media_set_type, request);
-				if (rc != NGX_OK)
-				{
-					return rc;
-				}
-
-				rc = ngx_http_vod_send_response(r, &response, NULL);
-				goto done;
-			}
+			blocking_reload = 1;
 		}
 		else
 		{
-			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-				"ngx_http_vod_handler: response cache miss");
+			rc = ngx_http_vod_send_cached_response(r, perf_counters, request, request_key);
+			if (rc != NGX_DECLINED)
+			{
+				goto done;
+			}
 		}
 	}
 
@@ -5525,18 +7903,10 @@ ngx_http_vod_handler(ngx_http_request_t *r)
 		goto done;
 	}
 
+	ngx_http_vod_init_ctx(ctx, r, conf, request, &request_params, &media_set);
+
 	ngx_memcpy(ctx->request_key, request_key, sizeof(request_key));
-	ctx->submodule_context.r = r;
-	ctx->submodule_context.conf = conf;
-	ctx->submodule_context.request_params = request_params;
-	ctx->submodule_context.media_set = media_set;
-	ctx->submodule_context.media_set.segmenter_conf = &conf->segmenter;
-	ctx->submodule_context.media_set.version = request_params.version;
-	ctx->request = request;
-	ctx->cur_source = media_set.sources_head;
-	ctx->submodule_context.request_context.pool = r->pool;
-	ctx->submodule_context.request_context.log = r->connection->log;
-	ctx->submodule_context.request_context.output_buffer_pool = conf->output_buffer_pool;
+	ctx->blocking_reload = blocking_reload;
 	ctx->perf_counters = perf_counters;
 	ngx_perf_counter_copy(ctx->total_perf_counter_context, pcctx);
 
@@ -5548,13 +7918,6 @@ ngx_http_vod_handler(ngx_http_request_t *r)
 	}
 #endif // NGX_DEBUG
 
-	clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
-	ctx->alloc_params[READER_FILE].alignment = clcf->directio_alignment;
-	ctx->alloc_params[READER_HTTP].alignment = 1;	// don't care about alignment in case of remote
-	ctx->alloc_params[READER_HTTP].extra_size = conf->max_upstream_headers_size + 1;	// the + 1 is discussed here: http://trac.nginx.org/nginx/ticket/680
-
-	ngx_http_set_ctx(r, ctx, ngx_http_vod_module);
-
 	// call the mode specific handler (remote/mapped/local)
 	rc = conf->request_handler(r);
 
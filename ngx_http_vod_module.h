@@ -19,4 +19,7 @@ ngx_int_t ngx_http_vod_local_request_handler(ngx_http_request_t *r);
 ngx_int_t ngx_http_vod_mapped_request_handler(ngx_http_request_t *r);
 ngx_int_t ngx_http_vod_remote_request_handler(ngx_http_request_t *r);
 
+// async frame processing
+void ngx_http_vod_frame_processor_completed(ngx_http_request_t *r);
+
 #endif // _NGX_HTTP_VOD_MODULE_H_INCLUDED_
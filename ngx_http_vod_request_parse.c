@@ -229,6 +229,7 @@ ngx_http_vod_parse_uri_file_name(
 	uint32_t* tracks_mask;
 	uint32_t segment_index_shift;
 	uint32_t sequence_index;
+	uint32_t part_index;
 	uint32_t clip_index;
 	uint32_t media_type;
 	uint32_t pts_delay;
@@ -280,6 +281,22 @@ ngx_http_vod_parse_uri_file_name(
 
 			skip_dash(start_pos, end_pos);
 		}
+
+		// part index
+		if ((flags & PARSE_FILE_NAME_EXPECT_PART_INDEX) != 0)
+		{
+			start_pos = parse_utils_extract_uint32_token(start_pos, end_pos, &part_index);
+			if (part_index <= 0)
+			{
+				ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+					"ngx_http_vod_parse_uri_file_name: failed to parse part index");
+				return ngx_http_vod_status_to_ngx_error(r, VOD_BAD_REQUEST);
+			}
+
+			result->part_index = part_index - 1;		// convert to 0-based
+
+			skip_dash(start_pos, end_pos);
+		}
 	}
 	else
 	{
@@ -46,6 +46,7 @@ static ngx_http_vod_stat_def_t buffer_cache_stat_defs[] = {
 	DEFINE_STAT(fetch_hit),
 	DEFINE_STAT(fetch_bytes),
 	DEFINE_STAT(fetch_miss),
+	DEFINE_STAT(fetch_stale),
 	DEFINE_STAT(evicted),
 	DEFINE_STAT(evicted_bytes),
 	DEFINE_STAT(reset),
@@ -85,6 +86,23 @@ static ngx_http_vod_cache_info_t cache_infos[] = {
 		ngx_string("<drm_info_cache>\r\n"),
 		ngx_string("</drm_info_cache>\r\n"),
 	},
+	{
+		offsetof(ngx_http_vod_loc_conf_t, audio_filter_cache),
+		ngx_string("<audio_filter_cache>\r\n"),
+		ngx_string("</audio_filter_cache>\r\n"),
+	},
+	{
+		offsetof(ngx_http_vod_loc_conf_t, manifest_fragment_cache),
+		ngx_string("<manifest_fragment_cache>\r\n"),
+		ngx_string("</manifest_fragment_cache>\r\n"),
+	},
+#if (NGX_HAVE_LIB_AV_CODEC)
+	{
+		offsetof(ngx_http_vod_loc_conf_t, thumb.cache),
+		ngx_string("<thumb_cache>\r\n"),
+		ngx_string("</thumb_cache>\r\n"),
+	},
+#endif // NGX_HAVE_LIB_AV_CODEC
 };
 
 static u_char*
@@ -41,12 +41,23 @@ typedef char* (*ngx_http_vod_merge_loc_conf_t)(
 	void *conf, 
 	void *prev);
 
+// returns VOD_AGAIN while there are more chunks, and VOD_OK for the last chunk
+typedef vod_status_t (*ngx_http_vod_manifest_next_chunk_t)(void* context, vod_str_t* result);
+
+typedef struct {
+	ngx_http_vod_manifest_next_chunk_t next_chunk;
+	void* context;
+} ngx_http_vod_manifest_stream_t;
+
 typedef struct {
 	request_context_t request_context;
 	media_set_t media_set;
 	request_params_t request_params;
 	ngx_http_request_t* r;
 	struct ngx_http_vod_loc_conf_s* conf;
+	ngx_str_t frames_index;		// REQUEST_FLAG_FRAMES_INDEX only - the cached index, or the index to save
+	ngx_flag_t manifest_streaming;		// when set, the submodule may return only the first chunk of the manifest
+	ngx_http_vod_manifest_stream_t manifest_stream;	// set by the submodule when more chunks follow the response
 } ngx_http_vod_submodule_context_t;
 
 // submodule request
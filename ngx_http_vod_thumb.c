@@ -1,5 +1,7 @@
 #include <ngx_http.h>
+#include <ngx_md5.h>
 #include "ngx_http_vod_submodule.h"
+#include "ngx_http_vod_module.h"
 #include "ngx_http_vod_utils.h"
 #include "vod/thumb/thumb_grabber.h"
 #include "vod/manifest_utils.h"
@@ -22,6 +24,24 @@
 		}								\
 	}
 
+// typedefs
+typedef struct {
+	ngx_buffer_cache_t* cache;
+	u_char key[BUFFER_CACHE_KEY_SIZE];
+	write_callback_t write_callback;
+	void* write_context;
+} ngx_http_vod_thumb_cache_writer_t;
+
+#if (NGX_THREADS)
+typedef struct {
+	ngx_http_request_t* r;
+	ngx_thread_pool_t* thread_pool;
+	void* grabber_state;
+	vod_status_t decode_rc;
+	ngx_flag_t decoded;
+} ngx_http_vod_thumb_thread_state_t;
+#endif // NGX_THREADS
+
 static const u_char jpg_file_ext[] = ".jpg";
 static u_char jpeg_content_type[] = "image/jpeg";
 
@@ -109,6 +129,173 @@ ngx_http_vod_thumb_get_url(
 	return NGX_OK;
 }
 
+#if (NGX_THREADS)
+static void
+ngx_http_vod_thumb_thread_handler(void* data, ngx_log_t* log)
+{
+	ngx_http_vod_thumb_thread_state_t* state = data;
+
+	state->decode_rc = thumb_grabber_decode(state->grabber_state);
+}
+
+static void
+ngx_http_vod_thumb_thread_event_handler(ngx_event_t* ev)
+{
+	ngx_http_vod_thumb_thread_state_t* state = ev->data;
+	ngx_http_request_t* r = state->r;
+	ngx_connection_t* c = r->connection;
+
+	r->main->blocked--;
+	r->aio = 0;
+
+	state->decoded = 1;
+
+	ngx_http_vod_frame_processor_completed(r);
+
+	ngx_http_run_posted_requests(c);
+}
+
+static vod_status_t
+ngx_http_vod_thumb_thread_process(void* context)
+{
+	ngx_http_vod_thumb_thread_state_t* state = context;
+	ngx_thread_task_t* task;
+	ngx_http_request_t* r = state->r;
+	vod_status_t rc;
+
+	if (state->decoded)
+	{
+		if (state->decode_rc != VOD_OK)
+		{
+			return state->decode_rc;
+		}
+
+		return thumb_grabber_write(state->grabber_state);
+	}
+
+	rc = thumb_grabber_process(state->grabber_state);
+	if (rc != VOD_DONE)
+	{
+		return rc;
+	}
+
+	// all frames were read, decode / resize / encode on the thread pool
+	task = ngx_thread_task_alloc(r->pool, 0);
+	if (task == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_thumb_thread_process: ngx_thread_task_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	task->ctx = state;
+	task->handler = ngx_http_vod_thumb_thread_handler;
+	task->event.data = state;
+	task->event.handler = ngx_http_vod_thumb_thread_event_handler;
+
+	if (ngx_thread_task_post(state->thread_pool, task) != NGX_OK)
+	{
+		ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+			"ngx_http_vod_thumb_thread_process: ngx_thread_task_post failed");
+		return VOD_UNEXPECTED;
+	}
+
+	r->main->blocked++;
+	r->aio = 1;
+
+	// Note: VOD_DONE signals the module that the processing continues asynchronously
+	return VOD_DONE;
+}
+#endif // NGX_THREADS
+
+static vod_status_t
+ngx_http_vod_thumb_cache_write(void* context, u_char* buffer, uint32_t size)
+{
+	ngx_http_vod_thumb_cache_writer_t* writer = context;
+
+	// Note: failing to save the thumbnail to the cache is not an error
+	ngx_buffer_cache_store(writer->cache, writer->key, buffer, size);
+
+	return writer->write_callback(writer->write_context, buffer, size);
+}
+
+static ngx_int_t
+ngx_http_vod_thumb_cache_init(
+	ngx_http_vod_submodule_context_t* submodule_context,
+	segment_writer_t* segment_writer,
+	ngx_http_vod_thumb_cache_writer_t** writer,
+	ngx_str_t* output_buffer)
+{
+	ngx_http_vod_thumb_cache_writer_t* result;
+	request_params_t* request_params = &submodule_context->request_params;
+	media_track_t* track = submodule_context->media_set.filtered_tracks;
+	ngx_buffer_cache_t* cache = submodule_context->conf->thumb.cache;
+	ngx_str_t buffer;
+	vod_status_t rc;
+	uint64_t frame_offset;
+	uint32_t token;
+	ngx_md5_t md5;
+
+	// Note: the key is the frame that is captured, so that any offset that maps to this frame is served from cache
+	rc = thumb_grabber_get_frame_offset(
+		&submodule_context->request_context,
+		track,
+		request_params,
+		submodule_context->conf->thumb.accurate,
+		&frame_offset);
+	if (rc != VOD_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+			"ngx_http_vod_thumb_cache_init: thumb_grabber_get_frame_offset failed %i", rc);
+		return ngx_http_vod_status_to_ngx_error(submodule_context->r, rc);
+	}
+
+	result = ngx_palloc(submodule_context->r->pool, sizeof(*result));
+	if (result == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+			"ngx_http_vod_thumb_cache_init: ngx_palloc failed (1)");
+		return ngx_http_vod_status_to_ngx_error(submodule_context->r, VOD_ALLOC_FAILED);
+	}
+
+	ngx_md5_init(&md5);
+	ngx_md5_update(&md5, track->file_info.source->file_key, sizeof(track->file_info.source->file_key));
+	ngx_md5_update(&md5, &track->media_info.track_id, sizeof(track->media_info.track_id));
+	ngx_md5_update(&md5, &frame_offset, sizeof(frame_offset));
+	ngx_md5_update(&md5, &request_params->width, sizeof(request_params->width));
+	ngx_md5_update(&md5, &request_params->height, sizeof(request_params->height));
+	ngx_md5_final(result->key, &md5);
+
+	if (ngx_buffer_cache_fetch(cache, result->key, &buffer, &token))
+	{
+		output_buffer->data = ngx_palloc(submodule_context->r->pool, buffer.len);
+		if (output_buffer->data == NULL)
+		{
+			ngx_buffer_cache_release(cache, result->key, token);
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+				"ngx_http_vod_thumb_cache_init: ngx_palloc failed (2)");
+			return ngx_http_vod_status_to_ngx_error(submodule_context->r, VOD_ALLOC_FAILED);
+		}
+
+		ngx_memcpy(output_buffer->data, buffer.data, buffer.len);
+		output_buffer->len = buffer.len;
+
+		ngx_buffer_cache_release(cache, result->key, token);
+
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+			"ngx_http_vod_thumb_cache_init: thumbnail served from cache");
+		return NGX_OK;
+	}
+
+	result->cache = cache;
+	result->write_callback = segment_writer->write_tail;
+	result->write_context = segment_writer->context;
+
+	*writer = result;
+
+	return NGX_OK;
+}
+
 static ngx_int_t
 ngx_http_vod_thumb_init_frame_processor(
 	ngx_http_vod_submodule_context_t* submodule_context,
@@ -119,15 +306,50 @@ ngx_http_vod_thumb_init_frame_processor(
 	size_t* response_size,
 	ngx_str_t* content_type)
 {
+#if (NGX_THREADS)
+	ngx_http_vod_thumb_thread_state_t* state;
+	ngx_thread_pool_t* thread_pool = submodule_context->conf->thumb.thread_pool;
+#endif // NGX_THREADS
+	ngx_http_vod_thumb_cache_writer_t* cache_writer = NULL;
+	write_callback_t write_callback = segment_writer->write_tail;
+	void* write_context = segment_writer->context;
+	bool_t deferred = FALSE;
 	vod_status_t rc;
 
+	content_type->len = sizeof(jpeg_content_type) - 1;
+	content_type->data = (u_char *)jpeg_content_type;
+
+	if (submodule_context->conf->thumb.cache != NULL)
+	{
+		rc = ngx_http_vod_thumb_cache_init(submodule_context, segment_writer, &cache_writer, output_buffer);
+		if (rc != NGX_OK)
+		{
+			return rc;
+		}
+
+		if (cache_writer == NULL)
+		{
+			// cache hit
+			*response_size = output_buffer->len;
+			return NGX_OK;
+		}
+
+		write_callback = ngx_http_vod_thumb_cache_write;
+		write_context = cache_writer;
+	}
+
+#if (NGX_THREADS)
+	deferred = thread_pool != NULL;
+#endif // NGX_THREADS
+
 	rc = thumb_grabber_init_state(
 		&submodule_context->request_context,
 		submodule_context->media_set.filtered_tracks,
 		&submodule_context->request_params,
 		submodule_context->conf->thumb.accurate,
-		segment_writer->write_tail,
-		segment_writer->context,
+		deferred,
+		write_callback,
+		write_context,
 		frame_processor_state);
 	if (rc != VOD_OK)
 	{
@@ -138,8 +360,25 @@ ngx_http_vod_thumb_init_frame_processor(
 
 	*frame_processor = (ngx_http_vod_frame_processor_t)thumb_grabber_process;
 
-	content_type->len = sizeof(jpeg_content_type) - 1;
-	content_type->data = (u_char *)jpeg_content_type;
+#if (NGX_THREADS)
+	if (deferred)
+	{
+		state = ngx_pcalloc(submodule_context->r->pool, sizeof(*state));
+		if (state == NULL)
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+				"ngx_http_vod_thumb_init_frame_processor: ngx_pcalloc failed");
+			return ngx_http_vod_status_to_ngx_error(submodule_context->r, VOD_ALLOC_FAILED);
+		}
+
+		state->r = submodule_context->r;
+		state->thread_pool = thread_pool;
+		state->grabber_state = *frame_processor_state;
+
+		*frame_processor = ngx_http_vod_thumb_thread_process;
+		*frame_processor_state = state;
+	}
+#endif // NGX_THREADS
 
 	return NGX_OK;
 }
@@ -154,12 +393,63 @@ static const ngx_http_vod_request_t thumb_request = {
 	ngx_http_vod_thumb_init_frame_processor,
 };
 
+#if (NGX_HAVE_LIB_SW_SCALE)
+static ngx_int_t
+ngx_http_vod_thumb_init_tile_frame_processor(
+	ngx_http_vod_submodule_context_t* submodule_context,
+	segment_writer_t* segment_writer,
+	ngx_http_vod_frame_processor_t* frame_processor,
+	void** frame_processor_state,
+	ngx_str_t* output_buffer,
+	size_t* response_size,
+	ngx_str_t* content_type)
+{
+	vod_status_t rc;
+
+	rc = thumb_grabber_init_tile_state(
+		&submodule_context->request_context,
+		submodule_context->media_set.filtered_tracks,
+		&submodule_context->request_params,
+		submodule_context->conf->thumb.accurate,
+		segment_writer->write_tail,
+		segment_writer->context,
+		frame_processor_state);
+	if (rc != VOD_OK)
+	{
+		ngx_log_debug1(NGX_LOG_DEBUG_HTTP, submodule_context->request_context.log, 0,
+			"ngx_http_vod_thumb_init_tile_frame_processor: thumb_grabber_init_tile_state failed %i", rc);
+		return ngx_http_vod_status_to_ngx_error(submodule_context->r, rc);
+	}
+
+	*frame_processor = (ngx_http_vod_frame_processor_t)thumb_grabber_tile_process;
+
+	content_type->len = sizeof(jpeg_content_type) - 1;
+	content_type->data = (u_char *)jpeg_content_type;
+
+	return NGX_OK;
+}
+
+static const ngx_http_vod_request_t thumb_tile_request = {
+	REQUEST_FLAG_SINGLE_TRACK,
+	PARSE_FLAG_FRAMES_ALL | PARSE_FLAG_EXTRA_DATA,
+	REQUEST_CLASS_THUMB,
+	VOD_CODEC_FLAG(AVC) | VOD_CODEC_FLAG(HEVC) | VOD_CODEC_FLAG(VP8) | VOD_CODEC_FLAG(VP9),
+	THUMB_TIMESCALE,
+	NULL,
+	ngx_http_vod_thumb_init_tile_frame_processor,
+};
+#endif // NGX_HAVE_LIB_SW_SCALE
+
 static void
 ngx_http_vod_thumb_create_loc_conf(
 	ngx_conf_t *cf,
 	ngx_http_vod_thumb_loc_conf_t *conf)
 {
 	conf->accurate = NGX_CONF_UNSET;
+	conf->cache = NGX_CONF_UNSET_PTR;
+#if (NGX_THREADS)
+	conf->thread_pool = NGX_CONF_UNSET_PTR;
+#endif // NGX_THREADS
 }
 
 static char *
@@ -170,7 +460,12 @@ ngx_http_vod_thumb_merge_loc_conf(
 	ngx_http_vod_thumb_loc_conf_t *prev)
 {
 	ngx_conf_merge_str_value(conf->file_name_prefix, prev->file_name_prefix, "thumb");
+	ngx_conf_merge_str_value(conf->tile_file_name_prefix, prev->tile_file_name_prefix, "tile");
 	ngx_conf_merge_value(conf->accurate, prev->accurate, 1);
+	ngx_conf_merge_ptr_value(conf->cache, prev->cache, NULL);
+#if (NGX_THREADS)
+	ngx_conf_merge_ptr_value(conf->thread_pool, prev->thread_pool, NULL);
+#endif // NGX_THREADS
 	return NGX_CONF_OK;
 }
 
@@ -220,6 +515,52 @@ ngx_http_vod_thumb_parse_dimensions(
 
 	return start_pos;
 }
+
+static u_char*
+ngx_http_vod_thumb_parse_tile_params(
+	u_char* start_pos,
+	u_char* end_pos,
+	request_params_t* result)
+{
+	// interval
+	if (start_pos >= end_pos || *start_pos != '-')
+	{
+		return NULL;
+	}
+
+	start_pos++;		// skip the -
+
+	start_pos = parse_utils_extract_uint32_token(start_pos, end_pos, &result->tile_interval);
+	if (result->tile_interval <= 0)
+	{
+		return NULL;
+	}
+
+	// columns x rows
+	if (start_pos >= end_pos || *start_pos != '-')
+	{
+		return NULL;
+	}
+
+	start_pos++;		// skip the -
+
+	start_pos = parse_utils_extract_uint32_token(start_pos, end_pos, &result->tile_columns);
+	if (start_pos >= end_pos || *start_pos != 'x')
+	{
+		return NULL;
+	}
+
+	start_pos++;		// skip the x
+
+	start_pos = parse_utils_extract_uint32_token(start_pos, end_pos, &result->tile_rows);
+	if (result->tile_columns <= 0 || result->tile_rows <= 0 ||
+		result->tile_columns > THUMB_GRABBER_MAX_TILES / result->tile_rows)
+	{
+		return NULL;
+	}
+
+	return start_pos;
+}
 #endif // NGX_HAVE_LIB_SW_SCALE
 
 static ngx_int_t
@@ -235,6 +576,15 @@ ngx_http_vod_thumb_parse_uri_file_name(
 	int64_t time;
 	ngx_int_t rc;
 
+#if (NGX_HAVE_LIB_SW_SCALE)
+	if (ngx_http_vod_match_prefix_postfix(start_pos, end_pos, &conf->thumb.tile_file_name_prefix, jpg_file_ext))
+	{
+		start_pos += conf->thumb.tile_file_name_prefix.len;
+		end_pos -= (sizeof(jpg_file_ext) - 1);
+		*request = &thumb_tile_request;
+	}
+	else
+#endif // NGX_HAVE_LIB_SW_SCALE
 	if (ngx_http_vod_match_prefix_postfix(start_pos, end_pos, &conf->thumb.file_name_prefix, jpg_file_ext))
 	{
 		start_pos += conf->thumb.file_name_prefix.len;
@@ -292,6 +642,25 @@ ngx_http_vod_thumb_parse_uri_file_name(
 	}
 
 #if (NGX_HAVE_LIB_SW_SCALE)
+	if (*request == &thumb_tile_request)
+	{
+		// Note: relative times are not supported in tiles, since the redirect url does not include the tile params
+		if (time_type != SEGMENT_TIME_ABSOLUTE)
+		{
+			ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+				"ngx_http_vod_thumb_parse_uri_file_name: relative time is not supported in tiles");
+			return ngx_http_vod_status_to_ngx_error(r, VOD_BAD_REQUEST);
+		}
+
+		start_pos = ngx_http_vod_thumb_parse_tile_params(start_pos, end_pos, request_params);
+		if (start_pos == NULL)
+		{
+			ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+				"ngx_http_vod_thumb_parse_uri_file_name: failed to parse tile params");
+			return ngx_http_vod_status_to_ngx_error(r, VOD_BAD_REQUEST);
+		}
+	}
+
 	start_pos = ngx_http_vod_thumb_parse_dimensions(r, start_pos, end_pos, request_params);
 	if (start_pos == NULL)
 	{
@@ -7,6 +7,13 @@
 	BASE_OFFSET + offsetof(ngx_http_vod_thumb_loc_conf_t, file_name_prefix),
 	NULL },
 
+	{ ngx_string("vod_thumb_tile_file_name_prefix"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
+	ngx_conf_set_str_slot,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	BASE_OFFSET + offsetof(ngx_http_vod_thumb_loc_conf_t, tile_file_name_prefix),
+	NULL },
+
 	{ ngx_string("vod_thumb_accurate_positioning"),
 	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_TAKE1,
 	ngx_conf_set_flag_slot,
@@ -14,4 +21,20 @@
 	BASE_OFFSET + offsetof(ngx_http_vod_thumb_loc_conf_t, accurate),
 	NULL },
 
+	{ ngx_string("vod_thumb_cache"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_1MORE,
+	ngx_http_vod_cache_command,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	BASE_OFFSET + offsetof(ngx_http_vod_thumb_loc_conf_t, cache),
+	NULL },
+
+#if (NGX_THREADS)
+	{ ngx_string("vod_thumb_thread_pool"),
+	NGX_HTTP_MAIN_CONF | NGX_HTTP_SRV_CONF | NGX_HTTP_LOC_CONF | NGX_CONF_NOARGS | NGX_CONF_TAKE1,
+	ngx_http_vod_thread_pool_command,
+	NGX_HTTP_LOC_CONF_OFFSET,
+	BASE_OFFSET + offsetof(ngx_http_vod_thumb_loc_conf_t, thread_pool),
+	NULL },
+#endif // NGX_THREADS
+
 #undef BASE_OFFSET
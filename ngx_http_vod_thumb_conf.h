@@ -3,12 +3,18 @@
 
 // includes
 #include <ngx_http.h>
+#include "ngx_buffer_cache.h"
 
 // typedefs
 typedef struct
 {
 	ngx_str_t file_name_prefix;
+	ngx_str_t tile_file_name_prefix;
 	ngx_flag_t accurate;
+	ngx_buffer_cache_t* cache;
+#if (NGX_THREADS)
+	ngx_thread_pool_t* thread_pool;
+#endif // NGX_THREADS
 } ngx_http_vod_thumb_loc_conf_t;
 
 #endif // _NGX_HTTP_VOD_THUMB_CONF_H_INCLUDED_
@@ -0,0 +1,439 @@
+// includes
+#include <ngx_event.h>
+#include "ngx_http_vod_warmup.h"
+#include "ngx_http_vod_module.h"
+#include "ngx_http_vod_utils.h"
+#include "ngx_http_vod_conf.h"
+
+// constants
+#define WARMUP_RESULT_FORMAT "%ui %V\r\n"
+#define WARMUP_WAIT_INTERVAL (100)
+
+// typedefs
+typedef struct {
+	ngx_str_t line;					// uri + args, for the result
+	ngx_str_t uri;
+	ngx_str_t args;
+	ngx_uint_t status;
+} ngx_http_vod_warmup_item_t;
+
+typedef struct {
+	ngx_http_vod_warmup_item_t* items;
+	ngx_uint_t item_count;
+	ngx_uint_t next_item;
+	ngx_uint_t active_count;
+	ngx_uint_t concurrency;
+	ngx_uint_t worker_concurrency;
+	ngx_event_t wait_event;
+	ngx_flag_t finalized;
+} ngx_http_vod_warmup_ctx_t;
+
+// constants
+static ngx_str_t text_content_type = ngx_string("text/plain");
+
+// globals
+static ngx_uint_t ngx_http_vod_warmup_worker_active = 0;		// the number of warm-up subrequests running in this worker
+
+static ngx_int_t
+ngx_http_vod_warmup_parse_body(ngx_http_request_t *r, ngx_str_t* result)
+{
+	ngx_chain_t* cl;
+	ngx_buf_t* b;
+	size_t size;
+	u_char* p;
+
+	if (r->request_body == NULL || r->request_body->bufs == NULL)
+	{
+		result->len = 0;
+		return NGX_OK;
+	}
+
+	size = 0;
+	for (cl = r->request_body->bufs; cl != NULL; cl = cl->next)
+	{
+		b = cl->buf;
+		if (b->in_file)
+		{
+			ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+				"ngx_http_vod_warmup_parse_body: request body was saved to a file, increase client_body_buffer_size");
+			return NGX_HTTP_REQUEST_ENTITY_TOO_LARGE;
+		}
+
+		size += b->last - b->pos;
+	}
+
+	p = ngx_pnalloc(r->pool, size);
+	if (p == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_warmup_parse_body: ngx_pnalloc failed");
+		return NGX_HTTP_INTERNAL_SERVER_ERROR;
+	}
+
+	result->data = p;
+	for (cl = r->request_body->bufs; cl != NULL; cl = cl->next)
+	{
+		b = cl->buf;
+		p = ngx_copy(p, b->pos, b->last - b->pos);
+	}
+	result->len = p - result->data;
+
+	return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_vod_warmup_parse_items(ngx_http_request_t *r, ngx_str_t* body, ngx_http_vod_warmup_ctx_t* ctx)
+{
+	ngx_http_vod_warmup_item_t* cur_item;
+	ngx_uint_t item_count;
+	u_char* line_start;
+	u_char* line_end;
+	u_char* end;
+	u_char* p;
+
+	// count the lines
+	item_count = 1;
+	end = body->data + body->len;
+	for (p = body->data; p < end; p++)
+	{
+		if (*p == LF)
+		{
+			item_count++;
+		}
+	}
+
+	ctx->items = ngx_palloc(r->pool, sizeof(ctx->items[0]) * item_count);
+	if (ctx->items == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_warmup_parse_items: ngx_palloc failed");
+		return NGX_HTTP_INTERNAL_SERVER_ERROR;
+	}
+
+	cur_item = ctx->items;
+
+	for (line_start = body->data; line_start < end; line_start = line_end + 1)
+	{
+		line_end = ngx_strlchr(line_start, end, LF);
+		if (line_end == NULL)
+		{
+			line_end = end;
+		}
+
+		// trim whitespace
+		p = line_end;
+		while (line_start < p && (*line_start == ' ' || *line_start == '\t'))
+		{
+			line_start++;
+		}
+
+		while (p > line_start && (p[-1] == CR || p[-1] == ' ' || p[-1] == '\t'))
+		{
+			p--;
+		}
+
+		// skip empty lines and comments
+		if (p <= line_start || *line_start == '#')
+		{
+			continue;
+		}
+
+		if (*line_start != '/')
+		{
+			ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+				"ngx_http_vod_warmup_parse_items: invalid uri \"%*s\"", (size_t)(p - line_start), line_start);
+			return NGX_HTTP_BAD_REQUEST;
+		}
+
+		cur_item->line.data = line_start;
+		cur_item->line.len = p - line_start;
+		cur_item->status = 0;
+
+		cur_item->uri = cur_item->line;
+		ngx_str_null(&cur_item->args);
+		ngx_http_split_args(r, &cur_item->uri, &cur_item->args);
+
+		cur_item++;
+	}
+
+	ctx->item_count = cur_item - ctx->items;
+
+	return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_vod_warmup_send_result(ngx_http_request_t *r, ngx_http_vod_warmup_ctx_t* ctx)
+{
+	ngx_http_vod_warmup_item_t* cur_item;
+	ngx_http_vod_warmup_item_t* items_end;
+	ngx_str_t response;
+	size_t result_size;
+	u_char* p;
+
+	// Note: the warm-up subrequests do not send headers, the result is the only output of the request
+	if (r->header_sent)
+	{
+		ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+			"ngx_http_vod_warmup_send_result: unexpected, header was already sent");
+		return NGX_ERROR;
+	}
+
+	items_end = ctx->items + ctx->item_count;
+
+	result_size = 0;
+	for (cur_item = ctx->items; cur_item < items_end; cur_item++)
+	{
+		result_size += sizeof(WARMUP_RESULT_FORMAT) + NGX_INT_T_LEN + cur_item->line.len;
+	}
+
+	response.data = ngx_pnalloc(r->pool, result_size);
+	if (response.data == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_warmup_send_result: ngx_pnalloc failed");
+		return NGX_HTTP_INTERNAL_SERVER_ERROR;
+	}
+
+	p = response.data;
+	for (cur_item = ctx->items; cur_item < items_end; cur_item++)
+	{
+		p = ngx_sprintf(p, WARMUP_RESULT_FORMAT, cur_item->status, &cur_item->line);
+	}
+
+	response.len = p - response.data;
+
+	return ngx_http_vod_send_response(r, &response, &text_content_type);
+}
+
+static ngx_int_t
+ngx_http_vod_warmup_subrequest_finished(ngx_http_request_t *sr, void *data, ngx_int_t rc)
+{
+	ngx_http_vod_warmup_item_t* item = data;
+	ngx_http_vod_warmup_ctx_t* ctx;
+
+	// make sure we are not called twice for the same request
+	sr->post_subrequest = NULL;
+
+	if (rc == NGX_OK || rc == NGX_DONE)
+	{
+		item->status = sr->headers_out.status != 0 ? sr->headers_out.status : NGX_HTTP_OK;
+	}
+	else if (rc >= NGX_HTTP_SPECIAL_RESPONSE)
+	{
+		item->status = rc;
+	}
+	else
+	{
+		item->status = NGX_HTTP_INTERNAL_SERVER_ERROR;
+	}
+
+	ngx_log_debug2(NGX_LOG_DEBUG_HTTP, sr->connection->log, 0,
+		"ngx_http_vod_warmup_subrequest_finished: \"%V\" completed with status %ui", &item->line, item->status);
+
+	ctx = ngx_http_get_module_ctx(sr->parent, ngx_http_vod_module);
+	ctx->active_count--;
+	ngx_http_vod_warmup_worker_active--;
+
+	// Note: the warmup result is the only output, errors of the warmed-up requests are not returned to the client
+	return NGX_OK;
+}
+
+static ngx_int_t
+ngx_http_vod_warmup_start_subrequests(ngx_http_request_t *r, ngx_http_vod_warmup_ctx_t* ctx)
+{
+	ngx_http_vod_warmup_item_t* cur_item;
+	ngx_http_post_subrequest_t* psr;
+	ngx_http_request_t* sr;
+	ngx_int_t rc;
+
+	while (ctx->active_count < ctx->concurrency && 
+		ngx_http_vod_warmup_worker_active < ctx->worker_concurrency &&
+		ctx->next_item < ctx->item_count)
+	{
+		cur_item = &ctx->items[ctx->next_item];
+
+		psr = ngx_palloc(r->pool, sizeof(*psr));
+		if (psr == NULL)
+		{
+			ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+				"ngx_http_vod_warmup_start_subrequests: ngx_palloc failed");
+			return NGX_HTTP_INTERNAL_SERVER_ERROR;
+		}
+
+		psr->handler = ngx_http_vod_warmup_subrequest_finished;
+		psr->data = cur_item;
+
+		rc = ngx_http_subrequest(r, &cur_item->uri, &cur_item->args, &sr, psr, NGX_HTTP_SUBREQUEST_WAITED);
+		if (rc == NGX_ERROR)
+		{
+			ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+				"ngx_http_vod_warmup_start_subrequests: ngx_http_subrequest failed %i", rc);
+			return NGX_HTTP_INTERNAL_SERVER_ERROR;
+		}
+
+		// the subrequests only fill the caches, the response body is not generated
+		sr->header_only = 1;
+
+		ctx->next_item++;
+		ctx->active_count++;
+		ngx_http_vod_warmup_worker_active++;
+	}
+
+	return NGX_OK;
+}
+
+static void
+ngx_http_vod_warmup_wev_handler(ngx_http_request_t *r)
+{
+	ngx_http_vod_warmup_ctx_t* ctx;
+	ngx_int_t rc;
+
+	ctx = ngx_http_get_module_ctx(r, ngx_http_vod_module);
+	if (ctx->finalized)
+	{
+		return;
+	}
+
+	rc = ngx_http_vod_warmup_start_subrequests(r, ctx);
+	if (rc != NGX_OK)
+	{
+		// wait for the active subrequests before finalizing
+		ctx->next_item = ctx->item_count;
+		if (ctx->active_count > 0)
+		{
+			return;
+		}
+	}
+	else
+	{
+		if (ctx->active_count > 0)
+		{
+			return;
+		}
+
+		if (ctx->next_item < ctx->item_count)
+		{
+			// the worker limit was reached by other warm-up requests, poll until they complete
+			ngx_add_timer(&ctx->wait_event, WARMUP_WAIT_INTERVAL);
+			return;
+		}
+
+		rc = ngx_http_vod_warmup_send_result(r, ctx);
+	}
+
+	ctx->finalized = 1;
+	ngx_http_finalize_request(r, rc);
+}
+
+static void
+ngx_http_vod_warmup_wait_handler(ngx_event_t* ev)
+{
+	ngx_http_request_t* r = ev->data;
+	ngx_connection_t* c = r->connection;
+
+	ngx_http_vod_warmup_wev_handler(r);
+
+	ngx_http_run_posted_requests(c);
+}
+
+static void
+ngx_http_vod_warmup_cleanup(void* data)
+{
+	ngx_http_vod_warmup_ctx_t* ctx = data;
+
+	if (ctx->wait_event.timer_set)
+	{
+		ngx_del_timer(&ctx->wait_event);
+	}
+
+	// Note: the completion handler is not called for subrequests that are terminated with the request
+	ngx_http_vod_warmup_worker_active -= ctx->active_count;
+	ctx->active_count = 0;
+}
+
+static void
+ngx_http_vod_warmup_body_handler(ngx_http_request_t *r)
+{
+	ngx_http_vod_warmup_ctx_t* ctx;
+	ngx_http_vod_loc_conf_t* conf;
+	ngx_pool_cleanup_t* cln;
+	ngx_str_t body;
+	ngx_int_t rc;
+
+	conf = ngx_http_get_module_loc_conf(r, ngx_http_vod_module);
+
+	rc = ngx_http_vod_warmup_parse_body(r, &body);
+	if (rc != NGX_OK)
+	{
+		ngx_http_finalize_request(r, rc);
+		return;
+	}
+
+	ctx = ngx_pcalloc(r->pool, sizeof(*ctx));
+	if (ctx == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_warmup_body_handler: ngx_pcalloc failed");
+		ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+		return;
+	}
+
+	cln = ngx_pool_cleanup_add(r->pool, 0);
+	if (cln == NULL)
+	{
+		ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+			"ngx_http_vod_warmup_body_handler: ngx_pool_cleanup_add failed");
+		ngx_http_finalize_request(r, NGX_HTTP_INTERNAL_SERVER_ERROR);
+		return;
+	}
+
+	cln->handler = ngx_http_vod_warmup_cleanup;
+	cln->data = ctx;
+
+	ctx->concurrency = conf->warmup_concurrency;
+	ctx->worker_concurrency = conf->warmup_worker_concurrency;
+
+	ctx->wait_event.handler = ngx_http_vod_warmup_wait_handler;
+	ctx->wait_event.data = r;
+	ctx->wait_event.log = r->connection->log;
+
+	rc = ngx_http_vod_warmup_parse_items(r, &body, ctx);
+	if (rc != NGX_OK)
+	{
+		ngx_http_finalize_request(r, rc);
+		return;
+	}
+
+	ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+		"ngx_http_vod_warmup_body_handler: warming up %ui uris", ctx->item_count);
+
+	ngx_http_set_ctx(r, ctx, ngx_http_vod_module);
+
+	// the write event handler is called whenever a subrequest completes
+	r->write_event_handler = ngx_http_vod_warmup_wev_handler;
+
+	ngx_http_vod_warmup_wev_handler(r);
+}
+
+ngx_int_t
+ngx_http_vod_warmup_handler(ngx_http_request_t *r)
+{
+	ngx_int_t rc;
+
+	if (r->method != NGX_HTTP_POST)
+	{
+		ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+			"ngx_http_vod_warmup_handler: unsupported method %ui", r->method);
+		return NGX_HTTP_NOT_ALLOWED;
+	}
+
+	r->request_body_in_single_buf = 1;
+
+	rc = ngx_http_read_client_request_body(r, ngx_http_vod_warmup_body_handler);
+	if (rc >= NGX_HTTP_SPECIAL_RESPONSE)
+	{
+		return rc;
+	}
+
+	return NGX_DONE;
+}
@@ -9,6 +9,7 @@
 // globals
 ngx_time_t ngx_time;
 ngx_shm_zone_t shm_zone;
+int lock_count;
 volatile ngx_cycle_t  *ngx_cycle;
 volatile ngx_time_t	 *ngx_cached_time = &ngx_time;
 
@@ -35,9 +36,16 @@ ngx_conf_log_error(ngx_uint_t level, ngx_conf_t *cf, ngx_err_t err,
 {
 }
 
+ngx_int_t
+ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
+{
+	return NGX_OK;
+}
+
 void
 ngx_shmtx_lock(ngx_shmtx_t *mtx)
 {
+	lock_count++;
 }
 
 void
@@ -53,7 +61,7 @@ ngx_shared_memory_add(ngx_conf_t *cf, ngx_str_t *name, size_t size, void *tag)
 
 // buffer cache initialization
 static ngx_flag_t
-init_buffer_cache(size_t size)
+init_buffer_cache(size_t size, time_t expiration, time_t stale_time, ngx_uint_t shard_count)
 {
 	ngx_conf_t cf;
 	ngx_log_t log;
@@ -71,7 +79,7 @@ init_buffer_cache(size_t size)
 	ngx_memzero(&log, sizeof(log));
 	cf.log = &log;
 	cf.pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, &log);
-	ngx_buffer_cache_create(&cf, NULL, 0, 0, NULL);
+	ngx_buffer_cache_create(&cf, NULL, 0, expiration, stale_time, shard_count, NULL);
 
 	shm_zone.init(&shm_zone, NULL);
 	return 1;
@@ -157,6 +165,7 @@ int run_test_cycle(time_t seed, size_t cache_size, int iterations, int size_fact
 	ngx_buffer_cache_stats_t stats;
 	u_char key[BUFFER_CACHE_KEY_SIZE];
 	ngx_str_t fetch_buffer;
+	uint32_t token;
 	u_char* store_buffer;
 	size_t* sizes_buffer;
 	size_t size;
@@ -182,7 +191,7 @@ int run_test_cycle(time_t seed, size_t cache_size, int iterations, int size_fact
 		return 0;
 	}
 
-	if (!init_buffer_cache(cache_size))
+	if (!init_buffer_cache(cache_size, 0, 0, 1))
 	{
 		printf("Error: failed to initialize the buffer cache\n");
 		return 0;
@@ -194,7 +203,7 @@ int run_test_cycle(time_t seed, size_t cache_size, int iterations, int size_fact
 		ngx_buffer_cache_t *cache;
 
 		cache = shm_zone.data;
-		sh = cache->sh;
+		sh = cache->shards[0];
 
 #ifdef VERBOSE
 		printf("%d. ", i);
@@ -230,8 +239,10 @@ int run_test_cycle(time_t seed, size_t cache_size, int iterations, int size_fact
 		for (j = min_existing_index; j <= i; j++)
 		{
 			((uint32_t*)&key)[0] = j;
-			if (ngx_buffer_cache_fetch(cache, key, &fetch_buffer))
+			if (ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token))
 			{
+				ngx_buffer_cache_release(cache, key, token);
+
 				if (sizes_buffer[j] != fetch_buffer.len)
 				{
 					printf("Error: invalid buffer size\n");
@@ -286,10 +297,507 @@ int run_test_cycle(time_t seed, size_t cache_size, int iterations, int size_fact
 	return 1;
 }
 
+static ngx_buffer_cache_entry_t*
+find_entry(ngx_buffer_cache_sh_t *sh, u_char* key)
+{
+	ngx_buffer_cache_entry_t* entry;
+
+	for (entry = sh->entries_start; entry < sh->entries_end; entry++)
+	{
+		if (entry->state == CES_READY && ngx_memcmp(entry->key, key, BUFFER_CACHE_KEY_SIZE) == 0)
+		{
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+int run_stale_test()
+{
+	ngx_buffer_cache_entry_t* entry;
+	ngx_buffer_cache_t *cache;
+	u_char key[BUFFER_CACHE_KEY_SIZE];
+	ngx_str_t fetch_buffer;
+	ngx_flag_t stale;
+	uint32_t token;
+
+	printf("starting stale test\n");
+
+	if (!init_buffer_cache(2 * 1024 * 1024, 10, 5, 1))
+	{
+		printf("Error: failed to initialize the buffer cache\n");
+		return 0;
+	}
+
+	cache = shm_zone.data;
+	ngx_memzero(key, sizeof(key));
+	ngx_time.sec = 100;
+
+	// fill lock
+	if (!ngx_buffer_cache_lock(cache, key, 5) || ngx_buffer_cache_lock(cache, key, 5))
+	{
+		printf("Error: expected the first lock to succeed and the second to fail\n");
+		return 0;
+	}
+
+	if (!ngx_buffer_cache_is_locked(cache, key))
+	{
+		printf("Error: expected the key to be locked\n");
+		return 0;
+	}
+
+	if (!ngx_buffer_cache_store(cache, key, (u_char*)"old", 3))
+	{
+		printf("Error: store failed\n");
+		return 0;
+	}
+
+	if (!ngx_buffer_cache_lock(cache, key, 5))
+	{
+		printf("Error: store did not release the lock\n");
+		return 0;
+	}
+
+	ngx_buffer_cache_unlock(cache, key);
+
+	if (ngx_buffer_cache_is_locked(cache, key))
+	{
+		printf("Error: unlock did not release the lock\n");
+		return 0;
+	}
+
+	// existing entry that did not expire
+	if (ngx_buffer_cache_store(cache, key, (u_char*)"new", 3))
+	{
+		printf("Error: store of an existing entry succeeded\n");
+		return 0;
+	}
+
+	// stale entry
+	ngx_time.sec += 12;
+
+	if (ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token))
+	{
+		printf("Error: fetch of an expired entry succeeded\n");
+		return 0;
+	}
+
+	if (!ngx_buffer_cache_fetch_stale(cache, key, &fetch_buffer, &token, &stale) || !stale ||
+		fetch_buffer.len != 3 || ngx_memcmp(fetch_buffer.data, "old", 3) != 0)
+	{
+		printf("Error: stale fetch failed\n");
+		return 0;
+	}
+
+	ngx_buffer_cache_release(cache, key, token);
+
+	// replace the stale entry
+	if (!ngx_buffer_cache_store(cache, key, (u_char*)"new", 3))
+	{
+		printf("Error: failed to replace a stale entry\n");
+		return 0;
+	}
+
+	if (!ngx_buffer_cache_fetch_stale(cache, key, &fetch_buffer, &token, &stale) || stale ||
+		fetch_buffer.len != 3 || ngx_memcmp(fetch_buffer.data, "new", 3) != 0)
+	{
+		printf("Error: fetch of the replaced entry failed\n");
+		return 0;
+	}
+
+	ngx_buffer_cache_release(cache, key, token);
+
+	// entry that passed the stale time
+	ngx_time.sec += 16;
+
+	if (ngx_buffer_cache_fetch_stale(cache, key, &fetch_buffer, &token, &stale))
+	{
+		printf("Error: fetch of an entry that passed the stale time succeeded\n");
+		return 0;
+	}
+
+	// replace a stale entry that is referenced
+	if (!ngx_buffer_cache_store(cache, key, (u_char*)"ref", 3))
+	{
+		printf("Error: failed to replace an entry that passed the stale time\n");
+		return 0;
+	}
+
+	ngx_time.sec += 12;
+
+	if (!ngx_buffer_cache_fetch_stale(cache, key, &fetch_buffer, &token, &stale) || !stale)
+	{
+		printf("Error: stale fetch of the referenced entry failed\n");
+		return 0;
+	}
+
+	entry = find_entry(cache->shards[0], key);
+	if (entry == NULL || entry->ref_count != 1)
+	{
+		printf("Error: failed to find the referenced entry\n");
+		return 0;
+	}
+
+	if (!ngx_buffer_cache_store(cache, key, (u_char*)"upd", 3))
+	{
+		printf("Error: failed to replace a referenced stale entry\n");
+		return 0;
+	}
+
+	if (entry->state != CES_REPLACED || ngx_memcmp(fetch_buffer.data, "ref", 3) != 0)
+	{
+		printf("Error: the referenced entry was freed\n");
+		return 0;
+	}
+
+	ngx_buffer_cache_release(cache, key, token);
+
+	if (entry->ref_count != 0 || cache->shards[0]->replaced_entries[0] != NULL)
+	{
+		printf("Error: the reference of the replaced entry was not released\n");
+		return 0;
+	}
+
+	if (!ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token) ||
+		fetch_buffer.len != 3 || ngx_memcmp(fetch_buffer.data, "upd", 3) != 0)
+	{
+		printf("Error: fetch of the entry that replaced a referenced entry failed\n");
+		return 0;
+	}
+
+	ngx_buffer_cache_release(cache, key, token);
+
+	free_buffer_cache();
+
+	return 1;
+}
+
+int run_lock_free_test()
+{
+	ngx_buffer_cache_entry_t* entry;
+	ngx_buffer_cache_sh_t *sh;
+	ngx_buffer_cache_t *cache;
+	ngx_atomic_uint_t version;
+	u_char key[BUFFER_CACHE_KEY_SIZE];
+	u_char other_key[BUFFER_CACHE_KEY_SIZE];
+	ngx_str_t fetch_buffer;
+	uint32_t token;
+	int cur_lock_count;
+
+	printf("starting lock free test\n");
+
+	if (!init_buffer_cache(2 * 1024 * 1024, 0, 0, 1))
+	{
+		printf("Error: failed to initialize the buffer cache\n");
+		return 0;
+	}
+
+	cache = shm_zone.data;
+	sh = cache->shards[0];
+	ngx_memzero(key, sizeof(key));
+	ngx_memzero(other_key, sizeof(other_key));
+	other_key[0] = 1;
+	ngx_time.sec = 100;
+
+	if (!ngx_buffer_cache_store(cache, key, (u_char*)"abc", 3))
+	{
+		printf("Error: store failed\n");
+		return 0;
+	}
+
+	entry = find_entry(sh, key);
+	if (entry == NULL || (entry->version & 1) != 0 || entry->ref_count != 0)
+	{
+		printf("Error: unexpected entry state after store\n");
+		return 0;
+	}
+
+	// fetch / release without the lock
+	cur_lock_count = lock_count;
+
+	if (!ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token) ||
+		fetch_buffer.len != 3 || ngx_memcmp(fetch_buffer.data, "abc", 3) != 0)
+	{
+		printf("Error: lock free fetch failed\n");
+		return 0;
+	}
+
+	if (entry->ref_count != 1)
+	{
+		printf("Error: lock free fetch did not increment the ref count\n");
+		return 0;
+	}
+
+	ngx_buffer_cache_release(cache, key, token);
+
+	if (entry->ref_count != 0)
+	{
+		printf("Error: lock free release did not decrement the ref count\n");
+		return 0;
+	}
+
+	if (lock_count != cur_lock_count)
+	{
+		printf("Error: lock free fetch / release took the lock\n");
+		return 0;
+	}
+
+	// an entry that is being evicted must not be used by the lock free path
+	version = entry->version;
+	entry->version++;
+	cur_lock_count = lock_count;
+
+	if (!ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token) || lock_count == cur_lock_count)
+	{
+		printf("Error: fetch of an entry being evicted did not fall back to the locked path\n");
+		return 0;
+	}
+
+	ngx_buffer_cache_release(cache, key, token);
+
+	if (entry->ref_count != 0)
+	{
+		printf("Error: ref count mismatch after release of an entry being evicted\n");
+		return 0;
+	}
+
+	entry->version = version;
+
+	// release of an entry whose slot was reused after a reset
+	if (!ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token))
+	{
+		printf("Error: fetch failed\n");
+		return 0;
+	}
+
+	ngx_time.sec += CACHE_LOCK_EXPIRATION + 1;
+	sh->reset = 1;
+
+	if (!ngx_buffer_cache_store(cache, other_key, (u_char*)"def", 3))
+	{
+		printf("Error: store after reset failed\n");
+		return 0;
+	}
+
+	if (find_entry(sh, other_key) != entry)
+	{
+		printf("Error: expected the entry slot to be reused\n");
+		return 0;
+	}
+
+	if ((entry->version & 1) != 0 || entry->version == version)
+	{
+		printf("Error: version was not advanced on reuse, old=%lu new=%lu\n", 
+			(unsigned long)version, (unsigned long)entry->version);
+		return 0;
+	}
+
+	ngx_buffer_cache_release(cache, key, token);
+
+	if (entry->ref_count != 0)
+	{
+		printf("Error: release of a stale reference changed the ref count of a reused entry\n");
+		return 0;
+	}
+
+	if (ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token))
+	{
+		printf("Error: fetch of an entry that was reset succeeded\n");
+		return 0;
+	}
+
+	free_buffer_cache();
+
+	return 1;
+}
+
+#define SHARDS_TEST_SHARD_COUNT (4)
+#define SHARDS_TEST_KEY_COUNT (256)
+
+int run_shards_test()
+{
+	ngx_buffer_cache_stats_t stats;
+	ngx_buffer_cache_sh_t *sh;
+	ngx_buffer_cache_t *cache;
+	u_char key[BUFFER_CACHE_KEY_SIZE];
+	u_char store_buffer[64];
+	ngx_uint_t residues;
+	ngx_uint_t slot;
+	ngx_str_t fetch_buffer;
+	ngx_uint_t shard_keys[SHARDS_TEST_SHARD_COUNT];
+	ngx_uint_t found;
+	ngx_uint_t j;
+	uint32_t token;
+	int cur_lock_count;
+	int i;
+
+	printf("starting shards test\n");
+
+	if (!init_buffer_cache(SHARDS_TEST_SHARD_COUNT * BUFFER_CACHE_MIN_SHARD_SIZE, 0, 0, SHARDS_TEST_SHARD_COUNT))
+	{
+		printf("Error: failed to initialize the buffer cache\n");
+		return 0;
+	}
+
+	cache = shm_zone.data;
+	if (cache->shard_count != SHARDS_TEST_SHARD_COUNT)
+	{
+		printf("Error: unexpected shard count %lu\n", (unsigned long)cache->shard_count);
+		return 0;
+	}
+
+	ngx_memzero(key, sizeof(key));
+	ngx_memzero(shard_keys, sizeof(shard_keys));
+	ngx_time.sec = 100;
+
+	for (i = 0; i < SHARDS_TEST_KEY_COUNT; i++)
+	{
+		((uint32_t*)&key)[0] = i;
+		generate_random_buffer(i, store_buffer, sizeof(store_buffer));
+
+		if (!ngx_buffer_cache_store(cache, key, store_buffer, sizeof(store_buffer)))
+		{
+			printf("Error: store failed\n");
+			return 0;
+		}
+	}
+
+	// every key must be stored in exactly one shard, and the keys must spread over all the shards
+	for (i = 0; i < SHARDS_TEST_KEY_COUNT; i++)
+	{
+		((uint32_t*)&key)[0] = i;
+
+		found = 0;
+		for (j = 0; j < SHARDS_TEST_SHARD_COUNT; j++)
+		{
+			if (find_entry(cache->shards[j], key) != NULL)
+			{
+				shard_keys[j]++;
+				found++;
+			}
+		}
+
+		if (found != 1)
+		{
+			printf("Error: key %d found in %lu shards\n", i, (unsigned long)found);
+			return 0;
+		}
+	}
+
+	for (j = 0; j < SHARDS_TEST_SHARD_COUNT; j++)
+	{
+		if (shard_keys[j] == 0)
+		{
+			printf("Error: no keys were stored in shard %lu\n", (unsigned long)j);
+			return 0;
+		}
+	}
+
+	// the keys of a shard share the hash bits that selected it, the index slots must not be limited by them
+	for (j = 0; j < SHARDS_TEST_SHARD_COUNT; j++)
+	{
+		sh = cache->shards[j];
+
+		residues = 0;
+		for (slot = 0; slot <= sh->index_mask; slot++)
+		{
+			if (sh->index[slot] != 0)
+			{
+				residues |= 1 << (slot % SHARDS_TEST_SHARD_COUNT);
+			}
+		}
+
+		if (residues == (1u << (j % SHARDS_TEST_SHARD_COUNT)) && shard_keys[j] > 1)
+		{
+			printf("Error: the index slots of shard %lu depend on the shard selection\n", (unsigned long)j);
+			return 0;
+		}
+	}
+
+	// all the keys must be reachable through the lock free index of their shard
+	cur_lock_count = lock_count;
+
+	for (i = 0; i < SHARDS_TEST_KEY_COUNT; i++)
+	{
+		((uint32_t*)&key)[0] = i;
+
+		if (!ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token))
+		{
+			printf("Error: fetch failed\n");
+			return 0;
+		}
+
+		ngx_buffer_cache_release(cache, key, token);
+
+		if (fetch_buffer.len != sizeof(store_buffer) ||
+			!validate_random_buffer(i, fetch_buffer.data, fetch_buffer.len))
+		{
+			printf("Error: invalid buffer content\n");
+			return 0;
+		}
+	}
+
+	if (lock_count != cur_lock_count)
+	{
+		printf("Error: fetch / release took the lock\n");
+		return 0;
+	}
+
+	// the stats are summed across the shards
+	((uint32_t*)&key)[0] = SHARDS_TEST_KEY_COUNT;
+	if (ngx_buffer_cache_fetch(cache, key, &fetch_buffer, &token))
+	{
+		printf("Error: fetch of a missing key succeeded\n");
+		return 0;
+	}
+
+	ngx_buffer_cache_get_stats(cache, &stats);
+	if (stats.store_ok != SHARDS_TEST_KEY_COUNT ||
+		stats.store_bytes != SHARDS_TEST_KEY_COUNT * sizeof(store_buffer) ||
+		stats.fetch_hit != SHARDS_TEST_KEY_COUNT ||
+		stats.fetch_bytes != SHARDS_TEST_KEY_COUNT * sizeof(store_buffer) ||
+		stats.fetch_miss != 1 ||
+		stats.evicted != 0)
+	{
+		printf("Error: unexpected stats, store_ok=%lu fetch_hit=%lu fetch_miss=%lu evicted=%lu\n",
+			(unsigned long)stats.store_ok, (unsigned long)stats.fetch_hit, 
+			(unsigned long)stats.fetch_miss, (unsigned long)stats.evicted);
+		return 0;
+	}
+
+	ngx_buffer_cache_reset_stats(cache);
+	ngx_buffer_cache_get_stats(cache, &stats);
+	if (stats.store_ok != 0 || stats.fetch_hit != 0 || stats.fetch_miss != 0)
+	{
+		printf("Error: stats were not reset in all the shards\n");
+		return 0;
+	}
+
+	free_buffer_cache();
+
+	return 1;
+}
+
 int main()
 {
 	setbuf(stdout, NULL);		// disable stdout buffering (for progress indication)
 	
+	if (!run_stale_test())
+	{
+		return 1;
+	}
+
+	if (!run_lock_free_test())
+	{
+		return 1;
+	}
+
+	if (!run_shards_test())
+	{
+		return 1;
+	}
+
 	while (run_test_cycle(time(NULL), RAND(2 * 1024 * 1024, 16 * 1024 * 1024), 1000, 1 << RAND(0, 6)));
 
 	return 0;
@@ -1,5 +1,6 @@
 #include <inttypes.h>
 #include <stdio.h>
+#include <time.h>
 #include <ngx_core.h>
 #include <vod/json_parser.h>
 #include <vod/parse_utils.h>
@@ -220,6 +221,117 @@ void bad_jsons_test()
 	}
 }
 
+static u_char*
+build_int_array_json(int count, int value_base)
+{
+	u_char* result;
+	u_char* p;
+	int i;
+
+	result = malloc(count * (NGX_INT32_LEN + 2) + 32);
+	if (result == NULL)
+	{
+		return NULL;
+	}
+
+	p = ngx_sprintf(result, "{\"durations\":[");
+	for (i = 0; i < count; i++)
+	{
+		p = ngx_sprintf(p, i > 0 ? ", %d" : "%d", value_base + i);
+	}
+	p = ngx_sprintf(p, "]}%Z");
+
+	return result;
+}
+
+void long_values_tests()
+{
+	static int counts[] = { 1, 2, 15, 16, 17, 1000, 100000 };
+	vod_json_key_value_t* pairs;
+	vod_json_value_t result;
+	vod_array_part_t* part;
+	int64_t* cur_item;
+	int64_t expected;
+	ngx_int_t rc;
+	u_char error[128];
+	u_char* json;
+	unsigned i;
+
+	// int arrays
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++)
+	{
+		json = build_int_array_json(counts[i], 1000);
+		rc = vod_json_parse(pool, json, &result, error, sizeof(error));
+		assert(rc == VOD_JSON_OK);
+		pairs = (vod_json_key_value_t*)result.v.obj.elts;
+		assert(pairs[0].value.type == VOD_JSON_ARRAY);
+		assert(pairs[0].value.v.arr.type == VOD_JSON_INT);
+		assert(pairs[0].value.v.arr.count == (size_t)counts[i]);
+
+		expected = 1000;
+		for (part = &pairs[0].value.v.arr.part; part != NULL; part = part->next)
+		{
+			for (cur_item = part->first; (void*)cur_item < part->last; cur_item++)
+			{
+				assert(*cur_item == expected);
+				expected++;
+			}
+		}
+		assert(expected == 1000 + counts[i]);
+		free(json);
+	}
+
+	// escapes on both sides of a 16 byte boundary
+	rc = vod_json_parse(pool, (u_char*)"[\"0123456789abcd\\\"ef0123456789abcdef0123456789\\\\\", \"x\"]", &result, error, sizeof(error));
+	assert(rc == VOD_JSON_OK);
+	assert(result.v.arr.type == VOD_JSON_STRING);
+	assert(result.v.arr.count == 2);
+	assert_string(((ngx_str_t*)result.v.arr.part.first)[0], "0123456789abcd\\\"ef0123456789abcdef0123456789\\\\");
+
+	// ints followed by a string
+	rc = vod_json_parse(pool, (u_char*)"[1, 2, 3, \"4,5,6\"]", &result, error, sizeof(error));
+	assert(rc == VOD_JSON_BAD_DATA);
+}
+
+// Note: the benchmark reuses the pool, so it should be the last test
+void parse_benchmark()
+{
+	struct timespec start;
+	struct timespec end;
+	vod_json_value_t result;
+	ngx_int_t rc;
+	u_char error[128];
+	u_char* json;
+	size_t json_size;
+	double elapsed;
+	int iterations = 200;
+	int i;
+
+	json = build_int_array_json(100000, 1000000);
+	if (json == NULL)
+	{
+		return;
+	}
+	json_size = ngx_strlen(json);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < iterations; i++)
+	{
+		rc = vod_json_parse(pool, json, &result, error, sizeof(error));
+		assert(rc == VOD_JSON_OK);
+		ngx_reset_pool(pool);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("parse benchmark: %d x %zu bytes, %.3f sec, %.1f MB/sec\n",
+		iterations, json_size, elapsed, iterations * json_size / elapsed / (1024 * 1024));
+
+	free(json);
+}
+
 void get_element_guid_tests()
 {
 	static ngx_str_t tests[] = {
@@ -295,5 +407,7 @@ int main()
 	get_element_guid_tests();
 	get_fixed_string_tests();
 	get_binary_string_tests();
+	long_values_tests();
+	parse_benchmark();
 	return 0;
 }
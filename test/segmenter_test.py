@@ -10,6 +10,7 @@ confMatrix = [
 		('dash-stl', ['vod dash', 'vod_dash_manifest_format segmenttimeline']),
 		('dash-st', ['vod dash', 'vod_dash_manifest_format segmenttemplate']),
 		('dash-sl', ['vod dash', 'vod_dash_manifest_format segmentlist']),
+		('hls-ll', ['vod hls', 'vod_hls_container_format fmp4', 'vod_partial_segment_duration 1000']),
 	],
 	[
 		('zw', ['vod_live_window_duration 0']),
@@ -42,8 +43,24 @@ fileByProtocol = {
 	'dash-stl': 'manifest.mpd',
 	'dash-st': 'manifest.mpd',
 	'dash-sl': 'manifest.mpd',
+	'hls-ll': 'master.m3u8',
 }
 
+vodDuration = 34469		# duration of the first clip in segmenter_test_backend.php
+partDuration = 1000
+
+def isValidConf(confComb):
+	combDict = dict(confComb)
+	return not (combDict.has_key('hls-ll') and combDict.has_key('akf'))	# partial segments not supported with key frame alignment
+
+def getLastSegmentPartUrls(locName, segmentDuration, jsonComb):
+	# request all the parts of the last segment + one past the end
+	segmentCount = (vodDuration + segmentDuration - 1) / segmentDuration
+	lastSegmentDuration = vodDuration - (segmentCount - 1) * segmentDuration
+	partCount = (lastSegmentDuration + partDuration - 1) / partDuration
+	baseUrl = '/' + locName + ''.join(map(lambda (x): '/%s/%s' % x, jsonComb))
+	return map(lambda partIndex: '%s/part-%s-%s-v1.m4s' % (baseUrl, segmentCount, partIndex), range(1, partCount + 2))
+
 jsonMatrix = [
 	[
 		('type', 'vod'),
@@ -150,6 +167,8 @@ http {
 def getConf():
 	locations = ''
 	for comb in itertools.product(*confMatrix):
+		if not isValidConf(comb):
+			continue
 		locName = '-'.join(map(lambda x: x[0], comb))
 		locDirectives = reduce(lambda x, y: x + y, map(lambda x: x[1], comb))
 		locations += 'location /%s/ {\n%s\n}\n\n' % (locName, 
@@ -159,6 +178,8 @@ def getConf():
 def getTestUrls():
 	result = []
 	for confComb in itertools.product(*confMatrix):
+		if not isValidConf(confComb):
+			continue
 		locName = '-'.join(map(lambda x: x[0], confComb))
 		for baseJsonComb in itertools.product(*jsonMatrix):
 			# decide on the live combinations
@@ -193,6 +214,12 @@ def getTestUrls():
 					'/time/@time@' + \
 					'/' + fileByProtocol[confComb[0][0]]
 				result.append(url)
+
+				# partial segments of the last segment (last segment policy short, no bootstrap)
+				if (combDict.has_key('hls-ll') and combDict['type'] == 'vod' and 
+					combDict.has_key('sps') and not combDict.has_key('bs')):
+					segmentDuration = 9000 if combDict.has_key('sd10') else 3000
+					result += getLastSegmentPartUrls(locName, segmentDuration, jsonComb)
 	return result
 
 if len(sys.argv) < 2:
@@ -92,6 +92,14 @@ def truncateAtom(name, newSize):
     return StringReader(inputData[:atomPos] + struct.pack('>L', atomHeaderSize + newSize) + inputData[(atomPos + 4):newAtomEndPos] +
         struct.pack('>L', atomEndPos - newAtomEndPos) + 'padd' + inputData[(newAtomEndPos + 8):])
 
+def patchConvertedAtom(params, path, offset, replacement):
+    convertedData = convertWithFfmpeg(params, False).read()
+    atomPos, atomHeaderSize, _, _ = getAtom(parseAtoms(convertedData, 0, len(convertedData)), path)
+    patchPos = atomPos + atomHeaderSize + offset
+    return StringReader(convertedData[:patchPos] + replacement + convertedData[(patchPos + len(replacement)):])
+
+FRAGMENTED_PARAMS = '-acodec copy -vcodec copy -movflags frag_keyframe+empty_moov+default_base_moof'
+
 # download and read the input file
 if not os.path.exists(TEMP_DOWNLOAD_PATH):
     http_utils.downloadUrl(TEST_FLAVOR_URL, TEMP_DOWNLOAD_PATH)
@@ -133,6 +141,21 @@ TEST_CASES = [
         ('/hls', 'index.m3u8', 200, None),
         ('', 'clipTo/10000/a.mp4', 200, None),
     ]),
+    ('FRAGMENTED', lambda: convertWithFfmpeg(FRAGMENTED_PARAMS, False), [
+        ('/hls', 'index.m3u8', 200, None),
+        ('/hls', 'seg-1.ts', 200, None),
+    ]),
+    ('FRAGMENTED_SIDX', lambda: convertWithFfmpeg(FRAGMENTED_PARAMS + '+global_sidx', False), [
+        ('/hls', 'index.m3u8', 200, None),
+        ('/hls', 'seg-1.ts', 200, None),
+    ]),
+    ('FRAGMENTED_TFDT_NON_ZERO', lambda: convertWithFfmpeg('-output_ts_offset 1000 ' + FRAGMENTED_PARAMS, False), [
+        ('/hls', 'index.m3u8', 200, None),
+        ('/hls', 'seg-1.ts', 200, None),
+    ]),
+    ('FRAGMENTED_TRUN_SAMPLE_COUNT_BIG', lambda: patchConvertedAtom(FRAGMENTED_PARAMS, 'moof.traf.trun', 0, struct.pack('>LL', 0, 100000000)), [
+        ('/hls', 'index.m3u8', 404, 'mp4_fragmented_reader_parse_trun: sample count 100000000 too big'),
+    ]),
     ('NON_H264_VIDEO', lambda: convertWithFfmpeg('-acodec copy -c:v mpeg4'), [
         ('/hls', 'index.m3u8', 200, 'unsupported format - media type 0'),
         ('', 'clipTo/10000/a.mp4', 200, None),
@@ -195,8 +195,66 @@ typedef struct {
 	uint64_t clip_start_time;
 	uint64_t segment_base_time;
 	adaptation_sets_t adaptation_sets;
+	request_context_t* request_context;
+	dash_period_cache_t* period_cache;
+	u_char* end;
 } write_period_context_t;
 
+// period cache key
+typedef struct {
+	uint64_t clip_start_time;
+	uint64_t segment_base_time;
+	uint64_t clip_time;
+	uint64_t next_clip_time;
+	uint32_t clip_index;
+	uint32_t clip_duration;
+	uint32_t clip_relative_index;
+	uint32_t media_set_type;
+	uint32_t flags;
+	uint32_t segment_duration;
+	uint32_t manifest_format;
+	uint32_t adaptation_set_count;
+	uint32_t base_url_len;
+	uint32_t init_file_name_prefix_len;
+	uint32_t fragment_file_name_prefix_len;
+	uint32_t subtitle_file_name_prefix_len;
+} dash_period_cache_key_header_t;
+
+typedef struct {
+	uint64_t start_time;
+	uint32_t type;
+	uint32_t track_count;
+	uint32_t item_count;
+	uint32_t timescale;
+} dash_period_cache_key_adaptation_set_t;
+
+typedef struct {
+	uint64_t duration;
+	uint32_t segment_index;
+	uint32_t repeat_count;
+	uint32_t discontinuity;
+	uint32_t reserved;
+} dash_period_cache_key_item_t;
+
+typedef struct {
+	uint32_t media_type;
+	uint32_t codec_id;
+	uint32_t sequence_index;
+	uint32_t track_index;
+	uint32_t width;
+	uint32_t height;
+	uint32_t min_frame_duration;
+	uint32_t sample_rate;
+	uint32_t bitrate;
+	uint32_t language;
+	uint32_t codec_name_len;
+	uint32_t label_len;
+} dash_period_cache_key_track_t;
+
+#define DASH_PERIOD_CACHE_FLAG_DISCONTINUITY	(0x01)
+#define DASH_PERIOD_CACHE_FLAG_MULTI_SEQUENCES	(0x02)
+#define DASH_PERIOD_CACHE_FLAG_MULTI_AUDIO		(0x04)
+
 typedef struct {
 	vod_str_t mime_type;
 	vod_str_t init_file_ext;
@@ -986,6 +1044,285 @@ dash_packager_write_mpd_period(
 	return p;
 }
 
+static segment_duration_item_t*
+dash_packager_get_period_items_end(
+	segment_durations_t* segment_durations,
+	segment_duration_item_t* cur_item)
+{
+	segment_duration_item_t* last_item = segment_durations->items + segment_durations->item_count;
+	segment_duration_item_t* first_item = cur_item;
+
+	for (; cur_item < last_item; cur_item++)
+	{
+		// stop on discontinuity, same as dash_packager_get_cur_clip_segment_count
+		if (cur_item->discontinuity && cur_item > first_item)
+		{
+			break;
+		}
+	}
+
+	return cur_item;
+}
+
+// Note: the key contains all the inputs of dash_packager_write_mpd_period, so that a period that did not
+//		change since the previous request (e.g. a completed period of a live stream) is not rendered again
+static vod_status_t
+dash_packager_get_period_cache_key(
+	write_period_context_t* context,
+	segment_duration_item_t** items_end,
+	vod_str_t* result)
+{
+	dash_period_cache_key_adaptation_set_t set_key;
+	dash_period_cache_key_header_t header;
+	dash_period_cache_key_track_t track_key;
+	dash_period_cache_key_item_t item_key;
+	segment_duration_item_t** cur_duration_items;
+	segment_duration_item_t* cur_item;
+	segment_durations_t* segment_durations;
+	adaptation_set_t* adaptation_set;
+	media_track_t** cur_track_ptr;
+	media_track_t* cur_track;
+	media_set_t* media_set = context->media_set;
+	uint32_t filtered_clip_offset;
+	size_t size;
+	u_char* p;
+
+	filtered_clip_offset = context->clip_index < media_set->clip_count ?
+		context->clip_index * media_set->total_track_count : 0;
+
+	// find the segment durations of the period and get the key size
+	size = sizeof(header) + context->base_url.len +
+		context->conf->init_file_name_prefix.len +
+		context->conf->fragment_file_name_prefix.len +
+		context->conf->subtitle_file_name_prefix.len;
+
+	for (adaptation_set = context->adaptation_sets.first, cur_duration_items = context->cur_duration_items;
+		adaptation_set < context->adaptation_sets.last;
+		adaptation_set++, cur_duration_items++, items_end++)
+	{
+		size += sizeof(set_key);
+
+		if (adaptation_set->type == MEDIA_TYPE_SUBTITLE)
+		{
+			*items_end = *cur_duration_items;
+		}
+		else
+		{
+			*items_end = dash_packager_get_period_items_end(
+				&context->segment_durations[adaptation_set->type],
+				*cur_duration_items);
+
+			size += sizeof(item_key) * (*items_end - *cur_duration_items);
+		}
+
+		for (cur_track_ptr = adaptation_set->first;
+			cur_track_ptr < adaptation_set->last;
+			cur_track_ptr++)
+		{
+			cur_track = (*cur_track_ptr) + filtered_clip_offset;
+
+			size += sizeof(track_key) + cur_track->media_info.codec_name.len + cur_track->media_info.label.len;
+		}
+	}
+
+	p = vod_alloc(context->request_context->pool, size);
+	if (p == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, context->request_context->log, 0,
+			"dash_packager_get_period_cache_key: vod_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	result->data = p;
+
+	// header
+	vod_memzero(&header, sizeof(header));
+	header.clip_start_time = context->clip_start_time;
+	header.segment_base_time = context->segment_base_time;
+	if (media_set->use_discontinuity)
+	{
+		header.clip_duration = media_set->timing.durations[context->clip_index];
+		if (media_set->timing.times != NULL)
+		{
+			header.clip_time = media_set->timing.times[context->clip_index];
+			if (context->clip_index + 1 < media_set->timing.total_count)
+			{
+				header.next_clip_time = media_set->timing.times[context->clip_index + 1];
+			}
+		}
+		header.flags |= DASH_PERIOD_CACHE_FLAG_DISCONTINUITY;
+	}
+
+	if (media_set->has_multi_sequences)
+	{
+		header.flags |= DASH_PERIOD_CACHE_FLAG_MULTI_SEQUENCES;
+	}
+
+	if (context->adaptation_sets.multi_audio)
+	{
+		header.flags |= DASH_PERIOD_CACHE_FLAG_MULTI_AUDIO;
+	}
+
+	header.clip_index = media_set->initial_clip_index + context->clip_index;
+	header.clip_relative_index = context->clip_index == 0 ? media_set->initial_segment_clip_relative_index : 0;
+	header.media_set_type = media_set->type;
+	header.segment_duration = media_set->segmenter_conf->segment_duration;
+	header.manifest_format = context->conf->manifest_format;
+	header.adaptation_set_count = context->adaptation_sets.total_count;
+	header.base_url_len = context->base_url.len;
+	header.init_file_name_prefix_len = context->conf->init_file_name_prefix.len;
+	header.fragment_file_name_prefix_len = context->conf->fragment_file_name_prefix.len;
+	header.subtitle_file_name_prefix_len = context->conf->subtitle_file_name_prefix.len;
+
+	p = vod_copy(p, &header, sizeof(header));
+	p = vod_copy(p, context->base_url.data, context->base_url.len);
+	p = vod_copy(p, context->conf->init_file_name_prefix.data, context->conf->init_file_name_prefix.len);
+	p = vod_copy(p, context->conf->fragment_file_name_prefix.data, context->conf->fragment_file_name_prefix.len);
+	p = vod_copy(p, context->conf->subtitle_file_name_prefix.data, context->conf->subtitle_file_name_prefix.len);
+
+	// adaptation sets
+	items_end -= context->adaptation_sets.total_count;
+
+	for (adaptation_set = context->adaptation_sets.first, cur_duration_items = context->cur_duration_items;
+		adaptation_set < context->adaptation_sets.last;
+		adaptation_set++, cur_duration_items++, items_end++)
+	{
+		vod_memzero(&set_key, sizeof(set_key));
+		set_key.type = adaptation_set->type;
+		set_key.track_count = adaptation_set->last - adaptation_set->first;
+		set_key.item_count = *items_end - *cur_duration_items;
+		if (adaptation_set->type != MEDIA_TYPE_SUBTITLE)
+		{
+			segment_durations = &context->segment_durations[adaptation_set->type];
+			set_key.timescale = segment_durations->timescale;
+			set_key.start_time = segment_durations->start_time;
+		}
+
+		p = vod_copy(p, &set_key, sizeof(set_key));
+
+		for (cur_item = *cur_duration_items; cur_item < *items_end; cur_item++)
+		{
+			item_key.duration = cur_item->duration;
+			item_key.segment_index = cur_item->segment_index;
+			item_key.repeat_count = cur_item->repeat_count;
+			item_key.discontinuity = cur_item->discontinuity;
+			item_key.reserved = 0;
+
+			p = vod_copy(p, &item_key, sizeof(item_key));
+		}
+
+		for (cur_track_ptr = adaptation_set->first;
+			cur_track_ptr < adaptation_set->last;
+			cur_track_ptr++)
+		{
+			cur_track = (*cur_track_ptr) + filtered_clip_offset;
+
+			vod_memzero(&track_key, sizeof(track_key));
+			track_key.media_type = cur_track->media_info.media_type;
+			track_key.codec_id = cur_track->media_info.codec_id;
+			track_key.sequence_index = cur_track->file_info.source->sequence->index;
+			track_key.track_index = cur_track->index;
+			track_key.min_frame_duration = cur_track->media_info.min_frame_duration;
+			track_key.bitrate = cur_track->media_info.bitrate;
+			track_key.language = cur_track->media_info.language;
+			track_key.codec_name_len = cur_track->media_info.codec_name.len;
+			track_key.label_len = cur_track->media_info.label.len;
+
+			switch (cur_track->media_info.media_type)
+			{
+			case MEDIA_TYPE_VIDEO:
+				track_key.width = cur_track->media_info.u.video.width;
+				track_key.height = cur_track->media_info.u.video.height;
+				break;
+
+			case MEDIA_TYPE_AUDIO:
+				track_key.sample_rate = cur_track->media_info.u.audio.sample_rate;
+				break;
+			}
+
+			p = vod_copy(p, &track_key, sizeof(track_key));
+			p = vod_copy(p, cur_track->media_info.codec_name.data, cur_track->media_info.codec_name.len);
+			p = vod_copy(p, cur_track->media_info.label.data, cur_track->media_info.label.len);
+		}
+	}
+
+	result->len = p - result->data;
+
+	if (result->len != size)
+	{
+		vod_log_error(VOD_LOG_ERR, context->request_context->log, 0,
+			"dash_packager_get_period_cache_key: result length %uz different than allocated length %uz",
+			result->len, size);
+		return VOD_UNEXPECTED;
+	}
+
+	return VOD_OK;
+}
+
+static vod_status_t
+dash_packager_write_cached_period(
+	u_char** p,
+	write_period_context_t* context)
+{
+	segment_duration_item_t** cur_duration_items;
+	segment_duration_item_t** items_end;
+	vod_str_t period;
+	vod_str_t key;
+	vod_status_t rc;
+	uint32_t i;
+
+	items_end = vod_alloc(context->request_context->pool,
+		sizeof(items_end[0]) * context->adaptation_sets.total_count);
+	if (items_end == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, context->request_context->log, 0,
+			"dash_packager_write_cached_period: vod_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	rc = dash_packager_get_period_cache_key(context, items_end, &key);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	rc = context->period_cache->fetch(context->period_cache->context, &key, &period);
+	switch (rc)
+	{
+	case VOD_OK:
+		if (period.len <= (size_t)(context->end - *p))
+		{
+			vod_log_debug1(VOD_LOG_DEBUG_LEVEL, context->request_context->log, 0,
+				"dash_packager_write_cached_period: period %uD found in cache", context->clip_index);
+
+			*p = vod_copy(*p, period.data, period.len);
+
+			// skip the segment durations of the period
+			cur_duration_items = context->cur_duration_items;
+			for (i = 0; i < context->adaptation_sets.total_count; i++)
+			{
+				cur_duration_items[i] = items_end[i];
+			}
+			return VOD_OK;
+		}
+		break;
+
+	case VOD_NOT_FOUND:
+		break;
+
+	default:
+		return rc;
+	}
+
+	period.data = *p;
+	*p = dash_packager_write_mpd_period(*p, context);
+	period.len = *p - period.data;
+
+	context->period_cache->store(context->period_cache->context, &key, &period);
+
+	return VOD_OK;
+}
+
 static size_t
 dash_packager_get_segment_list_total_size(
 	dash_manifest_config_t* conf,
@@ -1178,6 +1515,7 @@ dash_packager_build_mpd(
 	vod_str_t* base_url,
 	media_set_t* media_set,
 	dash_manifest_extensions_t* extensions,
+	dash_period_cache_t* period_cache,
 	vod_str_t* result)
 {
 	segment_duration_item_t** cur_duration_items;
@@ -1407,6 +1745,20 @@ dash_packager_build_mpd(
 	context.conf = conf;
 	context.media_set = media_set;
 	context.extensions = *extensions;
+	context.request_context = request_context;
+	context.end = result->data + result_size;
+
+	// Note: the output of the extensions is not part of the key, and segment lists depend on the whole media set
+	if (extensions->representation.write == NULL &&
+		extensions->adaptation_set.write == NULL &&
+		conf->manifest_format != FORMAT_SEGMENT_LIST)
+	{
+		context.period_cache = period_cache;
+	}
+	else
+	{
+		context.period_cache = NULL;
+	}
 
 	// print the manifest header
 	switch (media_set->type)
@@ -1464,9 +1816,22 @@ dash_packager_build_mpd(
 
 	for (;;)
 	{
-		p = dash_packager_write_mpd_period(
-			p,
-			&context);
+		if (context.period_cache != NULL)
+		{
+			rc = dash_packager_write_cached_period(
+				&p,
+				&context);
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+		}
+		else
+		{
+			p = dash_packager_write_mpd_period(
+				p,
+				&context);
+		}
 
 		context.clip_index++;
 		if (context.clip_index >= period_count)
@@ -42,6 +42,13 @@ typedef struct {
 	tags_writer_t adaptation_set;
 } dash_manifest_extensions_t;
 
+typedef struct {
+	// returns VOD_NOT_FOUND when the key is not in the cache, the result is allocated on the request pool
+	vod_status_t(*fetch)(void* context, vod_str_t* key, vod_str_t* result);
+	void(*store)(void* context, vod_str_t* key, vod_str_t* period);
+	void* context;
+} dash_period_cache_t;
+
 typedef struct {
 	size_t extra_traf_atoms_size;
 	dash_write_extra_traf_atoms_callback_t write_extra_traf_atoms_callback;
@@ -55,6 +62,7 @@ vod_status_t dash_packager_build_mpd(
 	vod_str_t* base_url,
 	media_set_t* media_set,
 	dash_manifest_extensions_t* extensions,
+	dash_period_cache_t* period_cache,
 	vod_str_t* result);
 
 vod_status_t dash_packager_build_fragment_header(
@@ -253,6 +253,7 @@ edash_packager_build_mpd(
 		base_url,
 		media_set,
 		&extensions,
+		NULL,
 		result);
 	if (rc != VOD_OK)
 	{
@@ -159,7 +159,11 @@ audio_decoder_init(
 	state->data_handled = TRUE;
 	state->frame_started = FALSE;
 	state->frame_buffer = NULL;
+	state->frames_buffer = NULL;
+	state->frames_pos = NULL;
+	state->frames_read = FALSE;
 
+	state->first_frame_part = track->frames;
 	state->cur_frame_part = track->frames;
 	state->cur_frame = track->frames.first_frame;
 	state->dts = track->first_frame_time_offset;
@@ -180,6 +184,20 @@ audio_decoder_free(audio_decoder_state_t* state)
 	av_frame_free(&state->decoded_frame);
 }
 
+static void
+audio_decoder_move_to_next_frame(audio_decoder_state_t* state)
+{
+	state->cur_frame++;
+	if (state->cur_frame >= state->cur_frame_part.last_frame &&
+		state->cur_frame_part.next != NULL)
+	{
+		state->cur_frame_part = *state->cur_frame_part.next;
+		state->cur_frame = state->cur_frame_part.first_frame;
+	}
+
+	state->frame_started = FALSE;
+}
+
 static vod_status_t
 audio_decoder_decode_frame(
 	audio_decoder_state_t* state,
@@ -216,16 +234,7 @@ audio_decoder_decode_frame(
 		return VOD_BAD_DATA;
 	}
 
-	// move to the next frame
-	state->cur_frame++;
-	if (state->cur_frame >= state->cur_frame_part.last_frame &&
-		state->cur_frame_part.next != NULL)
-	{
-		state->cur_frame_part = *state->cur_frame_part.next;
-		state->cur_frame = state->cur_frame_part.first_frame;
-	}
-
-	state->frame_started = FALSE;
+	audio_decoder_move_to_next_frame(state);
 
 	// receive a frame
 	avrc = avcodec_receive_frame(state->decoder, state->decoded_frame);
@@ -248,6 +257,139 @@ audio_decoder_decode_frame(
 	return VOD_OK;
 }
 
+static vod_status_t
+audio_decoder_alloc_frames_buffer(audio_decoder_state_t* state)
+{
+	frame_list_part_t* part;
+	input_frame_t* last_frame;
+	input_frame_t* cur_frame;
+	size_t total_size = 0;
+
+	part = &state->first_frame_part;
+	last_frame = part->last_frame;
+	for (cur_frame = part->first_frame;; cur_frame++)
+	{
+		if (cur_frame >= last_frame)
+		{
+			if (part->next == NULL)
+			{
+				break;
+			}
+			part = part->next;
+			cur_frame = part->first_frame;
+			last_frame = part->last_frame;
+		}
+
+		total_size += cur_frame->size;
+	}
+
+	state->frames_buffer = vod_alloc(
+		state->request_context->pool,
+		total_size + VOD_BUFFER_PADDING_SIZE);
+	if (state->frames_buffer == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+			"audio_decoder_alloc_frames_buffer: vod_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	state->frames_pos = state->frames_buffer;
+
+	return VOD_OK;
+}
+
+vod_status_t
+audio_decoder_read_frames(
+	audio_decoder_state_t* state)
+{
+	u_char* read_buffer;
+	uint32_t read_size;
+	vod_status_t rc;
+	bool_t frame_done;
+
+	if (state->frames_read)
+	{
+		return VOD_OK;
+	}
+
+	if (state->frames_buffer == NULL)
+	{
+		rc = audio_decoder_alloc_frames_buffer(state);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+	}
+
+	for (;;)
+	{
+		// start a frame if needed
+		if (!state->frame_started)
+		{
+			if (state->cur_frame >= state->cur_frame_part.last_frame)
+			{
+				break;
+			}
+
+			rc = state->cur_frame_part.frames_source->start_frame(
+				state->cur_frame_part.frames_source_context,
+				state->cur_frame,
+				NULL);
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+
+			state->frame_started = TRUE;
+		}
+
+		// read some data from the frame
+		rc = state->cur_frame_part.frames_source->read(
+			state->cur_frame_part.frames_source_context,
+			&read_buffer,
+			&read_size,
+			&frame_done);
+		if (rc != VOD_OK)
+		{
+			if (rc != VOD_AGAIN)
+			{
+				return rc;
+			}
+
+			if (!state->data_handled)
+			{
+				vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+					"audio_decoder_read_frames: no data was handled, probably a truncated file");
+				return VOD_BAD_DATA;
+			}
+
+			state->data_handled = FALSE;
+			return VOD_AGAIN;
+		}
+
+		state->data_handled = TRUE;
+
+		state->frames_pos = vod_copy(state->frames_pos, read_buffer, read_size);
+
+		if (frame_done)
+		{
+			audio_decoder_move_to_next_frame(state);
+		}
+	}
+
+	// Note: the frames are decoded in place, the padding is required only after the last frame,
+	//		since the bytes following the other frames are saved and restored around each decode
+	vod_memzero(state->frames_pos, VOD_BUFFER_PADDING_SIZE);
+
+	// rewind, the frames are now decoded from memory
+	state->frames_pos = state->frames_buffer;
+	state->cur_frame_part = state->first_frame_part;
+	state->cur_frame = state->first_frame_part.first_frame;
+	state->frames_read = TRUE;
+
+	return VOD_OK;
+}
+
 vod_status_t
 audio_decoder_get_frame(
 	audio_decoder_state_t* state,
@@ -258,6 +400,27 @@ audio_decoder_get_frame(
 	vod_status_t rc;
 	bool_t frame_done;
 
+	if (state->frames_read)
+	{
+		// Note: this path does not perform any allocations, and can run outside the event loop thread
+		for (;;)
+		{
+			if (state->cur_frame >= state->cur_frame_part.last_frame)
+			{
+				return VOD_DONE;
+			}
+
+			read_buffer = state->frames_pos;
+			state->frames_pos += state->cur_frame->size;
+
+			rc = audio_decoder_decode_frame(state, read_buffer, result);
+			if (rc != VOD_AGAIN)
+			{
+				return rc;
+			}
+		}
+	}
+
 	for (;;)
 	{
 		// start a frame if needed
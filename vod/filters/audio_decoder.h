@@ -15,10 +15,16 @@ typedef struct {
 	AVCodecContext* decoder;
 	AVFrame* decoded_frame;
 
+	frame_list_part_t first_frame_part;
 	frame_list_part_t cur_frame_part;
 	input_frame_t* cur_frame;
 	uint64_t dts;
 
+	// deferred mode - all frames are read to memory before decoding
+	u_char* frames_buffer;
+	u_char* frames_pos;
+	bool_t frames_read;
+
 	u_char* frame_buffer;
 	uint32_t max_frame_size;
 	uint32_t cur_frame_pos;
@@ -37,6 +43,9 @@ vod_status_t audio_decoder_init(
 
 void audio_decoder_free(audio_decoder_state_t* state);
 
+vod_status_t audio_decoder_read_frames(
+	audio_decoder_state_t* state);
+
 vod_status_t audio_decoder_get_frame(
 	audio_decoder_state_t* state,
 	AVFrame** result);
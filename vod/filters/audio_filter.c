@@ -46,6 +46,7 @@ typedef struct
 	audio_decoder_state_t decoder;
 	AVFilterContext *buffer_src;
 	bool_t buffersrc_flushed;
+	media_track_t* track;
 } audio_filter_source_t;
 
 typedef struct
@@ -56,6 +57,36 @@ typedef struct
 	vod_array_t frames_array;
 } audio_filter_sink_t;
 
+// Note: the cache key is the output params and the frame range of each source, followed by the filter graph
+//		description, the cache entry is a header, followed by the frames and the frames data
+typedef struct {
+	uint64_t channel_layout;
+	uint32_t output_codec_id;
+	uint32_t sample_rate;
+	uint32_t bitrate;
+	uint32_t source_count;
+} audio_filter_cache_key_header_t;
+
+typedef struct {
+	u_char file_key[MEDIA_CLIP_KEY_SIZE];
+	uint64_t first_frame_time_offset;
+	uint64_t first_frame_offset;
+	uint64_t total_frames_size;
+	uint32_t track_id;
+	uint32_t frame_count;
+} audio_filter_cache_key_source_t;
+
+typedef struct {
+	uint32_t frame_count;
+	uint32_t reserved;
+} audio_filter_cache_header_t;
+
+typedef struct {
+	uint32_t size;
+	uint32_t duration;
+	uint32_t pts_delay;
+} audio_filter_cache_frame_t;
+
 // constants
 static audio_filter_encoder_t libav_encoder = {
 	AUDIO_ENCODER_INPUT_SAMPLE_FORMAT,
@@ -246,6 +277,10 @@ audio_filter_alloc_memory_frame(
 
 typedef struct {
 	request_context_t* request_context;
+	request_context_t* output_context;
+	request_context_t deferred_context;
+	bool_t deferred;
+	bool_t frames_processed;
 	
 	// ffmpeg filter
 	AVFilterGraph *filter_graph;
@@ -262,6 +297,11 @@ typedef struct {
 
 	// processing state
 	audio_filter_source_t* cur_source;
+
+	// cache
+	audio_filter_cache_t* cache;
+	vod_str_t cache_key;
+	bool_t cached;
 } audio_filter_state_t;
 
 // globals
@@ -502,6 +542,8 @@ audio_filter_init_sources_and_graph_desc(audio_filter_init_context_t* state, med
 		cur_source = state->cur_source;
 		state->cur_source++;
 
+		cur_source->track = audio_track;
+
 		rc = audio_decoder_init(
 			&cur_source->decoder,
 			state->request_context,
@@ -549,6 +591,206 @@ audio_filter_init_sources_and_graph_desc(audio_filter_init_context_t* state, med
 	return VOD_OK;
 }
 
+static vod_status_t
+audio_filter_init_cache_key(
+	audio_filter_state_t* state,
+	u_char* graph_desc,
+	uint32_t output_codec_id,
+	uint64_t channel_layout)
+{
+	audio_filter_cache_key_source_t* source_key;
+	audio_filter_cache_key_header_t* header;
+	audio_filter_source_t* sources_cur;
+	media_track_t* track;
+	size_t graph_desc_len;
+	u_char* p;
+
+	for (sources_cur = state->sources; sources_cur < state->sources_end; sources_cur++)
+	{
+		// Note: sources that are generated in memory (e.g. silence) do not have a stable identity
+		if (sources_cur->track->frames.frames_source == &frames_source_memory)
+		{
+			return VOD_OK;
+		}
+	}
+
+	graph_desc_len = vod_strlen(graph_desc);
+
+	state->cache_key.len = graph_desc_len + sizeof(*header) +
+		sizeof(*source_key) * (state->sources_end - state->sources);
+	state->cache_key.data = vod_alloc(state->request_context->pool, state->cache_key.len);
+	if (state->cache_key.data == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+			"audio_filter_init_cache_key: vod_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	vod_memzero(state->cache_key.data, state->cache_key.len);
+
+	header = (void*)state->cache_key.data;
+	header->channel_layout = channel_layout;
+	header->output_codec_id = output_codec_id;
+	header->sample_rate = state->output->media_info.u.audio.sample_rate;
+	header->bitrate = state->output->media_info.bitrate;
+	header->source_count = state->sources_end - state->sources;
+
+	source_key = (void*)(header + 1);
+	for (sources_cur = state->sources; sources_cur < state->sources_end; sources_cur++, source_key++)
+	{
+		track = sources_cur->track;
+
+		vod_memcpy(source_key->file_key, track->file_info.source->file_key, sizeof(source_key->file_key));
+		source_key->first_frame_time_offset = track->first_frame_time_offset;
+		if (track->frames.first_frame < track->frames.last_frame)
+		{
+			source_key->first_frame_offset = track->frames.first_frame->offset;
+		}
+		source_key->total_frames_size = track->total_frames_size;
+		source_key->track_id = track->media_info.track_id;
+		source_key->frame_count = track->frame_count;
+	}
+
+	p = (u_char*)source_key;
+	vod_memcpy(p, graph_desc, graph_desc_len);
+
+	return VOD_OK;
+}
+
+static vod_status_t
+audio_filter_fetch_from_cache(audio_filter_state_t* state)
+{
+	audio_filter_cache_header_t* header;
+	audio_filter_cache_frame_t* cur_frame;
+	audio_filter_cache_frame_t* last_frame;
+	input_frame_t* output_frame;
+	vod_str_t buffer;
+	vod_status_t rc;
+	uint64_t data_size;
+	u_char* data;
+
+	rc = state->cache->fetch(state->cache->context, &state->cache_key, &buffer);
+	if (rc != VOD_OK)
+	{
+		if (rc == VOD_NOT_FOUND)
+		{
+			return VOD_OK;
+		}
+		return rc;
+	}
+
+	// validate the entry
+	if (buffer.len < sizeof(*header))
+	{
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"audio_filter_fetch_from_cache: entry size %uz smaller than header size", buffer.len);
+		return VOD_OK;
+	}
+
+	header = (audio_filter_cache_header_t*)buffer.data;
+	if (header->frame_count > (buffer.len - sizeof(*header)) / sizeof(*cur_frame))
+	{
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"audio_filter_fetch_from_cache: entry size %uz too small to hold %uD frames", buffer.len, header->frame_count);
+		return VOD_OK;
+	}
+
+	cur_frame = (audio_filter_cache_frame_t*)(header + 1);
+	last_frame = cur_frame + header->frame_count;
+	data = (u_char*)last_frame;
+
+	data_size = 0;
+	for (; cur_frame < last_frame; cur_frame++)
+	{
+		data_size += cur_frame->size;
+	}
+
+	if (data_size != (uint64_t)(buffer.data + buffer.len - data))
+	{
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"audio_filter_fetch_from_cache: frames size %uL does not match entry size %uz", data_size, buffer.len);
+		return VOD_OK;
+	}
+
+	// add the frames, the data is used in place
+	if (header->frame_count > 0)
+	{
+		output_frame = vod_array_push_n(&state->sink.frames_array, header->frame_count);
+		if (output_frame == NULL)
+		{
+			vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+				"audio_filter_fetch_from_cache: vod_array_push_n failed");
+			return VOD_ALLOC_FAILED;
+		}
+
+		for (cur_frame = (audio_filter_cache_frame_t*)(header + 1); cur_frame < last_frame; cur_frame++, output_frame++)
+		{
+			output_frame->offset = (uintptr_t)data;
+			output_frame->size = cur_frame->size;
+			output_frame->key_frame = 0;
+			output_frame->duration = cur_frame->duration;
+			output_frame->pts_delay = cur_frame->pts_delay;
+
+			data += cur_frame->size;
+		}
+	}
+
+	vod_log_debug1(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+		"audio_filter_fetch_from_cache: got %uD frames from cache", header->frame_count);
+
+	state->cached = TRUE;
+
+	return VOD_OK;
+}
+
+static void
+audio_filter_store_in_cache(audio_filter_state_t* state)
+{
+	audio_filter_cache_header_t* header;
+	audio_filter_cache_frame_t* cache_frame;
+	input_frame_t* cur_frame;
+	input_frame_t* last_frame;
+	vod_str_t* buffers;
+	vod_str_t* cur_buffer;
+	size_t frame_count;
+
+	frame_count = state->sink.frames_array.nelts;
+
+	buffers = vod_alloc(state->request_context->pool, sizeof(buffers[0]) * (frame_count + 1) +
+		sizeof(*header) + sizeof(*cache_frame) * frame_count);
+	if (buffers == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+			"audio_filter_store_in_cache: vod_alloc failed");
+		return;
+	}
+
+	// Note: failing to save to the cache is not an error, the frames are stored as multiple buffers to avoid copying them
+	header = (void*)(buffers + frame_count + 1);
+	header->frame_count = frame_count;
+	header->reserved = 0;
+
+	buffers[0].data = (u_char*)header;
+	buffers[0].len = sizeof(*header) + sizeof(*cache_frame) * frame_count;
+
+	cache_frame = (audio_filter_cache_frame_t*)(header + 1);
+	cur_buffer = buffers + 1;
+
+	cur_frame = state->sink.frames_array.elts;
+	last_frame = cur_frame + frame_count;
+	for (; cur_frame < last_frame; cur_frame++, cache_frame++, cur_buffer++)
+	{
+		cache_frame->size = cur_frame->size;
+		cache_frame->duration = cur_frame->duration;
+		cache_frame->pts_delay = cur_frame->pts_delay;
+
+		cur_buffer->data = (u_char*)(uintptr_t)cur_frame->offset;
+		cur_buffer->len = cur_frame->size;
+	}
+
+	state->cache->store(state->cache->context, &state->cache_key, buffers, frame_count + 1);
+}
+
 vod_status_t
 audio_filter_alloc_state(
 	request_context_t* request_context,
@@ -557,6 +799,8 @@ audio_filter_alloc_state(
 	media_track_t* output_track,
 	uint32_t max_frame_count,
 	uint32_t output_codec_id,
+	vod_pool_t* output_pool,
+	audio_filter_cache_t* cache,
 	size_t* cache_buffer_count,
 	void** result)
 {
@@ -636,6 +880,20 @@ audio_filter_alloc_state(
 	cln->handler = audio_filter_free_state;
 	cln->data = state;
 
+	// Note: in deferred mode, the output frames are allocated from a separate pool, since the encoding
+	//		may run outside the event loop thread, while the request pool is in use
+	if (output_pool != NULL)
+	{
+		state->deferred_context = *request_context;
+		state->deferred_context.pool = output_pool;
+		state->output_context = &state->deferred_context;
+		state->deferred = TRUE;
+	}
+	else
+	{
+		state->output_context = request_context;
+	}
+
 	// allocate the filter graph
 	state->filter_graph = avfilter_graph_alloc();
 	if (state->filter_graph == NULL)
@@ -744,7 +1002,7 @@ audio_filter_alloc_state(
 	if (output_codec_id == VOD_CODEC_ID_VOLUME_MAP)
 	{
 		rc = volume_map_encoder_init(
-			request_context,
+			state->output_context,
 			sink_link->time_base.den,
 			&state->sink.frames_array,
 			&state->sink.encoder_context);
@@ -762,7 +1020,7 @@ audio_filter_alloc_state(
 		encoder_params.bitrate = output_track->media_info.bitrate;
 
 		rc = audio_encoder_init(
-			request_context,
+			state->output_context,
 			&encoder_params,
 			&state->sink.frames_array,
 			&state->sink.encoder_context);
@@ -796,7 +1054,7 @@ audio_filter_alloc_state(
 	// initialize the output arrays
 	initial_alloc_size = init_context.output_frame_count + 10;
 
-	if (vod_array_init(&state->sink.frames_array, request_context->pool, initial_alloc_size, sizeof(input_frame_t)) != VOD_OK)
+	if (vod_array_init(&state->sink.frames_array, state->output_context->pool, initial_alloc_size, sizeof(input_frame_t)) != VOD_OK)
 	{
 		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
 			"audio_filter_alloc_state: vod_array_init failed");
@@ -808,6 +1066,26 @@ audio_filter_alloc_state(
 	state->sequence = sequence;
 	state->output = output_track;
 
+	if (cache != NULL)
+	{
+		rc = audio_filter_init_cache_key(state, init_context.graph_desc, output_codec_id, channel_layout);
+		if (rc != VOD_OK)
+		{
+			goto end;
+		}
+
+		if (state->cache_key.len != 0)
+		{
+			state->cache = cache;
+
+			rc = audio_filter_fetch_from_cache(state);
+			if (rc != VOD_OK)
+			{
+				goto end;
+			}
+		}
+	}
+
 	*cache_buffer_count = init_context.cache_slot_id;
 	*result = state;
 
@@ -1104,10 +1382,9 @@ audio_filter_choose_source(audio_filter_state_t* state)
 	return VOD_OK;
 }
 
-vod_status_t
-audio_filter_process(void* context)
+static vod_status_t
+audio_filter_run_graph(audio_filter_state_t* state)
 {
-	audio_filter_state_t* state = context;
 	vod_status_t rc;
 	AVFrame* frame;
 
@@ -1129,7 +1406,7 @@ audio_filter_process(void* context)
 					}
 				}
 
-				return audio_filter_update_track(state);
+				return VOD_OK;
 			}
 
 			if (rc != VOD_OK)
@@ -1156,6 +1433,82 @@ audio_filter_process(void* context)
 	}
 }
 
+static vod_status_t
+audio_filter_read_frames(audio_filter_state_t* state)
+{
+	audio_filter_source_t* sources_cur;
+	vod_status_t rc;
+
+	for (sources_cur = state->sources; sources_cur < state->sources_end; sources_cur++)
+	{
+		rc = audio_decoder_read_frames(&sources_cur->decoder);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+	}
+
+	return VOD_OK;
+}
+
+vod_status_t
+audio_filter_process(void* context)
+{
+	audio_filter_state_t* state = context;
+	vod_status_t rc;
+
+	if (state->cached)
+	{
+		return audio_filter_update_track(state);
+	}
+
+	if (state->deferred)
+	{
+		if (!state->frames_processed)
+		{
+			rc = audio_filter_read_frames(state);
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+
+			// Note: VOD_DONE signals the caller to run audio_filter_process_deferred and call this function again
+			return VOD_DONE;
+		}
+	}
+	else
+	{
+		rc = audio_filter_run_graph(state);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+	}
+
+	if (state->cache != NULL)
+	{
+		audio_filter_store_in_cache(state);
+	}
+
+	return audio_filter_update_track(state);
+}
+
+vod_status_t
+audio_filter_process_deferred(void* context)
+{
+	audio_filter_state_t* state = context;
+	vod_status_t rc;
+
+	rc = audio_filter_run_graph(state);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	state->frames_processed = TRUE;
+	return VOD_OK;
+}
+
 #else
 
 // empty stubs in case libavfilter/libavcodec are missing
@@ -1172,6 +1525,8 @@ audio_filter_alloc_state(
 	media_track_t* output_track,
 	uint32_t max_frame_count,
 	uint32_t output_codec_id,
+	vod_pool_t* output_pool,
+	audio_filter_cache_t* cache,
 	size_t* cache_buffer_count,
 	void** result)
 {
@@ -1219,4 +1574,10 @@ audio_filter_process(void* context)
 	return VOD_UNEXPECTED;
 }
 
+vod_status_t
+audio_filter_process_deferred(void* context)
+{
+	return VOD_UNEXPECTED;
+}
+
 #endif
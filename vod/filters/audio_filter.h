@@ -12,6 +12,13 @@ struct audio_filter_s {
 
 typedef struct audio_filter_s audio_filter_t;
 
+typedef struct {
+	// returns VOD_NOT_FOUND when the key is not in the cache, the result is allocated on the request pool
+	vod_status_t(*fetch)(void* context, vod_str_t* key, vod_str_t* result);
+	void(*store)(void* context, vod_str_t* key, vod_str_t* buffers, size_t buffer_count);
+	void* context;
+} audio_filter_cache_t;
+
 // functions
 void audio_filter_process_init(vod_log_t* log);
 
@@ -22,6 +29,8 @@ vod_status_t audio_filter_alloc_state(
 	media_track_t* output_track,
 	uint32_t max_frame_count,
 	uint32_t output_codec_id,
+	vod_pool_t* output_pool,
+	audio_filter_cache_t* cache,
 	size_t* cache_buffer_count,
 	void** result);
 
@@ -29,6 +38,8 @@ void audio_filter_free_state(void* context);
 
 vod_status_t audio_filter_process(void* context);
 
+vod_status_t audio_filter_process_deferred(void* context);
+
 vod_status_t audio_filter_alloc_memory_frame(
 	request_context_t* request_context,
 	vod_array_t* frames_array,
@@ -29,6 +29,8 @@ typedef struct {
 	void* audio_filter;
 	uint32_t max_frame_count;
 	uint32_t output_codec_id;
+	vod_pool_t* output_pool;
+	audio_filter_cache_t* cache;
 } apply_filters_state_t;
 
 static void
@@ -476,6 +478,8 @@ filter_init_state(
 	media_set_t* media_set,
 	uint32_t max_frame_count,
 	uint32_t output_codec_id,
+	vod_pool_t* output_pool,
+	audio_filter_cache_t* cache,
 	void** context)
 {
 	apply_filters_state_t* state;
@@ -496,6 +500,8 @@ filter_init_state(
 	state->cur_track = state->output_clip->first_track;
 	state->max_frame_count = max_frame_count;
 	state->output_codec_id = output_codec_id;
+	state->output_pool = output_pool;
+	state->cache = cache;
 	state->audio_filter = NULL;
 
 	*context = state;
@@ -560,6 +566,8 @@ filter_run_state_machine(void* context)
 			state->cur_track,
 			state->max_frame_count,
 			state->output_codec_id,
+			state->output_pool,
+			state->cache,
 			&cache_buffer_count,
 			&state->audio_filter);
 		if (rc != VOD_OK)
@@ -582,3 +590,11 @@ filter_run_state_machine(void* context)
 		}
 	}
 }
+
+vod_status_t
+filter_process_deferred(void* context)
+{
+	apply_filters_state_t* state = context;
+
+	return audio_filter_process_deferred(state->audio_filter);
+}
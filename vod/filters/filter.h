@@ -4,6 +4,7 @@
 // includes
 #include "../input/read_cache.h"
 #include "../media_set.h"
+#include "audio_filter.h"
 
 // functions
 vod_status_t filter_init_filtered_clips(
@@ -17,8 +18,12 @@ vod_status_t filter_init_state(
 	media_set_t* media_set, 
 	uint32_t max_frame_count,
 	uint32_t output_codec_id,
+	vod_pool_t* output_pool,
+	audio_filter_cache_t* cache,
 	void** context);
 
 vod_status_t filter_run_state_machine(void* context);
 
+vod_status_t filter_process_deferred(void* context);
+
 #endif // __FILTER_H__
@@ -31,6 +31,13 @@
 #define M3U8_VIDEO_RANGE_SDR ",VIDEO-RANGE=SDR"
 #define M3U8_VIDEO_RANGE_PQ ",VIDEO-RANGE=PQ"
 
+#define M3U8_IFRAME_INDEX_MAGIC (0x31786669)		// ifx1
+
+#define M3U8_STREAM_CHUNK_SIZE (64 * 1024)
+
+#define M3U8_PART_SEGMENT_COUNT (3)			// number of segments at the live edge that are listed with their parts
+#define M3U8_PART_HOLD_BACK (3)				// in part durations
+
 // constants
 static const u_char m3u8_header[] = "#EXTM3U\n";
 static const u_char m3u8_footer[] = "#EXT-X-ENDLIST\n";
@@ -44,6 +51,12 @@ static const u_char m3u8_url_suffix[] = ".m3u8";
 static const u_char m3u8_map_prefix[] = "#EXT-X-MAP:URI=\"";
 static const u_char m3u8_map_suffix[] = ".mp4\"\n";
 static const char m3u8_clip_index[] = "-c%uD";
+static const char m3u8_server_control[] = "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=";
+static const char m3u8_part_inf[] = "#EXT-X-PART-INF:PART-TARGET=";
+static const char m3u8_part_duration[] = "#EXT-X-PART:DURATION=";
+static const char m3u8_part_uri[] = ",URI=\"";
+static const char m3u8_part_independent[] = "\",INDEPENDENT=YES\n";
+static const char m3u8_preload_hint[] = "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"";
 
 
 static const char encryption_key_tag_method[] = "#EXT-X-KEY:METHOD=";
@@ -74,6 +87,64 @@ typedef struct {
 	vod_str_t* segment_file_name_prefix;
 } write_segment_context_t;
 
+// The iframe index holds the position of every key frame in the simulated TS segments, it is built once
+// from the frames of the media set, and saved in the metadata cache, so that subsequent iframe playlist
+// requests need to parse only the basic metadata of the files.
+//
+// Layout (native byte order):
+//	m3u8_iframe_index_header_t
+//	m3u8_iframe_index_entry_t[iframe_count]
+
+typedef struct {
+	uint32_t magic;
+	uint32_t segment_count;
+	uint32_t iframe_count;
+	uint32_t reserved;
+	uint64_t duration_millis;
+} m3u8_iframe_index_header_t;
+
+typedef struct {
+	uint32_t segment_index;
+	uint32_t duration;
+	uint32_t start;
+	uint32_t size;
+} m3u8_iframe_index_entry_t;
+
+typedef struct {
+	m3u8_iframe_index_entry_t* cur_entry;
+	m3u8_iframe_index_entry_t* last_entry;
+	bool_t overflow;
+} iframe_index_context_t;
+
+// Note: holds the position of the index playlist builder, when the playlist is streamed, the segments are
+//		written to a single fixed size buffer, which is refilled after its previous content was sent
+struct m3u8_index_stream_s {
+	request_context_t* request_context;
+	m3u8_config_t* conf;
+	vod_str_t* base_url;
+	vod_str_t* segments_base_url;
+	media_set_t* media_set;
+	vod_uint_t container_format;
+	vod_str_t name_suffix;
+	vod_str_t* suffix;
+	segment_durations_t segment_durations;
+	segment_duration_item_t* cur_item;
+	segment_duration_item_t* last_item;
+	uint32_t segment_index;
+	uint32_t clip_index;
+	uint32_t scale;
+	uint32_t parts_start_index;
+	uint32_t part_duration;
+	size_t segment_length;
+	size_t item_length;
+	bool_t item_started;
+	bool_t done;
+	u_char extinf_buf[sizeof("#EXTINF:.000,\n") + VOD_INT32_LEN];
+	size_t extinf_len;
+	u_char* buffer;
+	size_t buffer_size;
+};
+
 // Notes: 
 //	1. not using vod_sprintf in order to avoid the use of floats
 //  2. scale must be a power of 10
@@ -123,6 +194,61 @@ m3u8_builder_append_segment_name(
 	return p;
 }
 
+static u_char*
+m3u8_builder_append_part_name(
+	u_char* p,
+	vod_str_t* base_url,
+	vod_str_t* part_file_name_prefix,
+	uint32_t segment_index,
+	uint32_t part_index,
+	vod_str_t* suffix)
+{
+	p = vod_copy(p, base_url->data, base_url->len);
+	p = vod_copy(p, part_file_name_prefix->data, part_file_name_prefix->len);
+	p = vod_sprintf(p, "-%uD-%uD", segment_index + 1, part_index + 1);
+	p = vod_copy(p, suffix->data, suffix->len);
+	return p;
+}
+
+static u_char*
+m3u8_builder_append_parts(
+	u_char* p,
+	vod_str_t* base_url,
+	vod_str_t* part_file_name_prefix,
+	vod_str_t* suffix,
+	uint32_t part_duration,
+	uint32_t segment_index,
+	uint32_t duration)
+{
+	uint32_t cur_duration;
+	uint32_t part_index;
+
+	for (part_index = 0; duration > 0; part_index++)
+	{
+		cur_duration = vod_min(duration, part_duration);
+
+		p = vod_copy(p, m3u8_part_duration, sizeof(m3u8_part_duration) - 1);
+		p = m3u8_builder_format_double(p, cur_duration, 1000);
+		p = vod_copy(p, m3u8_part_uri, sizeof(m3u8_part_uri) - 1);
+		p = m3u8_builder_append_part_name(p, base_url, part_file_name_prefix, segment_index, part_index, suffix);
+
+		// Note: only the first part of the segment is guaranteed to start with a key frame
+		if (part_index == 0)
+		{
+			p = vod_copy(p, m3u8_part_independent, sizeof(m3u8_part_independent) - 1);
+		}
+		else
+		{
+			*p++ = '"';
+			*p++ = '\n';
+		}
+
+		duration -= cur_duration;
+	}
+
+	return p;
+}
+
 static u_char*
 m3u8_builder_append_extinf_tag(u_char* p, uint32_t duration, uint32_t scale)
 {
@@ -212,23 +338,38 @@ m3u8_builder_build_tracks_spec(
 	return VOD_OK;
 }
 
+static void
+m3u8_builder_append_iframe_index_entry(void* context, uint32_t segment_index, uint32_t frame_duration, uint32_t frame_start, uint32_t frame_size)
+{
+	iframe_index_context_t* ctx = (iframe_index_context_t*)context;
+
+	if (ctx->cur_entry >= ctx->last_entry)
+	{
+		ctx->overflow = TRUE;
+		return;
+	}
+
+	ctx->cur_entry->segment_index = segment_index;
+	ctx->cur_entry->duration = frame_duration;
+	ctx->cur_entry->start = frame_start;
+	ctx->cur_entry->size = frame_size;
+	ctx->cur_entry++;
+}
+
 vod_status_t
-m3u8_builder_build_iframe_playlist(
+m3u8_builder_build_iframe_index(
 	request_context_t* request_context,
-	m3u8_config_t* conf,
 	hls_mpegts_muxer_conf_t* muxer_conf,
-	vod_str_t* base_url,
 	media_set_t* media_set,
 	vod_str_t* result)
 {
 	hls_encryption_params_t encryption_params;
-	write_segment_context_t ctx;
+	m3u8_iframe_index_header_t* header;
 	segment_durations_t segment_durations;
 	segmenter_conf_t* segmenter_conf = media_set->segmenter_conf;
-	size_t iframe_length;
-	size_t result_size;
-	uint64_t duration_millis;
-	vod_status_t rc; 
+	iframe_index_context_t ctx;
+	uint32_t key_frame_count;
+	vod_status_t rc;
 
 	// iframes list is not supported with encryption, since:
 	// 1. AES-128 - the IV of each key frame is not known in advance
@@ -237,17 +378,6 @@ m3u8_builder_build_iframe_playlist(
 	encryption_params.key = NULL;
 	encryption_params.iv = NULL;
 
-	// build the required tracks string
-	rc = m3u8_builder_build_tracks_spec(
-		request_context,
-		media_set,
-		&m3u8_ts_suffix,
-		&ctx.name_suffix);
-	if (rc != VOD_OK)
-	{
-		return rc;
-	}
-
 	// get segment durations
 	if (segmenter_conf->align_to_key_frames)
 	{
@@ -275,45 +405,165 @@ m3u8_builder_build_iframe_playlist(
 		return rc;
 	}
 
-	duration_millis = segment_durations.duration;
-	iframe_length = sizeof("#EXTINF:.000,\n") - 1 + vod_get_int_print_len(vod_div_ceil(duration_millis, 1000)) +
-		sizeof(byte_range_tag_format) + VOD_INT32_LEN + vod_get_int_print_len(MAX_FRAME_SIZE) - (sizeof("%uD%uD") - 1) +
-		base_url->len + conf->segment_file_name_prefix.len + 1 + vod_get_int_print_len(segment_durations.segment_count) + ctx.name_suffix.len;
-
-	result_size =
-		conf->iframes_m3u8_header_len +
-		iframe_length * media_set->sequences[0].video_key_frame_count +
-		sizeof(m3u8_footer);
-
 	// allocate the buffer
-	result->data = vod_alloc(request_context->pool, result_size);
+	key_frame_count = media_set->sequences[0].video_key_frame_count;
+
+	result->data = vod_alloc(request_context->pool,
+		sizeof(*header) + sizeof(m3u8_iframe_index_entry_t) * key_frame_count);
 	if (result->data == NULL)
 	{
 		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-			"m3u8_builder_build_iframe_playlist: vod_alloc failed");
+			"m3u8_builder_build_iframe_index: vod_alloc failed");
 		return VOD_ALLOC_FAILED;
 	}
 
-	// fill out the buffer
-	ctx.p = vod_copy(result->data, conf->iframes_m3u8_header, conf->iframes_m3u8_header_len);
+	header = (m3u8_iframe_index_header_t*)result->data;
 
-	if (media_set->sequences[0].video_key_frame_count > 0)
+	ctx.cur_entry = (m3u8_iframe_index_entry_t*)(header + 1);
+	ctx.last_entry = ctx.cur_entry + key_frame_count;
+	ctx.overflow = FALSE;
+
+	if (key_frame_count > 0)
 	{
-		ctx.base_url = base_url;
-		ctx.segment_file_name_prefix = &conf->segment_file_name_prefix;
-	
 		rc = hls_muxer_simulate_get_iframes(
 			request_context,
-			&segment_durations, 
+			&segment_durations,
 			muxer_conf,
 			&encryption_params,
-			media_set, 
-			m3u8_builder_append_iframe_string, 
+			media_set,
+			m3u8_builder_append_iframe_index_entry,
 			&ctx);
 		if (rc != VOD_OK)
 		{
 			return rc;
 		}
+
+		if (ctx.overflow)
+		{
+			vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+				"m3u8_builder_build_iframe_index: iframe count exceeded key frame count %uD", key_frame_count);
+			return VOD_UNEXPECTED;
+		}
+	}
+
+	header->magic = M3U8_IFRAME_INDEX_MAGIC;
+	header->segment_count = segment_durations.segment_count;
+	header->iframe_count = ctx.cur_entry - (m3u8_iframe_index_entry_t*)(header + 1);
+	header->reserved = 0;
+	header->duration_millis = segment_durations.duration;
+
+	result->len = (u_char*)ctx.cur_entry - result->data;
+
+	return VOD_OK;
+}
+
+vod_status_t
+m3u8_builder_build_iframe_playlist(
+	request_context_t* request_context,
+	m3u8_config_t* conf,
+	vod_str_t* base_url,
+	media_set_t* media_set,
+	vod_str_t* iframe_index,
+	vod_str_t* result)
+{
+	m3u8_iframe_index_header_t header;
+	m3u8_iframe_index_entry_t* first_entry;
+	m3u8_iframe_index_entry_t* last_entry;
+	m3u8_iframe_index_entry_t* cur_entry;
+	write_segment_context_t ctx;
+	size_t iframe_length;
+	size_t result_size;
+	vod_status_t rc; 
+
+	// validate the index
+	if (iframe_index->len < sizeof(header))
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"m3u8_builder_build_iframe_playlist: index size %uz smaller than header size", iframe_index->len);
+		return VOD_BAD_DATA;
+	}
+
+	// Note: the index may not be aligned when returned from the cache
+	vod_memcpy(&header, iframe_index->data, sizeof(header));
+	if (header.magic != M3U8_IFRAME_INDEX_MAGIC ||
+		header.iframe_count != (iframe_index->len - sizeof(header)) / sizeof(*first_entry))
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"m3u8_builder_build_iframe_playlist: invalid index, size %uz", iframe_index->len);
+		return VOD_BAD_DATA;
+	}
+
+	first_entry = (m3u8_iframe_index_entry_t*)(iframe_index->data + sizeof(header));
+	if (((uintptr_t)first_entry & (sizeof(uint32_t) - 1)) != 0)
+	{
+		first_entry = vod_alloc(request_context->pool, iframe_index->len - sizeof(header));
+		if (first_entry == NULL)
+		{
+			vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+				"m3u8_builder_build_iframe_playlist: vod_alloc failed (1)");
+			return VOD_ALLOC_FAILED;
+		}
+
+		vod_memcpy(first_entry, iframe_index->data + sizeof(header), iframe_index->len - sizeof(header));
+	}
+
+	last_entry = first_entry + header.iframe_count;
+
+	for (cur_entry = first_entry; cur_entry < last_entry; cur_entry++)
+	{
+		if (cur_entry->segment_index >= header.segment_count ||
+			cur_entry->duration > header.duration_millis ||
+			cur_entry->size > MAX_FRAME_SIZE)
+		{
+			vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+				"m3u8_builder_build_iframe_playlist: invalid index entry, segment %uD duration %uD size %uD",
+				cur_entry->segment_index, cur_entry->duration, cur_entry->size);
+			return VOD_BAD_DATA;
+		}
+	}
+
+	// build the required tracks string
+	rc = m3u8_builder_build_tracks_spec(
+		request_context,
+		media_set,
+		&m3u8_ts_suffix,
+		&ctx.name_suffix);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	iframe_length = sizeof("#EXTINF:.000,\n") - 1 + vod_get_int_print_len(vod_div_ceil(header.duration_millis, 1000)) +
+		sizeof(byte_range_tag_format) + VOD_INT32_LEN + vod_get_int_print_len(MAX_FRAME_SIZE) - (sizeof("%uD%uD") - 1) +
+		base_url->len + conf->segment_file_name_prefix.len + 1 + vod_get_int_print_len(header.segment_count) + ctx.name_suffix.len;
+
+	result_size =
+		conf->iframes_m3u8_header_len +
+		iframe_length * header.iframe_count +
+		sizeof(m3u8_footer);
+
+	// allocate the buffer
+	result->data = vod_alloc(request_context->pool, result_size);
+	if (result->data == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"m3u8_builder_build_iframe_playlist: vod_alloc failed (2)");
+		return VOD_ALLOC_FAILED;
+	}
+
+	// fill out the buffer
+	ctx.p = vod_copy(result->data, conf->iframes_m3u8_header, conf->iframes_m3u8_header_len);
+	ctx.base_url = base_url;
+	ctx.segment_file_name_prefix = &conf->segment_file_name_prefix;
+
+	for (cur_entry = first_entry; cur_entry < last_entry; cur_entry++)
+	{
+		m3u8_builder_append_iframe_string(
+			&ctx,
+			cur_entry->segment_index,
+			cur_entry->duration,
+			cur_entry->start,
+			cur_entry->size);
 	}
 
 	ctx.p = vod_copy(ctx.p, m3u8_footer, sizeof(m3u8_footer) - 1);
@@ -375,6 +625,181 @@ m3u8_builder_write_psshs(
 }
 #endif // NGX_HAVE_OPENSSL_EVP
 
+bool_t
+m3u8_builder_low_latency_enabled(media_set_t* media_set, vod_uint_t container_format)
+{
+	segmenter_conf_t* segmenter_conf = media_set->segmenter_conf;
+
+	return segmenter_conf->part_duration != 0 &&
+		container_format == HLS_CONTAINER_FMP4 &&
+		media_set->type == MEDIA_SET_LIVE &&
+		!media_set->presentation_end &&
+		!media_set->use_discontinuity;
+}
+
+vod_status_t
+m3u8_builder_get_live_edge(
+	request_context_t* request_context,
+	media_set_t* media_set,
+	m3u8_live_edge_t* result)
+{
+	segment_durations_t segment_durations;
+	segment_duration_item_t* last_item;
+	segmenter_conf_t* segmenter_conf = media_set->segmenter_conf;
+	vod_status_t rc;
+
+	rc = segmenter_conf->get_segment_durations(
+		request_context,
+		segmenter_conf,
+		media_set,
+		NULL,
+		MEDIA_TYPE_NONE,
+		&segment_durations);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	if (segment_durations.item_count <= 0)
+	{
+		result->segment_index = 0;
+	}
+	else
+	{
+		last_item = segment_durations.items + segment_durations.item_count - 1;
+		result->segment_index = last_item->segment_index + last_item->repeat_count;
+	}
+
+	result->part_count = media_set->live_partial_duration / segmenter_conf->part_duration;
+
+	return VOD_OK;
+}
+
+// Note: when end is not NULL, writes only the segments that fit in the buffer, and saves the position in the state
+static u_char*
+m3u8_builder_write_segments(m3u8_index_stream_t* state, u_char* p, u_char* end)
+{
+	segment_duration_item_t* cur_item;
+	m3u8_config_t* conf = state->conf;
+	uint32_t last_segment_index;
+
+	for (; state->cur_item < state->last_item; state->cur_item++)
+	{
+		cur_item = state->cur_item;
+
+		if (!state->item_started)
+		{
+			if (end != NULL && (size_t)(end - p) < state->item_length)
+			{
+				return p;
+			}
+
+			if (cur_item->discontinuity)
+			{
+				p = vod_copy(p, m3u8_discontinuity, sizeof(m3u8_discontinuity) - 1);
+				if (state->container_format == HLS_CONTAINER_FMP4 && 
+					cur_item > state->segment_durations.items &&
+					state->media_set->initial_clip_index != INVALID_CLIP_INDEX)
+				{
+					p = vod_copy(p, m3u8_map_prefix, sizeof(m3u8_map_prefix) - 1);
+					p = vod_copy(p, state->base_url->data, state->base_url->len);
+					p = vod_copy(p, conf->init_file_name_prefix.data, conf->init_file_name_prefix.len);
+					p = vod_sprintf(p, m3u8_clip_index, state->clip_index++);
+					p = vod_copy(p, state->name_suffix.data, state->name_suffix.len - state->suffix->len);
+					p = vod_copy(p, m3u8_map_suffix, sizeof(m3u8_map_suffix) - 1);
+				}
+			}
+
+			// ignore zero duration segments (caused by alignment to keyframes)
+			if (cur_item->duration == 0)
+			{
+				continue;
+			}
+
+			state->extinf_len = m3u8_builder_append_extinf_tag(
+				state->extinf_buf,
+				rescale_time(cur_item->duration, state->segment_durations.timescale, state->scale),
+				state->scale) - state->extinf_buf;
+			state->segment_index = cur_item->segment_index;
+			state->item_started = TRUE;
+		}
+
+		last_segment_index = cur_item->segment_index + cur_item->repeat_count;
+		for (; state->segment_index < last_segment_index; state->segment_index++)
+		{
+			if (end != NULL && (size_t)(end - p) < state->segment_length)
+			{
+				return p;
+			}
+
+			if (state->segment_index >= state->parts_start_index)
+			{
+				p = m3u8_builder_append_parts(
+					p,
+					state->segments_base_url,
+					&conf->part_file_name_prefix,
+					&state->name_suffix,
+					state->part_duration,
+					state->segment_index,
+					rescale_time(cur_item->duration, state->segment_durations.timescale, 1000));
+			}
+
+			p = vod_copy(p, state->extinf_buf, state->extinf_len);
+			p = m3u8_builder_append_segment_name(
+				p, 
+				state->segments_base_url, 
+				&conf->segment_file_name_prefix, 
+				state->segment_index, 
+				&state->name_suffix);
+		}
+
+		state->item_started = FALSE;
+	}
+
+	// write the footer
+	if (state->media_set->presentation_end)
+	{
+		if (end != NULL && (size_t)(end - p) < sizeof(m3u8_footer) - 1)
+		{
+			return p;
+		}
+
+		p = vod_copy(p, m3u8_footer, sizeof(m3u8_footer) - 1);
+	}
+
+	state->done = TRUE;
+
+	return p;
+}
+
+// Note: must be called only after the previous chunk was sent, the buffer of the stream is reused.
+//		returns VOD_AGAIN while there are more chunks, and VOD_OK for the last chunk
+vod_status_t
+m3u8_builder_index_stream_next(void* context, vod_str_t* result)
+{
+	m3u8_index_stream_t* state = context;
+	u_char* p;
+
+	p = m3u8_builder_write_segments(state, state->buffer, state->buffer + state->buffer_size);
+
+	result->data = state->buffer;
+	result->len = p - state->buffer;
+
+	if (state->done)
+	{
+		return VOD_OK;
+	}
+
+	if (result->len <= 0)
+	{
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"m3u8_builder_index_stream_next: no segments fit in a buffer of size %uz", state->buffer_size);
+		return VOD_UNEXPECTED;
+	}
+
+	return VOD_AGAIN;
+}
+
 vod_status_t
 m3u8_builder_build_index_playlist(
 	request_context_t* request_context,
@@ -384,26 +809,32 @@ m3u8_builder_build_index_playlist(
 	hls_encryption_params_t* encryption_params,
 	vod_uint_t container_format,
 	media_set_t* media_set,
+	m3u8_index_stream_t** stream,
 	vod_str_t* result)
 {
+	m3u8_index_stream_t state;
 	segment_durations_t segment_durations;
 	segment_duration_item_t* cur_item;
 	segment_duration_item_t* last_item;
 	hls_encryption_type_t encryption_type;
 	segmenter_conf_t* segmenter_conf = media_set->segmenter_conf;
 	vod_str_t name_suffix;
-	vod_str_t extinf;
 	vod_str_t* suffix;
 	uint32_t conf_max_segment_duration;
 	uint64_t max_segment_duration;
 	uint64_t duration_millis;
-	uint32_t segment_index;
 	uint32_t last_segment_index;
-	uint32_t clip_index = 0;
-	uint32_t scale;
 	size_t segment_length;
+	size_t map_length;
+	size_t segments_size;
 	size_t result_size;
+	size_t alloc_size;
+	size_t part_length;
 	vod_status_t rc;
+	uint32_t next_segment_index;
+	uint32_t part_count;
+	bool_t low_latency;
+	u_char* end;
 	u_char* p;
 
 #if (NGX_HAVE_OPENSSL_EVP)
@@ -456,27 +887,78 @@ m3u8_builder_build_index_playlist(
 	}
 	last_item = segment_durations.items + segment_durations.item_count;
 
+	// find the max segment duration
+	max_segment_duration = 0;
+	for (cur_item = segment_durations.items; cur_item < last_item; cur_item++)
+	{
+		if (cur_item->duration > max_segment_duration)
+		{
+			max_segment_duration = cur_item->duration;
+		}
+	}
+
 	// get the required buffer length
 	duration_millis = segment_durations.duration;
 	last_segment_index = last_item[-1].segment_index + last_item[-1].repeat_count;
+	next_segment_index = last_segment_index;
 	segment_length = sizeof("#EXTINF:.000,\n") - 1 + vod_get_int_print_len(vod_div_ceil(duration_millis, 1000)) +
 		segments_base_url->len + conf->segment_file_name_prefix.len + 1 + vod_get_int_print_len(last_segment_index) + name_suffix.len;
 
+	map_length = sizeof(m3u8_map_prefix) - 1 +
+		base_url->len +
+		conf->init_file_name_prefix.len +
+		sizeof(m3u8_clip_index) - 1 + VOD_INT32_LEN +
+		name_suffix.len +
+		sizeof(m3u8_map_suffix) - 1;
+
+	segments_size =
+		segment_length * segment_durations.segment_count +
+		(sizeof(m3u8_discontinuity) - 1 + map_length) * segment_durations.discontinuities;
+
 	result_size =
 		sizeof(M3U8_HEADER_PART1) + VOD_INT64_LEN +
 		sizeof(M3U8_HEADER_VOD) +
 		sizeof(M3U8_HEADER_PART2) + VOD_INT64_LEN + VOD_INT32_LEN +
-		segment_length * segment_durations.segment_count +
-		segment_durations.discontinuities * (sizeof(m3u8_discontinuity) - 1) +
-		(sizeof(m3u8_map_prefix) - 1 +
-		 base_url->len +
-		 conf->init_file_name_prefix.len +
-		 sizeof(m3u8_clip_index) - 1 + VOD_INT32_LEN +
-		 name_suffix.len +
-		 sizeof(m3u8_map_suffix) - 1) *
-		(segment_durations.discontinuities + 1) +
+		map_length +
 		sizeof(m3u8_footer);
 
+	state.parts_start_index = UINT_MAX;
+	state.part_duration = 0;
+
+	low_latency = m3u8_builder_low_latency_enabled(media_set, container_format);
+	if (low_latency)
+	{
+		state.part_duration = segmenter_conf->part_duration;
+		if (next_segment_index > M3U8_PART_SEGMENT_COUNT)
+		{
+			state.parts_start_index = next_segment_index - M3U8_PART_SEGMENT_COUNT;
+		}
+		else
+		{
+			state.parts_start_index = 0;
+		}
+
+		// the parts of the last segments + the parts of the next segment
+		part_count = M3U8_PART_SEGMENT_COUNT *
+			vod_div_ceil(rescale_time(max_segment_duration, segment_durations.timescale, 1000), state.part_duration) +
+			media_set->live_partial_duration / state.part_duration;
+
+		part_length = sizeof(m3u8_part_duration) - 1 + VOD_INT32_LEN + 4 +	// 4 = .000
+			sizeof(m3u8_part_uri) - 1 +
+			segments_base_url->len + conf->part_file_name_prefix.len + 2 + 2 * VOD_INT32_LEN + name_suffix.len +
+			sizeof(m3u8_part_independent) - 1;
+
+		result_size +=
+			sizeof(m3u8_server_control) - 1 + VOD_INT32_LEN + 5 +		// 5 = .000\n
+			sizeof(m3u8_part_inf) - 1 + VOD_INT32_LEN + 5 +
+			part_length * part_count +
+			sizeof(m3u8_preload_hint) - 1 + segments_base_url->len + conf->part_file_name_prefix.len + 
+				2 + 2 * VOD_INT32_LEN + name_suffix.len + 2;		// 2 = '"', '\n'
+
+		// Note: live playlists are small, no need to stream them
+		stream = NULL;
+	}
+
 	if (encryption_type != HLS_ENC_NONE)
 	{
 		result_size +=
@@ -534,8 +1016,22 @@ m3u8_builder_build_index_playlist(
 		}
 	}
 
+	// Note: when streaming is requested and the playlist is large, the segments are written in fixed size chunks.
+	//		the first chunk is returned in result, the rest are pulled using m3u8_builder_index_stream_next
+	state.item_length = sizeof(m3u8_discontinuity) - 1 + map_length + segment_length;
+	if (stream != NULL && result_size + segments_size > M3U8_STREAM_CHUNK_SIZE)
+	{
+		// the header must fit in the first chunk
+		alloc_size = vod_max(result_size + state.item_length, M3U8_STREAM_CHUNK_SIZE);
+	}
+	else
+	{
+		result_size += segments_size;
+		alloc_size = result_size;
+	}
+
 	// allocate the buffer
-	result->data = vod_alloc(request_context->pool, result_size);
+	result->data = vod_alloc(request_context->pool, alloc_size);
 	if (result->data == NULL)
 	{
 		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
@@ -543,20 +1039,12 @@ m3u8_builder_build_index_playlist(
 		return VOD_ALLOC_FAILED;
 	}
 
-	// find the max segment duration
-	max_segment_duration = 0;
-	for (cur_item = segment_durations.items; cur_item < last_item; cur_item++)
-	{
-		if (cur_item->duration > max_segment_duration)
-		{
-			max_segment_duration = cur_item->duration;
-		}
-	}
+	end = alloc_size > result_size ? result->data + alloc_size : NULL;
 
 	// Note: scaling first to 'scale' so that target duration will always be round(max(manifest durations))
-	scale = conf->m3u8_version >= 3 ? 1000 : 1;
-	max_segment_duration = rescale_time(max_segment_duration, segment_durations.timescale, scale);
-	max_segment_duration = rescale_time(max_segment_duration, scale, 1);
+	state.scale = conf->m3u8_version >= 3 ? 1000 : 1;
+	max_segment_duration = rescale_time(max_segment_duration, segment_durations.timescale, state.scale);
+	max_segment_duration = rescale_time(max_segment_duration, state.scale, 1);
 
 	// make sure segment duration is not lower than the value set in the conf
 	conf_max_segment_duration = (segmenter_conf->max_segment_duration + 500) / 1000;
@@ -652,6 +1140,18 @@ m3u8_builder_build_index_playlist(
 		container_format == HLS_CONTAINER_FMP4 ? 6 : conf->m3u8_version, 
 		segment_durations.items[0].segment_index + 1);
 
+	if (low_latency)
+	{
+		p = vod_copy(p, m3u8_server_control, sizeof(m3u8_server_control) - 1);
+		p = m3u8_builder_format_double(p, state.part_duration * M3U8_PART_HOLD_BACK, 1000);
+		*p++ = '\n';
+		p = vod_copy(p, m3u8_part_inf, sizeof(m3u8_part_inf) - 1);
+		p = m3u8_builder_format_double(p, state.part_duration, 1000);
+		*p++ = '\n';
+	}
+
+	state.clip_index = 0;
+
 	if (container_format == HLS_CONTAINER_FMP4)
 	{
 		p = vod_copy(p, m3u8_map_prefix, sizeof(m3u8_map_prefix) - 1);
@@ -660,69 +1160,87 @@ m3u8_builder_build_index_playlist(
 		if (media_set->use_discontinuity && 
 			media_set->initial_clip_index != INVALID_CLIP_INDEX)
 		{
-			clip_index = media_set->initial_clip_index + 1;
-			p = vod_sprintf(p, m3u8_clip_index, clip_index++);
+			state.clip_index = media_set->initial_clip_index + 1;
+			p = vod_sprintf(p, m3u8_clip_index, state.clip_index++);
 		}
 		p = vod_copy(p, name_suffix.data, name_suffix.len - suffix->len);
 		p = vod_copy(p, m3u8_map_suffix, sizeof(m3u8_map_suffix) - 1);
 	}
 
 	// write the segments
-	for (cur_item = segment_durations.items; cur_item < last_item; cur_item++)
+	state.request_context = request_context;
+	state.conf = conf;
+	state.base_url = base_url;
+	state.segments_base_url = segments_base_url;
+	state.media_set = media_set;
+	state.container_format = container_format;
+	state.name_suffix = name_suffix;
+	state.suffix = suffix;
+	state.segment_durations = segment_durations;
+	state.cur_item = segment_durations.items;
+	state.last_item = last_item;
+	state.segment_length = segment_length;
+	state.item_started = FALSE;
+	state.done = FALSE;
+
+	if (low_latency)
 	{
-		segment_index = cur_item->segment_index;
-		last_segment_index = segment_index + cur_item->repeat_count;
+		// Note: the footer is never written in this case, since presentation_end is false
+		p = m3u8_builder_write_segments(&state, p, NULL);
 
-		if (cur_item->discontinuity)
-		{
-			p = vod_copy(p, m3u8_discontinuity, sizeof(m3u8_discontinuity) - 1);
-			if (container_format == HLS_CONTAINER_FMP4 && 
-				cur_item > segment_durations.items &&
-				media_set->initial_clip_index != INVALID_CLIP_INDEX)
-			{
-				p = vod_copy(p, m3u8_map_prefix, sizeof(m3u8_map_prefix) - 1);
-				p = vod_copy(p, base_url->data, base_url->len);
-				p = vod_copy(p, conf->init_file_name_prefix.data, conf->init_file_name_prefix.len);
-				p = vod_sprintf(p, m3u8_clip_index, clip_index++);
-				p = vod_copy(p, name_suffix.data, name_suffix.len - suffix->len);
-				p = vod_copy(p, m3u8_map_suffix, sizeof(m3u8_map_suffix) - 1);
-			}
-		}
+		// the complete parts of the next segment
+		p = m3u8_builder_append_parts(
+			p,
+			segments_base_url,
+			&conf->part_file_name_prefix,
+			&name_suffix,
+			state.part_duration,
+			next_segment_index,
+			media_set->live_partial_duration);
+
+		p = vod_copy(p, m3u8_preload_hint, sizeof(m3u8_preload_hint) - 1);
+		p = m3u8_builder_append_part_name(
+			p,
+			segments_base_url,
+			&conf->part_file_name_prefix,
+			next_segment_index,
+			media_set->live_partial_duration / state.part_duration,
+			&name_suffix);
+		*p++ = '"';
+		*p++ = '\n';
+	}
+	else
+	{
+		p = m3u8_builder_write_segments(&state, p, end);
+	}
 
-		// ignore zero duration segments (caused by alignment to keyframes)
-		if (cur_item->duration == 0)
+	if (!state.done)
+	{
+		// save the position, the remaining segments are written when the next chunks are requested
+		*stream = vod_alloc(request_context->pool, sizeof(state));
+		if (*stream == NULL)
 		{
-			continue;
+			vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+				"m3u8_builder_build_index_playlist: vod_alloc failed (2)");
+			return VOD_ALLOC_FAILED;
 		}
 
-		// write the first segment
-		extinf.data = p;
-		p = m3u8_builder_append_extinf_tag(p, rescale_time(cur_item->duration, segment_durations.timescale, scale), scale);
-		extinf.len = p - extinf.data;
-		p = m3u8_builder_append_segment_name(p, segments_base_url, &conf->segment_file_name_prefix, segment_index, &name_suffix);
-		segment_index++;
-
-		// write any additional segments
-		for (; segment_index < last_segment_index; segment_index++)
-		{
-			p = vod_copy(p, extinf.data, extinf.len);
-			p = m3u8_builder_append_segment_name(p, segments_base_url, &conf->segment_file_name_prefix, segment_index, &name_suffix);
-		}
+		state.buffer = result->data;
+		state.buffer_size = alloc_size;
+		**stream = state;
 	}
-
-	// write the footer
-	if (media_set->presentation_end)
+	else if (stream != NULL)
 	{
-		p = vod_copy(p, m3u8_footer, sizeof(m3u8_footer) - 1);
+		*stream = NULL;
 	}
 
 	result->len = p - result->data;
 
-	if (result->len > result_size)
+	if (result->len > alloc_size)
 	{
 		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
 			"m3u8_builder_build_index_playlist: result length %uz exceeded allocated length %uz", 
-			result->len, result_size);
+			result->len, alloc_size);
 		return VOD_UNEXPECTED;
 	}
 	
@@ -29,11 +29,19 @@ typedef struct {
 	vod_str_t iframes_file_name_prefix;
 	vod_str_t segment_file_name_prefix;
 	vod_str_t init_file_name_prefix;
+	vod_str_t part_file_name_prefix;
 	vod_str_t encryption_key_file_name;
 	vod_str_t encryption_key_format;
 	vod_str_t encryption_key_format_versions;
 } m3u8_config_t;
 
+typedef struct m3u8_index_stream_s m3u8_index_stream_t;
+
+typedef struct {
+	uint32_t segment_index;		// the index of the first incomplete segment
+	uint32_t part_count;		// the number of complete parts of this segment
+} m3u8_live_edge_t;
+
 // functions
 vod_status_t m3u8_builder_build_master_playlist(
 	request_context_t* request_context,
@@ -43,6 +51,15 @@ vod_status_t m3u8_builder_build_master_playlist(
 	media_set_t* media_set,
 	vod_str_t* result);
 
+bool_t m3u8_builder_low_latency_enabled(
+	media_set_t* media_set,
+	vod_uint_t container_format);
+
+vod_status_t m3u8_builder_get_live_edge(
+	request_context_t* request_context,
+	media_set_t* media_set,
+	m3u8_live_edge_t* result);
+
 vod_status_t m3u8_builder_build_index_playlist(
 	request_context_t* request_context,
 	m3u8_config_t* conf,
@@ -51,14 +68,25 @@ vod_status_t m3u8_builder_build_index_playlist(
 	hls_encryption_params_t* encryption_params,
 	vod_uint_t container_format,
 	media_set_t* media_set,
+	m3u8_index_stream_t** stream,
+	vod_str_t* result);
+
+vod_status_t m3u8_builder_index_stream_next(
+	void* context,
+	vod_str_t* result);
+
+vod_status_t m3u8_builder_build_iframe_index(
+	request_context_t* request_context,
+	hls_mpegts_muxer_conf_t* muxer_conf,
+	media_set_t* media_set,
 	vod_str_t* result);
 
 vod_status_t m3u8_builder_build_iframe_playlist(
 	request_context_t* request_context,
 	m3u8_config_t* conf,
-	hls_mpegts_muxer_conf_t* muxer_conf,
 	vod_str_t* base_url,
 	media_set_t* media_set,
+	vod_str_t* iframe_index,
 	vod_str_t* result);
 
 void m3u8_builder_init_config(
@@ -930,8 +930,12 @@ mpegts_encoder_write(media_filter_context_t* context, const u_char* buffer, uint
 {
 	mpegts_encoder_state_t* state = get_context(context);
 	uint32_t packet_used_size;
+	uint32_t packet_count;
 	uint32_t cur_size;
 	uint32_t initial_size;
+	unsigned cc;
+	off_t packet_offset;
+	u_char* end_packet;
 	u_char* cur_packet;
 	vod_status_t rc;
 	bool_t write_direct;
@@ -1003,15 +1007,41 @@ mpegts_encoder_write(media_filter_context_t* context, const u_char* buffer, uint
 
 	while (size >= MPEGTS_PACKET_USABLE_SIZE)
 	{
-		rc = mpegts_encoder_init_packet(state, TRUE);
-		if (rc != VOD_OK)
+		// Note: allocating a run of packets from the queue at once, the run is limited by the space left in the queue buffer
+		packet_offset = state->queue->cur_offset;
+
+		cur_packet = write_buffer_queue_get_buffers(
+			state->queue,
+			MPEGTS_PACKET_SIZE,
+			size / MPEGTS_PACKET_USABLE_SIZE,
+			state,
+			&packet_count);
+		if (cur_packet == NULL)
 		{
-			return rc;
+			vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+				"mpegts_encoder_write: write_buffer_queue_get_buffers failed");
+			return VOD_ALLOC_FAILED;
 		}
 
-		vod_memcpy(state->cur_pos, buffer, MPEGTS_PACKET_USABLE_SIZE);
-		buffer += MPEGTS_PACKET_USABLE_SIZE;
-		size -= MPEGTS_PACKET_USABLE_SIZE;
+		cc = state->cc;
+		end_packet = cur_packet + packet_count * MPEGTS_PACKET_SIZE;
+		for (; cur_packet < end_packet; cur_packet += MPEGTS_PACKET_SIZE)
+		{
+			mpegts_write_packet_header(cur_packet, state->stream_info.pid, cc);
+			cc++;
+
+			vod_memcpy(cur_packet + SIZEOF_MPEGTS_HEADER, buffer, MPEGTS_PACKET_USABLE_SIZE);
+			buffer += MPEGTS_PACKET_USABLE_SIZE;
+		}
+		state->cc = cc;
+
+		size -= packet_count * MPEGTS_PACKET_USABLE_SIZE;
+
+		// update the state to point to the last packet (same as mpegts_encoder_init_packet)
+		state->last_queue_offset = packet_offset + (packet_count - 1) * MPEGTS_PACKET_SIZE;
+		state->last_frame_pts = NO_TIMESTAMP;
+		state->cur_packet_start = end_packet - MPEGTS_PACKET_SIZE;
+		state->cur_packet_end = end_packet;
 	}
 
 	state->flushed_frame_bytes += initial_size - size;
@@ -4,10 +4,11 @@
 #define MIN_BUFFER_COUNT (2)
 
 void 
-read_cache_init(read_cache_state_t* state, request_context_t* request_context, size_t buffer_size, size_t alignment)
+read_cache_init(read_cache_state_t* state, request_context_t* request_context, size_t buffer_size, size_t max_read_size, size_t alignment)
 {
 	state->request_context = request_context;
 	state->buffer_size = buffer_size;
+	state->max_read_size = max_read_size;
 	state->alignment = alignment;
 	state->buffer_count = 0;
 	state->reuse_buffers = TRUE;
@@ -117,6 +118,16 @@ read_cache_get_from_cache(
 		}
 	}
 
+	// coalesce the remaining reads of the source into a single read, if they fit in max read size
+	// Note: this saves a read per buffer size, at the cost of reading the gaps between the frames
+	//		(e.g. the frames of other tracks) and allocating a larger buffer
+	if (read_size == state->buffer_size &&
+		source->last_offset > offset + read_size &&
+		source->last_offset - offset <= state->max_read_size)
+	{
+		read_size = ((source->last_offset + alignment) & ~alignment) - offset;
+	}
+
 	// don't read past the max required offset
 	if (offset + read_size > source->last_offset)
 	{
@@ -151,7 +162,16 @@ read_cache_get_read_buffer(
 	// return the target buffer pointer and size
 	result->source = target_buffer->source;
 	result->offset = target_buffer->start_offset;
-	result->buffer = state->reuse_buffers ? target_buffer->buffer_start : NULL;
+	if (state->reuse_buffers)
+	{
+		result->buffer = target_buffer->buffer_start;
+		result->buffer_end = target_buffer->buffer_end;
+	}
+	else
+	{
+		result->buffer = NULL;
+		result->buffer_end = NULL;
+	}
 	result->size = target_buffer->buffer_size;
 }
 
@@ -163,6 +183,7 @@ read_cache_read_completed(read_cache_state_t* state, vod_buf_t* buf)
 	// update the buffer size
 	target_buffer->buffer_start = buf->start;
 	target_buffer->buffer_pos = buf->pos;
+	target_buffer->buffer_end = buf->end;
 	target_buffer->buffer_size = buf->last - buf->pos;
 	target_buffer->end_offset = target_buffer->start_offset + target_buffer->buffer_size;
 
@@ -10,6 +10,7 @@ struct media_clip_source_s;
 typedef struct {
 	u_char* buffer_start;
 	u_char* buffer_pos;
+	u_char* buffer_end;			// end of the allocated buffer
 	uint32_t buffer_size;		// size of data read
 	void* source;				// opaque context that indicates from where the buffer should be read
 	uint64_t start_offset;
@@ -23,6 +24,7 @@ typedef struct {
 	cache_buffer_t* target_buffer;
 	size_t buffer_count;
 	size_t buffer_size;
+	size_t max_read_size;		// max size of a read that covers the remaining frames of a source
 	size_t alignment;
 	bool_t reuse_buffers;
 } read_cache_state_t;
@@ -44,6 +46,7 @@ typedef struct {
 	struct media_clip_source_s* source;
 	uint64_t offset;
 	u_char* buffer;
+	u_char* buffer_end;
 	uint32_t size;
 } read_cache_get_read_buffer_t;
 
@@ -52,6 +55,7 @@ void read_cache_init(
 	read_cache_state_t* state, 
 	request_context_t* request_context, 
 	size_t buffer_size, 
+	size_t max_read_size,
 	size_t alignment);
 	
 vod_status_t read_cache_allocate_buffer_slots(
@@ -1,13 +1,32 @@
 #include "json_parser.h"
 #include <ctype.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define VOD_JSON_HAVE_SSE2 (1)
+
+#if defined(__GNUC__)
+#define VOD_JSON_NO_SANITIZE_ADDRESS __attribute__((no_sanitize_address))
+#else
+#define VOD_JSON_NO_SANITIZE_ADDRESS
+#endif // __GNUC__
+#endif // __SSE2__
+
 // constants
 #define MAX_JSON_ELEMENTS (524288)
 #define MAX_RECURSION_DEPTH (32)
 #define FIRST_PART_COUNT (1)		// XXXXX increase this ! only for testing purpose
 #define MAX_PART_SIZE (65536)
+#define MAX_SAFE_INT_DIGITS (18)		// LLONG_MAX / 10 - 1 has 18 digits
+#define MAX_ESTIMATED_PART_COUNT (MAX_PART_SIZE / sizeof(int64_t))
+
+#define VOD_JSON_COMPILED_MAGIC (0x4e534a43)		// CJSN
+#define VOD_JSON_COMPILED_ALIGNMENT (sizeof(int64_t))
 
 // macros
+#define vod_json_is_digit(c) ((u_char)((c) - '0') <= 9)
+#define vod_json_is_space(c) ((c) == ' ' || (u_char)((c) - '\t') <= '\r' - '\t')
+
 #define ASSERT_CHAR(state, ch)										\
 	if (*(state)->cur_pos != ch)									\
 	{																\
@@ -27,6 +46,9 @@
 	}																\
 	(state)->cur_pos += sizeof(str) - 1;
 
+// pointers in compiled json are saved as offsets from the beginning of the buffer
+#define VOD_JSON_COMPILED_OFFSET(state, ptr) ((void*)((u_char*)(ptr) - (state)->base))
+
 // typedefs
 typedef struct {
 	vod_pool_t* pool;
@@ -36,6 +58,21 @@ typedef struct {
 	size_t error_size;
 } vod_json_parser_state_t;
 
+typedef struct {
+	uint32_t magic;
+	uint32_t word_size;
+	size_t size;
+	vod_json_value_t root;
+} vod_json_compiled_header_t;
+
+typedef struct {
+	vod_pool_t* pool;
+	u_char* base;
+	u_char* cur_pos;
+	u_char* end;		// used only when loading
+	int depth;			// used only when loading
+} vod_json_compile_state_t;
+
 typedef struct {
 	int type;
 	size_t size;
@@ -132,10 +169,141 @@ vod_json_get_value_type(vod_json_parser_state_t* state, vod_json_type_t** result
 	return VOD_JSON_OK;
 }
 
+#if (VOD_JSON_HAVE_SSE2)
+
+// Note: the functions below use aligned 16 byte loads, an aligned load never crosses a page boundary,
+//		so it is safe to read past the null terminator of the string (address sanitizer is disabled since
+//		it reports these reads)
+
+// returns the position of the first quote / backslash / null in the string
+static VOD_JSON_NO_SANITIZE_ADDRESS u_char*
+vod_json_skip_string_chars(u_char* cur_pos)
+{
+	__m128i quote = _mm_set1_epi8('"');
+	__m128i backslash = _mm_set1_epi8('\\');
+	__m128i zero = _mm_setzero_si128();
+	__m128i data;
+	u_char* block;
+	int offset;
+	int mask;
+
+	offset = (uintptr_t)cur_pos & 0xf;
+	block = cur_pos - offset;
+
+	data = _mm_load_si128((__m128i*)block);
+	mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(
+		_mm_cmpeq_epi8(data, quote),
+		_mm_cmpeq_epi8(data, backslash)),
+		_mm_cmpeq_epi8(data, zero)));
+	mask &= 0xffff << offset;		// ignore the bytes before the current position
+
+	while (mask == 0)
+	{
+		block += 16;
+
+		data = _mm_load_si128((__m128i*)block);
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(
+			_mm_cmpeq_epi8(data, quote),
+			_mm_cmpeq_epi8(data, backslash)),
+			_mm_cmpeq_epi8(data, zero)));
+	}
+
+	return block + __builtin_ctz(mask);
+}
+
+// returns the number of commas before the first structural char / null,
+// used to estimate the number of elements in an array of numbers
+static VOD_JSON_NO_SANITIZE_ADDRESS size_t
+vod_json_count_array_commas(u_char* cur_pos)
+{
+	__m128i comma = _mm_set1_epi8(',');
+	__m128i zero = _mm_setzero_si128();
+	__m128i data;
+	u_char* block;
+	size_t result;
+	int comma_mask;
+	int end_mask;
+	int offset;
+
+	offset = (uintptr_t)cur_pos & 0xf;
+	block = cur_pos - offset;
+
+	for (result = 0; ; block += 16, offset = 0)
+	{
+		data = _mm_load_si128((__m128i*)block);
+		comma_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(data, comma));
+		end_mask = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(_mm_or_si128(
+			_mm_cmpeq_epi8(data, _mm_set1_epi8(']')),
+			_mm_cmpeq_epi8(data, _mm_set1_epi8('['))),
+			_mm_or_si128(
+			_mm_cmpeq_epi8(data, _mm_set1_epi8('{')),
+			_mm_cmpeq_epi8(data, _mm_set1_epi8('"')))),
+			_mm_cmpeq_epi8(data, zero)));
+
+		comma_mask &= 0xffff << offset;
+		end_mask &= 0xffff << offset;
+
+		if (end_mask != 0)
+		{
+			// count only the commas before the end
+			comma_mask &= (end_mask & -end_mask) - 1;
+			return result + __builtin_popcount(comma_mask);
+		}
+
+		result += __builtin_popcount(comma_mask);
+		if (result >= MAX_ESTIMATED_PART_COUNT)
+		{
+			return result;
+		}
+	}
+}
+
+#else
+
+static u_char*
+vod_json_skip_string_chars(u_char* cur_pos)
+{
+	for (; *cur_pos && *cur_pos != '"' && *cur_pos != '\\'; cur_pos++);
+	return cur_pos;
+}
+
+static size_t
+vod_json_count_array_commas(u_char* cur_pos)
+{
+	size_t result = 0;
+
+	for (;; cur_pos++)
+	{
+		switch (*cur_pos)
+		{
+		case ',':
+			result++;
+			if (result >= MAX_ESTIMATED_PART_COUNT)
+			{
+				return result;
+			}
+			break;
+
+		case ']':
+		case '[':
+		case '{':
+		case '"':
+		case '\0':
+			return result;
+		}
+	}
+}
+
+#endif // VOD_JSON_HAVE_SSE2
+
 static void 
 vod_json_skip_spaces(vod_json_parser_state_t* state)
 {
-	for (; *state->cur_pos && isspace(*state->cur_pos); state->cur_pos++);
+	u_char* cur_pos;
+
+	for (cur_pos = state->cur_pos; vod_json_is_space(*cur_pos); cur_pos++);
+
+	state->cur_pos = cur_pos;
 }
 
 static vod_json_status_t
@@ -149,6 +317,8 @@ vod_json_parse_string(vod_json_parser_state_t* state, vod_str_t* result)
 
 	for (;;)
 	{
+		state->cur_pos = vod_json_skip_string_chars(state->cur_pos);
+
 		c = *state->cur_pos;
 		if (!c)
 		{
@@ -233,37 +403,52 @@ static vod_json_status_t
 vod_json_parse_int(vod_json_parser_state_t* state, int64_t* result, bool_t* negative)
 {
 	int64_t value;
+	u_char* cur_pos = state->cur_pos;
+	u_char* safe_end;
 
-	if (*state->cur_pos == '-')
+	if (*cur_pos == '-')
 	{
 		*negative = TRUE;
-		state->cur_pos++;
+		cur_pos++;
 	}
 	else
 	{
 		*negative = FALSE;
 	}
 
-	if (!isdigit(*state->cur_pos))
+	if (!vod_json_is_digit(*cur_pos))
 	{
-		vod_snprintf(state->error, state->error_size, "expected digit got 0x%xd%Z", (int)*state->cur_pos);
+		state->cur_pos = cur_pos;
+		vod_snprintf(state->error, state->error_size, "expected digit got 0x%xd%Z", (int)*cur_pos);
 		return VOD_JSON_BAD_DATA;
 	}
 
 	value = 0;
 
+	// Note: the value cannot overflow in the first MAX_SAFE_INT_DIGITS digits, checking only when the number is longer.
+	//		using a local pointer, since writes through the state pointer may alias the data
+	safe_end = cur_pos + MAX_SAFE_INT_DIGITS;
+
 	do
+	{
+		value = value * 10 + (*cur_pos - '0');
+		cur_pos++;
+	} while (vod_json_is_digit(*cur_pos) && cur_pos < safe_end);
+
+	while (vod_json_is_digit(*cur_pos))
 	{
 		if (value > LLONG_MAX / 10 - 1)
 		{
+			state->cur_pos = cur_pos;
 			vod_snprintf(state->error, state->error_size, "number value overflow (1)%Z");
 			return VOD_JSON_BAD_DATA;
 		}
 
-		value = value * 10 + (*state->cur_pos - '0');
-		state->cur_pos++;
-	} while (isdigit(*state->cur_pos));
+		value = value * 10 + (*cur_pos - '0');
+		cur_pos++;
+	}
 
+	state->cur_pos = cur_pos;
 	*result = value;
 
 	return VOD_JSON_OK;
@@ -362,7 +547,15 @@ vod_json_parse_array(vod_json_parser_state_t* state, vod_json_array_t* result)
 	result->type = type->type;
 	result->count = 0;
 	part = &result->part;
-	part_size = type->size * FIRST_PART_COUNT;
+	if (type == &vod_json_int || type == &vod_json_frac)
+	{
+		// arrays of numbers can be long (e.g. durations), size the first part according to the number of commas
+		part_size = type->size * vod_min(vod_json_count_array_commas(state->cur_pos) + 1, MAX_ESTIMATED_PART_COUNT);
+	}
+	else
+	{
+		part_size = type->size * FIRST_PART_COUNT;
+	}
 	cur_item = vod_alloc(state->pool, part_size);
 	if (cur_item == NULL)
 	{
@@ -403,7 +596,15 @@ vod_json_parse_array(vod_json_parser_state_t* state, vod_json_array_t* result)
 			part->last = (u_char*)cur_item + part_size;
 		}
 
-		rc = type->parser(state, cur_item);
+		if (type == &vod_json_int)
+		{
+			// Note: calling the int parser directly so that it can be inlined, arrays of ints can be long
+			rc = vod_json_parser_int(state, cur_item);
+		}
+		else
+		{
+			rc = type->parser(state, cur_item);
+		}
 		if (rc != VOD_JSON_OK)
 		{
 			return rc;
@@ -667,6 +868,453 @@ error:
 	return rc;
 }
 
+// compiled json
+static size_t
+vod_json_get_item_size(int type)
+{
+	switch (type)
+	{
+	case VOD_JSON_BOOL:
+		return sizeof(bool_t);
+
+	case VOD_JSON_INT:
+		return sizeof(int64_t);
+
+	case VOD_JSON_FRAC:
+		return sizeof(vod_json_fraction_t);
+
+	case VOD_JSON_STRING:
+		return sizeof(vod_str_t);
+
+	case VOD_JSON_ARRAY:
+		return sizeof(vod_json_array_t);
+
+	case VOD_JSON_OBJECT:
+		return sizeof(vod_json_object_t);
+	}
+
+	return 0;
+}
+
+static size_t
+vod_json_get_compiled_item_size(int type, void* item)
+{
+	vod_json_key_value_t* cur_element;
+	vod_json_key_value_t* last_element;
+	vod_json_object_t* object;
+	vod_json_array_t* array;
+	vod_array_part_t* part;
+	size_t item_size;
+	size_t result;
+	u_char* cur_item;
+
+	switch (type)
+	{
+	case VOD_JSON_STRING:
+		return vod_align(((vod_str_t*)item)->len, VOD_JSON_COMPILED_ALIGNMENT);
+
+	case VOD_JSON_ARRAY:
+		array = item;
+		item_size = vod_json_get_item_size(array->type);
+		result = vod_align(array->count * item_size, VOD_JSON_COMPILED_ALIGNMENT);
+
+		if (array->type != VOD_JSON_STRING &&
+			array->type != VOD_JSON_ARRAY &&
+			array->type != VOD_JSON_OBJECT)
+		{
+			return result;
+		}
+
+		for (part = &array->part; part != NULL; part = part->next)
+		{
+			for (cur_item = part->first; (void*)cur_item < part->last; cur_item += item_size)
+			{
+				result += vod_json_get_compiled_item_size(array->type, cur_item);
+			}
+		}
+		return result;
+
+	case VOD_JSON_OBJECT:
+		object = item;
+		result = vod_align(object->nelts * sizeof(*cur_element), VOD_JSON_COMPILED_ALIGNMENT);
+
+		cur_element = object->elts;
+		last_element = cur_element + object->nelts;
+		for (; cur_element < last_element; cur_element++)
+		{
+			result += vod_json_get_compiled_item_size(VOD_JSON_STRING, &cur_element->key);
+			result += vod_json_get_compiled_item_size(cur_element->value.type, &cur_element->value.v);
+		}
+		return result;
+	}
+
+	return 0;
+}
+
+static void*
+vod_json_compile_alloc(vod_json_compile_state_t* state, size_t size)
+{
+	u_char* result;
+
+	result = state->cur_pos;
+	state->cur_pos += vod_align(size, VOD_JSON_COMPILED_ALIGNMENT);
+	return result;
+}
+
+static void
+vod_json_compile_item(vod_json_compile_state_t* state, int type, void* src, void* dest)
+{
+	vod_json_key_value_t* src_element;
+	vod_json_key_value_t* last_element;
+	vod_json_key_value_t* dest_element;
+	vod_json_object_t* src_object;
+	vod_json_object_t* dest_object;
+	vod_json_array_t* src_array;
+	vod_json_array_t* dest_array;
+	vod_array_part_t* part;
+	vod_str_t* src_str;
+	vod_str_t* dest_str;
+	size_t item_size;
+	u_char* dest_item;
+	u_char* cur_item;
+	u_char* items;
+
+	switch (type)
+	{
+	case VOD_JSON_STRING:
+		src_str = src;
+		dest_str = dest;
+		dest_str->len = src_str->len;
+		dest_str->data = vod_json_compile_alloc(state, src_str->len);
+		vod_memcpy(dest_str->data, src_str->data, src_str->len);
+		dest_str->data = VOD_JSON_COMPILED_OFFSET(state, dest_str->data);
+		break;
+
+	case VOD_JSON_ARRAY:
+		src_array = src;
+		dest_array = dest;
+		dest_array->type = src_array->type;
+		dest_array->count = src_array->count;
+		dest_array->part.next = NULL;
+		dest_array->part.count = src_array->count;
+		if (src_array->count <= 0)
+		{
+			dest_array->part.first = NULL;
+			dest_array->part.last = NULL;
+			break;
+		}
+
+		// flatten the parts to a single buffer
+		item_size = vod_json_get_item_size(src_array->type);
+		items = vod_json_compile_alloc(state, src_array->count * item_size);
+
+		dest_item = items;
+		for (part = &src_array->part; part != NULL; part = part->next)
+		{
+			switch (src_array->type)
+			{
+			case VOD_JSON_STRING:
+			case VOD_JSON_ARRAY:
+			case VOD_JSON_OBJECT:
+				for (cur_item = part->first; (void*)cur_item < part->last; cur_item += item_size)
+				{
+					vod_json_compile_item(state, src_array->type, cur_item, dest_item);
+					dest_item += item_size;
+				}
+				break;
+
+			default:
+				dest_item = vod_copy(dest_item, part->first, (u_char*)part->last - (u_char*)part->first);
+				break;
+			}
+		}
+
+		dest_array->part.first = VOD_JSON_COMPILED_OFFSET(state, items);
+		dest_array->part.last = VOD_JSON_COMPILED_OFFSET(state, dest_item);
+		break;
+
+	case VOD_JSON_OBJECT:
+		src_object = src;
+		dest_object = dest;
+		dest_object->nelts = src_object->nelts;
+		dest_object->size = sizeof(*dest_element);
+		dest_object->nalloc = src_object->nelts;
+		dest_object->pool = NULL;
+		if (src_object->nelts <= 0)
+		{
+			dest_object->elts = NULL;
+			break;
+		}
+
+		dest_element = vod_json_compile_alloc(state, src_object->nelts * sizeof(*dest_element));
+		dest_object->elts = VOD_JSON_COMPILED_OFFSET(state, dest_element);
+
+		src_element = src_object->elts;
+		last_element = src_element + src_object->nelts;
+		for (; src_element < last_element; src_element++, dest_element++)
+		{
+			dest_element->key_hash = src_element->key_hash;
+			vod_json_compile_item(state, VOD_JSON_STRING, &src_element->key, &dest_element->key);
+
+			dest_element->value = src_element->value;
+			vod_json_compile_item(state, src_element->value.type, &src_element->value.v, &dest_element->value.v);
+		}
+		break;
+	}
+}
+
+vod_json_status_t
+vod_json_compile(vod_pool_t* pool, vod_json_value_t* value, vod_str_t* result)
+{
+	vod_json_compiled_header_t* header;
+	vod_json_compile_state_t state;
+	size_t size;
+
+	size = vod_align(sizeof(*header), VOD_JSON_COMPILED_ALIGNMENT) +
+		vod_json_get_compiled_item_size(value->type, &value->v);
+
+	header = vod_alloc(pool, size);
+	if (header == NULL)
+	{
+		return VOD_JSON_ALLOC_FAILED;
+	}
+
+	header->magic = VOD_JSON_COMPILED_MAGIC;
+	header->word_size = sizeof(void*);
+	header->size = size;
+	header->root = *value;
+
+	state.base = (u_char*)header;
+	state.cur_pos = state.base + vod_align(sizeof(*header), VOD_JSON_COMPILED_ALIGNMENT);
+
+	vod_json_compile_item(&state, value->type, &value->v, &header->root.v);
+
+	result->data = (u_char*)header;
+	result->len = size;
+
+	return VOD_JSON_OK;
+}
+
+bool_t
+vod_json_is_compiled(vod_str_t* buffer)
+{
+	vod_json_compiled_header_t* header = (vod_json_compiled_header_t*)buffer->data;
+
+	return buffer->len >= sizeof(*header) &&
+		header->magic == VOD_JSON_COMPILED_MAGIC &&
+		header->word_size == sizeof(void*) &&
+		header->size == buffer->len;
+}
+
+// Note: the regions of the compiled buffer are consumed in the same order in which vod_json_compile_item 
+//		allocated them, a region that does not start at the expected offset, or overflows the buffer, 
+//		fails the load. this way a corrupt buffer can not reference memory outside the buffer, and every 
+//		region is relocated exactly once
+static void*
+vod_json_relocate_region(vod_json_compile_state_t* state, void* offset, size_t size)
+{
+	u_char* result;
+	size_t aligned_size;
+
+	result = state->cur_pos;
+
+	if ((uintptr_t)offset != (uintptr_t)(result - state->base) ||
+		size > (size_t)(state->end - result))
+	{
+		return NULL;
+	}
+
+	aligned_size = vod_align(size, VOD_JSON_COMPILED_ALIGNMENT);
+	if (aligned_size > (size_t)(state->end - result))
+	{
+		return NULL;
+	}
+
+	state->cur_pos += aligned_size;
+	return result;
+}
+
+static vod_json_status_t
+vod_json_relocate_item(vod_json_compile_state_t* state, int type, void* item)
+{
+	vod_json_key_value_t* cur_element;
+	vod_json_key_value_t* last_element;
+	vod_json_object_t* object;
+	vod_json_array_t* array;
+	vod_json_status_t rc;
+	vod_str_t* str;
+	size_t item_size;
+	u_char* cur_item;
+
+	switch (type)
+	{
+	case VOD_JSON_NULL:
+	case VOD_JSON_BOOL:
+	case VOD_JSON_INT:
+	case VOD_JSON_FRAC:
+		return VOD_JSON_OK;
+
+	case VOD_JSON_STRING:
+		str = item;
+		str->data = vod_json_relocate_region(state, str->data, str->len);
+		if (str->data == NULL)
+		{
+			return VOD_JSON_BAD_DATA;
+		}
+		return VOD_JSON_OK;
+
+	case VOD_JSON_ARRAY:
+		array = item;
+		array->part.next = NULL;
+		array->part.count = array->count;
+		if (array->count <= 0)
+		{
+			array->part.first = NULL;
+			array->part.last = NULL;
+			return VOD_JSON_OK;
+		}
+
+		if (array->type < VOD_JSON_NULL || array->type > VOD_JSON_OBJECT)
+		{
+			return VOD_JSON_BAD_DATA;
+		}
+
+		item_size = vod_json_get_item_size(array->type);
+		if (item_size > 0 && array->count > (size_t)(state->end - state->cur_pos) / item_size)
+		{
+			return VOD_JSON_BAD_DATA;
+		}
+
+		array->part.first = vod_json_relocate_region(state, array->part.first, array->count * item_size);
+		if (array->part.first == NULL)
+		{
+			return VOD_JSON_BAD_DATA;
+		}
+		array->part.last = (u_char*)array->part.first + array->count * item_size;
+
+		if (array->type != VOD_JSON_STRING &&
+			array->type != VOD_JSON_ARRAY &&
+			array->type != VOD_JSON_OBJECT)
+		{
+			return VOD_JSON_OK;
+		}
+
+		if (state->depth >= MAX_RECURSION_DEPTH)
+		{
+			return VOD_JSON_BAD_DATA;
+		}
+
+		state->depth++;
+		for (cur_item = array->part.first; (void*)cur_item < array->part.last; cur_item += item_size)
+		{
+			rc = vod_json_relocate_item(state, array->type, cur_item);
+			if (rc != VOD_JSON_OK)
+			{
+				return rc;
+			}
+		}
+		state->depth--;
+		return VOD_JSON_OK;
+
+	case VOD_JSON_OBJECT:
+		object = item;
+		object->pool = state->pool;		// objects may grow when applying an override
+		object->size = sizeof(*cur_element);
+		object->nalloc = object->nelts;
+		if (object->nelts <= 0)
+		{
+			object->elts = NULL;
+			return VOD_JSON_OK;
+		}
+
+		if (object->nelts > (size_t)(state->end - state->cur_pos) / sizeof(*cur_element))
+		{
+			return VOD_JSON_BAD_DATA;
+		}
+
+		object->elts = vod_json_relocate_region(state, object->elts, object->nelts * sizeof(*cur_element));
+		if (object->elts == NULL)
+		{
+			return VOD_JSON_BAD_DATA;
+		}
+
+		if (state->depth >= MAX_RECURSION_DEPTH)
+		{
+			return VOD_JSON_BAD_DATA;
+		}
+
+		state->depth++;
+		cur_element = object->elts;
+		last_element = cur_element + object->nelts;
+		for (; cur_element < last_element; cur_element++)
+		{
+			rc = vod_json_relocate_item(state, VOD_JSON_STRING, &cur_element->key);
+			if (rc != VOD_JSON_OK)
+			{
+				return rc;
+			}
+
+			rc = vod_json_relocate_item(state, cur_element->value.type, &cur_element->value.v);
+			if (rc != VOD_JSON_OK)
+			{
+				return rc;
+			}
+		}
+		state->depth--;
+		return VOD_JSON_OK;
+	}
+
+	return VOD_JSON_BAD_DATA;
+}
+
+vod_json_status_t
+vod_json_load_compiled(vod_pool_t* pool, vod_str_t* buffer, vod_json_value_t* result)
+{
+	vod_json_compiled_header_t* header;
+	vod_json_compile_state_t state;
+	vod_json_status_t rc;
+
+	if (!vod_json_is_compiled(buffer))
+	{
+		return VOD_JSON_BAD_DATA;
+	}
+
+	// copy the buffer, since the parsed json may be modified in place
+	header = vod_alloc(pool, buffer->len);
+	if (header == NULL)
+	{
+		return VOD_JSON_ALLOC_FAILED;
+	}
+
+	vod_memcpy(header, buffer->data, buffer->len);
+
+	state.pool = pool;
+	state.base = (u_char*)header;
+	state.cur_pos = state.base + vod_align(sizeof(*header), VOD_JSON_COMPILED_ALIGNMENT);
+	state.end = state.base + buffer->len;
+	state.depth = 0;
+
+	if (state.cur_pos > state.end)
+	{
+		return VOD_JSON_BAD_DATA;
+	}
+
+	rc = vod_json_relocate_item(&state, header->root.type, &header->root.v);
+	if (rc != VOD_JSON_OK)
+	{
+		return rc;
+	}
+
+	if (state.cur_pos != state.end)
+	{
+		return VOD_JSON_BAD_DATA;
+	}
+
+	*result = header->root;
+
+	return VOD_JSON_OK;
+}
+
 static u_char*
 vod_json_unicode_hex_to_utf8(u_char* dest, u_char* src)
 {
@@ -64,6 +64,20 @@ vod_json_status_t vod_json_parse(
 	u_char* error, 
 	size_t error_size);
 
+// compiled json - a relocatable binary representation of a parsed json,
+// can be loaded without parsing by copying it and fixing up the pointers
+vod_json_status_t vod_json_compile(
+	vod_pool_t* pool,
+	vod_json_value_t* value,
+	vod_str_t* result);
+
+bool_t vod_json_is_compiled(vod_str_t* buffer);
+
+vod_json_status_t vod_json_load_compiled(
+	vod_pool_t* pool,
+	vod_str_t* buffer,
+	vod_json_value_t* result);
+
 vod_json_status_t vod_json_decode_string(vod_str_t* dest, vod_str_t* src);
 
 vod_status_t vod_json_init_hash(
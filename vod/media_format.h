@@ -63,6 +63,7 @@
 #define REQUEST_FLAG_LOOK_AHEAD_SEGMENTS			(0x10)
 #define REQUEST_FLAG_NO_DISCONTINUITY				(0x20)
 #define REQUEST_FLAG_FORCE_PLAYLIST_TYPE_VOD		(0x40)
+#define REQUEST_FLAG_FRAMES_INDEX					(0x80)
 
 #define VOD_CODEC_FLAG(name) (1 << (VOD_CODEC_ID_##name - 1))
 
@@ -326,6 +327,13 @@ typedef struct {
 		media_format_read_request_t* read_req,		// VOD_AGAIN
 		media_track_array_t* result);				// VOD_OK
 
+	// optional - builds an additional metadata part that is saved in the metadata cache
+	vod_status_t(*build_metadata_index)(
+		request_context_t* request_context,
+		vod_str_t* metadata_parts,
+		size_t metadata_part_count,
+		vod_str_t* result);
+
 } media_format_t;
 
 // functions
@@ -10,17 +10,18 @@
 #define SEGMENT_BASE_TIME_RELATIVE (ULLONG_MAX)
 #define INVALID_SEQUENCE_INDEX (UINT_MAX)
 #define INVALID_SEGMENT_INDEX (UINT_MAX)
+#define INVALID_PART_INDEX (UINT_MAX)
 #define INVALID_SEGMENT_TIME (LLONG_MAX)
 #define INVALID_CLIP_INDEX (UINT_MAX)
 
 #define MAX_LOOK_AHEAD_SEGMENTS (2)
 #define MAX_NOTIFICATIONS (1024)
-#define MAX_CLIPS (128)
-#define MAX_CLIPS_PER_REQUEST (16)
+#define MAX_CLIPS (65536)
+#define MAX_CLIPS_PER_REQUEST (64)
 #define MAX_SEQUENCES (32)
 #define MAX_SEQUENCE_IDS (4)
 #define MAX_SEQUENCE_TRACKS_MASKS (2)
-#define MAX_SOURCES (32)
+#define MAX_SOURCES (128)
 
 // enums
 enum {
@@ -135,6 +136,7 @@ typedef struct {
 	uint64_t segment_start_time;
 	uint32_t segment_duration;
 	int64_t live_window_duration;
+	uint32_t live_partial_duration;			// live only - duration of the complete parts following the last segment
 	media_look_ahead_segment_t* look_ahead_segments;
 	uint32_t look_ahead_segment_count;
 
@@ -162,6 +164,7 @@ typedef struct {
 	int64_t segment_time;		// used in mss
 	segment_time_type_t segment_time_type;
 	uint32_t segment_index;
+	uint32_t part_index;		// partial segment requests only
 	uint32_t clip_index;
 	uint32_t pts_delay;
 	uint32_t sequences_mask;
@@ -173,6 +176,14 @@ typedef struct {
 	uint32_t version;
 	uint32_t width;
 	uint32_t height;
+	uint32_t tile_columns;		// thumbnail tiles
+	uint32_t tile_rows;
+	uint32_t tile_interval;
 } request_params_t;
 
+// macros
+#define request_params_get_tile_span(params)	\
+	((params)->tile_columns > 0 ?				\
+		(uint64_t)(params)->tile_interval * ((params)->tile_columns * (params)->tile_rows - 1) : 0)
+
 #endif //__MEDIA_SET_H__
@@ -64,6 +64,7 @@ typedef struct {
 	uint32_t clip_id;
 	uint32_t base_clip_index;
 	uint32_t first_clip_from;
+	uint64_t* cumulative_durations;		// [total_count + 1] sum of the durations preceding each clip
 } media_set_parse_context_t;
 
 typedef struct {
@@ -197,10 +198,12 @@ static vod_status_t
 media_set_parse_durations(
 	request_context_t* request_context,
 	vod_json_array_t* array,
-	media_set_t* media_set)
+	media_set_t* media_set,
+	uint64_t** cumulative_durations)
 {
 	vod_array_part_t* part;
 	uint32_t* output_cur;
+	uint64_t* cumulative_cur;
 	uint64_t total_duration = 0;
 	int64_t cur_value;
 	int64_t* cur_pos;
@@ -223,12 +226,24 @@ media_set_parse_durations(
 	if (output_cur == NULL)
 	{
 		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-			"media_set_parse_durations: vod_alloc failed");
+			"media_set_parse_durations: vod_alloc failed (1)");
 		return VOD_ALLOC_FAILED;
 	}
 
 	media_set->timing.durations = output_cur;
 
+	// Note: the cumulative durations are collected during the (unavoidable) validation pass,
+	//	so that clipping can later locate clips without summing the durations again
+	cumulative_cur = vod_alloc(request_context->pool, sizeof(cumulative_cur[0]) * (array->count + 1));
+	if (cumulative_cur == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"media_set_parse_durations: vod_alloc failed (2)");
+		return VOD_ALLOC_FAILED;
+	}
+
+	*cumulative_durations = cumulative_cur;
+
 	part = &array->part;
 	for (cur_pos = part->first; ; cur_pos++, output_cur++)
 	{
@@ -258,10 +273,13 @@ media_set_parse_durations(
 			return VOD_BAD_MAPPING;
 		}
 
+		*cumulative_cur++ = total_duration;
 		*output_cur = cur_value;
 		total_duration += cur_value;
 	}
 
+	*cumulative_cur = total_duration;
+
 	if (total_duration > MAX_SEQUENCE_DURATION)
 	{
 		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
@@ -481,25 +499,72 @@ media_set_parse_bitrate(
 	return VOD_OK;
 }
 
+static vod_status_t
+media_set_parse_mapping(
+	request_context_t* request_context,
+	vod_str_t* mapping,
+	bool_t is_compiled,
+	vod_json_value_t* result,
+	vod_str_t* compiled)
+{
+	u_char error[128];
+	vod_status_t rc;
+
+	if (is_compiled)
+	{
+		rc = vod_json_load_compiled(request_context->pool, mapping, result);
+		if (rc != VOD_JSON_OK)
+		{
+			vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+				"media_set_parse_mapping: failed to load compiled json %i", rc);
+			return rc == VOD_JSON_ALLOC_FAILED ? VOD_ALLOC_FAILED : VOD_BAD_MAPPING;
+		}
+
+		return VOD_OK;
+	}
+
+	rc = vod_json_parse(request_context->pool, mapping->data, result, error, sizeof(error));
+	if (rc != VOD_JSON_OK)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"media_set_parse_mapping: failed to parse json %i: %s", rc, error);
+		return VOD_BAD_MAPPING;
+	}
+
+	if (compiled == NULL)
+	{
+		return VOD_OK;
+	}
+
+	// Note: must be done before the json is modified (e.g. by applying an override)
+	rc = vod_json_compile(request_context->pool, result, compiled);
+	if (rc != VOD_JSON_OK)
+	{
+		vod_log_debug1(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"media_set_parse_mapping: vod_json_compile failed %i", rc);
+		return VOD_ALLOC_FAILED;
+	}
+
+	return VOD_OK;
+}
+
 vod_status_t
 media_set_map_source(
 	request_context_t* request_context,
-	u_char* string,
+	vod_str_t* mapping,
+	bool_t is_compiled,
 	media_clip_source_t* source)
 {
 	media_filter_parse_context_t context;
 	vod_json_value_t json;
 	uint64_t initial_clip_to = source->clip_to;
 	uint64_t initial_clip_from = source->clip_from;
-	u_char error[128];
 	vod_status_t rc;
 
-	rc = vod_json_parse(request_context->pool, string, &json, error, sizeof(error));
-	if (rc != VOD_JSON_OK)
+	rc = media_set_parse_mapping(request_context, mapping, is_compiled, &json, NULL);
+	if (rc != VOD_OK)
 	{
-		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
-			"media_set_map_source: failed to parse json %i: %s", rc, error);
-		return VOD_BAD_MAPPING;
+		return rc;
 	}
 
 	if (json.type != VOD_JSON_OBJECT)
@@ -1353,18 +1418,25 @@ media_set_apply_live_window_duration_param(
 static bool_t
 media_set_is_clip_start(media_clip_timing_t* timing, uint64_t time)
 {
-	uint64_t* times_cur = timing->times;
-	uint64_t* times_end = times_cur + timing->total_count;
+	uint32_t left = 0;
+	uint32_t right = timing->total_count;
+	uint32_t mid;
 
-	for (; times_cur < times_end; times_cur++)
+	// Note: the clip times are sorted, validated by media_set_parse_clip_times
+	while (left < right)
 	{
-		if (time == *times_cur)
+		mid = (left + right) >> 1;
+		if (timing->times[mid] < time)
 		{
-			return TRUE;
+			left = mid + 1;
+		}
+		else
+		{
+			right = mid;
 		}
 	}
 
-	return FALSE;
+	return left < timing->total_count && timing->times[left] == time;
 }
 
 vod_status_t
@@ -1494,6 +1566,7 @@ media_set_init_look_ahead_segments(
 	media_set->look_ahead_segments = cur_output;
 
 	segment_index_limit = get_ranges_params->segment_index + MAX_LOOK_AHEAD_SEGMENTS;
+	get_ranges_params->part_index = INVALID_PART_INDEX;
 
 	while (get_ranges_params->segment_index < segment_index_limit)
 	{
@@ -1815,60 +1888,109 @@ media_set_parse_key_frame_offsets(
 	return VOD_OK;
 }
 
+// returns the index of the first clip that ends after the given time, or total_count if there is none
+static uint32_t
+media_set_find_clip_by_original_time(media_clip_timing_t* timing, uint64_t time)
+{
+	uint32_t left = 0;
+	uint32_t right = timing->total_count;
+	uint32_t mid;
+
+	while (left < right)
+	{
+		mid = (left + right) >> 1;
+		if (timing->original_times[mid] + timing->durations[mid] > time)
+		{
+			right = mid;
+		}
+		else
+		{
+			left = mid + 1;
+		}
+	}
+
+	return left;
+}
+
+// returns the sum of the durations of the clips preceding the given clip, after clipping was applied
+static uint64_t
+media_set_get_clip_offset(
+	media_set_parse_context_t* context,
+	media_clip_timing_t* timing,
+	uint32_t clip_index)
+{
+	uint64_t* cumulative_durations;
+
+	if (clip_index <= 0)
+	{
+		return 0;
+	}
+
+	if (clip_index >= timing->total_count)
+	{
+		return timing->total_duration;
+	}
+
+	cumulative_durations = context->cumulative_durations + context->base_clip_index;
+
+	return cumulative_durations[clip_index] - cumulative_durations[0] - context->first_clip_from;
+}
+
 static uint64_t
 media_set_start_relative_offset_to_absolute(
+	media_set_parse_context_t* context,
 	media_clip_timing_t* timing,
 	uint64_t time_left)
 {
-	uint32_t clip_duration;
-	uint32_t clip_index;
+	uint32_t left = 0;
+	uint32_t right = timing->total_count - 1;
+	uint32_t mid;
 
-	for (clip_index = 0;; clip_index++)
+	// find the first clip that ends at or after the offset
+	// Note: the last clip is returned if there is none, this is not supposed to happen since 
+	//	the relative offset was verified to be less than total duration
+	while (left < right)
 	{
-		clip_duration = timing->durations[clip_index];
-		if (clip_duration >= time_left)
+		mid = (left + right) >> 1;
+		if (media_set_get_clip_offset(context, timing, mid + 1) >= time_left)
 		{
-			break;
+			right = mid;
 		}
-
-		if (clip_index >= timing->total_count - 1)
+		else
 		{
-			// Note: this is not supposed to happen since the relative offset was verified to be less than total duration
-			break;
+			left = mid + 1;
 		}
-
-		time_left -= clip_duration;
 	}
 
-	return timing->times[clip_index] + time_left;
+	return timing->times[left] + time_left - media_set_get_clip_offset(context, timing, left);
 }
 
 static uint64_t
 media_set_end_relative_offset_to_absolute(
+	media_set_parse_context_t* context,
 	media_clip_timing_t* timing, 
 	uint64_t time_left)
 {
-	uint32_t clip_duration;
-	uint32_t clip_index;
+	uint64_t start_offset = timing->total_duration - time_left;
+	uint32_t left = 0;
+	uint32_t right = timing->total_count - 1;
+	uint32_t mid;
 
-	for (clip_index = timing->total_count - 1;; clip_index--)
+	// find the last clip that starts at or before the offset
+	while (left < right)
 	{
-		clip_duration = timing->durations[clip_index];
-		if (clip_duration >= time_left)
+		mid = (left + right + 1) >> 1;
+		if (media_set_get_clip_offset(context, timing, mid) <= start_offset)
 		{
-			break;
+			left = mid;
 		}
-
-		if (clip_index <= 0)
+		else
 		{
-			// Note: this is not supposed to happen since the relative offset was verified to be less than total duration
-			break;
+			right = mid - 1;
 		}
-
-		time_left -= clip_duration;
 	}
 
-	return timing->times[clip_index] + clip_duration - time_left;
+	return timing->times[left] + start_offset - media_set_get_clip_offset(context, timing, left);
 }
 
 static vod_status_t
@@ -1925,25 +2047,18 @@ media_set_apply_clip_from(
 	uint32_t clip_index;
 
 	// find the starting clip
-	for (clip_index = 0; ; clip_index++)
+	clip_index = media_set_find_clip_by_original_time(timing, clip_from);
+	if (clip_index >= timing->total_count)
 	{
-		if (clip_index >= timing->total_count)
-		{
-			vod_log_error(VOD_LOG_ERR, request_context->log, 0,
-				"media_set_apply_clip_from: clip from %uL exceeds last clip end time", clip_from);
-			return VOD_BAD_REQUEST;
-		}
-
-		original_clip_time = timing->original_times[clip_index];
-		clip_duration = timing->durations[clip_index];
-		if (clip_from < original_clip_time + clip_duration)
-		{
-			break;
-		}
-
-		timing->total_duration -= clip_duration;
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"media_set_apply_clip_from: clip from %uL exceeds last clip end time", clip_from);
+		return VOD_BAD_REQUEST;
 	}
 
+	original_clip_time = timing->original_times[clip_index];
+	clip_duration = timing->durations[clip_index];
+	timing->total_duration -= context->cumulative_durations[clip_index];
+
 	if (clip_from > original_clip_time)
 	{
 		clip_offset = clip_from - original_clip_time;
@@ -2059,7 +2174,8 @@ static vod_status_t
 media_set_apply_clip_to(
 	request_context_t* request_context,
 	media_set_t* media_set,
-	uint64_t clip_to)
+	uint64_t clip_to,
+	media_set_parse_context_t* context)
 {
 	align_to_key_frames_context_t align_context;
 	media_clip_timing_t* timing = &media_set->timing;
@@ -2069,24 +2185,17 @@ media_set_apply_clip_to(
 	uint32_t clip_offset;
 	uint32_t clip_index;
 
-	timing->total_duration = 0;
-	for (clip_index = 0; ; clip_index++)
+	// find the first clip that ends at or after clip to (clip to is positive since it is greater than clip from)
+	clip_index = media_set_find_clip_by_original_time(timing, clip_to - 1);
+	if (clip_index >= timing->total_count)
 	{
-		if (clip_index >= timing->total_count)
-		{
-			return VOD_OK;
-		}
-
-		clip_time = timing->original_times[clip_index];
-		clip_duration = timing->durations[clip_index];
-		if (clip_to <= clip_time + clip_duration)
-		{
-			break;
-		}
-
-		timing->total_duration += clip_duration;
+		return VOD_OK;
 	}
 
+	clip_time = timing->original_times[clip_index];
+	clip_duration = timing->durations[clip_index];
+	timing->total_duration = media_set_get_clip_offset(context, timing, clip_index);
+
 	if (clip_to > clip_time)
 	{
 		clip_offset = clip_to - clip_time;
@@ -2121,12 +2230,14 @@ media_set_apply_clip_to(
 vod_status_t
 media_set_parse_json(
 	request_context_t* request_context, 
-	u_char* string, 
+	vod_str_t* mapping, 
+	bool_t is_compiled,
 	u_char* override,
 	request_params_t* request_params,
 	segmenter_conf_t* segmenter,
 	media_clip_source_t* source,
 	int request_flags,
+	vod_str_t* compiled,
 	media_set_t* result)
 {
 	media_set_parse_context_t context;
@@ -2143,12 +2254,10 @@ media_set_parse_json(
 	u_char error[128];
 
 	// parse the json and get the media set object values
-	rc = vod_json_parse(request_context->pool, string, &json, error, sizeof(error));
-	if (rc != VOD_JSON_OK)
+	rc = media_set_parse_mapping(request_context, mapping, is_compiled, &json, compiled);
+	if (rc != VOD_OK)
 	{
-		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
-			"media_set_parse_json: failed to parse json %i: %s", rc, error);
-		return VOD_BAD_MAPPING;
+		return rc;
 	}
 
 	if (override != NULL)
@@ -2349,7 +2458,8 @@ media_set_parse_json(
 	rc = media_set_parse_durations(
 		request_context,
 		&params[MEDIA_SET_PARAM_DURATIONS]->v.arr,
-		result);
+		result,
+		&context.cumulative_durations);
 	if (rc != VOD_OK)
 	{
 		return rc;
@@ -2465,7 +2575,7 @@ media_set_parse_json(
 
 	if (source->clip_to < last_clip_end)
 	{
-		rc = media_set_apply_clip_to(request_context, result, source->clip_to);
+		rc = media_set_apply_clip_to(request_context, result, source->clip_to, &context);
 		if (rc != VOD_OK)
 		{
 			return rc;
@@ -2519,12 +2629,20 @@ media_set_parse_json(
 		get_ranges_params.first_key_frame_offset = result->sequences[0].first_key_frame_offset;
 		get_ranges_params.key_frame_durations = result->sequences[0].key_frame_durations;
 		get_ranges_params.allow_last_segment = result->presentation_end;
+		get_ranges_params.part_index = request_params->part_index;
 
 		if (request_params->segment_index != INVALID_SEGMENT_INDEX)
 		{
 			// segment
 			if (result->use_discontinuity)
 			{
+				if (request_params->part_index != INVALID_PART_INDEX)
+				{
+					vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+						"media_set_parse_json: partial segments are not supported with discontinuity");
+					return VOD_BAD_REQUEST;
+				}
+
 				get_ranges_params.initial_segment_index = result->initial_segment_index;
 
 				rc = segmenter_get_start_end_ranges_discontinuity(
@@ -2582,12 +2700,14 @@ media_set_parse_json(
 				if (request_params->segment_time_type == SEGMENT_TIME_END_RELATIVE)
 				{
 					request_params->segment_time = media_set_end_relative_offset_to_absolute(
+						&context,
 						&result->timing,
 						segment_time);
 				}
 				else
 				{
 					request_params->segment_time = media_set_start_relative_offset_to_absolute(
+						&context,
 						&result->timing,
 						segment_time);
 				}
@@ -2595,6 +2715,7 @@ media_set_parse_json(
 			}
 
 			get_ranges_params.time = request_params->segment_time;
+			get_ranges_params.time_span = request_params_get_tile_span(request_params);
 			rc = segmenter_get_start_end_ranges_gop(
 				&get_ranges_params,
 				&context.clip_ranges);
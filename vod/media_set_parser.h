@@ -24,19 +24,25 @@ vod_status_t media_set_parser_init(
 	vod_pool_t* pool,
 	vod_pool_t* temp_pool);
 
+// Note: the mapping can be either a null terminated json string or a compiled json (see vod_json_compile),
+//		is_compiled must be set only for mappings that were read from the mapping cache.
+//		when compiled is not null and the mapping is a json string, it receives the compiled form of the mapping
 vod_status_t media_set_parse_json(
 	request_context_t* request_context,
-	u_char* string,
+	vod_str_t* mapping,
+	bool_t is_compiled,
 	u_char* override,
 	request_params_t* request_params,
 	struct segmenter_conf_s* segmenter,
 	media_clip_source_t* source,
 	int request_flags,
+	vod_str_t* compiled,
 	media_set_t* result);
 
 vod_status_t media_set_map_source(
 	request_context_t* request_context,
-	u_char* string,
+	vod_str_t* mapping,
+	bool_t is_compiled,
 	media_clip_source_t* source);
 
 // filter utility functions
@@ -61,6 +61,10 @@
 #define MKV_ID_CUERELATIVEPOSITION	(0xF0)
 #define MKV_ID_POINTENTRY			(0xBB)
 
+// global
+#define MKV_ID_VOID					(0xEC)
+#define MKV_ID_CRC32				(0xBF)
+
 // cluster
 #define MKV_ID_CLUSTERTIMECODE		(0xE7)
 #define MKV_ID_SIMPLEBLOCK			(0xA3)
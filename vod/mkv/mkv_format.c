@@ -9,6 +9,8 @@
 #define BITRATE_ESTIMATE_SEC (5)
 #define FRAMES_PER_PART (160)		// about 4K
 #define MAX_GOP_FRAMES (600)		// 10 sec GOP in 60 fps
+#define CUE_INDEX_MAGIC (0x49434b4d)	// MKCI
+#define CLUSTER_HEADER_READ_SIZE (64)	// enough for the cluster id, size and timecode
 
 // prototypes
 static vod_status_t mkv_parse_seek_entry(ebml_context_t* context, ebml_spec_t* spec, void* dst);
@@ -63,6 +65,18 @@ typedef struct {
 	uint64_t timecode;
 } mkv_cluster_t;
 
+// cue index - built once when the metadata is read, and saved with it
+typedef struct {
+	uint64_t time;
+	uint64_t cluster_pos;
+} mkv_cue_point_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t count;
+	// followed by mkv_cue_point_t[count], sorted by time
+} mkv_cue_index_header_t;
+
 // matroksa specs
 
 // seekhead
@@ -168,7 +182,7 @@ static ebml_spec_t mkv_spec_bitrate_estimate_cluster[] = {
 enum {
 	SECTION_INFO,
 	SECTION_TRACKS,
-	SECTION_CUES,
+	SECTION_CUES,		// replaced by the cue index once read
 	SECTION_LAYOUT,		// a virtual section for holding mkv_base_layout_t
 	SECTION_COUNT,
 
@@ -180,6 +194,7 @@ enum {
 	MRS_INITIAL,
 	MRS_READ_SECTION_HEADER,
 	MRS_READ_SECTION_DATA,
+	MRS_SCAN_CLUSTERS,
 };
 
 // frame reader states
@@ -204,12 +219,14 @@ typedef struct {
 typedef struct {
 	mkv_base_layout_t base;
 	mkv_section_pos_t positions[SECTION_FILE_COUNT];
+	uint32_t section_count;		// SECTION_FILE_COUNT - 1 when the file has no cues
 } mkv_file_layout_t;
 
 typedef struct {
 	media_base_metadata_t base;
 	mkv_base_layout_t base_layout;
-	vod_str_t cues;
+	mkv_cue_point_t* cue_points;
+	uint32_t cue_count;
 	uint64_t start_time;
 	uint64_t end_time;
 	uint32_t max_frame_count;
@@ -224,6 +241,10 @@ typedef struct {
 	vod_str_t sections[SECTION_COUNT];
 	mkv_file_layout_t layout;
 	mkv_base_metadata_t result;
+	vod_array_t cue_points;		// mkv_cue_point_t
+	uint64_t scan_pos;
+	uint64_t scan_end;
+	uint64_t scan_read_pos;
 } mkv_metadata_reader_state_t;
 
 typedef struct {
@@ -469,10 +490,20 @@ mkv_get_file_layout(
 		return rc;
 	}
 
+	result->section_count = SECTION_FILE_COUNT;
+
 	for (i = 0; i < SECTION_FILE_COUNT; i++)
 	{
 		if (result->positions[i].pos == 0)
 		{
+			if (i == SECTION_CUES)
+			{
+				// no cues, the cue index will be built by scanning the clusters
+				result->positions[i].pos = ULLONG_MAX;
+				result->section_count--;
+				continue;
+			}
+
 			vod_log_error(VOD_LOG_ERR, request_context->log, 0,
 				"mkv_get_file_layout: missing position for index %d", i);
 			return VOD_BAD_DATA;
@@ -482,6 +513,7 @@ mkv_get_file_layout(
 	}
 
 	// sort according to position to optimize reading
+	// Note: a missing cues section is sorted last, and is therefore excluded by section_count
 	qsort(
 		result->positions, 
 		SECTION_FILE_COUNT, 
@@ -491,6 +523,357 @@ mkv_get_file_layout(
 	return VOD_OK;
 }
 
+static int
+mkv_compare_cue_points(const void* p1, const void* p2)
+{
+	uint64_t t1 = ((mkv_cue_point_t*)p1)->time;
+	uint64_t t2 = ((mkv_cue_point_t*)p2)->time;
+
+	if (t1 < t2)
+	{
+		return -1;
+	}
+	else if (t1 > t2)
+	{
+		return 1;
+	}
+
+	return 0;
+}
+
+static vod_status_t
+mkv_metadata_reader_add_cue_point(
+	mkv_metadata_reader_state_t* state,
+	uint64_t time,
+	uint64_t cluster_pos)
+{
+	mkv_cue_point_t* cue_point;
+
+	if (state->size_limit < sizeof(*cue_point))
+	{
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"mkv_metadata_reader_add_cue_point: cue index size exceeds the limit");
+		return VOD_BAD_DATA;
+	}
+
+	state->size_limit -= sizeof(*cue_point);
+
+	cue_point = vod_array_push(&state->cue_points);
+	if (cue_point == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+			"mkv_metadata_reader_add_cue_point: vod_array_push failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	cue_point->time = time;
+	cue_point->cluster_pos = cluster_pos;
+
+	return VOD_OK;
+}
+
+static vod_status_t
+mkv_metadata_reader_parse_cues(mkv_metadata_reader_state_t* state)
+{
+	ebml_context_t context;
+	mkv_index_t index;
+	vod_status_t rc;
+
+	// the raw cues are replaced by the cue index, the cue points are charged to the limit instead
+	state->size_limit += state->sections[SECTION_CUES].len;
+
+	context.request_context = state->request_context;
+	context.cur_pos = state->sections[SECTION_CUES].data;
+	context.end_pos = context.cur_pos + state->sections[SECTION_CUES].len;
+
+	while (context.cur_pos < context.end_pos)
+	{
+		rc = ebml_parse_single(&context, mkv_spec_index, &index);
+		if (rc != VOD_OK)
+		{
+			vod_log_debug1(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+				"mkv_metadata_reader_parse_cues: ebml_parse_single failed %i", rc);
+			return rc;
+		}
+
+		rc = mkv_metadata_reader_add_cue_point(state, index.time, index.cluster_pos);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+	}
+
+	return VOD_OK;
+}
+
+static vod_status_t
+mkv_parse_cluster_timecode(ebml_context_t* context, uint64_t* result)
+{
+	uint64_t timecode;
+	uint64_t size;
+	uint64_t id;
+	vod_status_t rc;
+
+	for (;;)
+	{
+		rc = ebml_read_id(context, &id);
+		if (rc < 0)
+		{
+			vod_log_debug1(VOD_LOG_DEBUG_LEVEL, context->request_context->log, 0,
+				"mkv_parse_cluster_timecode: ebml_read_id failed %i", rc);
+			return rc;
+		}
+
+		rc = ebml_read_num(context, &size, 8, 1);
+		if (rc < 0)
+		{
+			vod_log_debug1(VOD_LOG_DEBUG_LEVEL, context->request_context->log, 0,
+				"mkv_parse_cluster_timecode: ebml_read_num failed %i", rc);
+			return rc;
+		}
+
+		if (size > (uint64_t)(context->end_pos - context->cur_pos))
+		{
+			vod_log_error(VOD_LOG_ERR, context->request_context->log, 0,
+				"mkv_parse_cluster_timecode: element 0x%uxL size %uL exceeds the cluster header", id, size);
+			return VOD_BAD_DATA;
+		}
+
+		switch (id)
+		{
+		case MKV_ID_CLUSTERTIMECODE:
+			if (size > sizeof(timecode))
+			{
+				vod_log_error(VOD_LOG_ERR, context->request_context->log, 0,
+					"mkv_parse_cluster_timecode: invalid timecode size %uL", size);
+				return VOD_BAD_DATA;
+			}
+
+			timecode = 0;
+			for (; size > 0; size--)
+			{
+				timecode = (timecode << 8) | (*context->cur_pos++);
+			}
+
+			*result = timecode;
+			return VOD_OK;
+
+		case MKV_ID_CRC32:
+		case MKV_ID_VOID:
+			context->cur_pos += size;
+			break;
+
+		default:
+			vod_log_error(VOD_LOG_ERR, context->request_context->log, 0,
+				"mkv_parse_cluster_timecode: expected cluster timecode, got 0x%uxL", id);
+			return VOD_BAD_DATA;
+		}
+	}
+}
+
+static vod_status_t
+mkv_metadata_reader_scan_clusters(
+	mkv_metadata_reader_state_t* state,
+	uint64_t offset,
+	vod_str_t* buffer,
+	media_format_read_metadata_result_t* result)
+{
+	ebml_context_t context;
+	const u_char* start_pos;
+	uint64_t header_size;
+	uint64_t timecode;
+	uint64_t size;
+	uint64_t id;
+	vod_status_t rc;
+
+	context.request_context = state->request_context;
+
+	while (state->scan_pos < state->scan_end)
+	{
+		if (state->scan_pos < offset || 
+			state->scan_pos + CLUSTER_HEADER_READ_SIZE > offset + buffer->len)
+		{
+			if (state->scan_pos != state->scan_read_pos)
+			{
+				state->scan_read_pos = state->scan_pos;
+				result->read_req.read_offset = state->scan_pos;
+				result->read_req.read_size = CLUSTER_HEADER_READ_SIZE;
+				result->read_req.flags = 0;
+				return VOD_AGAIN;
+			}
+
+			// already read from this position, the element is close to the end of the file
+			if (state->scan_pos < offset || state->scan_pos >= offset + buffer->len)
+			{
+				vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+					"mkv_metadata_reader_scan_clusters: truncated file");
+				return VOD_BAD_DATA;
+			}
+		}
+
+		start_pos = buffer->data + state->scan_pos - offset;
+
+		context.cur_pos = start_pos;
+		context.end_pos = buffer->data + buffer->len;
+
+		rc = ebml_read_id(&context, &id);
+		if (rc < 0)
+		{
+			vod_log_debug1(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+				"mkv_metadata_reader_scan_clusters: ebml_read_id failed %i", rc);
+			return rc;
+		}
+
+		rc = ebml_read_num(&context, &size, 8, 1);
+		if (rc < 0)
+		{
+			vod_log_debug1(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+				"mkv_metadata_reader_scan_clusters: ebml_read_num failed %i", rc);
+			return rc;
+		}
+
+		if (is_unknown_size(size, rc))
+		{
+			vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+				"mkv_metadata_reader_scan_clusters: element 0x%uxL has unknown size", id);
+			return VOD_BAD_DATA;
+		}
+
+		header_size = context.cur_pos - start_pos;
+
+		if (id == MKV_ID_CLUSTER)
+		{
+			if ((uint64_t)(context.end_pos - context.cur_pos) > size)
+			{
+				context.end_pos = context.cur_pos + size;
+			}
+
+			rc = mkv_parse_cluster_timecode(&context, &timecode);
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+
+			rc = mkv_metadata_reader_add_cue_point(
+				state, 
+				timecode, 
+				state->scan_pos - state->layout.base.position_reference);
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+		}
+
+		state->scan_pos += header_size + size;
+	}
+
+	return VOD_OK;
+}
+
+static vod_status_t
+mkv_metadata_reader_start_scan(mkv_metadata_reader_state_t* state)
+{
+	vod_str_t* cur_section;
+	u_char* p;
+	int i;
+
+	vod_log_error(VOD_LOG_WARN, state->request_context->log, 0,
+		"mkv_metadata_reader_start_scan: file has no cues, scanning the clusters");
+
+	// copy the sections that were read, since the scan reads will not retain the read buffers
+	for (i = 0; i < SECTION_FILE_COUNT; i++)
+	{
+		cur_section = &state->sections[i];
+		if (cur_section->len <= 0)
+		{
+			continue;
+		}
+
+		p = vod_alloc(state->request_context->pool, cur_section->len);
+		if (p == NULL)
+		{
+			vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+				"mkv_metadata_reader_start_scan: vod_alloc failed");
+			return VOD_ALLOC_FAILED;
+		}
+
+		vod_memcpy(p, cur_section->data, cur_section->len);
+		cur_section->data = p;
+	}
+
+	state->scan_pos = state->layout.base.position_reference;
+	state->scan_end = state->layout.base.position_reference + state->layout.base.segment_size;
+	state->scan_read_pos = ULLONG_MAX;
+	state->state = MRS_SCAN_CLUSTERS;
+
+	return VOD_OK;
+}
+
+static vod_status_t
+mkv_metadata_reader_build_cue_index(mkv_metadata_reader_state_t* state)
+{
+	mkv_cue_index_header_t* header;
+	mkv_cue_point_t* cur_point;
+	mkv_cue_point_t* last_point;
+	size_t size;
+
+	// sort by time (expected to be sorted already)
+	cur_point = state->cue_points.elts;
+	last_point = cur_point + state->cue_points.nelts;
+	for (cur_point++; cur_point < last_point; cur_point++)
+	{
+		if (cur_point->time < cur_point[-1].time)
+		{
+			qsort(
+				state->cue_points.elts,
+				state->cue_points.nelts,
+				sizeof(mkv_cue_point_t),
+				mkv_compare_cue_points);
+			break;
+		}
+	}
+
+	size = sizeof(*header) + sizeof(mkv_cue_point_t) * state->cue_points.nelts;
+	header = vod_alloc(state->request_context->pool, size);
+	if (header == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+			"mkv_metadata_reader_build_cue_index: vod_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	header->magic = CUE_INDEX_MAGIC;
+	header->count = state->cue_points.nelts;
+	vod_memcpy(header + 1, state->cue_points.elts, sizeof(mkv_cue_point_t) * state->cue_points.nelts);
+
+	state->sections[SECTION_CUES].data = (u_char*)header;
+	state->sections[SECTION_CUES].len = size;
+
+	return VOD_OK;
+}
+
+static vod_status_t
+mkv_metadata_reader_finalize(
+	mkv_metadata_reader_state_t* state,
+	media_format_read_metadata_result_t* result)
+{
+	vod_status_t rc;
+
+	rc = mkv_metadata_reader_build_cue_index(state);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	state->sections[SECTION_LAYOUT].data = (u_char*)&state->layout.base;
+	state->sections[SECTION_LAYOUT].len = sizeof(state->layout.base);
+
+	result->parts = state->sections;
+	result->part_count = SECTION_COUNT;
+
+	return VOD_OK;
+}
+
 static vod_status_t
 mkv_metadata_reader_read(
 	void* ctx,
@@ -508,6 +891,17 @@ mkv_metadata_reader_read(
 	u_char* start_pos;
 	int initial_section = state->section;
 
+	if (state->state == MRS_SCAN_CLUSTERS)
+	{
+		rc = mkv_metadata_reader_scan_clusters(state, offset, buffer, result);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+
+		return mkv_metadata_reader_finalize(state, result);
+	}
+
 	// get the file layout
 	if (state->state == MRS_INITIAL)
 	{
@@ -516,11 +910,18 @@ mkv_metadata_reader_read(
 		{
 			return rc;
 		}
+
+		if (vod_array_init(&state->cue_points, state->request_context->pool, 256, sizeof(mkv_cue_point_t)) != VOD_OK)
+		{
+			vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+				"mkv_metadata_reader_read: vod_array_init failed");
+			return VOD_ALLOC_FAILED;
+		}
 	}
 
 	result->read_req.flags = 0;
 
-	for (; state->section < SECTION_FILE_COUNT; state->section++)
+	for (; state->section < state->layout.section_count; state->section++)
 	{
 		position = state->layout.positions + state->section;
 
@@ -609,13 +1010,30 @@ mkv_metadata_reader_read(
 		result->read_req.flags = MEDIA_READ_FLAG_REALLOC_BUFFER;
 	}
 
-	state->sections[SECTION_LAYOUT].data = (u_char*)&state->layout.base;
-	state->sections[SECTION_LAYOUT].len = sizeof(state->layout.base);
+	if (state->layout.section_count < SECTION_FILE_COUNT)
+	{
+		rc = mkv_metadata_reader_start_scan(state);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
 
-	result->parts = state->sections;
-	result->part_count = SECTION_COUNT;
+		rc = mkv_metadata_reader_scan_clusters(state, offset, buffer, result);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+	}
+	else
+	{
+		rc = mkv_metadata_reader_parse_cues(state);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+	}
 
-	return VOD_OK;
+	return mkv_metadata_reader_finalize(state, result);
 }
 
 static vod_status_t
@@ -626,6 +1044,7 @@ mkv_metadata_parse(
 	size_t metadata_part_count,
 	media_base_metadata_t** result)
 {
+	mkv_cue_index_header_t* cue_index;
 	mkv_base_metadata_t* metadata;
 	const mkv_codec_type_t* cur_codec;
 	media_sequence_t* sequence;
@@ -910,14 +1329,51 @@ mkv_metadata_parse(
 		return VOD_UNEXPECTED;
 	}
 
+	cue_index = (mkv_cue_index_header_t*)metadata_parts[SECTION_CUES].data;
+	if (metadata_parts[SECTION_CUES].len < sizeof(*cue_index) ||
+		cue_index->magic != CUE_INDEX_MAGIC ||
+		metadata_parts[SECTION_CUES].len != sizeof(*cue_index) + sizeof(mkv_cue_point_t) * cue_index->count)
+	{
+		// Note: metadata that was cached by a version that saved the raw cues element,
+		//		returning not found so that the caller will handle it as a cache miss
+		vod_log_error(VOD_LOG_WARN, request_context->log, 0,
+			"mkv_metadata_parse: unsupported cue index format, size %uz", metadata_parts[SECTION_CUES].len);
+		return VOD_NOT_FOUND;
+	}
+
 	metadata->base.timescale = timescale;
 	metadata->base.duration = info.duration;
-	metadata->cues = metadata_parts[SECTION_CUES];
+	metadata->cue_points = (mkv_cue_point_t*)(cue_index + 1);
+	metadata->cue_count = cue_index->count;
 	metadata->base_layout = *(mkv_base_layout_t*)metadata_parts[SECTION_LAYOUT].data;
 	*result = &metadata->base;
 	return VOD_OK;
 }
 
+// returns the index of the first cue point whose time is greater than or equal to the given time
+static uint32_t
+mkv_find_cue_point(mkv_base_metadata_t* metadata, uint64_t time)
+{
+	uint32_t left = 0;
+	uint32_t right = metadata->cue_count;
+	uint32_t mid;
+
+	while (left < right)
+	{
+		mid = (left + right) >> 1;
+		if (metadata->cue_points[mid].time < time)
+		{
+			left = mid + 1;
+		}
+		else
+		{
+			right = mid;
+		}
+	}
+
+	return left;
+}
+
 static vod_status_t
 mkv_get_read_frames_request(
 	request_context_t* request_context,
@@ -925,12 +1381,11 @@ mkv_get_read_frames_request(
 	uint32_t end_margin,
 	media_format_read_request_t* read_req)
 {
-	ebml_context_t context;
-	uint64_t prev_cluster_pos;
+	uint64_t start_pos;
+	uint64_t end_pos;
 	uint64_t end_time;
-	mkv_index_t index;
-	vod_status_t rc;
-	bool_t done = FALSE;
+	uint32_t start_index;
+	uint32_t end_index;
 
 	// Note: adding a second to the end time, to make sure we get a frame following the last frame
 	//	this is required since there is no duration per frame
@@ -939,62 +1394,44 @@ mkv_get_read_frames_request(
 	read_req->read_offset = ULLONG_MAX;
 	read_req->flags = 0;
 
-	prev_cluster_pos = ULLONG_MAX;
-
-	context.request_context = request_context;
-	context.cur_pos = metadata->cues.data;
-	context.end_pos = context.cur_pos + metadata->cues.len;
+	// the end is the first cue at or after the end time, or the end of the segment if there is none
+	end_index = mkv_find_cue_point(metadata, end_time);
 
-	for (;;)
+	// the start is the cue preceding the first cue after the start time
+	// Note: the end of the segment acts as a cue at the file duration
+	start_index = mkv_find_cue_point(metadata, metadata->start_time + 1);
+	if (start_index <= 0)
 	{
-		if (context.cur_pos < context.end_pos)
-		{
-			rc = ebml_parse_single(&context, mkv_spec_index, &index);
-			if (rc != VOD_OK)
-			{
-				vod_log_debug1(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
-					"mkv_get_read_frames_request: ebml_parse_single failed %i", rc);
-				return rc;
-			}
-		}
-		else
-		{
-			index.time = metadata->base.duration;
-			index.cluster_pos = metadata->base_layout.segment_size;
-			done = TRUE;
-		}
-
-		if (read_req->read_offset == ULLONG_MAX &&
-			metadata->start_time < index.time &&
-			prev_cluster_pos != ULLONG_MAX)
-		{
-			read_req->read_offset = prev_cluster_pos;
-		}
-
-		if (end_time <= index.time || done)
-		{
-			break;
-		}
-
-		prev_cluster_pos = index.cluster_pos;
+		start_index = 1;
 	}
 
-	if (read_req->read_offset == ULLONG_MAX)
+	if (start_index > end_index ||
+		(start_index >= metadata->cue_count && metadata->start_time >= metadata->base.duration))
 	{
 		// no frames
 		return VOD_OK;
 	}
 
-	if (index.cluster_pos <= read_req->read_offset)
+	start_pos = metadata->cue_points[start_index - 1].cluster_pos;
+	if (end_index < metadata->cue_count)
+	{
+		end_pos = metadata->cue_points[end_index].cluster_pos;
+	}
+	else
+	{
+		end_pos = metadata->base_layout.segment_size;
+	}
+
+	if (end_pos <= start_pos)
 	{
 		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
 			"mkv_get_read_frames_request: end cue pos %uL is less than start cue pos %uL",
-			index.cluster_pos, read_req->read_offset);
+			end_pos, start_pos);
 		return VOD_BAD_DATA;
 	}
 
-	read_req->read_size = index.cluster_pos - read_req->read_offset;
-	read_req->read_offset += metadata->base_layout.position_reference;
+	read_req->read_offset = start_pos + metadata->base_layout.position_reference;
+	read_req->read_size = end_pos - start_pos;
 
 	return VOD_AGAIN;
 }
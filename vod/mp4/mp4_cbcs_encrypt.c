@@ -704,6 +704,7 @@ mp4_cbcs_encrypt_video_get_fragment_writer(
 
 	segment_writer->write_tail = mp4_cbcs_encrypt_video_write_buffer;
 	segment_writer->write_head = NULL;
+	segment_writer->write_file_range = NULL;
 	segment_writer->context = stream_state;
 
 	// init writing for the first track
@@ -832,6 +833,7 @@ mp4_cbcs_encrypt_audio_get_fragment_writer(
 
 	segment_writer->write_tail = mp4_cbcs_encrypt_audio_write_buffer;
 	segment_writer->write_head = NULL;
+	segment_writer->write_file_range = NULL;
 	segment_writer->context = stream_state;
 
 	if (!mp4_cbcs_encrypt_move_to_next_frame(stream_state, NULL))
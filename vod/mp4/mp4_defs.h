@@ -48,6 +48,14 @@
 #define ATOM_NAME_DCOM (0x6d6f6364)		// data compression
 #define ATOM_NAME_CMVD (0x64766d63)		// compressed movie data
 #define ATOM_NAME_DOPS (0x73704f64)
+#define ATOM_NAME_MVEX (0x7865766d)		// movie extends
+#define ATOM_NAME_TREX (0x78657274)		// track extends
+#define ATOM_NAME_SIDX (0x78646973)		// segment index
+#define ATOM_NAME_MOOF (0x666f6f6d)		// movie fragment
+#define ATOM_NAME_TRAF (0x66617274)		// track fragment
+#define ATOM_NAME_TFHD (0x64686674)		// track fragment header
+#define ATOM_NAME_TFDT (0x74646674)		// track fragment decode time
+#define ATOM_NAME_TRUN (0x6e757274)		// track fragment run
 
 #define ATOM_NAME_NULL (0x00000000)
 
@@ -1,6 +1,8 @@
 #include "mp4_format.h"
 #include "mp4_parser.h"
 #include "mp4_clipper.h"
+#include "mp4_frame_index.h"
+#include "mp4_fragmented_reader.h"
 
 // constants
 #define MAX_MOOV_START_READS (4)		// maximum number of attempts to find the moov atom start for non-fast-start files
@@ -9,6 +11,7 @@
 enum {
 	STATE_READ_MOOV_HEADER,
 	STATE_READ_MOOV_DATA,
+	STATE_READ_FRAGMENTS,
 };
 
 // typedefs
@@ -17,6 +20,7 @@ typedef struct {
 	size_t max_moov_size;
 	int moov_start_reads;
 	int state;
+	void* fragmented_reader;
 	vod_str_t parts[MP4_METADATA_PART_COUNT];
 } mp4_read_metadata_state_t;
 
@@ -72,11 +76,52 @@ mp4_metadata_reader_init(
 	state->moov_start_reads = MAX_MOOV_START_READS;
 	state->max_moov_size = max_metadata_size;
 	state->state = STATE_READ_MOOV_HEADER;
+	state->fragmented_reader = NULL;
 	state->parts[MP4_METADATA_PART_FTYP].len = 0;
 	*ctx = state;
 	return VOD_OK;
 }
 
+static vod_status_t
+mp4_metadata_reader_read_fragments(
+	mp4_read_metadata_state_t* state,
+	uint64_t offset,
+	vod_str_t* buffer,
+	media_format_read_metadata_result_t* result)
+{
+	vod_status_t rc;
+
+	rc = mp4_fragmented_reader_read(
+		state->fragmented_reader,
+		offset,
+		buffer,
+		&result->read_req);
+	if (rc != VOD_OK)
+	{
+		if (rc != VOD_AGAIN)
+		{
+			vod_log_debug1(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+				"mp4_metadata_reader_read_fragments: mp4_fragmented_reader_read failed %i", rc);
+		}
+		return rc;
+	}
+
+	rc = mp4_fragmented_reader_build_moov(
+		state->fragmented_reader,
+		&state->parts[MP4_METADATA_PART_MOOV]);
+	if (rc != VOD_OK)
+	{
+		vod_log_debug1(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+			"mp4_metadata_reader_read_fragments: mp4_fragmented_reader_build_moov failed %i", rc);
+		return rc;
+	}
+
+	result->parts = state->parts;
+	result->part_count = MP4_METADATA_PART_COUNT;
+
+	return VOD_OK;
+}
+
 static vod_status_t
 mp4_metadata_reader_read(
 	void* ctx,
@@ -88,10 +133,16 @@ mp4_metadata_reader_read(
 	const u_char* ftyp_ptr;
 	size_t ftyp_size;
 	u_char* uncomp_buffer;
+	uint64_t moov_end_offset;
 	off_t moov_offset;
 	size_t moov_size;
 	vod_status_t rc;
 
+	if (state->state == STATE_READ_FRAGMENTS)
+	{
+		return mp4_metadata_reader_read_fragments(state, offset, buffer, result);
+	}
+
 	if (state->state == STATE_READ_MOOV_DATA)
 	{
 		// make sure we got the whole moov atom
@@ -218,6 +269,7 @@ mp4_metadata_reader_read(
 done:
 
 	state->parts[MP4_METADATA_PART_MOOV].data = buffer->data + moov_offset;
+	moov_end_offset = offset + moov_offset + moov_size;
 
 	// uncompress the moov atom if needed
 	rc = mp4_parser_uncompress_moov(
@@ -241,12 +293,45 @@ done:
 		state->parts[MP4_METADATA_PART_MOOV].len = moov_size;
 	}
 
+	// fragmented files - build the sample tables from the moof atoms that follow the moov
+	rc = mp4_fragmented_reader_init(
+		state->request_context,
+		&state->parts[MP4_METADATA_PART_MOOV],
+		moov_end_offset,
+		state->max_moov_size,
+		&state->fragmented_reader);
+	if (rc != VOD_OK)
+	{
+		vod_log_debug1(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+			"mp4_metadata_reader_read: mp4_fragmented_reader_init failed %i", rc);
+		return rc;
+	}
+
+	if (state->fragmented_reader != NULL)
+	{
+		state->state = STATE_READ_FRAGMENTS;
+		return mp4_metadata_reader_read_fragments(state, offset, buffer, result);
+	}
+
 	result->parts = state->parts;
 	result->part_count = MP4_METADATA_PART_COUNT;
 
 	return VOD_OK;
 }
 
+static vod_status_t
+mp4_metadata_build_index(
+	request_context_t* request_context,
+	vod_str_t* metadata_parts,
+	size_t metadata_part_count,
+	vod_str_t* result)
+{
+	return mp4_frame_index_build(
+		request_context,
+		&metadata_parts[MP4_METADATA_PART_MOOV],
+		result);
+}
+
 media_format_t mp4_format = {
 	FORMAT_ID_MP4,
 	vod_string("mp4"),
@@ -256,4 +341,5 @@ media_format_t mp4_format = {
 	mp4_clipper_build_header,
 	mp4_parser_parse_basic_metadata,
 	mp4_parser_parse_frames,
+	mp4_metadata_build_index,
 };
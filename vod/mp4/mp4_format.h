@@ -11,6 +11,9 @@ enum {
 	MP4_METADATA_PART_COUNT
 };
 
+// Note: the frame index part is optional, it is added only when the metadata is saved to cache
+#define MP4_METADATA_PART_FRAME_INDEX (MP4_METADATA_PART_COUNT)
+
 // globals
 extern media_format_t mp4_format;
 
@@ -1,5 +1,6 @@
 #include "mp4_fragment.h"
 #include "mp4_defs.h"
+#include "../input/frames_source_cache.h"
 
 // content types
 static u_char mp4_video_content_type[] = "video/mp4";
@@ -219,6 +220,7 @@ mp4_fragment_frame_writer_init(
 	request_context_t* request_context,
 	media_sequence_t* sequence,
 	write_callback_t write_callback,
+	write_file_range_callback_t write_file_range,
 	void* write_context, 
 	bool_t reuse_buffers,
 	fragment_writer_state_t** result)
@@ -235,6 +237,7 @@ mp4_fragment_frame_writer_init(
 
 	state->request_context = request_context;
 	state->write_callback = write_callback;
+	state->write_file_range = write_file_range;
 	state->write_context = write_context;
 	state->reuse_buffers = reuse_buffers;
 	state->frame_started = FALSE;
@@ -272,6 +275,72 @@ mp4_fragment_move_to_next_frame(fragment_writer_state_t* state)
 	return TRUE;
 }
 
+static vod_status_t
+mp4_fragment_write_file_ranges(fragment_writer_state_t* state, bool_t* done)
+{
+	input_frame_t* last_frame;
+	void* range_source = NULL;
+	void* source;
+	uint64_t range_start = 0;
+	uint64_t range_end = 0;
+	vod_status_t rc;
+
+	*done = FALSE;
+
+	for (;;)
+	{
+		if (state->cur_frame < state->cur_frame_part.last_frame)
+		{
+			source = get_frame_part_source_clip(state->cur_frame_part);
+			if (source == NULL)
+			{
+				break;		// the frames are not read from a file, use the read path
+			}
+
+			// merge frames that are contiguous in the source file
+			last_frame = state->cur_frame_part.last_frame;
+			for (; state->cur_frame < last_frame; state->cur_frame++)
+			{
+				if (source == range_source && state->cur_frame->offset == range_end)
+				{
+					range_end += state->cur_frame->size;
+					continue;
+				}
+
+				if (range_end > range_start)
+				{
+					rc = state->write_file_range(state->write_context, range_source, range_start, range_end - range_start);
+					if (rc != VOD_OK)
+					{
+						return rc;
+					}
+				}
+
+				range_source = source;
+				range_start = state->cur_frame->offset;
+				range_end = range_start + state->cur_frame->size;
+			}
+		}
+
+		if (!mp4_fragment_move_to_next_frame(state))
+		{
+			*done = TRUE;
+			break;
+		}
+	}
+
+	if (range_end > range_start)
+	{
+		rc = state->write_file_range(state->write_context, range_source, range_start, range_end - range_start);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+	}
+
+	return VOD_OK;
+}
+
 vod_status_t
 mp4_fragment_frame_writer_process(fragment_writer_state_t* state)
 {
@@ -282,6 +351,7 @@ mp4_fragment_frame_writer_process(fragment_writer_state_t* state)
 	vod_status_t rc;
 	bool_t processed_data = FALSE;
 	bool_t frame_done;
+	bool_t done;
 
 	if (!state->frame_started)
 	{
@@ -290,6 +360,16 @@ mp4_fragment_frame_writer_process(fragment_writer_state_t* state)
 			return VOD_OK;
 		}
 
+		if (state->write_file_range != NULL)
+		{
+			// output the frames as ranges of the source file, without reading them
+			rc = mp4_fragment_write_file_ranges(state, &done);
+			if (rc != VOD_OK || done)
+			{
+				return rc;
+			}
+		}
+
 		rc = state->cur_frame_part.frames_source->start_frame(state->cur_frame_part.frames_source_context, state->cur_frame, NULL);
 		if (rc != VOD_OK)
 		{
@@ -0,0 +1,1592 @@
+#include "mp4_fragmented_reader.h"
+#include "mp4_write_stream.h"
+#include "../read_stream.h"
+
+#include <limits.h>
+
+// Fragmented mp4 (CMAF) files have empty sample tables in the moov atom, the samples are described
+// by moof atoms that are interleaved with the media data. When the moov atom contains an mvex atom,
+// the metadata reader walks the top level atoms that follow it, parses the tfhd / tfdt / trun atoms
+// of every moof, and rebuilds the moov atom with regular stts / ctts / stsc / stsz / stco / stss
+// tables (each trun becomes a chunk). The rebuilt moov is what gets saved in the metadata cache, so
+// the moof atoms are read once per file, and segment requests read only the mdat ranges of the frames
+// they need, exactly like they do for non-fragmented files.
+// If the file has a segment index (sidx) that references several fragments, the scan stops at the
+// end of the indexed range, otherwise, it continues until the end of the file.
+// Limitations: encrypted fragments are not supported, the decode time of the first fragment of each
+// track is used only as the base of its timeline, gaps between fragments are added to the duration of
+// the preceding frame, and decode times that go backwards are ignored.
+
+// constants
+#define TFHD_FLAG_BASE_DATA_OFFSET			(0x000001)
+#define TFHD_FLAG_SAMPLE_DESC_INDEX			(0x000002)
+#define TFHD_FLAG_DEFAULT_SAMPLE_DURATION	(0x000008)
+#define TFHD_FLAG_DEFAULT_SAMPLE_SIZE		(0x000010)
+#define TFHD_FLAG_DEFAULT_SAMPLE_FLAGS		(0x000020)
+#define TFHD_FLAG_DEFAULT_BASE_IS_MOOF		(0x020000)
+
+#define TRUN_FLAG_DATA_OFFSET				(0x000001)
+#define TRUN_FLAG_FIRST_SAMPLE_FLAGS		(0x000004)
+#define TRUN_FLAG_SAMPLE_DURATION			(0x000100)
+#define TRUN_FLAG_SAMPLE_SIZE				(0x000200)
+#define TRUN_FLAG_SAMPLE_FLAGS				(0x000400)
+#define TRUN_FLAG_SAMPLE_CTS_OFFSET			(0x000800)
+
+#define SAMPLE_FLAG_NON_SYNC				(0x00010000)
+
+#define SIDX_REFERENCED_SIZE_MASK			(0x7fffffff)
+
+// typedefs
+typedef struct {
+	u_char version[1];
+	u_char flags[3];
+	u_char track_id[4];
+	u_char default_sample_description_index[4];
+	u_char default_sample_duration[4];
+	u_char default_sample_size[4];
+	u_char default_sample_flags[4];
+} trex_atom_t;
+
+typedef struct {
+	u_char version[1];
+	u_char flags[3];
+	u_char sample_count[4];
+} trun_header_t;
+
+typedef struct {
+	u_char version[1];
+	u_char flags[3];
+	u_char reference_id[4];
+	u_char timescale[4];
+} sidx_header_t;
+
+typedef struct {
+	u_char reserved[2];
+	u_char reference_count[2];
+} sidx_references_header_t;
+
+typedef struct {
+	u_char referenced_size[4];		// 1 bit reference type, 31 bit size
+	u_char subsegment_duration[4];
+	u_char sap[4];
+} sidx_reference_t;
+
+typedef struct {
+	uint32_t count;
+	uint32_t value;
+} fragmented_run_t;
+
+typedef struct {
+	uint64_t offset;
+	uint32_t sample_count;
+	uint32_t sample_desc;
+} fragmented_chunk_t;
+
+typedef struct {
+	atom_info_t tkhd;
+	atom_info_t mdhd;
+} fragmented_trak_atoms_t;
+
+typedef struct {
+	uint32_t track_id;
+	uint32_t timescale;
+	uint32_t default_sample_desc;
+	uint32_t default_sample_duration;
+	uint32_t default_sample_size;
+	uint32_t default_sample_flags;
+	uint64_t base_decode_time;		// decode time of the first fragment
+	uint64_t duration;
+	uint32_t sample_count;
+	bool_t has_ctts;
+	bool_t negative_ctts;
+	bool_t has_non_sync;
+	bool_t large_offsets;
+	vod_array_t stts;		// fragmented_run_t
+	vod_array_t ctts;		// fragmented_run_t, empty until the first non-zero offset
+	vod_array_t sizes;		// uint32_t
+	vod_array_t chunks;		// fragmented_chunk_t
+	vod_array_t sync;		// uint32_t, empty until the first non-sync sample
+} fragmented_track_t;
+
+typedef struct {
+	request_context_t* request_context;
+	vod_str_t moov;
+	size_t max_moov_size;
+	uint32_t movie_timescale;
+	atom_info_t mvex;
+	vod_array_t tracks;		// fragmented_track_t
+	uint64_t pos;
+	uint64_t end;
+	uint64_t read_size;		// size of the last read request, zero when reading the atom header
+	uint32_t moof_count;
+} mp4_fragmented_reader_state_t;
+
+typedef struct {
+	mp4_fragmented_reader_state_t* state;
+	uint64_t moof_offset;
+	uint64_t data_end;		// end of the data of the previous traf
+
+	// traf state
+	fragmented_track_t* track;
+	uint64_t base_data_offset;
+	uint64_t data_offset;
+	uint32_t sample_desc;
+	uint32_t default_sample_duration;
+	uint32_t default_sample_size;
+	uint32_t default_sample_flags;
+} fragmented_moof_context_t;
+
+typedef struct {
+	mp4_fragmented_reader_state_t* state;
+	fragmented_track_t* next_track;
+	fragmented_track_t* track;
+	uint64_t movie_duration;
+	u_char* p;
+} fragmented_write_context_t;
+
+// constants
+static const relevant_atom_t relevant_atoms_mdia[] = {
+	{ ATOM_NAME_MDHD, offsetof(fragmented_trak_atoms_t, mdhd), NULL },
+	{ ATOM_NAME_NULL, 0, NULL }
+};
+
+static const relevant_atom_t relevant_atoms_trak[] = {
+	{ ATOM_NAME_TKHD, offsetof(fragmented_trak_atoms_t, tkhd), NULL },
+	{ ATOM_NAME_MDIA, 0, relevant_atoms_mdia },
+	{ ATOM_NAME_NULL, 0, NULL }
+};
+
+static vod_status_t
+mp4_fragmented_reader_find_mvex_callback(void* context, atom_info_t* atom_info)
+{
+	if (atom_info->name != ATOM_NAME_MVEX)
+	{
+		return VOD_OK;
+	}
+
+	*(bool_t*)context = TRUE;
+	return VOD_NOT_FOUND;		// stop the iteration
+}
+
+static vod_status_t
+mp4_fragmented_reader_add_track(mp4_fragmented_reader_state_t* state, atom_info_t* atom_info)
+{
+	save_relevant_atoms_context_t save_atoms_context;
+	fragmented_trak_atoms_t trak_atoms;
+	fragmented_track_t* track;
+	vod_status_t rc;
+
+	vod_memzero(&trak_atoms, sizeof(trak_atoms));
+	save_atoms_context.relevant_atoms = relevant_atoms_trak;
+	save_atoms_context.result = &trak_atoms;
+	save_atoms_context.request_context = state->request_context;
+	rc = mp4_parser_parse_atoms(state->request_context, atom_info->ptr, atom_info->size, TRUE, &mp4_parser_save_relevant_atoms_callback, &save_atoms_context);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	track = vod_array_push(&state->tracks);
+	if (track == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+			"mp4_fragmented_reader_add_track: vod_array_push failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	vod_memzero(track, sizeof(*track));
+
+	if (trak_atoms.tkhd.size >= sizeof(tkhd64_atom_t) && trak_atoms.tkhd.ptr[0] == 1)
+	{
+		track->track_id = parse_be32(((const tkhd64_atom_t*)trak_atoms.tkhd.ptr)->track_id);
+	}
+	else if (trak_atoms.tkhd.size >= sizeof(tkhd_atom_t))
+	{
+		track->track_id = parse_be32(((const tkhd_atom_t*)trak_atoms.tkhd.ptr)->track_id);
+	}
+
+	if (trak_atoms.mdhd.size >= sizeof(mdhd64_atom_t) && trak_atoms.mdhd.ptr[0] == 1)
+	{
+		track->timescale = parse_be32(((const mdhd64_atom_t*)trak_atoms.mdhd.ptr)->timescale);
+	}
+	else if (trak_atoms.mdhd.size >= sizeof(mdhd_atom_t))
+	{
+		track->timescale = parse_be32(((const mdhd_atom_t*)trak_atoms.mdhd.ptr)->timescale);
+	}
+
+	track->default_sample_desc = 1;
+
+	if (vod_array_init(&track->stts, state->request_context->pool, 16, sizeof(fragmented_run_t)) != VOD_OK ||
+		vod_array_init(&track->ctts, state->request_context->pool, 16, sizeof(fragmented_run_t)) != VOD_OK ||
+		vod_array_init(&track->sizes, state->request_context->pool, 256, sizeof(uint32_t)) != VOD_OK ||
+		vod_array_init(&track->chunks, state->request_context->pool, 64, sizeof(fragmented_chunk_t)) != VOD_OK ||
+		vod_array_init(&track->sync, state->request_context->pool, 64, sizeof(uint32_t)) != VOD_OK)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+			"mp4_fragmented_reader_add_track: vod_array_init failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	return VOD_OK;
+}
+
+static fragmented_track_t*
+mp4_fragmented_reader_get_track(mp4_fragmented_reader_state_t* state, uint32_t track_id)
+{
+	fragmented_track_t* cur_track;
+	fragmented_track_t* last_track;
+
+	cur_track = state->tracks.elts;
+	last_track = cur_track + state->tracks.nelts;
+	for (; cur_track < last_track; cur_track++)
+	{
+		if (cur_track->track_id == track_id)
+		{
+			return cur_track;
+		}
+	}
+
+	return NULL;
+}
+
+static vod_status_t
+mp4_fragmented_reader_mvex_callback(void* ctx, atom_info_t* atom_info)
+{
+	mp4_fragmented_reader_state_t* state = ctx;
+	const trex_atom_t* atom = (const trex_atom_t*)atom_info->ptr;
+	fragmented_track_t* track;
+
+	if (atom_info->name != ATOM_NAME_TREX)
+	{
+		return VOD_OK;
+	}
+
+	if (atom_info->size < sizeof(*atom))
+	{
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"mp4_fragmented_reader_mvex_callback: trex atom size %uL too small", atom_info->size);
+		return VOD_BAD_DATA;
+	}
+
+	track = mp4_fragmented_reader_get_track(state, parse_be32(atom->track_id));
+	if (track == NULL)
+	{
+		return VOD_OK;
+	}
+
+	track->default_sample_desc = parse_be32(atom->default_sample_description_index);
+	track->default_sample_duration = parse_be32(atom->default_sample_duration);
+	track->default_sample_size = parse_be32(atom->default_sample_size);
+	track->default_sample_flags = parse_be32(atom->default_sample_flags);
+
+	return VOD_OK;
+}
+
+static vod_status_t
+mp4_fragmented_reader_moov_callback(void* ctx, atom_info_t* atom_info)
+{
+	mp4_fragmented_reader_state_t* state = ctx;
+
+	switch (atom_info->name)
+	{
+	case ATOM_NAME_MVHD:
+		if (atom_info->size >= sizeof(mvhd64_atom_t) && atom_info->ptr[0] == 1)
+		{
+			state->movie_timescale = parse_be32(((const mvhd64_atom_t*)atom_info->ptr)->timescale);
+		}
+		else if (atom_info->size >= sizeof(mvhd_atom_t))
+		{
+			state->movie_timescale = parse_be32(((const mvhd_atom_t*)atom_info->ptr)->timescale);
+		}
+		break;
+
+	case ATOM_NAME_TRAK:
+		return mp4_fragmented_reader_add_track(state, atom_info);
+
+	case ATOM_NAME_MVEX:
+		state->mvex = *atom_info;
+		break;
+	}
+
+	return VOD_OK;
+}
+
+vod_status_t
+mp4_fragmented_reader_init(
+	request_context_t* request_context,
+	vod_str_t* moov_atom,
+	uint64_t moov_end_offset,
+	size_t max_moov_size,
+	void** result)
+{
+	mp4_fragmented_reader_state_t* state;
+	bool_t mvex_found = FALSE;
+	vod_status_t rc;
+
+	mp4_parser_parse_atoms(
+		request_context,
+		moov_atom->data,
+		moov_atom->len,
+		TRUE,
+		mp4_fragmented_reader_find_mvex_callback,
+		&mvex_found);
+	if (!mvex_found)
+	{
+		*result = NULL;
+		return VOD_OK;
+	}
+
+	state = vod_alloc(request_context->pool, sizeof(*state));
+	if (state == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"mp4_fragmented_reader_init: vod_alloc failed (1)");
+		return VOD_ALLOC_FAILED;
+	}
+
+	vod_memzero(state, sizeof(*state));
+	state->request_context = request_context;
+	state->max_moov_size = max_moov_size;
+	state->pos = moov_end_offset;
+	state->end = ULLONG_MAX;
+
+	// the read buffer is reused by the reads that follow, copy the moov atom
+	state->moov.data = vod_alloc(request_context->pool, moov_atom->len);
+	if (state->moov.data == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"mp4_fragmented_reader_init: vod_alloc failed (2)");
+		return VOD_ALLOC_FAILED;
+	}
+
+	vod_memcpy(state->moov.data, moov_atom->data, moov_atom->len);
+	state->moov.len = moov_atom->len;
+
+	if (vod_array_init(&state->tracks, request_context->pool, 4, sizeof(fragmented_track_t)) != VOD_OK)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"mp4_fragmented_reader_init: vod_array_init failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	rc = mp4_parser_parse_atoms(
+		request_context,
+		state->moov.data,
+		state->moov.len,
+		TRUE,
+		mp4_fragmented_reader_moov_callback,
+		state);
+	if (rc != VOD_OK)
+	{
+		vod_log_debug1(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"mp4_fragmented_reader_init: mp4_parser_parse_atoms failed (1) %i", rc);
+		return rc;
+	}
+
+	// the mvex atom is parsed last, since it may precede the trak atoms
+	rc = mp4_parser_parse_atoms(
+		request_context,
+		state->mvex.ptr,
+		state->mvex.size,
+		TRUE,
+		mp4_fragmented_reader_mvex_callback,
+		state);
+	if (rc != VOD_OK)
+	{
+		vod_log_debug1(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"mp4_fragmented_reader_init: mp4_parser_parse_atoms failed (2) %i", rc);
+		return rc;
+	}
+
+	*result = state;
+	return VOD_OK;
+}
+
+static vod_status_t
+mp4_fragmented_reader_add_run(
+	request_context_t* request_context,
+	vod_array_t* runs,
+	uint32_t count,
+	uint32_t value)
+{
+	fragmented_run_t* run;
+
+	if (runs->nelts > 0)
+	{
+		run = (fragmented_run_t*)runs->elts + runs->nelts - 1;
+		if (run->value == value)
+		{
+			run->count += count;
+			return VOD_OK;
+		}
+	}
+
+	run = vod_array_push(runs);
+	if (run == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"mp4_fragmented_reader_add_run: vod_array_push failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	run->count = count;
+	run->value = value;
+	return VOD_OK;
+}
+
+static vod_status_t
+mp4_fragmented_reader_parse_tfhd(fragmented_moof_context_t* context, atom_info_t* atom_info)
+{
+	request_context_t* request_context = context->state->request_context;
+	const tfhd_atom_t* atom = (const tfhd_atom_t*)atom_info->ptr;
+	fragmented_track_t* track;
+	const u_char* cur_pos;
+	const u_char* end_pos;
+	uint32_t track_id;
+	uint32_t flags;
+
+	if (atom_info->size < sizeof(*atom))
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"mp4_fragmented_reader_parse_tfhd: atom size %uL too small (1)", atom_info->size);
+		return VOD_BAD_DATA;
+	}
+
+	flags = parse_be24(atom->flags);
+	track_id = parse_be32(atom->track_id);
+
+	cur_pos = atom_info->ptr + sizeof(*atom);
+	end_pos = atom_info->ptr + atom_info->size;
+
+	if ((size_t)(end_pos - cur_pos) <
+		((flags & TFHD_FLAG_BASE_DATA_OFFSET) ? sizeof(uint64_t) : 0) +
+		((flags & TFHD_FLAG_SAMPLE_DESC_INDEX) ? sizeof(uint32_t) : 0) +
+		((flags & TFHD_FLAG_DEFAULT_SAMPLE_DURATION) ? sizeof(uint32_t) : 0) +
+		((flags & TFHD_FLAG_DEFAULT_SAMPLE_SIZE) ? sizeof(uint32_t) : 0) +
+		((flags & TFHD_FLAG_DEFAULT_SAMPLE_FLAGS) ? sizeof(uint32_t) : 0))
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"mp4_fragmented_reader_parse_tfhd: atom size %uL too small (2)", atom_info->size);
+		return VOD_BAD_DATA;
+	}
+
+	track = mp4_fragmented_reader_get_track(context->state, track_id);
+	if (track == NULL)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"mp4_fragmented_reader_parse_tfhd: unknown track id %uD", track_id);
+		return VOD_BAD_DATA;
+	}
+
+	context->track = track;
+	context->sample_desc = track->default_sample_desc;
+	context->default_sample_duration = track->default_sample_duration;
+	context->default_sample_size = track->default_sample_size;
+	context->default_sample_flags = track->default_sample_flags;
+
+	if ((flags & TFHD_FLAG_BASE_DATA_OFFSET) != 0)
+	{
+		read_be64(cur_pos, context->base_data_offset);
+	}
+	else if ((flags & TFHD_FLAG_DEFAULT_BASE_IS_MOOF) != 0)
+	{
+		context->base_data_offset = context->moof_offset;
+	}
+	else
+	{
+		context->base_data_offset = context->data_end;
+	}
+
+	if ((flags & TFHD_FLAG_SAMPLE_DESC_INDEX) != 0)
+	{
+		read_be32(cur_pos, context->sample_desc);
+	}
+
+	if ((flags & TFHD_FLAG_DEFAULT_SAMPLE_DURATION) != 0)
+	{
+		read_be32(cur_pos, context->default_sample_duration);
+	}
+
+	if ((flags & TFHD_FLAG_DEFAULT_SAMPLE_SIZE) != 0)
+	{
+		read_be32(cur_pos, context->default_sample_size);
+	}
+
+	if ((flags & TFHD_FLAG_DEFAULT_SAMPLE_FLAGS) != 0)
+	{
+		read_be32(cur_pos, context->default_sample_flags);
+	}
+
+	context->data_offset = context->base_data_offset;
+
+	return VOD_OK;
+}
+
+static vod_status_t
+mp4_fragmented_reader_parse_tfdt(fragmented_moof_context_t* context, atom_info_t* atom_info)
+{
+	request_context_t* request_context = context->state->request_context;
+	const tfdt64_atom_t* atom64 = (const tfdt64_atom_t*)atom_info->ptr;
+	const tfdt_atom_t* atom = (const tfdt_atom_t*)atom_info->ptr;
+	fragmented_track_t* track = context->track;
+	fragmented_run_t* last_run;
+	uint64_t decode_time;
+	uint64_t gap;
+	uint32_t duration;
+
+	if (atom_info->size < sizeof(*atom))
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"mp4_fragmented_reader_parse_tfdt: atom size %uL too small (1)", atom_info->size);
+		return VOD_BAD_DATA;
+	}
+
+	if (atom->version[0] == 1)
+	{
+		if (atom_info->size < sizeof(*atom64))
+		{
+			vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+				"mp4_fragmented_reader_parse_tfdt: atom size %uL too small (2)", atom_info->size);
+			return VOD_BAD_DATA;
+		}
+
+		decode_time = parse_be64(atom64->earliest_pres_time);
+	}
+	else
+	{
+		decode_time = parse_be32(atom->earliest_pres_time);
+	}
+
+	if (track->sample_count <= 0)
+	{
+		// the timeline of the track starts at the first fragment
+		track->base_decode_time = decode_time;
+		return VOD_OK;
+	}
+
+	if (decode_time < track->base_decode_time)
+	{
+		vod_log_error(VOD_LOG_WARN, request_context->log, 0,
+			"mp4_fragmented_reader_parse_tfdt: ignoring decode time %uL of track %uD, smaller than the base %uL",
+			decode_time, track->track_id, track->base_decode_time);
+		return VOD_OK;
+	}
+
+	decode_time -= track->base_decode_time;
+	if (decode_time <= track->duration)
+	{
+		return VOD_OK;
+	}
+
+	// extend the last frame to cover the gap
+	gap = decode_time - track->duration;
+	last_run = (fragmented_run_t*)track->stts.elts + track->stts.nelts - 1;
+	if (gap > UINT_MAX - last_run->value)
+	{
+		return VOD_OK;
+	}
+
+	duration = last_run->value + gap;
+	track->duration += gap;
+
+	if (last_run->count <= 1)
+	{
+		last_run->value = duration;
+		return VOD_OK;
+	}
+
+	last_run->count--;
+
+	last_run = vod_array_push(&track->stts);
+	if (last_run == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"mp4_fragmented_reader_parse_tfdt: vod_array_push failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	last_run->count = 1;
+	last_run->value = duration;
+
+	return VOD_OK;
+}
+
+static vod_status_t
+mp4_fragmented_reader_parse_trun(fragmented_moof_context_t* context, atom_info_t* atom_info)
+{
+	request_context_t* request_context = context->state->request_context;
+	const trun_header_t* atom = (const trun_header_t*)atom_info->ptr;
+	fragmented_track_t* track = context->track;
+	fragmented_chunk_t* chunk;
+	const u_char* cur_pos;
+	const u_char* end_pos;
+	uint32_t first_sample_flags = 0;
+	uint32_t sample_field_size;
+	uint32_t sample_count;
+	uint32_t sample_flags;
+	uint32_t cts_offset;
+	uint32_t duration;
+	uint32_t* sizes;
+	uint32_t sync_index;
+	uint32_t* sync;
+	uint32_t flags;
+	uint32_t i;
+	vod_status_t rc;
+
+	if (atom_info->size < sizeof(*atom))
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"mp4_fragmented_reader_parse_trun: atom size %uL too small (1)", atom_info->size);
+		return VOD_BAD_DATA;
+	}
+
+	flags = parse_be24(atom->flags);
+	sample_count = parse_be32(atom->sample_count);
+
+	cur_pos = atom_info->ptr + sizeof(*atom);
+	end_pos = atom_info->ptr + atom_info->size;
+
+	if ((size_t)(end_pos - cur_pos) <
+		((flags & TRUN_FLAG_DATA_OFFSET) ? sizeof(uint32_t) : 0) +
+		((flags & TRUN_FLAG_FIRST_SAMPLE_FLAGS) ? sizeof(uint32_t) : 0))
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"mp4_fragmented_reader_parse_trun: atom size %uL too small (2)", atom_info->size);
+		return VOD_BAD_DATA;
+	}
+
+	if ((flags & TRUN_FLAG_DATA_OFFSET) != 0)
+	{
+		context->data_offset = context->base_data_offset + (int32_t)parse_be32(cur_pos);
+		cur_pos += sizeof(uint32_t);
+	}
+
+	if ((flags & TRUN_FLAG_FIRST_SAMPLE_FLAGS) != 0)
+	{
+		read_be32(cur_pos, first_sample_flags);
+	}
+
+	sample_field_size =
+		((flags & TRUN_FLAG_SAMPLE_DURATION) ? sizeof(uint32_t) : 0) +
+		((flags & TRUN_FLAG_SAMPLE_SIZE) ? sizeof(uint32_t) : 0) +
+		((flags & TRUN_FLAG_SAMPLE_FLAGS) ? sizeof(uint32_t) : 0) +
+		((flags & TRUN_FLAG_SAMPLE_CTS_OFFSET) ? sizeof(uint32_t) : 0);
+
+	if ((uint64_t)sample_count * sample_field_size > (uint64_t)(end_pos - cur_pos))
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"mp4_fragmented_reader_parse_trun: atom size %uL too small to hold %uD samples",
+			atom_info->size, sample_count);
+		return VOD_BAD_DATA;
+	}
+
+	if (sample_count <= 0)
+	{
+		return VOD_OK;
+	}
+
+	// Note: the sample count is bounded by the size of the stsz atom that will be built, since when 
+	//		the samples use the defaults, the trun atom does not need to grow with the sample count
+	if ((uint64_t)track->sample_count + sample_count > context->state->max_moov_size / sizeof(uint32_t))
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"mp4_fragmented_reader_parse_trun: sample count %uD too big", sample_count);
+		return VOD_BAD_DATA;
+	}
+
+	// every run is a chunk
+	chunk = vod_array_push(&track->chunks);
+	if (chunk == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"mp4_fragmented_reader_parse_trun: vod_array_push failed (1)");
+		return VOD_ALLOC_FAILED;
+	}
+
+	chunk->offset = context->data_offset;
+	chunk->sample_count = sample_count;
+	chunk->sample_desc = context->sample_desc;
+
+	if (chunk->offset > UINT_MAX)
+	{
+		track->large_offsets = TRUE;
+	}
+
+	sizes = vod_array_push_n(&track->sizes, sample_count);
+	if (sizes == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"mp4_fragmented_reader_parse_trun: vod_array_push_n failed (1)");
+		return VOD_ALLOC_FAILED;
+	}
+
+	for (i = 0; i < sample_count; i++)
+	{
+		duration = context->default_sample_duration;
+		if ((flags & TRUN_FLAG_SAMPLE_DURATION) != 0)
+		{
+			read_be32(cur_pos, duration);
+		}
+
+		sizes[i] = context->default_sample_size;
+		if ((flags & TRUN_FLAG_SAMPLE_SIZE) != 0)
+		{
+			read_be32(cur_pos, sizes[i]);
+		}
+
+		sample_flags = context->default_sample_flags;
+		if ((flags & TRUN_FLAG_SAMPLE_FLAGS) != 0)
+		{
+			read_be32(cur_pos, sample_flags);
+		}
+
+		if (i == 0 && (flags & TRUN_FLAG_FIRST_SAMPLE_FLAGS) != 0)
+		{
+			sample_flags = first_sample_flags;
+		}
+
+		cts_offset = 0;
+		if ((flags & TRUN_FLAG_SAMPLE_CTS_OFFSET) != 0)
+		{
+			read_be32(cur_pos, cts_offset);
+		}
+
+		// duration
+		rc = mp4_fragmented_reader_add_run(request_context, &track->stts, 1, duration);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+
+		track->duration += duration;
+
+		// composition time offset
+		if (cts_offset != 0 && !track->has_ctts)
+		{
+			track->has_ctts = TRUE;
+			if (track->sample_count > 0)
+			{
+				rc = mp4_fragmented_reader_add_run(request_context, &track->ctts, track->sample_count, 0);
+				if (rc != VOD_OK)
+				{
+					return rc;
+				}
+			}
+		}
+
+		if (track->has_ctts)
+		{
+			if (atom->version[0] == 1 && (int32_t)cts_offset < 0)
+			{
+				track->negative_ctts = TRUE;
+			}
+
+			rc = mp4_fragmented_reader_add_run(request_context, &track->ctts, 1, cts_offset);
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+		}
+
+		// key frames
+		track->sample_count++;
+
+		if ((sample_flags & SAMPLE_FLAG_NON_SYNC) != 0)
+		{
+			if (!track->has_non_sync)
+			{
+				track->has_non_sync = TRUE;
+
+				// all the preceding samples are sync samples
+				if (track->sample_count > 1)
+				{
+					sync = vod_array_push_n(&track->sync, track->sample_count - 1);
+					if (sync == NULL)
+					{
+						vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+							"mp4_fragmented_reader_parse_trun: vod_array_push_n failed (2)");
+						return VOD_ALLOC_FAILED;
+					}
+
+					for (sync_index = 1; sync_index < track->sample_count; sync_index++)
+					{
+						*sync++ = sync_index;
+					}
+				}
+			}
+		}
+		else if (track->has_non_sync)
+		{
+			sync = vod_array_push(&track->sync);
+			if (sync == NULL)
+			{
+				vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+					"mp4_fragmented_reader_parse_trun: vod_array_push failed (2)");
+				return VOD_ALLOC_FAILED;
+			}
+
+			*sync = track->sample_count;
+		}
+
+		context->data_offset += sizes[i];
+	}
+
+	return VOD_OK;
+}
+
+static vod_status_t
+mp4_fragmented_reader_traf_callback(void* ctx, atom_info_t* atom_info)
+{
+	fragmented_moof_context_t* context = ctx;
+
+	switch (atom_info->name)
+	{
+	case ATOM_NAME_TFHD:
+		return mp4_fragmented_reader_parse_tfhd(context, atom_info);
+
+	case ATOM_NAME_TFDT:
+	case ATOM_NAME_TRUN:
+		if (context->track == NULL)
+		{
+			vod_log_error(VOD_LOG_ERR, context->state->request_context->log, 0,
+				"mp4_fragmented_reader_traf_callback: %*s atom precedes the tfhd atom",
+				(size_t)sizeof(atom_info->name), (char*)&atom_info->name);
+			return VOD_BAD_DATA;
+		}
+
+		if (atom_info->name == ATOM_NAME_TFDT)
+		{
+			return mp4_fragmented_reader_parse_tfdt(context, atom_info);
+		}
+
+		return mp4_fragmented_reader_parse_trun(context, atom_info);
+
+	case ATOM_NAME_SENC:
+		vod_log_error(VOD_LOG_ERR, context->state->request_context->log, 0,
+			"mp4_fragmented_reader_traf_callback: encrypted fragments are not supported");
+		return VOD_BAD_DATA;
+	}
+
+	return VOD_OK;
+}
+
+static vod_status_t
+mp4_fragmented_reader_moof_callback(void* ctx, atom_info_t* atom_info)
+{
+	fragmented_moof_context_t* context = ctx;
+	vod_status_t rc;
+
+	if (atom_info->name != ATOM_NAME_TRAF)
+	{
+		return VOD_OK;
+	}
+
+	context->track = NULL;
+
+	rc = mp4_parser_parse_atoms(
+		context->state->request_context,
+		atom_info->ptr,
+		atom_info->size,
+		TRUE,
+		mp4_fragmented_reader_traf_callback,
+		context);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	if (context->track != NULL)
+	{
+		context->data_end = context->data_offset;
+	}
+
+	return VOD_OK;
+}
+
+static size_t
+mp4_fragmented_reader_get_tables_size(fragmented_track_t* track)
+{
+	size_t result;
+
+	result = sizeof(mdhd64_atom_t) - sizeof(mdhd_atom_t) +		// the mdhd atom may be upgraded to version 1
+		ATOM_HEADER_SIZE + sizeof(stts_atom_t) + track->stts.nelts * sizeof(stts_entry_t) +
+		ATOM_HEADER_SIZE + sizeof(stsc_atom_t) + track->chunks.nelts * sizeof(stsc_entry_t) +
+		ATOM_HEADER_SIZE + sizeof(stsz_atom_t) + track->sizes.nelts * sizeof(uint32_t) +
+		ATOM_HEADER_SIZE + sizeof(stco_atom_t) + track->chunks.nelts * (track->large_offsets ? sizeof(uint64_t) : sizeof(uint32_t));
+
+	if (track->has_ctts)
+	{
+		result += ATOM_HEADER_SIZE + sizeof(ctts_atom_t) + track->ctts.nelts * sizeof(ctts_entry_t);
+	}
+
+	if (track->has_non_sync)
+	{
+		result += ATOM_HEADER_SIZE + sizeof(stss_atom_t) + track->sync.nelts * sizeof(uint32_t);
+	}
+
+	return result;
+}
+
+static size_t
+mp4_fragmented_reader_get_moov_size(mp4_fragmented_reader_state_t* state)
+{
+	fragmented_track_t* cur_track;
+	fragmented_track_t* last_track;
+	size_t result = state->moov.len;
+
+	cur_track = state->tracks.elts;
+	last_track = cur_track + state->tracks.nelts;
+	for (; cur_track < last_track; cur_track++)
+	{
+		result += mp4_fragmented_reader_get_tables_size(cur_track);
+	}
+
+	return result;
+}
+
+static vod_status_t
+mp4_fragmented_reader_parse_moof(
+	mp4_fragmented_reader_state_t* state,
+	const u_char* buffer,
+	uint64_t size)
+{
+	fragmented_moof_context_t context;
+	size_t moov_size;
+	vod_status_t rc;
+
+	vod_memzero(&context, sizeof(context));
+	context.state = state;
+	context.moof_offset = state->pos;
+	context.data_end = state->pos;
+
+	rc = mp4_parser_parse_atoms(
+		state->request_context,
+		buffer,
+		size,
+		TRUE,
+		mp4_fragmented_reader_moof_callback,
+		&context);
+	if (rc != VOD_OK)
+	{
+		vod_log_debug1(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+			"mp4_fragmented_reader_parse_moof: mp4_parser_parse_atoms failed %i", rc);
+		return rc;
+	}
+
+	state->moof_count++;
+
+	moov_size = mp4_fragmented_reader_get_moov_size(state);
+	if (moov_size > state->max_moov_size)
+	{
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"mp4_fragmented_reader_parse_moof: moov size %uz exceeds the max %uz after %uD fragments",
+			moov_size, state->max_moov_size, state->moof_count);
+		return VOD_BAD_DATA;
+	}
+
+	return VOD_OK;
+}
+
+static vod_status_t
+mp4_fragmented_reader_parse_sidx(
+	mp4_fragmented_reader_state_t* state,
+	const u_char* buffer,
+	uint64_t size,
+	uint64_t atom_end)
+{
+	const sidx_references_header_t* references_header;
+	const sidx_reference_t* cur_reference;
+	const sidx_reference_t* last_reference;
+	const sidx_header_t* atom = (const sidx_header_t*)buffer;
+	const u_char* end_pos = buffer + size;
+	const u_char* cur_pos;
+	uint64_t first_offset;
+	uint64_t end;
+	uint16_t reference_count;
+
+	if (state->moof_count > 0)
+	{
+		return VOD_OK;		// index of a single fragment
+	}
+
+	if (size < sizeof(*atom))
+	{
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"mp4_fragmented_reader_parse_sidx: atom size %uL too small (1)", size);
+		return VOD_BAD_DATA;
+	}
+
+	cur_pos = buffer + sizeof(*atom);
+
+	if ((size_t)(end_pos - cur_pos) < (atom->version[0] == 1 ? 2 * sizeof(uint64_t) : 2 * sizeof(uint32_t)) + sizeof(*references_header))
+	{
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"mp4_fragmented_reader_parse_sidx: atom size %uL too small (2)", size);
+		return VOD_BAD_DATA;
+	}
+
+	if (atom->version[0] == 1)
+	{
+		cur_pos += sizeof(uint64_t);		// earliest presentation time
+		read_be64(cur_pos, first_offset);
+	}
+	else
+	{
+		cur_pos += sizeof(uint32_t);		// earliest presentation time
+		read_be32(cur_pos, first_offset);
+	}
+
+	references_header = (const sidx_references_header_t*)cur_pos;
+	reference_count = parse_be16(references_header->reference_count);
+	cur_pos += sizeof(*references_header);
+
+	if ((size_t)(end_pos - cur_pos) < reference_count * sizeof(*cur_reference))
+	{
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"mp4_fragmented_reader_parse_sidx: atom size %uL too small to hold %uD references", 
+			size, (uint32_t)reference_count);
+		return VOD_BAD_DATA;
+	}
+
+	if (reference_count <= 1)
+	{
+		return VOD_OK;		// index of a single fragment
+	}
+
+	// the indexed range starts first_offset bytes after the end of the sidx atom
+	end = atom_end + first_offset;
+
+	cur_reference = (const sidx_reference_t*)cur_pos;
+	last_reference = cur_reference + reference_count;
+	for (; cur_reference < last_reference; cur_reference++)
+	{
+		end += parse_be32(cur_reference->referenced_size) & SIDX_REFERENCED_SIZE_MASK;
+	}
+
+	if (state->end == ULLONG_MAX || end > state->end)
+	{
+		state->end = end;
+	}
+
+	return VOD_OK;
+}
+
+vod_status_t
+mp4_fragmented_reader_read(
+	void* ctx,
+	uint64_t offset,
+	vod_str_t* buffer,
+	media_format_read_request_t* read_req)
+{
+	mp4_fragmented_reader_state_t* state = ctx;
+	const u_char* cur_pos;
+	uint64_t atom_size;
+	uint32_t header_size;
+	uint32_t atom_name;
+	size_t left;
+	vod_status_t rc;
+
+	for (;;)
+	{
+		if (state->pos >= state->end)
+		{
+			return VOD_OK;
+		}
+
+		if (state->pos < offset || state->pos - offset >= buffer->len)
+		{
+			goto read_more;
+		}
+
+		cur_pos = buffer->data + (state->pos - offset);
+		left = buffer->len - (state->pos - offset);
+		if (left < ATOM_HEADER_SIZE)
+		{
+			goto read_more;
+		}
+
+		read_be32(cur_pos, atom_size);
+		read_le32(cur_pos, atom_name);
+		header_size = ATOM_HEADER_SIZE;
+
+		if (atom_size == 1)
+		{
+			if (left < ATOM_HEADER64_SIZE)
+			{
+				goto read_more;
+			}
+
+			read_be64(cur_pos, atom_size);
+			header_size = ATOM_HEADER64_SIZE;
+		}
+		else if (atom_size == 0)
+		{
+			return VOD_OK;		// the atom extends to the end of the file
+		}
+
+		if (atom_size < header_size)
+		{
+			vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+				"mp4_fragmented_reader_read: atom size %uL is less than the atom header size %uD at offset %uL",
+				atom_size, header_size, state->pos);
+			return VOD_BAD_DATA;
+		}
+
+		switch (atom_name)
+		{
+		case ATOM_NAME_MOOF:
+		case ATOM_NAME_SIDX:
+			if (atom_size > left)
+			{
+				if (atom_size > state->max_moov_size)
+				{
+					vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+						"mp4_fragmented_reader_read: %*s size %uL exceeds the max %uz",
+						(size_t)sizeof(atom_name), (char*)&atom_name, atom_size, state->max_moov_size);
+					return VOD_BAD_DATA;
+				}
+
+				if (state->pos == offset && state->read_size >= atom_size)
+				{
+					vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+						"mp4_fragmented_reader_read: %*s atom at offset %uL is truncated, size %uL, read %uz",
+						(size_t)sizeof(atom_name), (char*)&atom_name, state->pos, atom_size, left);
+					return VOD_BAD_DATA;
+				}
+
+				state->read_size = atom_size;
+
+				read_req->read_offset = state->pos;
+				read_req->read_size = atom_size;
+				read_req->flags = 0;
+				return VOD_AGAIN;
+			}
+
+			if (atom_name == ATOM_NAME_MOOF)
+			{
+				rc = mp4_fragmented_reader_parse_moof(state, cur_pos, atom_size - header_size);
+			}
+			else
+			{
+				rc = mp4_fragmented_reader_parse_sidx(state, cur_pos, atom_size - header_size, state->pos + atom_size);
+			}
+
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+			break;
+		}
+
+		state->pos += atom_size;
+	}
+
+read_more:
+
+	if (state->pos == offset)
+	{
+		// got less than an atom header at the requested offset - end of file
+		return VOD_OK;
+	}
+
+	state->read_size = 0;
+
+	read_req->read_offset = state->pos;
+	read_req->read_size = 0;
+	read_req->flags = MEDIA_READ_FLAG_ALLOW_EMPTY_READ;
+	return VOD_AGAIN;
+}
+
+static u_char*
+mp4_fragmented_reader_write_tables(fragmented_track_t* track, u_char* p)
+{
+	fragmented_chunk_t* first_chunk;
+	fragmented_chunk_t* last_chunk;
+	fragmented_chunk_t* cur_chunk;
+	fragmented_run_t* cur_run;
+	fragmented_run_t* last_run;
+	uint32_t* cur_value;
+	uint32_t* last_value;
+	uint32_t entries;
+	u_char* atom_start;
+
+	// stts
+	write_atom_header(p, ATOM_HEADER_SIZE + sizeof(stts_atom_t) + track->stts.nelts * sizeof(stts_entry_t), 's', 't', 't', 's');
+	write_be32(p, 0);		// version + flags
+	write_be32(p, track->stts.nelts);
+
+	cur_run = track->stts.elts;
+	last_run = cur_run + track->stts.nelts;
+	for (; cur_run < last_run; cur_run++)
+	{
+		write_be32(p, cur_run->count);
+		write_be32(p, cur_run->value);
+	}
+
+	// ctts
+	if (track->has_ctts)
+	{
+		write_atom_header(p, ATOM_HEADER_SIZE + sizeof(ctts_atom_t) + track->ctts.nelts * sizeof(ctts_entry_t), 'c', 't', 't', 's');
+		write_be32(p, track->negative_ctts ? 0x01000000 : 0);		// version + flags
+		write_be32(p, track->ctts.nelts);
+
+		cur_run = track->ctts.elts;
+		last_run = cur_run + track->ctts.nelts;
+		for (; cur_run < last_run; cur_run++)
+		{
+			write_be32(p, cur_run->count);
+			write_be32(p, cur_run->value);
+		}
+	}
+
+	// stsc
+	atom_start = p;
+	p += ATOM_HEADER_SIZE + sizeof(stsc_atom_t);
+
+	entries = 0;
+	first_chunk = track->chunks.elts;
+	last_chunk = first_chunk + track->chunks.nelts;
+	for (cur_chunk = first_chunk; cur_chunk < last_chunk; cur_chunk++)
+	{
+		if (cur_chunk > first_chunk &&
+			cur_chunk->sample_count == cur_chunk[-1].sample_count &&
+			cur_chunk->sample_desc == cur_chunk[-1].sample_desc)
+		{
+			continue;
+		}
+
+		write_be32(p, cur_chunk - first_chunk + 1);
+		write_be32(p, cur_chunk->sample_count);
+		write_be32(p, cur_chunk->sample_desc);
+		entries++;
+	}
+
+	write_atom_header(atom_start, ATOM_HEADER_SIZE + sizeof(stsc_atom_t) + entries * sizeof(stsc_entry_t), 's', 't', 's', 'c');
+	write_be32(atom_start, 0);		// version + flags
+	write_be32(atom_start, entries);
+
+	// stsz
+	write_atom_header(p, ATOM_HEADER_SIZE + sizeof(stsz_atom_t) + track->sizes.nelts * sizeof(uint32_t), 's', 't', 's', 'z');
+	write_be32(p, 0);		// version + flags
+	write_be32(p, 0);		// uniform size
+	write_be32(p, track->sizes.nelts);
+
+	cur_value = track->sizes.elts;
+	last_value = cur_value + track->sizes.nelts;
+	for (; cur_value < last_value; cur_value++)
+	{
+		write_be32(p, *cur_value);
+	}
+
+	// stco / co64
+	if (track->large_offsets)
+	{
+		write_atom_header(p, ATOM_HEADER_SIZE + sizeof(stco_atom_t) + track->chunks.nelts * sizeof(uint64_t), 'c', 'o', '6', '4');
+	}
+	else
+	{
+		write_atom_header(p, ATOM_HEADER_SIZE + sizeof(stco_atom_t) + track->chunks.nelts * sizeof(uint32_t), 's', 't', 'c', 'o');
+	}
+	write_be32(p, 0);		// version + flags
+	write_be32(p, track->chunks.nelts);
+
+	for (cur_chunk = first_chunk; cur_chunk < last_chunk; cur_chunk++)
+	{
+		if (track->large_offsets)
+		{
+			write_be64(p, cur_chunk->offset);
+		}
+		else
+		{
+			write_be32(p, cur_chunk->offset);
+		}
+	}
+
+	// stss
+	if (track->has_non_sync)
+	{
+		write_atom_header(p, ATOM_HEADER_SIZE + sizeof(stss_atom_t) + track->sync.nelts * sizeof(uint32_t), 's', 't', 's', 's');
+		write_be32(p, 0);		// version + flags
+		write_be32(p, track->sync.nelts);
+
+		cur_value = track->sync.elts;
+		last_value = cur_value + track->sync.nelts;
+		for (; cur_value < last_value; cur_value++)
+		{
+			write_be32(p, *cur_value);
+		}
+	}
+
+	return p;
+}
+
+static u_char*
+mp4_fragmented_reader_write_mdhd(fragmented_track_t* track, atom_info_t* atom_info, u_char* p)
+{
+	const mdhd_atom_t* atom = (const mdhd_atom_t*)atom_info->ptr;
+	u_char* atom_start = p;
+
+	if (atom_info->size < sizeof(mdhd_atom_t) ||
+		(atom->version[0] == 1 && atom_info->size < sizeof(mdhd64_atom_t)))
+	{
+		// invalid, will fail in trak parsing
+		return vod_copy(p, atom_info->ptr - atom_info->header_size, atom_info->header_size + atom_info->size);
+	}
+
+	if (atom->version[0] == 1)
+	{
+		p = vod_copy(p, atom_info->ptr - atom_info->header_size, atom_info->header_size + atom_info->size);
+		p = atom_start + atom_info->header_size + offsetof(mdhd64_atom_t, duration);
+		write_be64(p, track->duration);
+		return atom_start + atom_info->header_size + atom_info->size;
+	}
+
+	if (track->duration <= UINT_MAX)
+	{
+		p = vod_copy(p, atom_info->ptr - atom_info->header_size, atom_info->header_size + atom_info->size);
+		p = atom_start + atom_info->header_size + offsetof(mdhd_atom_t, duration);
+		write_be32(p, track->duration);
+		return atom_start + atom_info->header_size + atom_info->size;
+	}
+
+	// the duration does not fit in 32 bit, upgrade to version 1
+	write_atom_header(p, ATOM_HEADER_SIZE + sizeof(mdhd64_atom_t), 'm', 'd', 'h', 'd');
+	*p++ = 1;
+	p = vod_copy(p, atom->flags, sizeof(atom->flags));
+	write_be64(p, (uint64_t)parse_be32(atom->creation_time));
+	write_be64(p, (uint64_t)parse_be32(atom->modification_time));
+	p = vod_copy(p, atom->timescale, sizeof(atom->timescale));
+	write_be64(p, track->duration);
+	p = vod_copy(p, atom->language, sizeof(atom->language));
+	p = vod_copy(p, atom->quality, sizeof(atom->quality));
+	return p;
+}
+
+static void
+mp4_fragmented_reader_patch_duration(
+	atom_info_t* atom_info,
+	u_char* atom_start,
+	size_t duration_offset,
+	size_t duration64_offset,
+	size_t min_size,
+	size_t min_size64,
+	uint64_t duration)
+{
+	u_char* p = atom_start + atom_info->header_size;
+
+	if (atom_info->ptr[0] == 1)
+	{
+		if (atom_info->size >= min_size64)
+		{
+			p += duration64_offset;
+			write_be64(p, duration);
+		}
+	}
+	else if (atom_info->size >= min_size)
+	{
+		duration = vod_min(duration, UINT_MAX);
+		p += duration_offset;
+		write_be32(p, duration);
+	}
+}
+
+static vod_status_t
+mp4_fragmented_reader_write_atom(void* ctx, atom_info_t* atom_info)
+{
+	fragmented_write_context_t* context = ctx;
+	fragmented_track_t* track = context->track;
+	u_char* atom_start;
+	uint32_t atom_size;
+	vod_status_t rc;
+
+	switch (atom_info->name)
+	{
+	case ATOM_NAME_MVEX:
+		return VOD_OK;		// the samples are no longer fragmented
+
+	case ATOM_NAME_STTS:
+	case ATOM_NAME_CTTS:
+	case ATOM_NAME_STSC:
+	case ATOM_NAME_STSZ:
+	case ATOM_NAME_STZ2:
+	case ATOM_NAME_STCO:
+	case ATOM_NAME_CO64:
+	case ATOM_NAME_STSS:
+		if (track != NULL)
+		{
+			return VOD_OK;		// replaced by the tables built from the fragments
+		}
+		break;
+
+	case ATOM_NAME_TRAK:
+	case ATOM_NAME_MDIA:
+	case ATOM_NAME_MINF:
+	case ATOM_NAME_STBL:
+		if (atom_info->name == ATOM_NAME_TRAK)
+		{
+			track = context->track = context->next_track++;
+		}
+		else if (track == NULL)
+		{
+			break;
+		}
+
+		atom_start = context->p;
+		context->p += ATOM_HEADER_SIZE;
+
+		rc = mp4_parser_parse_atoms(
+			context->state->request_context,
+			atom_info->ptr,
+			atom_info->size,
+			TRUE,
+			mp4_fragmented_reader_write_atom,
+			context);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+
+		if (atom_info->name == ATOM_NAME_STBL)
+		{
+			context->p = mp4_fragmented_reader_write_tables(track, context->p);
+		}
+		else if (atom_info->name == ATOM_NAME_TRAK)
+		{
+			context->track = NULL;
+		}
+
+		atom_size = context->p - atom_start;
+		write_be32(atom_start, atom_size);
+		write_le32(atom_start, atom_info->name);
+		return VOD_OK;
+
+	case ATOM_NAME_MDHD:
+		if (track != NULL)
+		{
+			context->p = mp4_fragmented_reader_write_mdhd(track, atom_info, context->p);
+			return VOD_OK;
+		}
+		break;
+	}
+
+	// copy the atom as is
+	atom_start = context->p;
+	context->p = vod_copy(context->p, atom_info->ptr - atom_info->header_size, atom_info->header_size + atom_info->size);
+
+	switch (atom_info->name)
+	{
+	case ATOM_NAME_MVHD:
+		mp4_fragmented_reader_patch_duration(
+			atom_info,
+			atom_start,
+			offsetof(mvhd_atom_t, duration),
+			offsetof(mvhd64_atom_t, duration),
+			sizeof(mvhd_atom_t),
+			sizeof(mvhd64_atom_t),
+			context->movie_duration);
+		break;
+
+	case ATOM_NAME_TKHD:
+		if (track != NULL && track->timescale != 0)
+		{
+			mp4_fragmented_reader_patch_duration(
+				atom_info,
+				atom_start,
+				offsetof(tkhd_atom_t, duration),
+				offsetof(tkhd64_atom_t, duration),
+				sizeof(tkhd_atom_t),
+				sizeof(tkhd64_atom_t),
+				rescale_time(track->duration, track->timescale, context->state->movie_timescale));
+		}
+		break;
+	}
+
+	return VOD_OK;
+}
+
+vod_status_t
+mp4_fragmented_reader_build_moov(
+	void* ctx,
+	vod_str_t* result)
+{
+	mp4_fragmented_reader_state_t* state = ctx;
+	fragmented_write_context_t context;
+	fragmented_track_t* cur_track;
+	fragmented_track_t* last_track;
+	uint64_t track_duration;
+	uint64_t sample_count = 0;
+	size_t alloc_size;
+	u_char* buffer;
+	vod_status_t rc;
+
+	context.movie_duration = 0;
+
+	cur_track = state->tracks.elts;
+	last_track = cur_track + state->tracks.nelts;
+	for (; cur_track < last_track; cur_track++)
+	{
+		sample_count += cur_track->sample_count;
+
+		if (cur_track->timescale == 0)
+		{
+			continue;
+		}
+
+		track_duration = rescale_time(cur_track->duration, cur_track->timescale, state->movie_timescale);
+		context.movie_duration = vod_max(context.movie_duration, track_duration);
+	}
+
+	if (sample_count <= 0)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+			"mp4_fragmented_reader_build_moov: no fragments found, using the moov atom as is");
+		*result = state->moov;
+		return VOD_OK;
+	}
+
+	alloc_size = mp4_fragmented_reader_get_moov_size(state);
+
+	buffer = vod_alloc(state->request_context->pool, alloc_size);
+	if (buffer == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+			"mp4_fragmented_reader_build_moov: vod_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	context.state = state;
+	context.next_track = state->tracks.elts;
+	context.track = NULL;
+	context.p = buffer;
+
+	rc = mp4_parser_parse_atoms(
+		state->request_context,
+		state->moov.data,
+		state->moov.len,
+		TRUE,
+		mp4_fragmented_reader_write_atom,
+		&context);
+	if (rc != VOD_OK)
+	{
+		vod_log_debug1(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+			"mp4_fragmented_reader_build_moov: mp4_parser_parse_atoms failed %i", rc);
+		return rc;
+	}
+
+	if ((size_t)(context.p - buffer) > alloc_size)
+	{
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"mp4_fragmented_reader_build_moov: result length %uz exceeded allocated length %uz",
+			(size_t)(context.p - buffer), alloc_size);
+		return VOD_UNEXPECTED;
+	}
+
+	vod_log_debug3(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+		"mp4_fragmented_reader_build_moov: built a moov of size %uz from %uD fragments, %uL samples",
+		(size_t)(context.p - buffer), state->moof_count, sample_count);
+
+	result->data = buffer;
+	result->len = context.p - buffer;
+
+	return VOD_OK;
+}
@@ -0,0 +1,25 @@
+#ifndef __MP4_FRAGMENTED_READER_H__
+#define __MP4_FRAGMENTED_READER_H__
+
+// includes
+#include "mp4_parser_base.h"
+
+// functions
+vod_status_t mp4_fragmented_reader_init(
+	request_context_t* request_context,
+	vod_str_t* moov_atom,
+	uint64_t moov_end_offset,
+	size_t max_moov_size,
+	void** result);
+
+vod_status_t mp4_fragmented_reader_read(
+	void* ctx,
+	uint64_t offset,
+	vod_str_t* buffer,
+	media_format_read_request_t* read_req);
+
+vod_status_t mp4_fragmented_reader_build_moov(
+	void* ctx,
+	vod_str_t* result);
+
+#endif //__MP4_FRAGMENTED_READER_H__
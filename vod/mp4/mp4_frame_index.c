@@ -0,0 +1,588 @@
+#include "mp4_frame_index.h"
+#include "mp4_defs.h"
+#include "../read_stream.h"
+
+#include <limits.h>
+
+// The frame index holds, for every MP4_FRAME_INDEX_INTERVAL frames of a track, the position of the
+// stts / ctts / stsc entries that contain the frame. It is built once when the moov atom is read,
+// and saved in the metadata cache along with the moov atom, so that the frame parsers of subsequent
+// requests can resume from the nearest checkpoint instead of iterating the tables from the start.
+// The stsz / stco / stss tables are not indexed, since they are already accessed directly / using
+// binary search.
+//
+// Layout (native byte order, position independent):
+//	mp4_frame_index_header_t
+//	mp4_frame_index_track_header_t[track_count]
+//	mp4_frame_index_checkpoint_t[sum of checkpoint_count]
+
+// constants
+#define MP4_FRAME_INDEX_MAGIC (0x31786466)		// fdx1
+#define MP4_FRAME_INDEX_MAX_CHECKPOINTS (65536)
+
+// typedefs
+typedef struct {
+	uint32_t magic;
+	uint32_t interval;
+	uint32_t track_count;
+	uint32_t reserved;
+} mp4_frame_index_header_t;
+
+typedef struct {
+	uint32_t stts_offset;		// offset of the stts atom data relative to the moov atom, identifies the track
+	uint32_t checkpoint_count;
+} mp4_frame_index_track_header_t;
+
+typedef struct {
+	atom_info_t stts;
+	atom_info_t ctts;
+	atom_info_t stsc;
+} frame_index_trak_atoms_t;
+
+typedef struct {
+	request_context_t* request_context;
+	const u_char* moov_start;
+	vod_array_t tracks;			// mp4_frame_index_track_header_t
+	vod_array_t checkpoints;	// mp4_frame_index_checkpoint_t
+} frame_index_build_context_t;
+
+// constants
+static const relevant_atom_t relevant_atoms_stbl[] = {
+	{ ATOM_NAME_STTS, offsetof(frame_index_trak_atoms_t, stts), NULL },
+	{ ATOM_NAME_CTTS, offsetof(frame_index_trak_atoms_t, ctts), NULL },
+	{ ATOM_NAME_STSC, offsetof(frame_index_trak_atoms_t, stsc), NULL },
+	{ ATOM_NAME_NULL, 0, NULL }
+};
+
+static const relevant_atom_t relevant_atoms_minf[] = {
+	{ ATOM_NAME_STBL, 0, relevant_atoms_stbl },
+	{ ATOM_NAME_NULL, 0, NULL }
+};
+
+static const relevant_atom_t relevant_atoms_mdia[] = {
+	{ ATOM_NAME_MINF, 0, relevant_atoms_minf },
+	{ ATOM_NAME_NULL, 0, NULL }
+};
+
+static const relevant_atom_t relevant_atoms_trak[] = {
+	{ ATOM_NAME_MDIA, 0, relevant_atoms_mdia },
+	{ ATOM_NAME_NULL, 0, NULL }
+};
+
+static vod_status_t
+mp4_frame_index_build_stts(
+	frame_index_build_context_t* context,
+	atom_info_t* atom_info,
+	uint32_t* count)
+{
+	mp4_frame_index_checkpoint_t* checkpoint;
+	const stts_entry_t* first_entry;
+	const stts_entry_t* last_entry;
+	const stts_entry_t* cur_entry;
+	uint64_t accum_duration = 0;
+	uint64_t next_frame_index = 0;
+	uint64_t frame_index = 0;
+	uint32_t sample_count;
+	uint32_t entries;
+	vod_status_t rc;
+
+	*count = 0;
+
+	rc = mp4_parser_validate_stts_data(context->request_context, atom_info, &entries);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	first_entry = (const stts_entry_t*)(atom_info->ptr + sizeof(stts_atom_t));
+	last_entry = first_entry + entries;
+
+	for (cur_entry = first_entry; cur_entry < last_entry; cur_entry++)
+	{
+		sample_count = parse_be32(cur_entry->count);
+
+		for (; next_frame_index < frame_index + sample_count; next_frame_index += MP4_FRAME_INDEX_INTERVAL)
+		{
+			if (*count >= MP4_FRAME_INDEX_MAX_CHECKPOINTS)
+			{
+				return VOD_OK;
+			}
+
+			checkpoint = vod_array_push(&context->checkpoints);
+			if (checkpoint == NULL)
+			{
+				vod_log_debug0(VOD_LOG_DEBUG_LEVEL, context->request_context->log, 0,
+					"mp4_frame_index_build_stts: vod_array_push failed");
+				return VOD_ALLOC_FAILED;
+			}
+
+			vod_memzero(checkpoint, sizeof(*checkpoint));
+			checkpoint->stts_accum_duration = accum_duration;
+			checkpoint->stts_entry = cur_entry - first_entry;
+			checkpoint->stts_frame_index = frame_index;
+			(*count)++;
+		}
+
+		frame_index += sample_count;
+		if (frame_index > UINT_MAX)
+		{
+			break;
+		}
+
+		accum_duration += (uint64_t)parse_be32(cur_entry->duration) * sample_count;
+	}
+
+	return VOD_OK;
+}
+
+static void
+mp4_frame_index_build_ctts(
+	frame_index_build_context_t* context,
+	atom_info_t* atom_info,
+	mp4_frame_index_checkpoint_t* checkpoints,
+	uint32_t count)
+{
+	const ctts_entry_t* first_entry;
+	const ctts_entry_t* last_entry;
+	const ctts_entry_t* cur_entry;
+	uint64_t next_frame_index;
+	uint32_t frame_index = 0;
+	uint32_t dts_shift = 0;
+	uint32_t sample_count;
+	int32_t sample_duration;
+	uint32_t entries;
+	uint32_t i = 0;
+
+	if (atom_info->size == 0)		// optional atom
+	{
+		return;
+	}
+
+	if (mp4_parser_validate_ctts_atom(context->request_context, atom_info, &entries) != VOD_OK)
+	{
+		return;
+	}
+
+	first_entry = (const ctts_entry_t*)(atom_info->ptr + sizeof(ctts_atom_t));
+	last_entry = first_entry + entries;
+
+	for (cur_entry = first_entry; cur_entry < last_entry && i < count; cur_entry++)
+	{
+		sample_count = parse_be32(cur_entry->count);
+		next_frame_index = (uint64_t)frame_index + sample_count;
+
+		for (; i < count && (uint64_t)i * MP4_FRAME_INDEX_INTERVAL < next_frame_index; i++)
+		{
+			checkpoints[i].ctts_entry = cur_entry - first_entry;
+			checkpoints[i].ctts_frame_index = frame_index;
+			checkpoints[i].ctts_dts_shift = dts_shift;
+		}
+
+		if (next_frame_index > UINT_MAX)
+		{
+			break;
+		}
+
+		frame_index = next_frame_index;
+
+		sample_duration = parse_be32(cur_entry->duration);
+		if (sample_duration < 0 && (uint32_t)-sample_duration > dts_shift)
+		{
+			dts_shift = (uint32_t)-sample_duration;
+		}
+	}
+
+	// Note: a checkpoint that points to an earlier entry is still valid, it only saves less work
+	for (; i > 0 && i < count; i++)
+	{
+		checkpoints[i].ctts_entry = checkpoints[i - 1].ctts_entry;
+		checkpoints[i].ctts_frame_index = checkpoints[i - 1].ctts_frame_index;
+		checkpoints[i].ctts_dts_shift = checkpoints[i - 1].ctts_dts_shift;
+	}
+}
+
+static void
+mp4_frame_index_build_stsc(
+	frame_index_build_context_t* context,
+	atom_info_t* atom_info,
+	mp4_frame_index_checkpoint_t* checkpoints,
+	uint32_t count)
+{
+	const stsc_entry_t* first_entry;
+	const stsc_entry_t* last_entry;
+	const stsc_entry_t* cur_entry;
+	uint64_t next_frame_index;
+	uint32_t frame_index = 0;
+	uint32_t samples_per_chunk;
+	uint32_t cur_chunk;
+	uint32_t next_chunk;
+	uint32_t entries;
+	uint32_t i = 0;
+
+	if (mp4_parser_validate_stsc_atom(context->request_context, atom_info, &entries) != VOD_OK)
+	{
+		return;
+	}
+
+	first_entry = (const stsc_entry_t*)(atom_info->ptr + sizeof(stsc_atom_t));
+	last_entry = first_entry + entries;
+
+	if (first_entry >= last_entry || parse_be32(first_entry->first_chunk) != 1)
+	{
+		return;
+	}
+
+	for (cur_entry = first_entry; cur_entry < last_entry && i < count; cur_entry++)
+	{
+		if (cur_entry + 1 < last_entry)
+		{
+			cur_chunk = parse_be32(cur_entry->first_chunk);
+			next_chunk = parse_be32(cur_entry[1].first_chunk);
+			samples_per_chunk = parse_be32(cur_entry->samples_per_chunk);
+			if (next_chunk <= cur_chunk || samples_per_chunk == 0)
+			{
+				break;		// invalid, will fail in the frame parser
+			}
+
+			next_frame_index = frame_index + (uint64_t)(next_chunk - cur_chunk) * samples_per_chunk;
+		}
+		else
+		{
+			next_frame_index = ULLONG_MAX;
+		}
+
+		for (; i < count && (uint64_t)i * MP4_FRAME_INDEX_INTERVAL < next_frame_index; i++)
+		{
+			checkpoints[i].stsc_entry = cur_entry - first_entry;
+			checkpoints[i].stsc_frame_index = frame_index;
+		}
+
+		if (next_frame_index > UINT_MAX)
+		{
+			break;
+		}
+
+		frame_index = next_frame_index;
+	}
+
+	for (; i > 0 && i < count; i++)
+	{
+		checkpoints[i].stsc_entry = checkpoints[i - 1].stsc_entry;
+		checkpoints[i].stsc_frame_index = checkpoints[i - 1].stsc_frame_index;
+	}
+}
+
+static vod_status_t
+mp4_frame_index_process_moov_atom_callback(void* ctx, atom_info_t* atom_info)
+{
+	frame_index_build_context_t* context = (frame_index_build_context_t*)ctx;
+	save_relevant_atoms_context_t save_atoms_context;
+	mp4_frame_index_track_header_t* track;
+	mp4_frame_index_checkpoint_t* checkpoints;
+	frame_index_trak_atoms_t trak_atoms;
+	uint32_t first_checkpoint;
+	uint32_t count;
+	vod_status_t rc;
+
+	if (atom_info->name != ATOM_NAME_TRAK)
+	{
+		return VOD_OK;
+	}
+
+	// find required trak atoms
+	vod_memzero(&trak_atoms, sizeof(trak_atoms));
+	save_atoms_context.relevant_atoms = relevant_atoms_trak;
+	save_atoms_context.result = &trak_atoms;
+	save_atoms_context.request_context = context->request_context;
+	rc = mp4_parser_parse_atoms(context->request_context, atom_info->ptr, atom_info->size, TRUE, &mp4_parser_save_relevant_atoms_callback, &save_atoms_context);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	if (trak_atoms.stts.ptr == NULL)
+	{
+		return VOD_OK;
+	}
+
+	first_checkpoint = context->checkpoints.nelts;
+
+	rc = mp4_frame_index_build_stts(context, &trak_atoms.stts, &count);
+	switch (rc)
+	{
+	case VOD_OK:
+		break;
+
+	case VOD_BAD_DATA:
+		context->checkpoints.nelts = first_checkpoint;
+		return VOD_OK;		// skip the track, will fail in the frame parser
+
+	default:
+		return rc;
+	}
+
+	if (count < 2)
+	{
+		// nothing to skip
+		context->checkpoints.nelts = first_checkpoint;
+		return VOD_OK;
+	}
+
+	checkpoints = (mp4_frame_index_checkpoint_t*)context->checkpoints.elts + first_checkpoint;
+
+	mp4_frame_index_build_ctts(context, &trak_atoms.ctts, checkpoints, count);
+
+	mp4_frame_index_build_stsc(context, &trak_atoms.stsc, checkpoints, count);
+
+	track = vod_array_push(&context->tracks);
+	if (track == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, context->request_context->log, 0,
+			"mp4_frame_index_process_moov_atom_callback: vod_array_push failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	track->stts_offset = trak_atoms.stts.ptr - context->moov_start;
+	track->checkpoint_count = count;
+
+	return VOD_OK;
+}
+
+vod_status_t
+mp4_frame_index_build(
+	request_context_t* request_context,
+	vod_str_t* moov_atom,
+	vod_str_t* result)
+{
+	frame_index_build_context_t context;
+	mp4_frame_index_header_t* header;
+	size_t tracks_size;
+	size_t checkpoints_size;
+	vod_status_t rc;
+	u_char* p;
+
+	context.request_context = request_context;
+	context.moov_start = moov_atom->data;
+
+	if (vod_array_init(&context.tracks, request_context->pool, 2, sizeof(mp4_frame_index_track_header_t)) != VOD_OK ||
+		vod_array_init(&context.checkpoints, request_context->pool, 64, sizeof(mp4_frame_index_checkpoint_t)) != VOD_OK)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"mp4_frame_index_build: vod_array_init failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	rc = mp4_parser_parse_atoms(
+		request_context,
+		moov_atom->data,
+		moov_atom->len,
+		TRUE,
+		&mp4_frame_index_process_moov_atom_callback,
+		&context);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	if (context.tracks.nelts == 0)
+	{
+		result->data = NULL;
+		result->len = 0;
+		return VOD_OK;
+	}
+
+	tracks_size = context.tracks.nelts * sizeof(mp4_frame_index_track_header_t);
+	checkpoints_size = context.checkpoints.nelts * sizeof(mp4_frame_index_checkpoint_t);
+
+	result->len = sizeof(*header) + tracks_size + checkpoints_size;
+	result->data = vod_alloc(request_context->pool, result->len);
+	if (result->data == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"mp4_frame_index_build: vod_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	header = (mp4_frame_index_header_t*)result->data;
+	header->magic = MP4_FRAME_INDEX_MAGIC;
+	header->interval = MP4_FRAME_INDEX_INTERVAL;
+	header->track_count = context.tracks.nelts;
+	header->reserved = 0;
+
+	p = result->data + sizeof(*header);
+	p = vod_copy(p, context.tracks.elts, tracks_size);
+	vod_memcpy(p, context.checkpoints.elts, checkpoints_size);
+
+	vod_log_debug2(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+		"mp4_frame_index_build: built %uD checkpoints for %uD tracks",
+		(uint32_t)context.checkpoints.nelts, (uint32_t)context.tracks.nelts);
+
+	return VOD_OK;
+}
+
+vod_status_t
+mp4_frame_index_init(
+	request_context_t* request_context,
+	vod_str_t* buffer,
+	mp4_frame_index_t* result)
+{
+	const mp4_frame_index_track_header_t* cur_track;
+	const mp4_frame_index_track_header_t* last_track;
+	mp4_frame_index_header_t* header;
+	uint64_t checkpoint_count = 0;
+	size_t size;
+	u_char* data;
+
+	vod_memzero(result, sizeof(*result));
+
+	if (buffer->len == 0)
+	{
+		return VOD_OK;
+	}
+
+	if (buffer->len < sizeof(*header))
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"mp4_frame_index_init: buffer size %uz smaller than header size", buffer->len);
+		return VOD_BAD_DATA;
+	}
+
+	// Note: the index may not be aligned when returned from the cache
+	data = buffer->data;
+	if (((uintptr_t)data & (sizeof(uint64_t) - 1)) != 0)
+	{
+		data = vod_alloc(request_context->pool, buffer->len);
+		if (data == NULL)
+		{
+			vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+				"mp4_frame_index_init: vod_alloc failed");
+			return VOD_ALLOC_FAILED;
+		}
+
+		vod_memcpy(data, buffer->data, buffer->len);
+	}
+
+	header = (mp4_frame_index_header_t*)data;
+	if (header->magic != MP4_FRAME_INDEX_MAGIC || header->interval == 0)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"mp4_frame_index_init: invalid header");
+		return VOD_BAD_DATA;
+	}
+
+	size = buffer->len - sizeof(*header);
+	if (header->track_count > size / sizeof(*cur_track))
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"mp4_frame_index_init: size %uz too small to hold %uD tracks", buffer->len, header->track_count);
+		return VOD_BAD_DATA;
+	}
+
+	cur_track = (const mp4_frame_index_track_header_t*)(header + 1);
+	last_track = cur_track + header->track_count;
+	for (; cur_track < last_track; cur_track++)
+	{
+		checkpoint_count += cur_track->checkpoint_count;
+	}
+
+	size -= header->track_count * sizeof(*cur_track);
+	if (checkpoint_count > size / sizeof(mp4_frame_index_checkpoint_t))
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"mp4_frame_index_init: size %uz too small to hold %uL checkpoints", buffer->len, checkpoint_count);
+		return VOD_BAD_DATA;
+	}
+
+	result->tracks = (const u_char*)(header + 1);
+	result->checkpoints = (const mp4_frame_index_checkpoint_t*)last_track;
+	result->track_count = header->track_count;
+	result->interval = header->interval;
+
+	return VOD_OK;
+}
+
+void
+mp4_frame_index_get_track(
+	mp4_frame_index_t* index,
+	uint32_t stts_offset,
+	mp4_frame_index_track_t* result)
+{
+	const mp4_frame_index_track_header_t* cur_track;
+	const mp4_frame_index_track_header_t* last_track;
+	const mp4_frame_index_checkpoint_t* checkpoints;
+
+	cur_track = (const mp4_frame_index_track_header_t*)index->tracks;
+	last_track = cur_track + index->track_count;
+	checkpoints = index->checkpoints;
+
+	for (; cur_track < last_track; cur_track++)
+	{
+		if (cur_track->stts_offset == stts_offset)
+		{
+			result->first = checkpoints;
+			result->count = cur_track->checkpoint_count;
+			result->interval = index->interval;
+			return;
+		}
+
+		checkpoints += cur_track->checkpoint_count;
+	}
+
+	result->first = NULL;
+	result->count = 0;
+	result->interval = 0;
+}
+
+const mp4_frame_index_checkpoint_t*
+mp4_frame_index_find_by_frame(
+	mp4_frame_index_track_t* track,
+	uint32_t frame_index)
+{
+	uint32_t index;
+
+	if (track->count == 0)
+	{
+		return NULL;
+	}
+
+	index = frame_index / track->interval;
+	if (index >= track->count)
+	{
+		index = track->count - 1;
+	}
+
+	return track->first + index;
+}
+
+const mp4_frame_index_checkpoint_t*
+mp4_frame_index_find_by_time(
+	mp4_frame_index_track_t* track,
+	uint64_t accum_duration)
+{
+	uint32_t left;
+	uint32_t right;
+	uint32_t mid;
+
+	if (track->count == 0 || track->first[0].stts_accum_duration >= accum_duration)
+	{
+		return NULL;
+	}
+
+	// find the last checkpoint whose stts entry starts before the given time
+	left = 0;
+	right = track->count - 1;
+	while (left < right)
+	{
+		mid = (left + right + 1) / 2;
+		if (track->first[mid].stts_accum_duration < accum_duration)
+		{
+			left = mid;
+		}
+		else
+		{
+			right = mid - 1;
+		}
+	}
+
+	return track->first + left;
+}
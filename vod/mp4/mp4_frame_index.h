@@ -0,0 +1,60 @@
+#ifndef __MP4_FRAME_INDEX_H__
+#define __MP4_FRAME_INDEX_H__
+
+// includes
+#include "mp4_parser_base.h"
+
+// constants
+#define MP4_FRAME_INDEX_INTERVAL (1024)		// number of frames between checkpoints
+
+// typedefs
+typedef struct {
+	uint64_t stts_accum_duration;		// duration of the stts entries preceding stts_entry
+	uint32_t stts_entry;
+	uint32_t stts_frame_index;			// index of the first frame of stts_entry
+	uint32_t ctts_entry;
+	uint32_t ctts_frame_index;			// index of the first frame of ctts_entry
+	uint32_t ctts_dts_shift;			// dts shift implied by the ctts entries preceding ctts_entry
+	uint32_t stsc_entry;
+	uint32_t stsc_frame_index;			// index of the first frame of stsc_entry
+	uint32_t reserved;
+} mp4_frame_index_checkpoint_t;
+
+typedef struct {
+	const mp4_frame_index_checkpoint_t* first;
+	uint32_t count;
+	uint32_t interval;
+} mp4_frame_index_track_t;
+
+typedef struct {
+	const u_char* tracks;
+	const mp4_frame_index_checkpoint_t* checkpoints;
+	uint32_t track_count;
+	uint32_t interval;
+} mp4_frame_index_t;
+
+// functions
+vod_status_t mp4_frame_index_build(
+	request_context_t* request_context,
+	vod_str_t* moov_atom,
+	vod_str_t* result);
+
+vod_status_t mp4_frame_index_init(
+	request_context_t* request_context,
+	vod_str_t* buffer,
+	mp4_frame_index_t* result);
+
+void mp4_frame_index_get_track(
+	mp4_frame_index_t* index,
+	uint32_t stts_offset,
+	mp4_frame_index_track_t* result);
+
+const mp4_frame_index_checkpoint_t* mp4_frame_index_find_by_frame(
+	mp4_frame_index_track_t* track,
+	uint32_t frame_index);
+
+const mp4_frame_index_checkpoint_t* mp4_frame_index_find_by_time(
+	mp4_frame_index_track_t* track,
+	uint64_t accum_duration);
+
+#endif //__MP4_FRAME_INDEX_H__
@@ -13,6 +13,7 @@
 typedef struct {
 	// fixed
 	write_callback_t write_callback;
+	write_file_range_callback_t write_file_range;
 	void* write_context;
 	uint32_t timescale;
 	int media_type;
@@ -503,6 +504,7 @@ mp4_muxer_init_state(
 	{
 		cur_stream->index = index;
 		cur_stream->write_callback = track_writers->write_tail;
+		cur_stream->write_file_range = track_writers->write_file_range;
 		cur_stream->write_context = track_writers->context;
 		if (per_stream_writer)
 		{
@@ -799,10 +801,86 @@ mp4_muxer_start_frame(mp4_muxer_state_t* state)
 	return VOD_OK;
 }
 
+static vod_status_t
+mp4_muxer_write_file_ranges(mp4_muxer_state_t* state, bool_t* done)
+{
+	mp4_muxer_stream_state_t* selected_stream;
+	mp4_muxer_stream_state_t* last_stream = NULL;
+	void* range_source = NULL;
+	void* source;
+	uint64_t range_start = 0;
+	uint64_t range_end = 0;
+	vod_status_t rc;
+
+	*done = FALSE;
+
+	for (;;)
+	{
+		selected_stream = state->selected_stream;
+		if (selected_stream->write_file_range == NULL ||
+			state->frames_source != &frames_source_cache)
+		{
+			break;		// the frame is not read from a file, use the read path
+		}
+
+		source = ((frames_source_cache_state_t*)state->frames_source_context)->req.source;
+
+		// merge frames that are contiguous in the source file
+		if (source == range_source && 
+			state->cur_frame->offset == range_end &&
+			(last_stream == selected_stream || !state->per_stream_writer))
+		{
+			range_end += state->cur_frame->size;
+		}
+		else
+		{
+			if (range_end > range_start)
+			{
+				rc = last_stream->write_file_range(last_stream->write_context, range_source, range_start, range_end - range_start);
+				if (rc != VOD_OK)
+				{
+					return rc;
+				}
+			}
+
+			range_source = source;
+			range_start = state->cur_frame->offset;
+			range_end = range_start + state->cur_frame->size;
+			last_stream = selected_stream;
+		}
+
+		// start a new frame
+		rc = mp4_muxer_start_frame(state);
+		if (rc != VOD_OK)
+		{
+			if (rc != VOD_NOT_FOUND)
+			{
+				vod_log_debug1(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+					"mp4_muxer_write_file_ranges: mp4_muxer_start_frame failed %i", rc);
+				return rc;
+			}
+
+			*done = TRUE;
+			break;
+		}
+	}
+
+	if (range_end > range_start)
+	{
+		rc = last_stream->write_file_range(last_stream->write_context, range_source, range_start, range_end - range_start);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+	}
+
+	return VOD_OK;
+}
+
 vod_status_t
 mp4_muxer_process_frames(mp4_muxer_state_t* state)
 {
-	mp4_muxer_stream_state_t* selected_stream = state->selected_stream;
+	mp4_muxer_stream_state_t* selected_stream;
 	mp4_muxer_stream_state_t* last_stream = NULL;
 	u_char* read_buffer;
 	uint32_t read_size;
@@ -811,6 +889,20 @@ mp4_muxer_process_frames(mp4_muxer_state_t* state)
 	vod_status_t rc;
 	bool_t processed_data = FALSE;
 	bool_t frame_done;
+	bool_t done;
+
+	// Note: first_time is reset whenever VOD_AGAIN is returned, so it is set only before any frame data was read
+	if (state->first_time)
+	{
+		// output the frames as ranges of the source file, without reading them
+		rc = mp4_muxer_write_file_ranges(state, &done);
+		if (rc != VOD_OK || done)
+		{
+			return rc;
+		}
+	}
+
+	selected_stream = state->selected_stream;
 
 	for (;;)
 	{
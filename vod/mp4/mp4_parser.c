@@ -1,5 +1,6 @@
 #include "mp4_parser.h"
 #include "mp4_format.h"
+#include "mp4_frame_index.h"
 #include "mp4_defs.h"
 #include "../media_format.h"
 #include "../input/frames_source_cache.h"
@@ -103,6 +104,7 @@ typedef struct {
 	// input - reset between tracks
 	const uint32_t* stss_start_pos;			// initialized only when aligning keyframes
 	uint32_t stss_entries;					// initialized only when aligning keyframes
+	mp4_frame_index_track_t frame_index;
 
 	// output
 	uint32_t stss_start_index;
@@ -130,6 +132,7 @@ typedef struct {
 	media_info_t media_info;
 	atom_info_t sinf_atom;
 	uint32_t track_index;
+	mp4_frame_index_track_t frame_index;
 } mp4_track_base_metadata_t;
 
 typedef struct {
@@ -618,10 +621,38 @@ mp4_parser_parse_stts_atom_frame_duration_only(atom_info_t* atom_info, frames_pa
 	return VOD_OK;
 }
 
+static const mp4_frame_index_checkpoint_t*
+mp4_parser_find_stts_checkpoint(
+	frames_parse_context_t* context,
+	uint64_t time,
+	uint64_t initial_accum_duration,
+	uint32_t cur_entry_index,
+	uint32_t entries)
+{
+	const mp4_frame_index_checkpoint_t* checkpoint;
+
+	if (time <= initial_accum_duration)
+	{
+		return NULL;
+	}
+
+	checkpoint = mp4_frame_index_find_by_time(&context->frame_index, time - initial_accum_duration);
+	if (checkpoint == NULL || 
+		checkpoint->stts_entry <= cur_entry_index || 
+		checkpoint->stts_entry >= entries)
+	{
+		return NULL;
+	}
+
+	return checkpoint;
+}
+
 static vod_status_t 
 mp4_parser_parse_stts_atom(atom_info_t* atom_info, frames_parse_context_t* context)
 {
 	uint32_t timescale = context->media_info->timescale;
+	const mp4_frame_index_checkpoint_t* checkpoint;
+	const stts_entry_t* first_entry;
 	const stts_entry_t* last_entry;
 	const stts_entry_t* cur_entry;
 	media_range_t* range = context->parse_params.range;
@@ -633,6 +664,7 @@ mp4_parser_parse_stts_atom(atom_info_t* atom_info, frames_parse_context_t* conte
 	uint64_t end_time;
 	uint64_t clip_to;
 	uint64_t clip_from_accum_duration = 0;
+	uint64_t initial_accum_duration;
 	uint64_t accum_duration;
 	uint64_t next_accum_duration;
 	int64_t empty_duration;
@@ -668,9 +700,12 @@ mp4_parser_parse_stts_atom(atom_info_t* atom_info, frames_parse_context_t* conte
 		accum_duration = 0;
 	}
 
+	initial_accum_duration = accum_duration;
+
 	// parse the first sample
-	cur_entry = (const stts_entry_t*)(atom_info->ptr + sizeof(stts_atom_t));
-	last_entry = cur_entry + entries;
+	first_entry = (const stts_entry_t*)(atom_info->ptr + sizeof(stts_atom_t));
+	last_entry = first_entry + entries;
+	cur_entry = first_entry;
 	if (cur_entry >= last_entry)
 	{
 		if (context->stss_entries != 0)
@@ -689,6 +724,18 @@ mp4_parser_parse_stts_atom(atom_info_t* atom_info, frames_parse_context_t* conte
 	{
 		clip_from = (((uint64_t)context->parse_params.clip_from * timescale) / 1000);
 
+		// skip the entries that end before the clip position using the frame index
+		checkpoint = mp4_parser_find_stts_checkpoint(context, clip_from, initial_accum_duration, cur_entry - first_entry, entries);
+		if (checkpoint != NULL)
+		{
+			cur_entry = first_entry + checkpoint->stts_entry;
+			frame_index = checkpoint->stts_frame_index;
+			accum_duration = initial_accum_duration + checkpoint->stts_accum_duration;
+			sample_duration = parse_be32(cur_entry->duration);
+			sample_count = parse_be32(cur_entry->count);
+			next_accum_duration = accum_duration + (uint64_t)sample_duration * sample_count;
+		}
+
 		for (;;)
 		{
 			if (clip_from + sample_duration <= next_accum_duration)
@@ -784,6 +831,17 @@ mp4_parser_parse_stts_atom(atom_info_t* atom_info, frames_parse_context_t* conte
 	// skip to the sample containing the start time
 	start_time = ((range->start + context->clip_from) * timescale) / range->timescale;
 
+	checkpoint = mp4_parser_find_stts_checkpoint(context, start_time, initial_accum_duration, cur_entry - first_entry, entries);
+	if (checkpoint != NULL)
+	{
+		cur_entry = first_entry + checkpoint->stts_entry;
+		frame_index = checkpoint->stts_frame_index;
+		accum_duration = initial_accum_duration + checkpoint->stts_accum_duration;
+		sample_duration = parse_be32(cur_entry->duration);
+		sample_count = parse_be32(cur_entry->count);
+		next_accum_duration = accum_duration + (uint64_t)sample_duration * sample_count;
+	}
+
 	for (;;)
 	{
 		if (start_time + sample_duration <= next_accum_duration)
@@ -1167,6 +1225,7 @@ mp4_parser_parse_ctts_atom_initial_pts_delay(atom_info_t* atom_info, frames_pars
 static vod_status_t 
 mp4_parser_parse_ctts_atom(atom_info_t* atom_info, frames_parse_context_t* context)
 {
+	const mp4_frame_index_checkpoint_t* checkpoint;
 	const ctts_entry_t* first_entry;
 	const ctts_entry_t* last_entry;
 	const ctts_entry_t* cur_entry;
@@ -1195,6 +1254,17 @@ mp4_parser_parse_ctts_atom(atom_info_t* atom_info, frames_parse_context_t* conte
 	last_entry = first_entry + entries;
 	cur_entry = first_entry;
 
+	// resume from the nearest checkpoint of the frame index
+	checkpoint = mp4_frame_index_find_by_frame(&context->frame_index, context->first_frame);
+	if (checkpoint != NULL && 
+		checkpoint->ctts_entry < entries && 
+		checkpoint->ctts_frame_index <= context->first_frame)
+	{
+		cur_entry += checkpoint->ctts_entry;
+		frame_index = checkpoint->ctts_frame_index;
+		dts_shift = checkpoint->ctts_dts_shift;
+	}
+
 	// parse the first entry
 	if (cur_entry >= last_entry)
 	{
@@ -1379,6 +1449,7 @@ static const u_char chunk_equals_sample_entry[] = {
 static vod_status_t 
 mp4_parser_parse_stsc_atom(atom_info_t* atom_info, frames_parse_context_t* context)
 {
+	const mp4_frame_index_checkpoint_t* checkpoint;
 	input_frame_t* cur_frame = context->frames;
 	input_frame_t* last_frame = cur_frame + context->frame_count;
 	const stsc_entry_t* last_entry;
@@ -1422,6 +1493,17 @@ mp4_parser_parse_stsc_atom(atom_info_t* atom_info, frames_parse_context_t* conte
 
 	if (frame_index < context->first_frame)
 	{
+		// resume from the nearest checkpoint of the frame index
+		checkpoint = mp4_frame_index_find_by_frame(&context->frame_index, context->first_frame);
+		if (checkpoint != NULL && 
+			checkpoint->stsc_entry < entries && 
+			checkpoint->stsc_frame_index <= context->first_frame)
+		{
+			cur_entry += checkpoint->stsc_entry;
+			frame_index = checkpoint->stsc_frame_index;
+			next_chunk = parse_be32(cur_entry->first_chunk);
+		}
+
 		// skip to the relevant entry
 		for (; cur_entry + 1 < last_entry; cur_entry++, frame_index += cur_entry_samples)
 		{
@@ -2835,6 +2917,7 @@ mp4_parser_process_moov_atom_callback(void* ctx, atom_info_t* atom_info)
 	result_track->media_info = metadata_parse_context.media_info;
 	result_track->sinf_atom = metadata_parse_context.sinf_atom;
 	result_track->track_index = track_index;
+	vod_memzero(&result_track->frame_index, sizeof(result_track->frame_index));
 
 	// update max duration / track index
 	if (result->base.duration == 0 ||
@@ -2911,7 +2994,10 @@ mp4_parser_parse_basic_metadata(
 	size_t metadata_part_count,
 	media_base_metadata_t** result)
 {
+	mp4_track_base_metadata_t* cur_track;
+	mp4_track_base_metadata_t* last_track;
 	process_moov_context_t context;
+	mp4_frame_index_t frame_index;
 	mp4_base_metadata_t* metadata;
 	vod_status_t rc;
 
@@ -2956,6 +3042,31 @@ mp4_parser_parse_basic_metadata(
 		return VOD_BAD_DATA;
 	}
 
+	// attach the frame index, if it was saved along with the moov atom
+	if (metadata_part_count > MP4_METADATA_PART_FRAME_INDEX)
+	{
+		rc = mp4_frame_index_init(request_context, &metadata_parts[MP4_METADATA_PART_FRAME_INDEX], &frame_index);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+
+		cur_track = (mp4_track_base_metadata_t*)metadata->base.tracks.elts;
+		last_track = cur_track + metadata->base.tracks.nelts;
+		for (; cur_track < last_track; cur_track++)
+		{
+			if (cur_track->trak_atom_infos.stts.ptr == NULL)
+			{
+				continue;
+			}
+
+			mp4_frame_index_get_track(
+				&frame_index,
+				cur_track->trak_atom_infos.stts.ptr - metadata_parts[MP4_METADATA_PART_MOOV].data,
+				&cur_track->frame_index);
+		}
+	}
+
 	*result = &metadata->base;
 
 	return VOD_OK;
@@ -3117,6 +3228,8 @@ mp4_parser_parse_frames(
 		vod_memzero((u_char*)&context + offsetof(frames_parse_context_t, stss_start_pos),
 			sizeof(context) - offsetof(frames_parse_context_t, stss_start_pos));
 
+		context.frame_index = cur_track->frame_index;
+
 		if (cur_track == first_track &&
 			media_type == MEDIA_TYPE_VIDEO &&
 			cur_track->trak_atom_infos.stss.size != 0 &&
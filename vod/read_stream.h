@@ -7,6 +7,7 @@
 // int parsing macros
 #define parse_le32(p) ( ((uint32_t) ((u_char*)(p))[3] << 24) | (((u_char*)(p))[2] << 16) | (((u_char*)(p))[1] << 8) | (((u_char*)(p))[0]) )
 #define parse_be16(p) ( ((uint16_t) ((u_char*)(p))[0] << 8)  | (((u_char*)(p))[1]) )
+#define parse_be24(p) ( ((uint32_t) ((u_char*)(p))[0] << 16) | (((u_char*)(p))[1] << 8) | (((u_char*)(p))[2]) )
 #define parse_be32(p) ( ((uint32_t) ((u_char*)(p))[0] << 24) | (((u_char*)(p))[1] << 16) | (((u_char*)(p))[2] << 8) | (((u_char*)(p))[3]) )
 #define parse_be64(p) ((((uint64_t)parse_be32(p)) << 32) | parse_be32((p) + 4))
 
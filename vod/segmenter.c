@@ -312,6 +312,31 @@ segmenter_get_segment_index_no_discontinuity(
 	return result;
 }
 
+// returns the index of the first clip that ends after the given time, or total_count if there is none.
+// Note: relies on the clips being sorted and non-overlapping (validated by the media set parser)
+static uint32_t
+segmenter_find_clip_by_time(media_clip_timing_t* timing, uint64_t time_millis)
+{
+	uint32_t left = 0;
+	uint32_t right = timing->total_count;
+	uint32_t mid;
+
+	while (left < right)
+	{
+		mid = (left + right) >> 1;
+		if (timing->times[mid] + timing->durations[mid] > time_millis)
+		{
+			right = mid;
+		}
+		else
+		{
+			left = mid + 1;
+		}
+	}
+
+	return left;
+}
+
 vod_status_t
 segmenter_get_segment_index_discontinuity(
 	request_context_t* request_context,
@@ -404,41 +429,27 @@ segmenter_get_start_end_ranges_gop(
 	uint64_t clip_time;
 	uint64_t start;
 	uint64_t end;
-	uint64_t* cur_clip_time;
-	uint32_t* clip_durations = params->timing.durations;
-	uint32_t* end_duration = clip_durations + params->timing.total_count;
-	uint32_t* cur_duration;
 	uint64_t time = params->time;
 	uint32_t clip_duration;
 	uint32_t clip_index;
 
-	for (cur_duration = clip_durations, cur_clip_time = params->timing.times;
-		;
-		cur_duration++, cur_clip_time++)
+	clip_index = segmenter_find_clip_by_time(&params->timing, time);
+	if (clip_index >= params->timing.total_count)
 	{
-		if (cur_duration >= end_duration)
-		{
-			vod_log_error(VOD_LOG_ERR, request_context->log, 0,
-				"segmenter_get_start_end_ranges_gop: invalid time %uL (1)", time);
-			return VOD_BAD_REQUEST;
-		}
-
-		clip_time = *cur_clip_time;
-		if (time < clip_time)
-		{
-			vod_log_error(VOD_LOG_ERR, request_context->log, 0,
-				"segmenter_get_start_end_ranges_gop: invalid time %uL (2)", time);
-			return VOD_BAD_REQUEST;
-		}
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"segmenter_get_start_end_ranges_gop: invalid time %uL (1)", time);
+		return VOD_BAD_REQUEST;
+	}
 
-		clip_duration = *cur_duration;
-		if (time < clip_time + clip_duration)
-		{
-			break;
-		}
+	clip_time = params->timing.times[clip_index];
+	if (time < clip_time)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"segmenter_get_start_end_ranges_gop: invalid time %uL (2)", time);
+		return VOD_BAD_REQUEST;
 	}
 
-	clip_index = cur_duration - clip_durations;
+	clip_duration = params->timing.durations[clip_index];
 
 	start = time - clip_time;
 	if (start > conf->gop_look_behind)
@@ -450,7 +461,7 @@ segmenter_get_start_end_ranges_gop(
 		start = 0;
 	}
 
-	end = time - clip_time + conf->gop_look_ahead;
+	end = time - clip_time + params->time_span + conf->gop_look_ahead;
 	if (end > clip_duration)
 	{
 		end = clip_duration;
@@ -599,6 +610,24 @@ segmenter_get_start_end_ranges_no_discontinuity(
 		end = last_segment_end;
 	}
 
+	if (params->part_index != INVALID_PART_INDEX)
+	{
+		// Note: the part is cut from the final segment range, the same way the playlist splits the segment duration.
+		//		parts are not aligned to key frames, only the first part of the segment starts with a key frame
+		start += (uint64_t)params->part_index * params->conf->part_duration;
+		if (start >= end)
+		{
+			vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+				"segmenter_get_start_end_ranges_no_discontinuity: invalid part index %uD", params->part_index);
+			return VOD_BAD_REQUEST;
+		}
+
+		if (end > start + params->conf->part_duration)
+		{
+			end = start + params->conf->part_duration;
+		}
+	}
+
 	// find min/max clip indexes and initial sequence offset
 	result->min_clip_index = INVALID_CLIP_INDEX;
 	result->max_clip_index = params->timing.total_count - 1;
@@ -685,7 +714,6 @@ segmenter_get_start_end_ranges_discontinuity(
 	request_context_t* request_context = params->request_context;
 	segmenter_conf_t* conf = params->conf;
 	media_range_t* cur_clip_range;
-	uint64_t* cur_clip_time;
 	uint32_t* end_duration = params->timing.durations + params->timing.total_count;
 	uint32_t* cur_duration;
 	uint64_t clip_start_offset;
@@ -771,26 +799,17 @@ segmenter_get_start_end_ranges_discontinuity(
 		end += params->timing.segment_base_time;
 
 		// find the clip that intersects start-end
-		for (cur_duration = params->timing.durations, cur_clip_time = params->timing.times;
-			; 
-			cur_duration++, cur_clip_time++)
+		clip_index = segmenter_find_clip_by_time(&params->timing, start);
+		if (clip_index >= params->timing.total_count || 
+			end <= params->timing.times[clip_index])
 		{
-			if (cur_duration >= end_duration)
-			{
-				vod_log_error(VOD_LOG_ERR, request_context->log, 0,
-					"segmenter_get_start_end_ranges_discontinuity: invalid segment index %uD (2)", segment_index);
-				return VOD_BAD_REQUEST;
-			}
-
-			clip_time = *cur_clip_time;
-			clip_duration = *cur_duration;
-			if (end > clip_time && start < clip_time + clip_duration)
-			{
-				break;
-			}
+			vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+				"segmenter_get_start_end_ranges_discontinuity: invalid segment index %uD (2)", segment_index);
+			return VOD_BAD_REQUEST;
 		}
 
-		clip_index = cur_duration - params->timing.durations;
+		clip_time = params->timing.times[clip_index];
+		clip_duration = params->timing.durations[clip_index];
 		clip_start_offset = clip_time;
 
 		clip_initial_segment_index = segmenter_get_segment_index_no_discontinuity(
@@ -901,6 +920,7 @@ segmenter_get_live_window_start_end(
 	uint64_t segment_base_time;
 	uint64_t clip_end_time;
 	uint64_t clip_time;
+	uint64_t edge_time;
 	uint64_t end_time;
 	uint64_t start_time;
 	uint32_t end_clip_offset;
@@ -963,15 +983,16 @@ segmenter_get_live_window_start_end(
 			return VOD_BAD_MAPPING;
 		}
 
-		for (end_clip_index = timing->total_count - 1;; end_clip_index--)
+		// find the last clip that starts before the end time
+		end_clip_index = segmenter_find_clip_by_time(timing, end_time);
+		if (end_clip_index >= timing->total_count ||
+			timing->times[end_clip_index] >= end_time)
 		{
-			clip_time = timing->times[end_clip_index];
-			if (end_time > clip_time)
-			{
-				break;
-			}
+			end_clip_index--;
 		}
 
+		clip_time = timing->times[end_clip_index];
+
 		if (end_time < clip_time + timing->durations[end_clip_index])
 		{
 			end_clip_offset = end_time - clip_time;
@@ -989,6 +1010,7 @@ segmenter_get_live_window_start_end(
 		end_clip_offset < timing->durations[end_clip_index])
 	{
 		media_set->presentation_end = FALSE;
+		edge_time = end_time;
 
 		// snap end to segment boundary
 		if (timing->segment_base_time == SEGMENT_BASE_TIME_RELATIVE)
@@ -1029,6 +1051,11 @@ segmenter_get_live_window_start_end(
 				clip_end_time = timing->times[end_clip_index] + timing->durations[end_clip_index];
 				end_time = segmenter_align_to_key_frames(&align_context, end_time, clip_end_time);
 			}
+			else if (conf->part_duration != 0 && !media_set->use_discontinuity)
+			{
+				// the complete parts of the next segment
+				media_set->live_partial_duration = ((edge_time - end_time) / conf->part_duration) * conf->part_duration;
+			}
 
 			end_clip_offset = end_time - timing->times[end_clip_index];
 		}
@@ -51,12 +51,14 @@ typedef struct {
 
 	// no discontinuity
 	uint64_t last_segment_end;
+	uint32_t part_index;		// INVALID_PART_INDEX = the whole segment
 
 	// discontinuity
 	uint32_t initial_segment_index;
 
 	// gop
 	uint64_t time;
+	uint64_t time_span;		// the range is extended to time + time_span (used in thumbnail tiles)
 } get_clip_ranges_params_t;
 
 typedef struct {
@@ -89,6 +91,7 @@ struct segmenter_conf_s {
 	vod_uint_t manifest_duration_policy;
 	uintptr_t gop_look_behind;
 	uintptr_t gop_look_ahead;
+	uintptr_t part_duration;		// 0 = partial segments disabled
 
 	// derived fields
 	uint32_t parse_type;
@@ -8,6 +8,10 @@
 #include <libavutil/imgutils.h>
 #endif // VOD_HAVE_LIB_SW_SCALE
 
+// constants
+#define THUMB_TILE_DEFAULT_WIDTH (160)
+#define THUMB_TILE_MAX_DIMENSION (16384)
+
 // typedefs
 typedef struct
 {
@@ -15,6 +19,7 @@ typedef struct
 	request_context_t* request_context;
 	write_callback_t write_callback;
 	void* write_context;
+	bool_t deferred;
 
 	// libavcodec
 	AVCodecContext *decoder;
@@ -38,8 +43,73 @@ typedef struct
 	u_char* frame_buffer;
 	uint32_t cur_frame_pos;
 
+	// deferred decode state
+	frame_list_part_t first_frame_part;
+	uint32_t frame_count;
+	size_t frames_pos;
+
 } thumb_grabber_state_t;
 
+#if (VOD_HAVE_LIB_SW_SCALE)
+typedef struct {
+	frame_list_part_t* key_frame_part;
+	input_frame_t* key_frame;
+	uint64_t key_frame_dts;
+	uint64_t pts;					// pts of the frame that should be captured
+	uint32_t frame_count;			// number of frames from the key frame up to the captured frame
+	bool_t captured;
+} thumb_grabber_tile_t;
+
+typedef struct
+{
+	// fixed
+	request_context_t* request_context;
+	write_callback_t write_callback;
+	void* write_context;
+	thumb_grabber_tile_t* tiles;
+	uint32_t tile_count;
+	uint32_t columns;
+	uint32_t tile_width;
+	uint32_t tile_height;
+
+	// libavcodec
+	AVCodecContext *decoder;
+	AVCodecContext *encoder;
+	AVFrame *decoded_frame;
+	AVFrame *last_frame;
+	AVFrame *output_frame;
+	AVPacket output_packet;
+	struct SwsContext *sws_ctx;
+	int has_last_frame;
+
+	// run state - a run is a group of tiles that share the same key frame
+	uint32_t cur_tile;
+	uint32_t run_end;
+	uint32_t frames_left;
+	bool_t run_started;
+
+	// frame state
+	frame_list_part_t cur_frame_part;
+	input_frame_t* cur_frame;
+	bool_t first_time;
+	bool_t frame_started;
+	uint64_t dts;
+
+	// frame buffer state
+	uint32_t max_frame_size;
+	u_char* frame_buffer;
+	uint32_t cur_frame_pos;
+
+} thumb_grabber_tile_state_t;
+#endif // VOD_HAVE_LIB_SW_SCALE
+
+typedef struct {
+	frame_list_part_t* part;		// the part of the key frame
+	input_frame_t* key_frame;
+	input_frame_t* frame;
+	uint32_t skip_count;			// number of frames between the key frame and the frame
+} thumb_grabber_frame_t;
+
 typedef struct {
 	uint32_t codec_id;
 	enum AVCodecID av_codec_id;
@@ -213,36 +283,60 @@ thumb_grabber_get_max_frame_size(media_track_t* track, uint32_t limit)
 	return max_frame_size;
 }
 
+static size_t
+thumb_grabber_get_total_frames_size(media_track_t* track, uint32_t limit)
+{
+	frame_list_part_t* part;
+	input_frame_t* cur_frame;
+	input_frame_t* last_frame;
+	size_t total_size = 0;
+
+	part = &track->frames;
+	last_frame = part->last_frame;
+	for (cur_frame = part->first_frame; limit > 0; cur_frame++, limit--)
+	{
+		if (cur_frame >= last_frame)
+		{
+			part = part->next;
+			cur_frame = part->first_frame;
+			last_frame = part->last_frame;
+		}
+
+		total_size += cur_frame->size;
+	}
+
+	return total_size;
+}
+
 static vod_status_t
-thumb_grabber_truncate_frames(
+thumb_grabber_find_frame(
 	request_context_t* request_context,
 	media_track_t* track, 
 	uint64_t requested_time, 
 	bool_t accurate,
-	uint32_t* skip_count)
+	thumb_grabber_frame_t* result)
 {
 	frame_list_part_t* last_key_frame_part = NULL;
-	frame_list_part_t* min_part = NULL;
 	frame_list_part_t* part;
 	input_frame_t* last_key_frame = NULL;
 	input_frame_t* cur_frame;
 	input_frame_t* last_frame;
-	vod_status_t rc;
 	uint64_t dts = track->clip_start_time + track->first_frame_time_offset;
 	uint64_t pts;
 	uint64_t cur_diff;
 	uint64_t min_diff = ULLONG_MAX;
 	uint32_t last_key_frame_index = 0;
-	uint32_t min_index = 0;
 	uint32_t index;
 
 	if (track->frame_count <= 0)
 	{
 		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
-			"thumb_grabber_truncate_frames: did not find any frames (1)");
+			"thumb_grabber_find_frame: did not find any frames (1)");
 		return VOD_BAD_REQUEST;
 	}
 
+	result->part = NULL;
+
 	part = &track->frames;
 	last_frame = part->last_frame;
 	cur_frame = part->first_frame;
@@ -277,36 +371,80 @@ thumb_grabber_truncate_frames(
 			(cur_frame->key_frame || 
 			(accurate && last_key_frame != NULL)))
 		{
-			min_index = index - last_key_frame_index;
 			min_diff = cur_diff;
-			min_part = last_key_frame_part;
-
-			rc = min_part->frames_source->skip_frames(
-				min_part->frames_source_context,
-				last_key_frame - min_part->first_frame);
-			if (rc != VOD_OK)
-			{
-				return rc;
-			}
-
-			// truncate any frames before the key frame of the closest frame
-			min_part->first_frame = last_key_frame;
+			result->skip_count = index - last_key_frame_index;
+			result->part = last_key_frame_part;
+			result->key_frame = last_key_frame;
+			result->frame = cur_frame;
 		}
 
 		dts += cur_frame->duration;
 	}
 
-	if (min_part == NULL)
+	if (result->part == NULL)
 	{
 		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
-			"thumb_grabber_truncate_frames: did not find any frames (2)");
+			"thumb_grabber_find_frame: did not find any frames (2)");
 		return VOD_UNEXPECTED;
 	}
 
+	return VOD_OK;
+}
+
+static vod_status_t
+thumb_grabber_truncate_frames(
+	request_context_t* request_context,
+	media_track_t* track, 
+	uint64_t requested_time, 
+	bool_t accurate,
+	uint32_t* skip_count)
+{
+	thumb_grabber_frame_t frame;
+	vod_status_t rc;
+
+	rc = thumb_grabber_find_frame(request_context, track, requested_time, accurate, &frame);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	rc = frame.part->frames_source->skip_frames(
+		frame.part->frames_source_context,
+		frame.key_frame - frame.part->first_frame);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	// truncate any frames before the key frame of the closest frame
+	frame.part->first_frame = frame.key_frame;
+
 	// truncate any parts before the key frame of the closest frame
-	track->frames = *min_part;
+	track->frames = *frame.part;
+
+	*skip_count = frame.skip_count;
+
+	return VOD_OK;
+}
+
+vod_status_t
+thumb_grabber_get_frame_offset(
+	request_context_t* request_context,
+	media_track_t* track,
+	request_params_t* request_params,
+	bool_t accurate,
+	uint64_t* result)
+{
+	thumb_grabber_frame_t frame;
+	vod_status_t rc;
+
+	rc = thumb_grabber_find_frame(request_context, track, request_params->segment_time, accurate, &frame);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
 
-	*skip_count = min_index;
+	*result = frame.frame->offset;
 
 	return VOD_OK;
 }
@@ -317,6 +455,7 @@ thumb_grabber_init_state(
 	media_track_t* track, 
 	request_params_t* request_params,
 	bool_t accurate,
+	bool_t deferred,
 	write_callback_t write_callback,
 	void* write_context,
 	void** result)
@@ -438,10 +577,35 @@ thumb_grabber_init_state(
 	state->request_context = request_context;
 	state->write_callback = write_callback;
 	state->write_context = write_context;
+	state->deferred = deferred;
 	state->cur_frame_part = track->frames;
 	state->cur_frame = track->frames.first_frame;
-	state->max_frame_size = thumb_grabber_get_max_frame_size(track, frame_index + 1);
 	state->frame_buffer = NULL;
+
+	if (deferred)
+	{
+		// Note: in deferred mode, all the frames up to the requested one are saved to a single buffer,
+		//		since the decoding is performed after all of them are read
+		state->first_frame_part = track->frames;
+		state->frame_count = frame_index + 1;
+		state->frames_pos = 0;
+		state->max_frame_size = 0;
+
+		state->frame_buffer = vod_alloc(
+			request_context->pool,
+			thumb_grabber_get_total_frames_size(track, frame_index + 1) + VOD_BUFFER_PADDING_SIZE);
+		if (state->frame_buffer == NULL)
+		{
+			vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+				"thumb_grabber_init_state: vod_alloc failed (2)");
+			return VOD_ALLOC_FAILED;
+		}
+	}
+	else
+	{
+		state->max_frame_size = thumb_grabber_get_max_frame_size(track, frame_index + 1);
+	}
+
 	state->skip_count = frame_index;
 	state->cur_frame_pos = 0;
 	state->first_time = TRUE;
@@ -623,7 +787,7 @@ end:
 #endif // VOD_HAVE_LIB_SW_SCALE
 
 static vod_status_t
-thumb_grabber_write_frame(thumb_grabber_state_t* state)
+thumb_grabber_encode_frame(thumb_grabber_state_t* state)
 {
 	vod_status_t rc;
 	int avrc;
@@ -640,7 +804,7 @@ thumb_grabber_write_frame(thumb_grabber_state_t* state)
 	if (!state->has_frame)
 	{
 		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
-			"thumb_grabber_write_frame: no frames were decoded");
+			"thumb_grabber_encode_frame: no frames were decoded");
 		return VOD_UNEXPECTED;
 	}
 
@@ -660,7 +824,7 @@ thumb_grabber_write_frame(thumb_grabber_state_t* state)
 	if (avrc < 0)
 	{
 		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
-			"thumb_grabber_write_frame: avcodec_send_frame failed %d", avrc);
+			"thumb_grabber_encode_frame: avcodec_send_frame failed %d", avrc);
 		return VOD_UNEXPECTED;
 	}
 
@@ -668,17 +832,69 @@ thumb_grabber_write_frame(thumb_grabber_state_t* state)
 	if (avrc < 0)
 	{
 		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
-			"thumb_grabber_write_frame: avcodec_receive_packet failed %d", avrc);
+			"thumb_grabber_encode_frame: avcodec_receive_packet failed %d", avrc);
 		return VOD_UNEXPECTED;
 	}
 
-	rc = state->write_callback(state->write_context, state->output_packet.data, state->output_packet.size);
+	return VOD_OK;
+}
+
+static vod_status_t
+thumb_grabber_write_frame(thumb_grabber_state_t* state)
+{
+	vod_status_t rc;
+
+	rc = thumb_grabber_encode_frame(state);
 	if (rc != VOD_OK)
 	{
 		return rc;
 	}
 
-	return VOD_OK;
+	return thumb_grabber_write(state);
+}
+
+vod_status_t
+thumb_grabber_decode(void* context)
+{
+	thumb_grabber_state_t* state = context;
+	input_frame_t* last_frame;
+	u_char* buffer;
+	uint32_t count;
+	vod_status_t rc;
+
+	state->cur_frame_part = state->first_frame_part;
+	state->cur_frame = state->cur_frame_part.first_frame;
+	last_frame = state->cur_frame_part.last_frame;
+	buffer = state->frame_buffer;
+
+	for (count = state->frame_count; count > 0; count--)
+	{
+		if (state->cur_frame >= last_frame)
+		{
+			state->cur_frame_part = *state->cur_frame_part.next;
+			state->cur_frame = state->cur_frame_part.first_frame;
+			last_frame = state->cur_frame_part.last_frame;
+		}
+
+		rc = thumb_grabber_decode_frame(state, buffer);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+
+		buffer += state->cur_frame->size;
+		state->cur_frame++;
+	}
+
+	return thumb_grabber_encode_frame(state);
+}
+
+vod_status_t
+thumb_grabber_write(void* context)
+{
+	thumb_grabber_state_t* state = context;
+
+	return state->write_callback(state->write_context, state->output_packet.data, state->output_packet.size);
 }
 
 vod_status_t
@@ -741,6 +957,30 @@ thumb_grabber_process(void* context)
 
 		processed_data = TRUE;
 
+		if (state->deferred)
+		{
+			// save the frame data, the decoding is performed by thumb_grabber_decode
+			vod_memcpy(state->frame_buffer + state->frames_pos, read_buffer, read_size);
+			state->frames_pos += read_size;
+
+			if (!frame_done)
+			{
+				continue;
+			}
+
+			if (state->skip_count <= 0)
+			{
+				return VOD_DONE;
+			}
+
+			state->skip_count--;
+
+			// move to the next frame
+			state->cur_frame++;
+			state->frame_started = FALSE;
+			continue;
+		}
+
 		if (!frame_done)
 		{
 			// didn't finish the frame, append to the frame buffer
@@ -790,3 +1030,682 @@ thumb_grabber_process(void* context)
 		state->frame_started = FALSE;
 	}
 }
+
+#if (VOD_HAVE_LIB_SW_SCALE)
+static void
+thumb_grabber_tile_free_state(void* context)
+{
+	thumb_grabber_tile_state_t* state = (thumb_grabber_tile_state_t*)context;
+
+	av_packet_unref(&state->output_packet);
+	sws_freeContext(state->sws_ctx);
+	if (state->output_frame != NULL)
+	{
+		av_freep(&state->output_frame->data[0]);
+		av_frame_free(&state->output_frame);
+	}
+	av_frame_free(&state->last_frame);
+	av_frame_free(&state->decoded_frame);
+	avcodec_close(state->encoder);
+	av_free(state->encoder);
+	avcodec_close(state->decoder);
+	av_free(state->decoder);
+}
+
+static vod_status_t
+thumb_grabber_tile_find_frames(
+	request_context_t* request_context,
+	media_track_t* track,
+	request_params_t* request_params,
+	bool_t accurate,
+	thumb_grabber_tile_t* tiles,
+	uint32_t tile_count,
+	uint32_t* max_frame_size)
+{
+	thumb_grabber_tile_t* cur_tile = tiles;
+	thumb_grabber_tile_t* tiles_end = tiles + tile_count;
+	thumb_grabber_tile_t below;
+	thumb_grabber_tile_t key;
+	frame_list_part_t* part;
+	input_frame_t* cur_frame;
+	input_frame_t* last_frame;
+	uint64_t dts = track->clip_start_time + track->first_frame_time_offset;
+	uint64_t pts;
+	uint64_t tile_time;
+	uint32_t max_size = 0;
+
+	if (track->frame_count <= 0)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"thumb_grabber_tile_find_frames: did not find any frames (1)");
+		return VOD_BAD_REQUEST;
+	}
+
+	part = &track->frames;
+	last_frame = part->last_frame;
+	cur_frame = part->first_frame;
+
+	tile_time = request_params->segment_time + cur_frame->pts_delay;
+
+	key.key_frame = NULL;
+	below.key_frame = NULL;
+
+	// Note: walking the frames once, each tile is assigned the closest eligible frame to its time.
+	//		since the tile times are increasing, it is enough to track the last eligible frame
+	//		that precedes the current tile time.
+	for (;; cur_frame++)
+	{
+		if (cur_frame >= last_frame)
+		{
+			if (part->next == NULL)
+			{
+				break;
+			}
+			part = part->next;
+			cur_frame = part->first_frame;
+			last_frame = part->last_frame;
+		}
+
+		if (cur_frame->key_frame)
+		{
+			key.key_frame_part = part;
+			key.key_frame = cur_frame;
+			key.key_frame_dts = dts;
+			key.frame_count = 0;
+		}
+
+		pts = dts + cur_frame->pts_delay;
+		dts += cur_frame->duration;
+
+		if (key.key_frame == NULL)
+		{
+			continue;
+		}
+
+		key.frame_count++;
+
+		if (key.frame_count > 1 && !accurate)
+		{
+			continue;
+		}
+
+		if (cur_frame->size > max_size)
+		{
+			max_size = cur_frame->size;
+		}
+
+		key.pts = pts;
+
+		while (cur_tile < tiles_end && pts >= tile_time)
+		{
+			if (below.key_frame != NULL && tile_time - below.pts < pts - tile_time)
+			{
+				*cur_tile = below;
+			}
+			else
+			{
+				*cur_tile = key;
+			}
+
+			cur_tile++;
+			tile_time += request_params->tile_interval;
+		}
+
+		if (cur_tile < tiles_end && (below.key_frame == NULL || pts > below.pts))
+		{
+			below = key;
+		}
+	}
+
+	if (below.key_frame == NULL)
+	{
+		if (cur_tile <= tiles)
+		{
+			vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+				"thumb_grabber_tile_find_frames: did not find any frames (2)");
+			return VOD_UNEXPECTED;
+		}
+
+		below = cur_tile[-1];
+	}
+
+	// the tiles that are beyond the last frame use the last frame
+	for (; cur_tile < tiles_end; cur_tile++)
+	{
+		*cur_tile = below;
+	}
+
+	for (cur_tile = tiles; cur_tile < tiles_end; cur_tile++)
+	{
+		cur_tile->captured = FALSE;
+	}
+
+	*max_frame_size = max_size;
+
+	return VOD_OK;
+}
+
+vod_status_t
+thumb_grabber_init_tile_state(
+	request_context_t* request_context,
+	media_track_t* track,
+	request_params_t* request_params,
+	bool_t accurate,
+	write_callback_t write_callback,
+	void* write_context,
+	void** result)
+{
+	thumb_grabber_tile_state_t* state;
+	vod_pool_cleanup_t *cln;
+	vod_status_t rc;
+	uint32_t output_width;
+	uint32_t output_height;
+	uint32_t tile_count;
+	int avrc;
+
+	if (decoder_codec[track->media_info.codec_id] == NULL)
+	{
+		vod_log_debug1(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"thumb_grabber_init_tile_state: no decoder was initialized for codec %uD", track->media_info.codec_id);
+		return VOD_BAD_REQUEST;
+	}
+
+	if (track->media_info.u.video.width <= 0 || track->media_info.u.video.height <= 0)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"thumb_grabber_init_tile_state: input width/height is zero");
+		return VOD_BAD_DATA;
+	}
+
+	state = vod_alloc(request_context->pool, sizeof(*state));
+	if (state == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"thumb_grabber_init_tile_state: vod_alloc failed (1)");
+		return VOD_ALLOC_FAILED;
+	}
+
+	// get the tile size
+	if (request_params->width != 0)
+	{
+		state->tile_width = request_params->width;
+		if (request_params->height != 0)
+		{
+			state->tile_height = request_params->height;
+		}
+		else
+		{
+			state->tile_height = ((uint64_t)track->media_info.u.video.height * request_params->width) / track->media_info.u.video.width;
+		}
+	}
+	else if (request_params->height != 0)
+	{
+		state->tile_width = ((uint64_t)track->media_info.u.video.width * request_params->height) / track->media_info.u.video.height;
+		state->tile_height = request_params->height;
+	}
+	else
+	{
+		state->tile_width = THUMB_TILE_DEFAULT_WIDTH;
+		state->tile_height = ((uint64_t)track->media_info.u.video.height * THUMB_TILE_DEFAULT_WIDTH) / track->media_info.u.video.width;
+	}
+
+	// Note: the tiles are aligned to even dimensions, since the chroma planes are subsampled
+	state->tile_width &= ~1;
+	state->tile_height &= ~1;
+
+	if (state->tile_width <= 0 || state->tile_height <= 0 ||
+		state->tile_width > THUMB_TILE_MAX_DIMENSION / request_params->tile_columns ||
+		state->tile_height > THUMB_TILE_MAX_DIMENSION / request_params->tile_rows)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"thumb_grabber_init_tile_state: invalid tile size %uDx%uD",
+			state->tile_width, state->tile_height);
+		return VOD_BAD_REQUEST;
+	}
+
+	output_width = state->tile_width * request_params->tile_columns;
+	output_height = state->tile_height * request_params->tile_rows;
+	tile_count = request_params->tile_columns * request_params->tile_rows;
+
+	state->tiles = vod_alloc(request_context->pool, sizeof(state->tiles[0]) * tile_count);
+	if (state->tiles == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"thumb_grabber_init_tile_state: vod_alloc failed (2)");
+		return VOD_ALLOC_FAILED;
+	}
+
+	rc = thumb_grabber_tile_find_frames(
+		request_context,
+		track,
+		request_params,
+		accurate,
+		state->tiles,
+		tile_count,
+		&state->max_frame_size);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	// clear all ffmpeg members, so that they will be initialized in case init fails
+	state->decoded_frame = NULL;
+	state->last_frame = NULL;
+	state->output_frame = NULL;
+	state->sws_ctx = NULL;
+	state->decoder = NULL;
+	state->encoder = NULL;
+	av_init_packet(&state->output_packet);
+	state->output_packet.data = NULL;
+	state->output_packet.size = 0;
+
+	// add to the cleanup pool
+	cln = vod_pool_cleanup_add(request_context->pool, 0);
+	if (cln == NULL)
+	{
+		vod_log_debug0(VOD_LOG_DEBUG_LEVEL, request_context->log, 0,
+			"thumb_grabber_init_tile_state: vod_pool_cleanup_add failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	cln->handler = thumb_grabber_tile_free_state;
+	cln->data = state;
+
+	rc = thumb_grabber_init_decoder(request_context, &track->media_info, &state->decoder);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	rc = thumb_grabber_init_encoder(request_context, output_width, output_height, &state->encoder);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	state->decoded_frame = av_frame_alloc();
+	state->last_frame = av_frame_alloc();
+	state->output_frame = av_frame_alloc();
+	if (state->decoded_frame == NULL || state->last_frame == NULL || state->output_frame == NULL)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"thumb_grabber_init_tile_state: av_frame_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	state->output_frame->width = output_width;
+	state->output_frame->height = output_height;
+	state->output_frame->format = AV_PIX_FMT_YUV420P;
+
+	avrc = av_image_alloc(
+		state->output_frame->data, state->output_frame->linesize,
+		output_width, output_height, state->output_frame->format, 16);
+	if (avrc < 0)
+	{
+		vod_log_error(VOD_LOG_ERR, request_context->log, 0,
+			"thumb_grabber_init_tile_state: av_image_alloc failed");
+		return VOD_ALLOC_FAILED;
+	}
+
+	// initialize to black, in case some tile is not captured
+	vod_memset(state->output_frame->data[0], 0, state->output_frame->linesize[0] * output_height);
+	vod_memset(state->output_frame->data[1], 0x80, state->output_frame->linesize[1] * (output_height / 2));
+	vod_memset(state->output_frame->data[2], 0x80, state->output_frame->linesize[2] * (output_height / 2));
+
+	state->request_context = request_context;
+	state->write_callback = write_callback;
+	state->write_context = write_context;
+	state->tile_count = tile_count;
+	state->columns = request_params->tile_columns;
+	state->has_last_frame = 0;
+	state->cur_tile = 0;
+	state->run_end = 0;
+	state->frames_left = 0;
+	state->run_started = FALSE;
+	state->frame_buffer = NULL;
+	state->cur_frame_pos = 0;
+	state->first_time = TRUE;
+	state->frame_started = FALSE;
+
+	*result = state;
+
+	return VOD_OK;
+}
+
+static vod_status_t
+thumb_grabber_tile_draw(thumb_grabber_tile_state_t* state, uint32_t tile_index, AVFrame* frame)
+{
+	AVFrame* output_frame = state->output_frame;
+	uint8_t* dst[4];
+	uint32_t x;
+	uint32_t y;
+
+	// Note: a single scaling context is used for the whole sheet, it is recreated only if the input changes
+	state->sws_ctx = sws_getCachedContext(state->sws_ctx,
+		frame->width, frame->height, frame->format,
+		state->tile_width, state->tile_height, output_frame->format,
+		SWS_BICUBIC, NULL, NULL, NULL);
+	if (state->sws_ctx == NULL)
+	{
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"thumb_grabber_tile_draw: sws_getCachedContext failed");
+		return VOD_UNEXPECTED;
+	}
+
+	x = (tile_index % state->columns) * state->tile_width;
+	y = (tile_index / state->columns) * state->tile_height;
+
+	dst[0] = output_frame->data[0] + y * output_frame->linesize[0] + x;
+	dst[1] = output_frame->data[1] + (y / 2) * output_frame->linesize[1] + x / 2;
+	dst[2] = output_frame->data[2] + (y / 2) * output_frame->linesize[2] + x / 2;
+	dst[3] = NULL;
+
+	sws_scale(state->sws_ctx,
+		(const uint8_t* const*)frame->data, frame->linesize, 0, frame->height,
+		dst, output_frame->linesize);
+
+	state->tiles[tile_index].captured = TRUE;
+
+	return VOD_OK;
+}
+
+static vod_status_t
+thumb_grabber_tile_receive_frames(thumb_grabber_tile_state_t* state)
+{
+	thumb_grabber_tile_t* cur_tile;
+	thumb_grabber_tile_t* run_end;
+	vod_status_t rc;
+	int avrc;
+
+	run_end = state->tiles + state->run_end;
+
+	for (;;)
+	{
+		avrc = avcodec_receive_frame(state->decoder, state->decoded_frame);
+		if (avrc == AVERROR(EAGAIN) || avrc == AVERROR_EOF)
+		{
+			return VOD_OK;
+		}
+
+		if (avrc < 0)
+		{
+			vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+				"thumb_grabber_tile_receive_frames: avcodec_receive_frame failed %d", avrc);
+			return VOD_BAD_DATA;
+		}
+
+		// capture the frame in all the tiles of the run that point to it
+		for (cur_tile = state->tiles + state->cur_tile; cur_tile < run_end; cur_tile++)
+		{
+			if (cur_tile->captured || (uint64_t)state->decoded_frame->pts != cur_tile->pts)
+			{
+				continue;
+			}
+
+			rc = thumb_grabber_tile_draw(state, cur_tile - state->tiles, state->decoded_frame);
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+		}
+
+		av_frame_unref(state->last_frame);
+		av_frame_move_ref(state->last_frame, state->decoded_frame);
+		state->has_last_frame = 1;
+	}
+}
+
+static vod_status_t
+thumb_grabber_tile_decode_frame(thumb_grabber_tile_state_t* state, u_char* buffer)
+{
+	input_frame_t* frame = state->cur_frame;
+	AVPacket input_packet;
+	u_char original_pad[VOD_BUFFER_PADDING_SIZE];
+	u_char* frame_end;
+	int avrc;
+
+	vod_memzero(&input_packet, sizeof(input_packet));
+	input_packet.data = buffer;
+	input_packet.size = frame->size;
+	input_packet.dts = state->dts;
+	input_packet.pts = state->dts + frame->pts_delay;
+	input_packet.duration = frame->duration;
+	input_packet.flags = frame->key_frame ? AV_PKT_FLAG_KEY : 0;
+	state->dts += frame->duration;
+
+	frame_end = buffer + frame->size;
+	vod_memcpy(original_pad, frame_end, sizeof(original_pad));
+	vod_memzero(frame_end, sizeof(original_pad));
+
+	avrc = avcodec_send_packet(state->decoder, &input_packet);
+
+	vod_memcpy(frame_end, original_pad, sizeof(original_pad));
+
+	if (avrc < 0)
+	{
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"thumb_grabber_tile_decode_frame: avcodec_send_packet failed %d", avrc);
+		return VOD_BAD_DATA;
+	}
+
+	return thumb_grabber_tile_receive_frames(state);
+}
+
+static void
+thumb_grabber_tile_start_run(thumb_grabber_tile_state_t* state)
+{
+	thumb_grabber_tile_t* first_tile = state->tiles + state->cur_tile;
+	thumb_grabber_tile_t* tiles_end = state->tiles + state->tile_count;
+	thumb_grabber_tile_t* cur_tile;
+
+	state->frames_left = 0;
+	for (cur_tile = first_tile;
+		cur_tile < tiles_end && cur_tile->key_frame == first_tile->key_frame;
+		cur_tile++)
+	{
+		if (cur_tile->frame_count > state->frames_left)
+		{
+			state->frames_left = cur_tile->frame_count;
+		}
+	}
+
+	state->run_end = cur_tile - state->tiles;
+	state->cur_frame_part = *first_tile->key_frame_part;
+	state->cur_frame = first_tile->key_frame;
+	state->dts = first_tile->key_frame_dts;
+	state->run_started = TRUE;
+}
+
+static vod_status_t
+thumb_grabber_tile_end_run(thumb_grabber_tile_state_t* state)
+{
+	thumb_grabber_tile_t* cur_tile;
+	thumb_grabber_tile_t* run_end;
+	vod_status_t rc;
+	int avrc;
+
+	// drain the decoder
+	avrc = avcodec_send_packet(state->decoder, NULL);
+	if (avrc < 0)
+	{
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"thumb_grabber_tile_end_run: avcodec_send_packet failed %d", avrc);
+		return VOD_BAD_DATA;
+	}
+
+	rc = thumb_grabber_tile_receive_frames(state);
+	if (rc != VOD_OK)
+	{
+		return rc;
+	}
+
+	// reset the decoder, the next run starts from a different key frame
+	avcodec_flush_buffers(state->decoder);
+
+	// tiles whose frame was not returned by the decoder get the last decoded frame
+	run_end = state->tiles + state->run_end;
+	for (cur_tile = state->tiles + state->cur_tile; cur_tile < run_end; cur_tile++)
+	{
+		if (cur_tile->captured || !state->has_last_frame)
+		{
+			continue;
+		}
+
+		rc = thumb_grabber_tile_draw(state, cur_tile - state->tiles, state->last_frame);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+	}
+
+	state->cur_tile = state->run_end;
+	state->run_started = FALSE;
+
+	return VOD_OK;
+}
+
+static vod_status_t
+thumb_grabber_tile_write(thumb_grabber_tile_state_t* state)
+{
+	int avrc;
+
+	avrc = avcodec_send_frame(state->encoder, state->output_frame);
+	if (avrc < 0)
+	{
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"thumb_grabber_tile_write: avcodec_send_frame failed %d", avrc);
+		return VOD_UNEXPECTED;
+	}
+
+	avrc = avcodec_receive_packet(state->encoder, &state->output_packet);
+	if (avrc < 0)
+	{
+		vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+			"thumb_grabber_tile_write: avcodec_receive_packet failed %d", avrc);
+		return VOD_UNEXPECTED;
+	}
+
+	return state->write_callback(state->write_context, state->output_packet.data, state->output_packet.size);
+}
+
+vod_status_t
+thumb_grabber_tile_process(void* context)
+{
+	thumb_grabber_tile_state_t* state = context;
+	u_char* read_buffer;
+	uint32_t read_size;
+	bool_t processed_data = FALSE;
+	vod_status_t rc;
+	bool_t frame_done;
+
+	for (;;)
+	{
+		// start a frame if needed
+		if (!state->frame_started)
+		{
+			if (state->frames_left <= 0)
+			{
+				if (state->run_started)
+				{
+					rc = thumb_grabber_tile_end_run(state);
+					if (rc != VOD_OK)
+					{
+						return rc;
+					}
+				}
+
+				if (state->cur_tile >= state->tile_count)
+				{
+					return thumb_grabber_tile_write(state);
+				}
+
+				thumb_grabber_tile_start_run(state);
+			}
+
+			if (state->cur_frame >= state->cur_frame_part.last_frame)
+			{
+				state->cur_frame_part = *state->cur_frame_part.next;
+				state->cur_frame = state->cur_frame_part.first_frame;
+			}
+
+			// start the frame
+			rc = state->cur_frame_part.frames_source->start_frame(
+				state->cur_frame_part.frames_source_context,
+				state->cur_frame,
+				NULL);
+			if (rc != VOD_OK)
+			{
+				return rc;
+			}
+
+			state->frame_started = TRUE;
+		}
+
+		// read some data from the frame
+		rc = state->cur_frame_part.frames_source->read(
+			state->cur_frame_part.frames_source_context,
+			&read_buffer,
+			&read_size,
+			&frame_done);
+		if (rc != VOD_OK)
+		{
+			if (rc != VOD_AGAIN)
+			{
+				return rc;
+			}
+
+			if (!processed_data && !state->first_time)
+			{
+				vod_log_error(VOD_LOG_ERR, state->request_context->log, 0,
+					"thumb_grabber_tile_process: no data was handled, probably a truncated file");
+				return VOD_BAD_DATA;
+			}
+
+			state->first_time = FALSE;
+			return VOD_AGAIN;
+		}
+
+		processed_data = TRUE;
+
+		if (!frame_done)
+		{
+			// didn't finish the frame, append to the frame buffer
+			if (state->frame_buffer == NULL)
+			{
+				state->frame_buffer = vod_alloc(
+					state->request_context->pool,
+					state->max_frame_size + VOD_BUFFER_PADDING_SIZE);
+				if (state->frame_buffer == NULL)
+				{
+					vod_log_debug0(VOD_LOG_DEBUG_LEVEL, state->request_context->log, 0,
+						"thumb_grabber_tile_process: vod_alloc failed");
+					return VOD_ALLOC_FAILED;
+				}
+			}
+
+			vod_memcpy(state->frame_buffer + state->cur_frame_pos, read_buffer, read_size);
+			state->cur_frame_pos += read_size;
+			continue;
+		}
+
+		if (state->cur_frame_pos != 0)
+		{
+			// copy the remainder
+			vod_memcpy(state->frame_buffer + state->cur_frame_pos, read_buffer, read_size);
+			state->cur_frame_pos = 0;
+			read_buffer = state->frame_buffer;
+		}
+
+		rc = thumb_grabber_tile_decode_frame(state, read_buffer);
+		if (rc != VOD_OK)
+		{
+			return rc;
+		}
+
+		// move to the next frame
+		state->frames_left--;
+		state->cur_frame++;
+		state->frame_started = FALSE;
+	}
+}
+#endif // VOD_HAVE_LIB_SW_SCALE
@@ -5,6 +5,9 @@
 #include "../media_format.h"
 #include "../media_set.h"
 
+// constants
+#define THUMB_GRABBER_MAX_TILES (1024)
+
 // functions
 void thumb_grabber_process_init(vod_log_t* log);
 
@@ -13,10 +16,38 @@ vod_status_t thumb_grabber_init_state(
 	media_track_t* track,
 	request_params_t* request_params,
 	bool_t accurate,
+	bool_t deferred,
 	write_callback_t write_callback,
 	void* write_context,
 	void** result);
 
 vod_status_t thumb_grabber_process(void* context);
 
+vod_status_t thumb_grabber_get_frame_offset(
+	request_context_t* request_context,
+	media_track_t* track,
+	request_params_t* request_params,
+	bool_t accurate,
+	uint64_t* result);
+
+// deferred mode - thumb_grabber_process returns VOD_DONE once all frames were read,
+// thumb_grabber_decode does not use the pool and can run on a different thread
+vod_status_t thumb_grabber_decode(void* context);
+
+vod_status_t thumb_grabber_write(void* context);
+
+#if (VOD_HAVE_LIB_SW_SCALE)
+// tiles - a single image composed of thumbnails captured at a fixed interval
+vod_status_t thumb_grabber_init_tile_state(
+	request_context_t* request_context,
+	media_track_t* track,
+	request_params_t* request_params,
+	bool_t accurate,
+	write_callback_t write_callback,
+	void* write_context,
+	void** result);
+
+vod_status_t thumb_grabber_tile_process(void* context);
+#endif // VOD_HAVE_LIB_SW_SCALE
+
 #endif //__THUMB_GRABBER_H__
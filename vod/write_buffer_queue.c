@@ -99,6 +99,36 @@ write_buffer_queue_get_buffer(write_buffer_queue_t* queue, uint32_t size, void*
 	return result;
 }
 
+// allocates between 1 and max_count contiguous units, according to the space left in the current buffer
+u_char*
+write_buffer_queue_get_buffers(write_buffer_queue_t* queue, uint32_t unit_size, uint32_t max_count, void* writer_context, uint32_t* count)
+{
+	buffer_header_t* write_buffer;
+	uint32_t extra_count;
+	u_char* result;
+
+	// allocate the first unit, moves to the next buffer if the current one is full
+	result = write_buffer_queue_get_buffer(queue, unit_size, writer_context);
+	if (result == NULL)
+	{
+		return NULL;
+	}
+
+	// extend the allocation using the space left in the buffer
+	write_buffer = queue->cur_write_buffer;
+	extra_count = (write_buffer->end_pos - write_buffer->cur_pos) / unit_size;
+	if (extra_count > max_count - 1)
+	{
+		extra_count = max_count - 1;
+	}
+
+	write_buffer->cur_pos += extra_count * unit_size;
+	queue->cur_offset += extra_count * unit_size;
+
+	*count = extra_count + 1;
+	return result;
+}
+
 vod_status_t
 write_buffer_queue_send(write_buffer_queue_t* queue, off_t max_offset)
 {